@@ -38,8 +38,12 @@ layout(std430, binding = 8) restrict writeonly buffer layoutName8 {
     vec4 output_tangent_light_directions[];
 };
 
+layout(std430, binding = 9) restrict readonly buffer layoutName9 {
+    uint pose_indices[];
+};
+
 mat4 fetchMatrix(uint instance_number, uint bone_index) {
-	return bone_matrices[instance_number * bone_count + bone_index];
+	return bone_matrices[pose_indices[instance_number] * bone_count + bone_index];
 }
 
 layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
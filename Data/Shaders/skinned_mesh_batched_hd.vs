@@ -0,0 +1,31 @@
+#version 450 core
+
+// Per instance data, selected by the base instance of the indirect draw command
+layout (location = 0) in vec4 instance_color;
+layout (location = 1) in uvec3 instance_offsets; // x: first preskinned vertex of the instance, y: first vertex of the mesh, z: first normal of the mesh
+
+layout(std430, binding = 1) buffer layoutName1 {
+    vec2 uvs[];
+};
+
+layout(std430, binding = 2) buffer layoutName2 {
+    vec4 vertices[];
+};
+
+layout(std430, binding = 3) buffer layoutName3 {
+    vec4 tangent_light_directions[];
+};
+
+out vec2 UV;
+out vec3 tangent_light_direction;
+out vec4 vertexColor;
+
+void main() {
+	// gl_VertexID includes the base vertex of the command and thus indexes the shared arenas directly
+	const uint vertex_index = instance_offsets.x + uint(gl_VertexID) - instance_offsets.y;
+	gl_Position = vertices[vertex_index];
+
+	UV = uvs[gl_VertexID];
+	tangent_light_direction = vec3(tangent_light_directions[vertex_index]);
+	vertexColor = instance_color;
+}
@@ -0,0 +1,15 @@
+#version 450 core
+
+// The kind of instance that is drawn: 0 for units, 1 for doodads (the highest bit of the pick id)
+layout (location = 0) uniform uint kind;
+
+flat in uint pick_id;
+
+out uint id;
+
+void main() {
+	if (pick_id == 0 || (pick_id >> 31) != kind) {
+		discard;
+	}
+	id = pick_id & 0x7FFFFFFFu;
+}
@@ -0,0 +1,16 @@
+#version 450 core
+
+// Per instance data, selected by the base instance of the indirect draw command
+layout (location = 0) in uvec3 instance_data; // x: first preskinned vertex of the instance, y: first vertex of the mesh, z: pick id
+
+layout(std430, binding = 2) buffer layoutName2 {
+    vec4 vertices[];
+};
+
+flat out uint pick_id;
+
+void main() {
+	// The vertices have already been skinned and transformed by preskin_mesh.cs
+	gl_Position = vertices[instance_data.x + uint(gl_VertexID) - instance_data.y];
+	pick_id = instance_data.z;
+}
@@ -31,8 +31,7 @@ void main() {
 	texture_indices = texelFetch(terrain_texture_list, pos, 0);
 	pathing_map_uv = (vPosition + pos) * 4;	
 
-	const ivec2 pos2 = ivec2(gl_InstanceID % (size.x + 1), gl_InstanceID / (size.x + 1));
-	const bool is_ground = texelFetch(terrain_exists_texture, pos2, 0).r > 0;
+	const bool is_ground = texelFetch(terrain_exists_texture, pos, 0).r > 0;
 
 	gl_Position = is_ground ? MVP * vec4(vPosition + pos, height.r, 1) : vec4(2.0, 0.0, 0.0, 1.0);
 }
\ No newline at end of file
@@ -3,41 +3,85 @@ module;
 #include <stdexcept>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <span>
+#include <memory>
+#include <cstring>
 
 export module BinaryReader;
 
 import no_init_allocator;
+import MappedFile;
 
+/// Reads binary data either from a buffer it owns or from memory it borrows, such as a memory mapped file.
+/// The read_span and read_string_view functions return views into that memory instead of copying, so they stay valid only as long as the reader (or the borrowed memory) does
 export class BinaryReader {
   public:
+	/// Empty if the reader borrows its data
 	std::vector<uint8_t, default_init_allocator<uint8_t>> buffer;
+	/// The data that is read from. Points into buffer when the reader owns its data
+	std::span<const uint8_t> bytes;
 	unsigned long long int position = 0;
 
 	explicit BinaryReader(std::vector<uint8_t, default_init_allocator<uint8_t>> buffer)
-		: buffer(std::move(buffer)) {
+		: buffer(std::move(buffer)), bytes(this->buffer) {
 	}
 
+	/// Borrows the memory, which has to outlive the reader
+	explicit BinaryReader(std::span<const uint8_t> bytes)
+		: bytes(bytes) {
+	}
+
+	/// Reads directly from the mapped file which is kept alive by the reader and its copies
+	explicit BinaryReader(std::shared_ptr<const MappedFile> file)
+		: bytes(file->data()), file(std::move(file)) {
+	}
+
+	BinaryReader(const BinaryReader& other)
+		: buffer(other.buffer), bytes(other.owns_data() ? std::span<const uint8_t>(buffer) : other.bytes), position(other.position), file(other.file) {
+	}
+
+	BinaryReader& operator=(const BinaryReader& other) {
+		if (this != &other) {
+			buffer = other.buffer;
+			bytes = other.owns_data() ? std::span<const uint8_t>(buffer) : other.bytes;
+			position = other.position;
+			file = other.file;
+		}
+		return *this;
+	}
+
+	// Moving the vector keeps its allocation so the span stays valid
+	BinaryReader(BinaryReader&&) noexcept = default;
+	BinaryReader& operator=(BinaryReader&&) noexcept = default;
+
 	template <typename T>
 	[[nodiscard]] T read() {
 		static_assert(std::is_standard_layout<T>::value, "T must be of standard layout.");
 
-		if (position + sizeof(T) > buffer.size()) {
+		if (position + sizeof(T) > bytes.size()) {
 			throw std::out_of_range("Trying to read out of range of buffer");
 		}
-		T result = *reinterpret_cast<T*>(&buffer[position]);
+		T result;
+		std::memcpy(&result, bytes.data() + position, sizeof(T));
 
 		position += sizeof(T);
 		return result;
 	}
 
 	[[nodiscard]] std::string read_string(const size_t size) {
-		if (position + size > buffer.size()) {
+		return std::string(read_string_view(size));
+	}
+
+	/// Like read_string, but returns a view into the data. Stops at the first null terminator within size
+	[[nodiscard]] std::string_view read_string_view(const size_t size) {
+		if (position + size > bytes.size()) {
 			throw std::out_of_range("Trying to read out of range of buffer");
 		}
-		std::string result = { reinterpret_cast<char*>(&buffer[position]), static_cast<size_t>(size) };
+		std::string_view result = { reinterpret_cast<const char*>(bytes.data() + position), static_cast<size_t>(size) };
 
 		if (const size_t pos = result.find_first_of('\0', 0); pos != std::string::npos) {
-			result.resize(pos);
+			result = result.substr(0, pos);
 		}
 
 		position += size;
@@ -45,10 +89,11 @@ export class BinaryReader {
 	}
 
 	[[nodiscard]] std::string read_c_string() {
-		const std::string string(reinterpret_cast<char*>(buffer.data() + position));
+		const std::string_view remaining_bytes(reinterpret_cast<const char*>(bytes.data() + position), bytes.size() - position);
+		const std::string string(remaining_bytes.substr(0, remaining_bytes.find('\0')));
 		position += string.size() + 1;
 
-		if (position > buffer.size()) {
+		if (position > bytes.size()) {
 			throw std::out_of_range("Trying to read out of range of buffer");
 		}
 
@@ -57,32 +102,47 @@ export class BinaryReader {
 
 	template <typename T>
 	[[nodiscard]] std::vector<T> read_vector(const size_t size) {
+		const std::span<const T> view = read_span<T>(size);
+		return std::vector<T>(view.begin(), view.end());
+	}
+
+	/// Like read_vector, but returns a view into the data
+	template <typename T>
+	[[nodiscard]] std::span<const T> read_span(const size_t size) {
 		static_assert(std::is_standard_layout<T>::value, "T must be of standard layout.");
 
-		if (position + sizeof(T) * size > buffer.size()) {
+		if (position + sizeof(T) * size > bytes.size()) {
 			throw std::out_of_range("Trying to read out of range of buffer");
 		}
-		std::vector<T> result(reinterpret_cast<T*>(&buffer[position]), reinterpret_cast<T*>(&buffer[position]) + size);
+		std::span<const T> result(reinterpret_cast<const T*>(bytes.data() + position), size);
 		position += sizeof(T) * size;
 		return result;
 	}
 
 	[[nodiscard]] long long remaining() const {
-		return buffer.size() - position;
+		return bytes.size() - position;
 	}
 
 	void advance(const size_t amount) {
-		if (position + amount > buffer.size()) {
+		if (position + amount > bytes.size()) {
 			throw std::out_of_range("Trying to advance past the end of the buffer");
 		}
 		position += amount;
 	}
 
 	void advance_c_string() {
-		position += std::string(reinterpret_cast<char*>(buffer.data() + position)).size() + 1;
-
-		if (position > buffer.size()) {
+		const std::string_view remaining_bytes(reinterpret_cast<const char*>(bytes.data() + position), bytes.size() - position);
+		const size_t terminator = remaining_bytes.find('\0');
+		if (terminator == std::string_view::npos) {
 			throw std::out_of_range("Trying to read out of range of buffer");
 		}
+		position += terminator + 1;
+	}
+
+  private:
+	std::shared_ptr<const MappedFile> file;
+
+	bool owns_data() const {
+		return bytes.data() == buffer.data();
 	}
 };
\ No newline at end of file
@@ -191,6 +191,32 @@ export struct Camera {
 		return v0 && v1 && v2 && v3 && v4;
 	}
 
+	enum class Visibility {
+		outside,
+		intersecting,
+		inside
+	};
+
+	/// Classifies an axis aligned box against the same planes inside_frustrum(min, max) uses.
+	/// Boxes that are fully inside do not need their contents tested any further
+	Visibility frustum_visibility(const glm::vec3& min, const glm::vec3& max) const {
+		Visibility result = Visibility::inside;
+		for (const auto plane : { Right, Left, Bottom, Top, Front }) {
+			const glm::vec4& clip = frustum_planes[plane];
+			// The corners furthest along and furthest against the plane normal
+			const glm::vec3 positive = { clip.x >= 0.f ? max.x : min.x, clip.y >= 0.f ? max.y : min.y, clip.z >= 0.f ? max.z : min.z };
+			const glm::vec3 negative = { clip.x >= 0.f ? min.x : max.x, clip.y >= 0.f ? min.y : max.y, clip.z >= 0.f ? min.z : max.z };
+
+			if (glm::dot(glm::vec3(clip), positive) + clip.w <= 0.f) {
+				return Visibility::outside;
+			}
+			if (glm::dot(glm::vec3(clip), negative) + clip.w <= 0.f) {
+				result = Visibility::intersecting;
+			}
+		}
+		return result;
+	}
+
 	bool rolling = false;
 
 	void update(double delta) {
@@ -1,5 +1,6 @@
 #include "doodads.h"
 
+#include <functional>
 #include <iostream>
 #include <optional>
 
@@ -12,6 +13,31 @@
 
 import BinaryWriter;
 import Hierarchy;
+import ResourceManager;
+import Camera;
+import RenderManager;
+import MathOperations;
+
+/// The transformed extent of the current sequence, the same box the frustum tests use
+static SpatialGrid::Bounds grid_bounds(const Doodad& doodad) {
+	if (!doodad.mesh || doodad.skeleton.sequence_index < 0 || static_cast<size_t>(doodad.skeleton.sequence_index) >= doodad.mesh->model->sequences.size()) {
+		return { glm::vec2(doodad.position), doodad.position, doodad.position };
+	}
+
+	const auto& extent = doodad.mesh->model->sequences[doodad.skeleton.sequence_index].extent;
+	SpatialGrid::Bounds bounds = { glm::vec2(doodad.position) };
+	transform_box(doodad.skeleton.matrix, extent.minimum, extent.maximum, bounds.minimum, bounds.maximum);
+	return bounds;
+}
+
+size_t Doodad::memory_usage() const {
+	size_t total = sizeof(Doodad) + string_memory(id) + string_memory(skin_id) + skeleton.memory_usage();
+	total += item_sets.capacity() * sizeof(ItemSet);
+	for (const auto& i : item_sets) {
+		total += i.memory_usage();
+	}
+	return total;
+}
 
 void Doodad::update() {
 	glm::vec3 base_scale = glm::vec3(1.f);
@@ -40,6 +66,8 @@ void Doodad::update() {
 	if (!max_roll.empty() && max_roll != "-") {
 		skeleton.matrix = glm::rotate(skeleton.matrix, -std::stof(max_roll), glm::vec3(1, 0, 0));
 	}
+
+	map->doodads.update_spatial_grid(*this);
 }
 
 float Doodad::acceptable_angle(std::string_view id, std::shared_ptr<PathingTexture> pathing, float current_angle, float target_angle) {
@@ -68,7 +96,7 @@ float Doodad::acceptable_angle(std::string_view id, std::shared_ptr<PathingTextu
 bool Doodads::load() {
 	BinaryReader reader = hierarchy.map_file_read("war3map.doo");
 
-	const std::string magic_number = reader.read_string(4);
+	const std::string_view magic_number = reader.read_string_view(4);
 	if (magic_number != "W3do") {
 		std::cout << "Invalid war3map.doo file: Magic number is not W3do\n";
 		return false;
@@ -83,8 +111,13 @@ bool Doodads::load() {
 	// ToDO check subversion
 
 	Doodad::auto_increment = 0;
-	doodads.resize(reader.read<uint32_t>());
-	for (auto&& i : doodads) {
+	doodads.clear();
+	creation_number_to_handle.clear();
+
+	const uint32_t doodad_count = reader.read<uint32_t>();
+	doodads.reserve(doodad_count);
+	for (size_t j = 0; j < doodad_count; j++) {
+		Doodad i;
 		i.id = reader.read_string(4);
 		i.variation = reader.read<uint32_t>();
 		i.position = (reader.read<glm::vec3>() - glm::vec3(map->terrain.offset, 0)) / 128.f;
@@ -114,6 +147,7 @@ bool Doodads::load() {
 
 		i.creation_number = reader.read<uint32_t>();
 		Doodad::auto_increment = std::max(Doodad::auto_increment, i.creation_number);
+		add_doodad(std::move(i));
 	}
 
 	// Terrain Doodads
@@ -175,9 +209,40 @@ void Doodads::save() const {
 }
 
 void Doodads::create() {
+	// Load all the meshes and pathing textures in parallel first
+	std::vector<std::pair<std::string, ResourceFuture<SkinnedMesh>>> meshes;
+	std::vector<ResourceFuture<PathingTexture>> pathing_textures;
+	std::unordered_set<std::string> requested_meshes;
+	std::unordered_set<std::string> requested_pathing_textures;
+
+	const auto request = [&](const std::string& id, int variation, const slk::SLK& slk) {
+		std::string full_id = id + std::to_string(variation);
+		if (!id_to_mesh.contains(full_id) && requested_meshes.insert(full_id).second) {
+			const MeshSource source = mesh_source(id, variation);
+			meshes.emplace_back(std::move(full_id), resource_manager.load_async<SkinnedMesh>(source.path, source.identifier, source.replaceable_id_override));
+		}
+
+		const std::string pathing_texture_path = slk.data("pathtex", id);
+		if (requested_pathing_textures.insert(pathing_texture_path).second && hierarchy.file_exists(pathing_texture_path)) {
+			pathing_textures.push_back(resource_manager.load_async<PathingTexture>(pathing_texture_path));
+		}
+	};
+
+	for (const auto& i : doodads) {
+		request(i.id, i.variation, doodads_slk.row_headers.contains(i.id) ? doodads_slk : destructibles_slk);
+	}
+	for (const auto& i : special_doodads) {
+		request(i.id, i.variation, doodads_slk);
+	}
+
+	for (auto& [full_id, mesh] : meshes) {
+		id_to_mesh.emplace(full_id, mesh.get());
+	}
+
+	// The pathing textures are picked up by resource_manager.load() below for as long as pathing_textures keeps them alive
 	for (auto&& i : doodads) {
 		i.mesh = get_mesh(i.id, i.variation);
-		i.skeleton = SkeletalModelInstance(i.mesh->model);
+		i.skeleton = SkeletalModelInstance(i.mesh->model, true);
 		// Get pathing map
 		const bool is_doodad = doodads_slk.row_headers.contains(i.id);
 		const slk::SLK& slk = is_doodad ? doodads_slk : destructibles_slk;
@@ -189,6 +254,7 @@ void Doodads::create() {
 		i.update();
 	}
 
+	// Special doodads are not animated by the AnimationScheduler so they keep a pose of their own
 	for (auto&& i : special_doodads) {
 		i.mesh = get_mesh(i.id, i.variation);
 		i.skeleton = SkeletalModelInstance(i.mesh->model);
@@ -214,16 +280,16 @@ void Doodads::create() {
 
 		map->pathing_map.blit_pathing_texture(i.position, glm::degrees(i.angle) + 90, i.pathing);
 	}
-	map->pathing_map.upload_dynamic_pathing();
 
 	// Update terrain exists
 	update_special_doodad_pathing(QRect(0, 0, map->terrain.width, map->terrain.height));
 }
 
 void Doodads::render() {
-	for (auto&& i : doodads) {
+	for (const uint32_t index : visible_doodads()) {
+		const Doodad& i = doodads[index];
 		//i.mesh->render_queue(i.skeleton, i.color);
-		map->render_manager.render_queue(*i.mesh, i.skeleton, i.color);
+		map->render_manager.render_queue_visible(*i.mesh, i.skeleton, i.color, RenderManager::doodad_pick_id(index));
 	}
 	for (auto&& i : special_doodads) {
 		//i.mesh->render_queue(i.skeleton, glm::vec3(1.f));
@@ -242,7 +308,7 @@ Doodad& Doodads::add_doodad(std::string id, int variation, glm::vec3 position) {
 	doodad.scale = { 1, 1, 1 };
 	doodad.angle = 0;
 	doodad.creation_number = ++Doodad::auto_increment;
-	doodad.skeleton = SkeletalModelInstance(doodad.mesh->model);
+	doodad.skeleton = SkeletalModelInstance(doodad.mesh->model, true);
 
 	const bool is_doodad = doodads_slk.row_headers.contains(id);
 	const slk::SLK& slk = is_doodad ? doodads_slk : destructibles_slk;
@@ -253,36 +319,50 @@ Doodad& Doodads::add_doodad(std::string id, int variation, glm::vec3 position) {
 
 	doodad.update();
 
-	doodads.push_back(doodad);
-	return doodads.back();
+	return add_doodad(std::move(doodad));
 }
 
-// You will have to manually set a creation number and valid skin ID
+// You will have to manually set a unique creation number and valid skin ID before adding
 Doodad& Doodads::add_doodad(Doodad doodad) {
-	doodads.push_back(doodad);
-	return doodads.back();
+	const int creation_number = doodad.creation_number;
+	const DoodadHandle handle = doodads.insert(std::move(doodad));
+	creation_number_to_handle[creation_number] = handle;
+	invalidate_spatial_grid();
+	return *doodads.get(handle);
 }
 
-void Doodads::remove_doodad(Doodad* doodad) {
-	auto iterator = doodads.begin() + std::distance(doodads.data(), doodad);
-	doodads.erase(iterator);
+void Doodads::remove_doodad(DoodadHandle doodad) {
+	const Doodad* target = doodads.get(doodad);
+	if (!target) {
+		return;
+	}
+	creation_number_to_handle.erase(target->creation_number);
+	doodads.erase(doodad);
+	invalidate_spatial_grid();
 }
 
-std::vector<Doodad*> Doodads::query_area(const QRectF& area) {
-	std::vector<Doodad*> result;
+DoodadHandle Doodads::find(int creation_number) const {
+	const auto found = creation_number_to_handle.find(creation_number);
+	return found != creation_number_to_handle.end() ? found->second : DoodadHandle();
+}
 
-	for (auto&& i : doodads) {
-		if (area.contains(i.position.x, i.position.y)) {
-			result.push_back(&i);
+std::vector<DoodadHandle> Doodads::query_area(const QRectF& area) {
+	std::vector<DoodadHandle> result;
+
+	const QRectF bounds = area.normalized();
+	spatial_grid().query_area({ bounds.left(), bounds.top() }, { bounds.right(), bounds.bottom() }, [&](const uint32_t index) {
+		const Doodad& doodad = doodads[index];
+		if (area.contains(doodad.position.x, doodad.position.y)) {
+			result.push_back(doodads.handle(index));
 		}
-	}
+	});
 	return result;
 }
 
-void Doodads::remove_doodads(const std::unordered_set<Doodad*>& list) {
-	std::erase_if(doodads, [&](Doodad& doodad) {
-		return list.contains(&doodad); 
-	});
+void Doodads::remove_doodads(const std::unordered_set<DoodadHandle>& list) {
+	for (const auto& i : list) {
+		remove_doodad(i);
+	}
 }
 
 void Doodads::update_doodad_pathing(const std::vector<Doodad>& target_doodads) {
@@ -297,9 +377,14 @@ void Doodads::update_doodad_pathing(const std::vector<Doodad>& target_doodads) {
 	update_doodad_pathing(update_pathing_area);
 }
 
-void Doodads::update_doodad_pathing(const std::unordered_set<Doodad*>& target_doodads) {
+void Doodads::update_doodad_pathing(const std::unordered_set<DoodadHandle>& target_doodads) {
 	QRectF update_pathing_area;
-	for (const auto& i : target_doodads) {
+	for (const auto& handle : target_doodads) {
+		const Doodad* i = doodads.get(handle);
+		if (!i) {
+			continue;
+		}
+
 		if (update_pathing_area.width() == 0 || update_pathing_area.height() == 0) {
 			update_pathing_area = { i->position.x, i->position.y, 1.f, 1.f };
 		}
@@ -315,14 +400,13 @@ void Doodads::update_doodad_pathing(const QRectF& area) {
 
 	new_area.adjust(-6, -6, 6, 6);
 
-	const auto doodads_to_blit = map->doodads.query_area(new_area);
-	for (const auto& i : doodads_to_blit) {
+	for (const auto& handle : query_area(new_area)) {
+		const Doodad* i = doodads.get(handle);
 		if (!i->pathing) {
 			continue;
 		}
 		map->pathing_map.blit_pathing_texture(i->position, glm::degrees(i->angle) + 90, i->pathing);
 	}
-	map->pathing_map.upload_dynamic_pathing();
 }
 
 void Doodads::update_special_doodad_pathing(const QRectF& area) {
@@ -331,7 +415,7 @@ void Doodads::update_special_doodad_pathing(const QRectF& area) {
 
 	for (int i = new_area.left(); i < new_area.right(); i++) {
 		for (int j = new_area.top(); j < new_area.bottom(); j++) {
-			map->terrain.corners[i][j].special_doodad = false;
+			map->terrain.corners(i, j).special_doodad = false;
 		}
 	}
 
@@ -355,7 +439,7 @@ void Doodads::update_special_doodad_pathing(const QRectF& area) {
 					continue;
 				}
 
-				map->terrain.corners[x][y].special_doodad = true;
+				map->terrain.corners(x, y).special_doodad = true;
 			}
 		}
 	}
@@ -373,7 +457,7 @@ void Doodads::process_doodad_field_change(const std::string& id, const std::stri
 		for (auto& i : doodads) {
 			if (i.id == id) {
 				i.mesh = get_mesh(id, i.variation);
-				i.skeleton = SkeletalModelInstance(i.mesh->model);
+				i.skeleton = SkeletalModelInstance(i.mesh->model, true);
 				i.update();
 			}
 		}
@@ -398,7 +482,7 @@ void Doodads::process_destructible_field_change(const std::string& id, const std
 		for (auto& i : doodads) {
 			if (i.id == id) {
 				i.mesh = get_mesh(id, i.variation);
-				i.skeleton = SkeletalModelInstance(i.mesh->model);
+				i.skeleton = SkeletalModelInstance(i.mesh->model, true);
 				i.update();
 			}
 		}
@@ -419,6 +503,76 @@ std::shared_ptr<SkinnedMesh> Doodads::get_mesh(std::string id, int variation) {
 		return id_to_mesh[full_id];
 	}
 
+	const MeshSource source = mesh_source(id, variation);
+	id_to_mesh.emplace(full_id, resource_manager.load<SkinnedMesh>(source.path, source.identifier, source.replaceable_id_override));
+
+	return id_to_mesh[full_id];
+}
+
+const SpatialGrid& Doodads::spatial_grid() {
+	if (grid.is_dirty()) {
+		grid.build(map->terrain.width, map->terrain.height, doodads.size(), [&](const size_t i) {
+			return grid_bounds(doodads[i]);
+		});
+	}
+	return grid;
+}
+
+std::optional<size_t> Doodads::pick(const Ray& ray) {
+	return ray_pick(spatial_grid(), ray, [&](const uint32_t i) { return grid_bounds(doodads[i]); }, [&](const uint32_t i) -> std::optional<float> {
+		const Doodad& doodad = doodads[i];
+		if (!doodad.mesh) {
+			return std::nullopt;
+		}
+		return doodad.mesh->intersect(ray, doodad.skeleton);
+	});
+}
+
+void Doodads::invalidate_spatial_grid() {
+	grid.invalidate();
+	visible_dirty = true;
+}
+
+void Doodads::cull() {
+	visible.clear();
+	spatial_grid().cull(
+		[](const glm::vec3& minimum, const glm::vec3& maximum) {
+			return camera.frustum_visibility(minimum, maximum);
+		},
+		[&](const SpatialGrid::Cell& cell, const bool fully_inside) {
+			for (const uint32_t index : cell.items) {
+				if (fully_inside) {
+					visible.push_back(index);
+					continue;
+				}
+
+				const SpatialGrid::Bounds bounds = grid_bounds(doodads[index]);
+				if (camera.inside_frustrum(bounds.minimum, bounds.maximum)) {
+					visible.push_back(index);
+				}
+			}
+		});
+	visible_dirty = false;
+}
+
+const std::vector<uint32_t>& Doodads::visible_doodads() {
+	if (visible_dirty) {
+		cull();
+	}
+	return visible;
+}
+
+void Doodads::update_spatial_grid(const Doodad& doodad) {
+	// Copies of doodads (e.g. in undo actions or not yet added doodads) are not part of the grid
+	// Comparing pointers into different arrays with < is unspecified, std::less gives them a total order
+	const std::less<const Doodad*> before;
+	if (doodads.empty() || before(&doodad, doodads.data()) || !before(&doodad, doodads.data() + doodads.size())) {
+		return;
+	}
+	grid.move(static_cast<uint32_t>(&doodad - doodads.data()), grid_bounds(doodad));
+}
+
+Doodads::MeshSource Doodads::mesh_source(const std::string& id, int variation) const {
 	fs::path mesh_path;
 	std::string variations;
 	std::string replaceable_id;
@@ -453,26 +607,26 @@ std::shared_ptr<SkinnedMesh> Doodads::get_mesh(std::string id, int variation) {
 	// Mesh doesnt exist at all
 	if (!hierarchy.file_exists(mesh_path)) {
 		std::cout << "Invalid model file for " << id << " With file path: " << mesh_path << "\n";
-		id_to_mesh.emplace(full_id, resource_manager.load<SkinnedMesh>("Objects/Invalidmodel/Invalidmodel.mdx", "", std::nullopt));
-		return id_to_mesh[full_id];
+		return { "Objects/Invalidmodel/Invalidmodel.mdx", "", std::nullopt };
 	}
 
 	if (is_number(replaceable_id) && texture_name != "_") {
-		id_to_mesh.emplace(full_id, resource_manager.load<SkinnedMesh>(mesh_path, texture_name.string(), std::make_optional(std::make_pair(std::stoi(replaceable_id), texture_name.replace_extension("").string()))));
-	} else {
-		id_to_mesh.emplace(full_id, resource_manager.load<SkinnedMesh>(mesh_path, "", std::nullopt));
+		return { mesh_path, texture_name.string(), std::make_optional(std::make_pair(std::stoi(replaceable_id), texture_name.replace_extension("").string())) };
 	}
-
-	return id_to_mesh[full_id];
+	return { mesh_path, "", std::nullopt };
 }
 
 void DoodadAddAction::undo() {
-	map->doodads.doodads.resize(map->doodads.doodads.size() - doodads.size());
+	for (const auto& i : doodads) {
+		map->doodads.remove_doodad(map->doodads.find(i.creation_number));
+	}
 	map->doodads.update_doodad_pathing(doodads);
 }
 
 void DoodadAddAction::redo() {
-	map->doodads.doodads.insert(map->doodads.doodads.end(), doodads.begin(), doodads.end());
+	for (const auto& i : doodads) {
+		map->doodads.add_doodad(i);
+	}
 	map->doodads.update_doodad_pathing(doodads);
 }
 
@@ -481,7 +635,9 @@ void DoodadDeleteAction::undo() {
 		map->brush->clear_selection();
 	}
 
-	map->doodads.doodads.insert(map->doodads.doodads.end(), doodads.begin(), doodads.end());
+	for (const auto& i : doodads) {
+		map->doodads.add_doodad(i);
+	}
 	map->doodads.update_doodad_pathing(doodads);
 }
 
@@ -490,42 +646,37 @@ void DoodadDeleteAction::redo() {
 		map->brush->clear_selection();
 	}
 
-	map->doodads.doodads.resize(map->doodads.doodads.size() - doodads.size());
+	for (const auto& i : doodads) {
+		map->doodads.remove_doodad(map->doodads.find(i.creation_number));
+	}
 	map->doodads.update_doodad_pathing(doodads);
 }
 
-void DoodadStateAction::undo() {
+/// Replaces the current state of the doodads with the given state, matched by creation number
+static void apply_doodad_state(const std::vector<Doodad>& state) {
 	QRectF update_pathing_area;
-	for (auto& i : old_doodads) {
-		for (auto& j : map->doodads.doodads) {
-			if (i.creation_number == j.creation_number) {
-				if (update_pathing_area.width() == 0 || update_pathing_area.height() == 0) {
-					update_pathing_area = { j.position.x, j.position.y, 1.f, 1.f };
-				}
-				update_pathing_area |= { j.position.x, j.position.y, 1.f, 1.f };
-				update_pathing_area |= { i.position.x, i.position.y, 1.f, 1.f };
+	for (const auto& i : state) {
+		Doodad* j = map->doodads.doodads.get(map->doodads.find(i.creation_number));
+		if (!j) {
+			continue;
+		}
 
-				j = i;
-			}
+		if (update_pathing_area.width() == 0 || update_pathing_area.height() == 0) {
+			update_pathing_area = { j->position.x, j->position.y, 1.f, 1.f };
 		}
+		update_pathing_area |= { j->position.x, j->position.y, 1.f, 1.f };
+		update_pathing_area |= { i.position.x, i.position.y, 1.f, 1.f };
+
+		*j = i;
+		map->doodads.update_spatial_grid(*j);
 	}
 	map->doodads.update_doodad_pathing(update_pathing_area);
 }
 
-void DoodadStateAction::redo() {
-	QRectF update_pathing_area;
-	for (auto& i : new_doodads) {
-		for (auto& j : map->doodads.doodads) {
-			if (i.creation_number == j.creation_number) {
-				if (update_pathing_area.width() == 0 || update_pathing_area.height() == 0) {
-					update_pathing_area = { j.position.x, j.position.y, 1.f, 1.f };
-				}
-				update_pathing_area |= { j.position.x, j.position.y, 1.f, 1.f };
-				update_pathing_area |= { i.position.x, i.position.y, 1.f, 1.f };
-
-				j = i;
-			}
-		}
-	}
-	map->doodads.update_doodad_pathing(update_pathing_area);
+void DoodadStateAction::undo() {
+	apply_doodad_state(old_doodads);
 }
+
+void DoodadStateAction::redo() {
+	apply_doodad_state(new_doodads);
+}
\ No newline at end of file
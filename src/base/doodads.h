@@ -3,12 +3,17 @@
 #include <vector>
 #include <memory>
 #include <unordered_set>
+#include <optional>
+#include <filesystem>
 
 import SkeletalModelInstance;
 import SkinnedMesh;
 import PathingTexture;
 import Utilities;
 import TerrainUndo;
+import SpatialGrid;
+import SlotMap;
+import RayCast;
 
 #include "unordered_dense.h"
 #include "Terrain.h"
@@ -43,9 +48,22 @@ struct Doodad {
 	glm::vec3 color;
 
 	void update();
+	/// An estimate of the memory a copy of this doodad takes, including what it owns but not the shared mesh and pathing texture
+	size_t memory_usage() const;
 	static float acceptable_angle(std::string_view id, std::shared_ptr<PathingTexture> pathing, float current_angle, float target_angle);
 };
 
+using DoodadHandle = SlotHandle<Doodad>;
+
+/// The memory_usage() of all doodads
+inline size_t memory_usage_of(const std::vector<Doodad>& doodads) {
+	size_t total = 0;
+	for (const auto& i : doodads) {
+		total += i.memory_usage();
+	}
+	return total;
+}
+
 struct SpecialDoodad {
 	std::string id;
 	int variation;
@@ -62,28 +80,51 @@ struct SpecialDoodad {
 class Doodads {
 	std::unordered_map<std::string, std::shared_ptr<SkinnedMesh>> id_to_mesh;
 
+	/// The arguments with which the mesh of a doodad/destructible is loaded from the resource manager
+	struct MeshSource {
+		std::filesystem::path path;
+		std::string identifier;
+		std::optional<std::pair<int, std::string>> replaceable_id_override;
+	};
+
+	MeshSource mesh_source(const std::string& id, int variation) const;
+
+	/// Buckets the doodads on their tile position. Rebuilt lazily by spatial_grid() after doodads were added or removed
+	SpatialGrid grid;
+
+	/// Creation numbers are unique and survive undo/redo (which recreates doodads with new handles)
+	ankerl::unordered_dense::map<int, DoodadHandle> creation_number_to_handle;
+
+	/// Indices of the doodads inside the view frustum as determined by the last cull()
+	std::vector<uint32_t> visible;
+	bool visible_dirty = true;
+
 	static constexpr int write_version = 8;
 	static constexpr int write_subversion = 11;
 	static constexpr int write_special_version = 0;
 
 public:
 	std::vector<SpecialDoodad> special_doodads;
-	std::vector<Doodad> doodads;
+	SlotMap<Doodad> doodads;
 
 	bool load();
 	void save() const;
 	void create();
 	void render();
 
+	/// The returned reference is only valid until the next doodad is added or removed
 	Doodad& add_doodad(std::string id, int variation, glm::vec3 position);
 	Doodad& add_doodad(Doodad doodad);
 
-	void remove_doodad(Doodad* doodad);
+	void remove_doodad(DoodadHandle doodad);
 
-	std::vector<Doodad*> query_area(const QRectF& area);
-	void remove_doodads(const std::unordered_set<Doodad*>& list);
+	/// Returns a null handle if no doodad with this creation number exists
+	DoodadHandle find(int creation_number) const;
 
-	void update_doodad_pathing(const std::unordered_set<Doodad*>& target_doodads);
+	std::vector<DoodadHandle> query_area(const QRectF& area);
+	void remove_doodads(const std::unordered_set<DoodadHandle>& list);
+
+	void update_doodad_pathing(const std::unordered_set<DoodadHandle>& target_doodads);
 	void update_doodad_pathing(const std::vector<Doodad>& target_doodads);
 	void update_doodad_pathing(const QRectF& area);
 
@@ -93,6 +134,22 @@ public:
 	void process_destructible_field_change(const std::string& id, const std::string& field);
 
 	std::shared_ptr<SkinnedMesh> get_mesh(std::string id, int variation);
+
+	const SpatialGrid& spatial_grid();
+
+	/// Returns the index of the doodad whose mesh the ray hits first in its current pose, using the spatial grid to find the candidates.
+	/// Runs entirely on the CPU, see ray_pick()
+	std::optional<size_t> pick(const Ray& ray);
+
+	/// Determines which doodads are inside the view frustum using the bounding volume hierarchy of the spatial grid.
+	/// Done once per frame so that animation, rendering and picking can share the result
+	void cull();
+	/// The result of the last cull(). Culls again if doodads were added or removed since
+	const std::vector<uint32_t>& visible_doodads();
+	/// Has to be called whenever doodads are added to or removed from the doodads vector
+	void invalidate_spatial_grid();
+	/// Moves the doodad to its current cell. Called by Doodad::update() so any doodad that has been updated after moving is already up to date
+	void update_spatial_grid(const Doodad& doodad);
 };
 
 // Undo/redo structures
@@ -102,6 +159,10 @@ public:
 
 	void undo() override;
 	void redo() override;
+
+	size_t memory_usage() const override {
+		return memory_usage_of(doodads);
+	}
 };
 
 class DoodadDeleteAction : public TerrainUndoAction {
@@ -110,6 +171,10 @@ public:
 
 	void undo() override;
 	void redo() override;
+
+	size_t memory_usage() const override {
+		return memory_usage_of(doodads);
+	}
 };
 
 class DoodadStateAction : public TerrainUndoAction {
@@ -119,4 +184,8 @@ public:
 
 	void undo() override;
 	void redo() override;
+
+	size_t memory_usage() const override {
+		return memory_usage_of(old_doodads) + memory_usage_of(new_doodads);
+	}
 };
\ No newline at end of file
@@ -1,9 +1,18 @@
 module;
 
 #include <vector>
+#include <memory>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <optional>
+#include <array>
+#include <string>
+#include <compare>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <unordered_map>
 
 export module Hierarchy;
 
@@ -14,6 +23,15 @@ import JSON;
 import BinaryReader;
 import CASC;
 import no_init_allocator;
+import MappedFile;
+
+/// A file that game data was loaded from. local files are relative to the working directory instead of going through the hierarchy
+export struct SourceFile {
+	fs::path path;
+	bool local = false;
+
+	auto operator<=>(const SourceFile&) const = default;
+};
 
 export class Hierarchy {
   public:
@@ -25,6 +43,9 @@ export class Hierarchy {
 	fs::path warcraft_directory;
 	fs::path root_directory;
 
+	/// Where the index of all CASC file names is stored between launches. Not persisted if empty
+	fs::path casc_index_path;
+
 	bool ptr = false;
 	bool hd = true;
 	bool teen = false;
@@ -44,64 +65,128 @@ export class Hierarchy {
 		root_directory = warcraft_directory / (ptr ? "_ptr_" : "_retail_");
 
 		if (open) {
+			if (casc_index_path.empty() || !game_data.load_index(casc_index_path)) {
+				if (game_data.build_index() && !casc_index_path.empty()) {
+					game_data.save_index(casc_index_path);
+				}
+			}
+
 			aliases.load(open_file("filealiases.json"));
+			// Lookups done before the aliases were loaded could not follow them
+			invalidate_cache();
 		}
 		return open;
 	}
 
-	BinaryReader open_file(const fs::path& path) const {
-		casc::File file;
+	/// Where a logical game data path ends up after walking the lookup hierarchy
+	struct ResolvedFile {
+		enum class Source {
+			disk, // Local files and map files, path is a filesystem path
+			casc // path is the full CASC name
+		};
 
-		if (local_files && fs::exists(root_directory / path)) {
-			std::ifstream stream(root_directory / path, std::ios::binary);
-			return BinaryReader(std::vector<uint8_t, default_init_allocator<uint8_t>>(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>()));
-		} else if (hd && teen && map_file_exists("_hd.w3mod:_teen.w3mod:" + path.string())) {
-			return map_file_read("_hd.w3mod:_teen.w3mod:" + path.string());
-		} else if (hd && map_file_exists("_hd.w3mod:" + path.string())) {
-			return map_file_read("_hd.w3mod:" + path.string());
-		} else if (map_file_exists(path)) {
-			return map_file_read(path);
-		} else if (hd && game_data.file_exists("war3.w3mod:_hd.w3mod:_tilesets/"s + tileset + ".w3mod:"s + path.string())) {
-			file = game_data.file_open("war3.w3mod:_hd.w3mod:_tilesets/"s + tileset + ".w3mod:"s + path.string());
-		} else if (hd && teen && game_data.file_exists("war3.w3mod:_hd.w3mod:_teen.w3mod:"s + path.string())) {
-			file = game_data.file_open("war3.w3mod:_hd.w3mod:_teen.w3mod:"s + path.string());
-		} else if (hd && game_data.file_exists("war3.w3mod:_hd.w3mod:"s + path.string())) {
-			file = game_data.file_open("war3.w3mod:_hd.w3mod:"s + path.string());
-		} else if (game_data.file_exists("war3.w3mod:_tilesets/"s + tileset + ".w3mod:"s + path.string())) {
-			file = game_data.file_open("war3.w3mod:_tilesets/"s + tileset + ".w3mod:"s + path.string());
-		} else if (game_data.file_exists("war3.w3mod:_locales/enus.w3mod:"s + path.string())) {
-			file = game_data.file_open("war3.w3mod:_locales/enus.w3mod:"s + path.string());
-		} else if (teen && game_data.file_exists("war3.w3mod:_teen.w3mod:"s + path.string())) {
-			file = game_data.file_open("war3.w3mod:_teen.w3mod:"s + path.string());
-		} else if (game_data.file_exists("war3.w3mod:"s + path.string())) {
-			file = game_data.file_open("war3.w3mod:"s + path.string());
-		} else if (game_data.file_exists("war3.w3mod:_deprecated.w3mod:"s + path.string())) {
-			file = game_data.file_open("war3.w3mod:_deprecated.w3mod:"s + path.string());
-		} else if (aliases.exists(path.string())) {
-			return open_file(aliases.alias(path.string()));
-		} else {
+		Source source;
+		std::string path;
+	};
+
+	/// Walks the hierarchy in priority order and returns the first location that contains the file.
+	/// Results (including files that were not found) are cached until the tileset, hd/teen/ptr/local_files flags or map/root directory change or invalidate_cache() is called
+	std::optional<ResolvedFile> resolve(const fs::path& path) const {
+		if (path.empty()) {
+			return std::nullopt;
+		}
+
+		std::string file = path.string();
+
+		{
+			std::shared_lock lock(cache_mutex);
+			if (cache_state_matches()) {
+				if (const auto found = cache.find(file); found != cache.end()) {
+					cache_hits++;
+					return found->second;
+				}
+			}
+		}
+		cache_misses++;
+
+		std::optional<ResolvedFile> resolved = resolve_uncached(path);
+
+		std::unique_lock lock(cache_mutex);
+		if (!cache_state_matches()) {
+			cache.clear();
+			cache_state = { tileset, ptr, hd, teen, local_files, map_directory, root_directory };
+		}
+		cache.emplace(std::move(file), resolved);
+		return resolved;
+	}
+
+	/// Forgets all cached lookups. Has to be called when files are added or removed outside of the map_file_* functions, changes to the settings are detected automatically
+	void invalidate_cache() const {
+		std::unique_lock lock(cache_mutex);
+		cache.clear();
+	}
+
+	size_t cache_hit_count() const {
+		return cache_hits;
+	}
+
+	size_t cache_miss_count() const {
+		return cache_misses;
+	}
+
+	BinaryReader open_file(const fs::path& path) const {
+		const std::optional<ResolvedFile> resolved = resolve(path);
+		if (!resolved) {
 			throw std::invalid_argument(path.string() + " could not be found in the hierarchy");
 		}
 
-		return BinaryReader(file.read());
+		if (resolved->source == ResolvedFile::Source::disk) {
+			return BinaryReader(read_disk_file(resolved->path));
+		}
+
+		return BinaryReader(game_data.file_open(resolved->path).read());
 	}
 
 	bool file_exists(const fs::path& path) const {
-		if (path.empty()) {
-			return false;
+		return resolve(path).has_value();
+	}
+
+	/// Returns a string that changes whenever the contents of the file change.
+	/// For CASC files this is the content key, for files on disk the last write time.
+	std::string file_version(const SourceFile& file) const {
+		if (file.local) {
+			std::error_code error;
+			const auto time = fs::last_write_time(file.path, error);
+			return error ? "missing"s : "disk:"s + file.path.string() + ":" + std::to_string(time.time_since_epoch().count());
+		}
+
+		const std::optional<ResolvedFile> resolved = resolve(file.path);
+		if (!resolved) {
+			return "missing";
+		}
+
+		if (resolved->source == ResolvedFile::Source::disk) {
+			std::error_code error;
+			const auto time = fs::last_write_time(resolved->path, error);
+			return "disk:"s + resolved->path + ":" + std::to_string(time.time_since_epoch().count());
 		}
 
-		return (local_files && fs::exists(root_directory / path)) || (hd && teen && map_file_exists("_hd.w3mod:_teen.w3mod:" + path.string())) || (hd && map_file_exists("_hd.w3mod:" + path.string())) || map_file_exists(path) || (hd && game_data.file_exists("war3.w3mod:_hd.w3mod:_tilesets/"s + tileset + ".w3mod:"s + path.string())) || (hd && teen && game_data.file_exists("war3.w3mod:_hd.w3mod:_teen.w3mod:"s + path.string())) || (hd && game_data.file_exists("war3.w3mod:_hd.w3mod:"s + path.string())) || game_data.file_exists("war3.w3mod:_tilesets/"s + tileset + ".w3mod:"s + path.string()) || game_data.file_exists("war3.w3mod:_locales/enus.w3mod:"s + path.string()) || (teen && game_data.file_exists("war3.w3mod:_teen.w3mod:"s + path.string())) || game_data.file_exists("war3.w3mod:"s + path.string()) || game_data.file_exists("war3.w3mod:_deprecated.w3mod:"s + path.string()) || (aliases.exists(path.string()) ? file_exists(aliases.alias(path.string())) : false);
+		return "casc:"s + resolved->path + ":" + game_data.file_open(resolved->path).content_key();
 	}
 
+	/// Memory maps the map file. Returns an empty reader if the file does not exist or is empty
 	BinaryReader map_file_read(const fs::path& path) const {
-		std::ifstream stream(map_directory / path, std::ios::binary);
-		return BinaryReader(std::vector<uint8_t, default_init_allocator<uint8_t>>(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>()));
+		auto file = std::make_shared<MappedFile>();
+		if (!file->open(map_directory / path)) {
+			return BinaryReader(std::vector<uint8_t, default_init_allocator<uint8_t>>());
+		}
+		return BinaryReader(std::shared_ptr<const MappedFile>(std::move(file)));
 	}
 
 	/// source somewhere on disk, destination relative to the map
 	void map_file_add(const fs::path& source, const fs::path& destination) const {
 		fs::copy_file(source, map_directory / destination, fs::copy_options::overwrite_existing);
+		invalidate_cache();
 	}
 
 	void map_file_write(const fs::path& path, const std::vector<uint8_t>& data) const {
@@ -112,10 +197,12 @@ export class Hierarchy {
 		}
 
 		outfile.write(reinterpret_cast<char const*>(data.data()), data.size());
+		invalidate_cache();
 	}
 
 	void map_file_remove(const fs::path& path) const {
 		fs::remove(map_directory / path);
+		invalidate_cache();
 	}
 
 	bool map_file_exists(const fs::path& path) const {
@@ -124,6 +211,82 @@ export class Hierarchy {
 
 	void map_file_rename(const fs::path& original, const fs::path& renamed) const {
 		fs::rename(map_directory / original, map_directory / renamed);
+		invalidate_cache();
+	}
+
+  private:
+	/// Everything that influences the result of resolve()
+	struct CacheState {
+		char tileset = 0;
+		bool ptr = false;
+		bool hd = false;
+		bool teen = false;
+		bool local_files = false;
+		fs::path map_directory;
+		fs::path root_directory;
+	};
+
+	mutable std::shared_mutex cache_mutex;
+	mutable std::unordered_map<std::string, std::optional<ResolvedFile>> cache;
+	mutable CacheState cache_state;
+	mutable std::atomic<size_t> cache_hits = 0;
+	mutable std::atomic<size_t> cache_misses = 0;
+
+	/// Reads the whole file in one go. Returns an empty buffer if the file does not exist
+	static std::vector<uint8_t, default_init_allocator<uint8_t>> read_disk_file(const fs::path& path) {
+		std::ifstream stream(path, std::ios::binary | std::ios::ate);
+		if (!stream) {
+			return {};
+		}
+
+		std::vector<uint8_t, default_init_allocator<uint8_t>> buffer(static_cast<size_t>(stream.tellg()));
+		stream.seekg(0);
+		stream.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+		return buffer;
+	}
+
+	/// Compares field by field to avoid copying the paths on every lookup
+	bool cache_state_matches() const {
+		return cache_state.tileset == tileset && cache_state.ptr == ptr && cache_state.hd == hd && cache_state.teen == teen && cache_state.local_files == local_files
+			&& cache_state.map_directory == map_directory && cache_state.root_directory == root_directory;
+	}
+
+	std::optional<ResolvedFile> resolve_uncached(const fs::path& path) const {
+		const std::string file = path.string();
+
+		if (local_files && fs::exists(root_directory / path)) {
+			return ResolvedFile { ResolvedFile::Source::disk, (root_directory / path).string() };
+		} else if (hd && teen && map_file_exists("_hd.w3mod:_teen.w3mod:" + file)) {
+			return ResolvedFile { ResolvedFile::Source::disk, (map_directory / ("_hd.w3mod:_teen.w3mod:" + file)).string() };
+		} else if (hd && map_file_exists("_hd.w3mod:" + file)) {
+			return ResolvedFile { ResolvedFile::Source::disk, (map_directory / ("_hd.w3mod:" + file)).string() };
+		} else if (map_file_exists(path)) {
+			return ResolvedFile { ResolvedFile::Source::disk, (map_directory / path).string() };
+		}
+
+		// In order of priority, empty entries are skipped
+		const std::array<std::string, 8> casc_candidates = {
+			hd ? "war3.w3mod:_hd.w3mod:_tilesets/"s + tileset + ".w3mod:"s + file : ""s,
+			hd && teen ? "war3.w3mod:_hd.w3mod:_teen.w3mod:"s + file : ""s,
+			hd ? "war3.w3mod:_hd.w3mod:"s + file : ""s,
+			"war3.w3mod:_tilesets/"s + tileset + ".w3mod:"s + file,
+			"war3.w3mod:_locales/enus.w3mod:"s + file,
+			teen ? "war3.w3mod:_teen.w3mod:"s + file : ""s,
+			"war3.w3mod:"s + file,
+			"war3.w3mod:_deprecated.w3mod:"s + file,
+		};
+
+		for (const auto& name : casc_candidates) {
+			if (!name.empty() && game_data.file_exists(name)) {
+				return ResolvedFile { ResolvedFile::Source::casc, name };
+			}
+		}
+
+		if (aliases.exists(file)) {
+			return resolve(aliases.alias(file));
+		}
+
+		return std::nullopt;
 	}
 };
 
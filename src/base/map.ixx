@@ -14,8 +14,16 @@ module;
 #include <map>
 #include <fstream>
 #include <print>
+#include <array>
+#include <string_view>
+#include <algorithm>
+#include <vector>
+#include <optional>
+
+#include <tbb/task_group.h>
 
 #include <QMessageBox>
+#include <QStandardPaths>
 #include <glad/glad.h>
 #include <bullet/btBulletDynamicsCommon.h>
 
@@ -39,6 +47,10 @@ import Timer;
 import Physics;
 import ModificationTables;
 import RenderManager;
+import AnimationScheduler;
+import SkeletalModelInstance;
+import SLKSnapshot;
+import RayCast;
 
 namespace fs = std::filesystem;
 using namespace std::literals::string_literals;
@@ -76,12 +88,18 @@ export class Map : public QObject {
 	bool render_wireframe = false;
 	bool render_debug = false;
 
+	/// Pick units and doodads with the id pass of the render manager instead of ray casting against their triangles on the CPU
+	bool gpu_picking = false;
+	/// The ray from the camera through the mouse, updated every frame
+	Ray mouse_ray = { glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f) };
+
 	glm::vec3 light_direction = glm::normalize(glm::vec3(1.f, 1.f, -3.f));
 
 	fs::path filesystem_path;
 	std::string name;
 
 	RenderManager render_manager;
+	AnimationScheduler animation_scheduler;
 
 	void load(const fs::path& path) {
 		Timer timer;
@@ -94,165 +112,9 @@ export class Map : public QObject {
 		// Maybe just ignore RoC so we only need to choose between _balance/custom_v1.w3mod/Units and /Units
 		// Maybe just force everyone to suck it up and use /Units
 
-		// Units
-		units_slk = slk::SLK("Units/UnitData.slk");
-		// By making some changes to unitmetadata.slk and unitdata.slk we can avoid the 1->2->2 mapping for SLK->OE->W3U files. We have to add some columns for this though
-		units_slk.add_column("missilearc2");
-		units_slk.add_column("missileart2");
-		units_slk.add_column("missilespeed2");
-		units_slk.add_column("buttonpos2");
-
-		units_meta_slk = slk::SLK("Data/Warcraft/UnitMetaData.slk", true);
-		units_meta_slk.substitute(world_edit_strings, "WorldEditStrings");
-		units_meta_slk.build_meta_map();
-
-		unit_editor_data = ini::INI("UI/UnitEditorData.txt");
-		unit_editor_data.substitute(world_edit_strings, "WorldEditStrings");
-		// Have to substitute twice since some of the keys refer to other keys in the same file
-		unit_editor_data.substitute(world_edit_strings, "WorldEditStrings");
-
-		units_slk.merge(ini::INI("Units/UnitSkin.txt"), units_meta_slk);
-		units_slk.merge(ini::INI("Units/UnitWeaponsFunc.txt"), units_meta_slk);
-		units_slk.merge(ini::INI("Units/UnitWeaponsSkin.txt"), units_meta_slk);
-
-		units_slk.merge(slk::SLK("Units/UnitBalance.slk"));
-		units_slk.merge(slk::SLK("Units/unitUI.slk"));
-		units_slk.merge(slk::SLK("Units/UnitWeapons.slk"));
-		units_slk.merge(slk::SLK("Units/UnitAbilities.slk"));
-
-		units_slk.merge(ini::INI("Units/HumanUnitFunc.txt"), units_meta_slk);
-		units_slk.merge(ini::INI("Units/OrcUnitFunc.txt"), units_meta_slk);
-		units_slk.merge(ini::INI("Units/UndeadUnitFunc.txt"), units_meta_slk);
-		units_slk.merge(ini::INI("Units/NightElfUnitFunc.txt"), units_meta_slk);
-		units_slk.merge(ini::INI("Units/NeutralUnitFunc.txt"), units_meta_slk);
-		units_slk.merge(ini::INI("Units/CampaignUnitFunc.txt"), units_meta_slk);
-
-		units_slk.merge(ini::INI("Units/HumanUnitStrings.txt"), units_meta_slk);
-		units_slk.merge(ini::INI("Units/OrcUnitStrings.txt"), units_meta_slk);
-		units_slk.merge(ini::INI("Units/UndeadUnitStrings.txt"), units_meta_slk);
-		units_slk.merge(ini::INI("Units/NightElfUnitStrings.txt"), units_meta_slk);
-		units_slk.merge(ini::INI("Units/NeutralUnitStrings.txt"), units_meta_slk);
-		units_slk.merge(ini::INI("Units/CampaignUnitStrings.txt"), units_meta_slk);
-
-		abilities_slk = slk::SLK("Units/AbilityData.slk");
-		abilities_meta_slk = slk::SLK("Units/AbilityMetaData.slk");
-		abilities_meta_slk.substitute(world_edit_strings, "WorldEditStrings");
-
-		// Patch the SLKs
-		abilities_slk.add_column("buttonpos2");
-		abilities_slk.add_column("unbuttonpos2");
-		abilities_slk.add_column("researchbuttonpos2");
-		abilities_meta_slk.set_shadow_data("field", "abpy", "buttonpos2");
-		abilities_meta_slk.set_shadow_data("field", "auby", "unbuttonpos2");
-		abilities_meta_slk.set_shadow_data("field", "arpy", "researchbuttonpos2");
-		abilities_meta_slk.build_meta_map();
-
-		abilities_slk.merge(ini::INI("Units/AbilitySkin.txt"), abilities_meta_slk);
-		abilities_slk.merge(ini::INI("Units/AbilitySkinStrings.txt"), abilities_meta_slk);
-		abilities_slk.merge(ini::INI("Units/HumanAbilityFunc.txt"), abilities_meta_slk);
-		abilities_slk.merge(ini::INI("Units/OrcAbilityFunc.txt"), abilities_meta_slk);
-		abilities_slk.merge(ini::INI("Units/UndeadAbilityFunc.txt"), abilities_meta_slk);
-		abilities_slk.merge(ini::INI("Units/NightElfAbilityFunc.txt"), abilities_meta_slk);
-		abilities_slk.merge(ini::INI("Units/NeutralAbilityFunc.txt"), abilities_meta_slk);
-		abilities_slk.merge(ini::INI("Units/ItemAbilityFunc.txt"), abilities_meta_slk);
-		abilities_slk.merge(ini::INI("Units/CommonAbilityFunc.txt"), abilities_meta_slk);
-		abilities_slk.merge(ini::INI("Units/CampaignAbilityFunc.txt"), abilities_meta_slk);
-
-		abilities_slk.merge(ini::INI("Units/HumanAbilityStrings.txt"), abilities_meta_slk);
-		abilities_slk.merge(ini::INI("Units/OrcAbilityStrings.txt"), abilities_meta_slk);
-		abilities_slk.merge(ini::INI("Units/UndeadAbilityStrings.txt"), abilities_meta_slk);
-		abilities_slk.merge(ini::INI("Units/NightElfAbilityStrings.txt"), abilities_meta_slk);
-		abilities_slk.merge(ini::INI("Units/NeutralAbilityStrings.txt"), abilities_meta_slk);
-		abilities_slk.merge(ini::INI("Units/ItemAbilityStrings.txt"), abilities_meta_slk);
-		abilities_slk.merge(ini::INI("Units/CommonAbilityStrings.txt"), abilities_meta_slk);
-		abilities_slk.merge(ini::INI("Units/CampaignAbilityStrings.txt"), abilities_meta_slk);
-
-		// Items
-		items_slk = slk::SLK("Units/ItemData.slk");
-		items_meta_slk = slk::SLK("Data/Warcraft/ItemMetaData.slk", true);
-		items_meta_slk.substitute(world_edit_strings, "WorldEditStrings");
-		items_meta_slk.build_meta_map();
-
-		items_slk.merge(ini::INI("Units/ItemSkin.txt"), items_meta_slk);
-		items_slk.merge(ini::INI("Units/ItemFunc.txt"), items_meta_slk);
-		items_slk.merge(ini::INI("Units/ItemStrings.txt"), items_meta_slk);
-
-		// Doodads
-		doodads_slk = slk::SLK("Doodads/Doodads.slk");
-		doodads_meta_slk = slk::SLK("Doodads/DoodadMetaData.slk");
-		doodads_meta_slk.substitute(world_edit_strings, "WorldEditStrings");
-		doodads_meta_slk.build_meta_map();
-
-		doodads_slk.merge(ini::INI("Doodads/DoodadSkins.txt"), doodads_meta_slk);
-		doodads_slk.substitute(world_edit_strings, "WorldEditStrings");
-		doodads_slk.substitute(world_edit_game_strings, "WorldEditStrings");
-
-		// Destructables
-		destructibles_slk = slk::SLK("Units/DestructableData.slk");
-		destructibles_slk.substitute(world_edit_strings, "WorldEditStrings");
-
-		destructibles_meta_slk = slk::SLK("Units/DestructableMetaData.slk");
-		destructibles_meta_slk.substitute(world_edit_strings, "WorldEditStrings");
-		destructibles_meta_slk.build_meta_map();
-
-		// Fix Scorched tree
-		destructibles_slk.merge(ini::INI("Data/Warcraft/DestructableSkin.txt", true), destructibles_meta_slk);
-
-		destructibles_slk.merge(ini::INI("Units/DestructableSkin.txt"), destructibles_meta_slk);
-		destructibles_slk.substitute(world_edit_strings, "WorldEditStrings");
-		destructibles_slk.substitute(world_edit_game_strings, "WorldEditStrings");
-
-		upgrade_slk = slk::SLK("Units/UpgradeData.slk");
-		upgrade_meta_slk = slk::SLK("Units/UpgradeMetaData.slk");
-		upgrade_meta_slk.substitute(world_edit_strings, "WorldEditStrings");
-
-		// Patch the SLKs
-		upgrade_slk.add_column("buttonpos2");
-		upgrade_meta_slk.set_shadow_data("field", "gbpy", "buttonpos2");
-		upgrade_meta_slk.build_meta_map();
-
-		upgrade_slk.merge(ini::INI("Units/AbilitySkin.txt"), upgrade_meta_slk);
-		upgrade_slk.merge(ini::INI("Units/UpgradeSkin.txt"), upgrade_meta_slk);
-		upgrade_slk.merge(ini::INI("Units/HumanUpgradeFunc.txt"), upgrade_meta_slk);
-		upgrade_slk.merge(ini::INI("Units/OrcUpgradeFunc.txt"), upgrade_meta_slk);
-		upgrade_slk.merge(ini::INI("Units/UndeadUpgradeFunc.txt"), upgrade_meta_slk);
-		upgrade_slk.merge(ini::INI("Units/NightElfUpgradeFunc.txt"), upgrade_meta_slk);
-		upgrade_slk.merge(ini::INI("Units/NeutralUpgradeFunc.txt"), upgrade_meta_slk);
-		upgrade_slk.merge(ini::INI("Units/CampaignUpgradeFunc.txt"), upgrade_meta_slk);
-
-		upgrade_slk.merge(ini::INI("Units/CampaignUpgradeStrings.txt"), upgrade_meta_slk);
-		upgrade_slk.merge(ini::INI("Units/HumanUpgradeStrings.txt"), upgrade_meta_slk);
-		upgrade_slk.merge(ini::INI("Units/NeutralUpgradeStrings.txt"), upgrade_meta_slk);
-		upgrade_slk.merge(ini::INI("Units/NightElfUpgradeStrings.txt"), upgrade_meta_slk);
-		upgrade_slk.merge(ini::INI("Units/OrcUpgradeStrings.txt"), upgrade_meta_slk);
-		upgrade_slk.merge(ini::INI("Units/UndeadUpgradeStrings.txt"), upgrade_meta_slk);
-		upgrade_slk.merge(ini::INI("Units/UpgradeSkinStrings.txt"), upgrade_meta_slk);
-		upgrade_slk.merge(ini::INI("Units/CampaignUpgradeFunc.txt"), upgrade_meta_slk);
-
-		buff_slk = slk::SLK("Units/AbilityBuffData.slk");
-		buff_meta_slk = slk::SLK("Units/AbilityBuffMetaData.slk");
-		buff_meta_slk.substitute(world_edit_strings, "WorldEditStrings");
-		buff_meta_slk.build_meta_map();
-
-		buff_slk.merge(ini::INI("Units/AbilitySkin.txt"), buff_meta_slk);
-		buff_slk.merge(ini::INI("Units/AbilitySkinStrings.txt"), buff_meta_slk);
-		buff_slk.merge(ini::INI("Units/HumanAbilityFunc.txt"), buff_meta_slk);
-		buff_slk.merge(ini::INI("Units/OrcAbilityFunc.txt"), buff_meta_slk);
-		buff_slk.merge(ini::INI("Units/UndeadAbilityFunc.txt"), buff_meta_slk);
-		buff_slk.merge(ini::INI("Units/NightElfAbilityFunc.txt"), buff_meta_slk);
-		buff_slk.merge(ini::INI("Units/NeutralAbilityFunc.txt"), buff_meta_slk);
-		buff_slk.merge(ini::INI("Units/ItemAbilityFunc.txt"), buff_meta_slk);
-		buff_slk.merge(ini::INI("Units/CommonAbilityFunc.txt"), buff_meta_slk);
-		buff_slk.merge(ini::INI("Units/CampaignAbilityFunc.txt"), buff_meta_slk);
-
-		buff_slk.merge(ini::INI("Units/HumanAbilityStrings.txt"), buff_meta_slk);
-		buff_slk.merge(ini::INI("Units/OrcAbilityStrings.txt"), buff_meta_slk);
-		buff_slk.merge(ini::INI("Units/UndeadAbilityStrings.txt"), buff_meta_slk);
-		buff_slk.merge(ini::INI("Units/NightElfAbilityStrings.txt"), buff_meta_slk);
-		buff_slk.merge(ini::INI("Units/NeutralAbilityStrings.txt"), buff_meta_slk);
-		buff_slk.merge(ini::INI("Units/ItemAbilityStrings.txt"), buff_meta_slk);
-		buff_slk.merge(ini::INI("Units/CommonAbilityStrings.txt"), buff_meta_slk);
-		buff_slk.merge(ini::INI("Units/CampaignAbilityStrings.txt"), buff_meta_slk);
+		// The per table chains do not depend on each other so they are loaded concurrently.
+		// Within a chain the merge order is kept as the later files override the earlier ones.
+		const auto stages = load_game_data();
 
 		units_table = new TableModel(&units_slk, &units_meta_slk);
 		items_table = new TableModel(&items_slk, &items_meta_slk);
@@ -263,6 +125,9 @@ export class Map : public QObject {
 		buff_table = new TableModel(&buff_slk, &buff_meta_slk);
 
 		std::print("\nSLK loading:\t {:>5}ms\n", timer.elapsed_ms());
+		for (const auto& stage : stages) {
+			std::print("  {:<14} {:>5.0f}ms{}\n", stage.name, stage.elapsed_ms, stage.from_snapshot ? " (snapshot)" : "");
+		}
 		timer.reset();
 
 		// Trigger strings
@@ -482,12 +347,13 @@ export class Map : public QObject {
 		light_direction = glm::normalize(glm::vec3(std::cos(seconds), std::sin(seconds), -2.f));*/
 
 		// Map mouse coordinates to world coordinates
+		glm::vec3 window = { input_handler.mouse.x, height - input_handler.mouse.y, 1.f };
+		glm::vec3 pos = glm::unProject(window, camera.view, camera.projection, glm::vec4(0, 0, width, height));
+		glm::vec3 origin = camera.position - camera.direction * camera.distance;
+		mouse_ray = { origin, glm::normalize(pos - origin) };
+
 		if (input_handler.mouse != input_handler.previous_mouse) {
-			glm::vec3 window = { input_handler.mouse.x, height - input_handler.mouse.y, 1.f };
-			glm::vec3 pos = glm::unProject(window, camera.view, camera.projection, glm::vec4(0, 0, width, height));
-			glm::vec3 origin = camera.position - camera.direction * camera.distance;
-			glm::vec3 direction = glm::normalize(pos - origin);
-			glm::vec3 toto = origin + direction * 2000.f;
+			glm::vec3 toto = mouse_ray.at(2000.f);
 
 			btVector3 from(origin.x, origin.y, origin.z);
 			btVector3 to(toto.x, toto.y, toto.z);
@@ -504,34 +370,28 @@ export class Map : public QObject {
 			}
 		}
 
-		// Animate units
-		std::for_each(std::execution::par_unseq, units.units.begin(), units.units.end(), [&](Unit& i) {
-			if (i.id == "sloc") {
-				return;
-			} // ToDo handle starting locations
+		// Determine what is visible once per frame. Rendering and picking reuse the result
+		units.cull();
+		doodads.cull();
 
-			mdx::Extent& extent = i.mesh->model->sequences[i.skeleton.sequence_index].extent;
-			if (!camera.inside_frustrum(i.skeleton.matrix * glm::vec4(extent.minimum, 1.f), i.skeleton.matrix * glm::vec4(extent.maximum, 1.f))) {
-				return;
-			}
-
-			i.skeleton.update(delta);
-		});
+		animation_scheduler.begin_frame(delta);
 
-		// Animate items
+		// Animate units and items
+		animated_skeletons.clear();
+		for (const uint32_t index : units.visible_units()) {
+			animated_skeletons.push_back(&units.units[index].skeleton);
+		}
 		for (auto& i : units.items) {
-			i.skeleton.update(delta);
+			animated_skeletons.push_back(&i.skeleton);
 		}
+		animation_scheduler.update(animated_skeletons, false);
 
-		// Animate doodads
-		std::for_each(std::execution::par_unseq, doodads.doodads.begin(), doodads.doodads.end(), [&](Doodad& i) {
-			mdx::Extent& extent = i.mesh->model->sequences[i.skeleton.sequence_index].extent;
-			if (!camera.inside_frustrum(i.skeleton.matrix * glm::vec4(extent.minimum, 1.f), i.skeleton.matrix * glm::vec4(extent.maximum, 1.f))) {
-				return;
-			}
-
-			i.skeleton.update(delta);
-		});
+		// Animate doodads. Doodads of the same type all play the same animation so identical ones only have to be evaluated once
+		animated_skeletons.clear();
+		for (const uint32_t index : doodads.visible_doodads()) {
+			animated_skeletons.push_back(&doodads.doodads[index].skeleton);
+		}
+		animation_scheduler.update(animated_skeletons, true);
 	}
 
 	void render() {
@@ -543,6 +403,9 @@ export class Map : public QObject {
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		glPolygonMode(GL_FRONT_AND_BACK, render_wireframe ? GL_LINE : GL_FILL);
 
+		terrain.upload_dirty();
+		pathing_map.upload_dirty();
+
 		terrain.render_ground(render_pathing, render_lighting);
 
 		if (render_doodads) {
@@ -558,6 +421,14 @@ export class Map : public QObject {
 		}
 
 		terrain.render_water();
+
+		// Brushes pick units and doodads under the mouse, so keep the ids under it read back
+		if (brush && gpu_picking) {
+			render_manager.pick_position = glm::ivec2(input_handler.mouse);
+			render_manager.pick_versions = { units.units.layout_version(), doodads.doodads.layout_version() };
+		} else {
+			render_manager.pick_position.reset();
+		}
 		render_manager.render(render_lighting, light_direction);
 
 		// physics.dynamicsWorld->debugDrawWorld();
@@ -585,6 +456,255 @@ export class Map : public QObject {
 
 		return id;
 	}
+
+	/// Returns the index of the unit under the mouse
+	std::optional<size_t> unit_under_mouse() {
+		if (gpu_picking) {
+			return render_manager.pick_unit_id_under_mouse(input_handler.mouse, units.units.layout_version());
+		}
+		return units.pick(mouse_ray);
+	}
+
+	/// Returns the index of the doodad under the mouse
+	std::optional<size_t> doodad_under_mouse() {
+		if (gpu_picking) {
+			return render_manager.pick_doodad_id_under_mouse(input_handler.mouse, doodads.doodads.layout_version());
+		}
+		return doodads.pick(mouse_ray);
+	}
+
+  private:
+	/// Scratch space for the skeletons handed to the animation scheduler each frame
+	std::vector<SkeletalModelInstance*> animated_skeletons;
+
+	struct GameDataStage {
+		std::string_view name;
+		void (Map::*load)();
+		/// Part of the snapshot key. Increment whenever load changes how the tables are built (column merges, shadow data, meta handling)
+		uint32_t chain_version;
+		std::array<slk::SLK*, 2> tables;
+		double elapsed_ms = 0.0;
+		bool from_snapshot = false;
+	};
+
+	/// Loads the SLK/INI game data tables. Every table is built by its own chain of SLK -> meta map -> INI merges
+	/// and the chains run as separate tasks on the TBB worker threads.
+	/// The merged tables are cached on disk and restored from there as long as none of the source files changed.
+	/// Returns the stages with their load times
+	std::array<GameDataStage, 7> load_game_data() {
+		std::array<GameDataStage, 7> stages = { {
+			{ "Units", &Map::load_units_data, 1, { &units_slk, &units_meta_slk } },
+			{ "Abilities", &Map::load_abilities_data, 1, { &abilities_slk, &abilities_meta_slk } },
+			{ "Items", &Map::load_items_data, 1, { &items_slk, &items_meta_slk } },
+			{ "Doodads", &Map::load_doodads_data, 1, { &doodads_slk, &doodads_meta_slk } },
+			{ "Destructibles", &Map::load_destructibles_data, 1, { &destructibles_slk, &destructibles_meta_slk } },
+			{ "Upgrades", &Map::load_upgrades_data, 1, { &upgrade_slk, &upgrade_meta_slk } },
+			{ "Buffs", &Map::load_buffs_data, 1, { &buff_slk, &buff_meta_slk } },
+		} };
+
+		const fs::path snapshot_path = fs::path(QStandardPaths::writableLocation(QStandardPaths::CacheLocation).toStdWString()) / "game_data.snapshot";
+		slk::SnapshotCache snapshot(snapshot_path);
+
+		// The chains open their files concurrently. The Hierarchy resolution cache has its own lock and casc::CASC serializes all CascLib calls
+		tbb::task_group loaders;
+		loaders.run([] {
+			unit_editor_data = ini::INI("UI/UnitEditorData.txt");
+			unit_editor_data.substitute(world_edit_strings, "WorldEditStrings");
+			// Have to substitute twice since some of the keys refer to other keys in the same file
+			unit_editor_data.substitute(world_edit_strings, "WorldEditStrings");
+		});
+
+		for (auto& stage : stages) {
+			loaders.run([this, &stage, &snapshot] {
+				Timer timer;
+				stage.from_snapshot = snapshot.load(stage.name, stage.chain_version, stage.tables);
+				if (!stage.from_snapshot) {
+					(this->*stage.load)();
+				}
+				stage.elapsed_ms = timer.elapsed_ms();
+			});
+		}
+		loaders.wait();
+
+		if (std::ranges::all_of(stages, &GameDataStage::from_snapshot)) {
+			return stages;
+		}
+
+		std::vector<slk::SnapshotCache::Entry> entries;
+		for (const auto& stage : stages) {
+			entries.push_back({ stage.name, stage.chain_version, { stage.tables.begin(), stage.tables.end() } });
+		}
+
+		// The file can not be replaced while it is still mapped
+		snapshot.close();
+		slk::SnapshotCache::save(snapshot_path, entries);
+		return stages;
+	}
+
+	void load_units_data() {
+		units_slk = slk::SLK("Units/UnitData.slk");
+		// By making some changes to unitmetadata.slk and unitdata.slk we can avoid the 1->2->2 mapping for SLK->OE->W3U files. We have to add some columns for this though
+		units_slk.add_column("missilearc2");
+		units_slk.add_column("missileart2");
+		units_slk.add_column("missilespeed2");
+		units_slk.add_column("buttonpos2");
+
+		units_meta_slk = slk::SLK("Data/Warcraft/UnitMetaData.slk", true);
+		units_meta_slk.substitute(world_edit_strings, "WorldEditStrings");
+		units_meta_slk.build_meta_map();
+
+		units_slk.merge(ini::INI("Units/UnitSkin.txt"), units_meta_slk);
+		units_slk.merge(ini::INI("Units/UnitWeaponsFunc.txt"), units_meta_slk);
+		units_slk.merge(ini::INI("Units/UnitWeaponsSkin.txt"), units_meta_slk);
+
+		units_slk.merge(slk::SLK("Units/UnitBalance.slk"));
+		units_slk.merge(slk::SLK("Units/unitUI.slk"));
+		units_slk.merge(slk::SLK("Units/UnitWeapons.slk"));
+		units_slk.merge(slk::SLK("Units/UnitAbilities.slk"));
+
+		units_slk.merge(ini::INI("Units/HumanUnitFunc.txt"), units_meta_slk);
+		units_slk.merge(ini::INI("Units/OrcUnitFunc.txt"), units_meta_slk);
+		units_slk.merge(ini::INI("Units/UndeadUnitFunc.txt"), units_meta_slk);
+		units_slk.merge(ini::INI("Units/NightElfUnitFunc.txt"), units_meta_slk);
+		units_slk.merge(ini::INI("Units/NeutralUnitFunc.txt"), units_meta_slk);
+		units_slk.merge(ini::INI("Units/CampaignUnitFunc.txt"), units_meta_slk);
+
+		units_slk.merge(ini::INI("Units/HumanUnitStrings.txt"), units_meta_slk);
+		units_slk.merge(ini::INI("Units/OrcUnitStrings.txt"), units_meta_slk);
+		units_slk.merge(ini::INI("Units/UndeadUnitStrings.txt"), units_meta_slk);
+		units_slk.merge(ini::INI("Units/NightElfUnitStrings.txt"), units_meta_slk);
+		units_slk.merge(ini::INI("Units/NeutralUnitStrings.txt"), units_meta_slk);
+		units_slk.merge(ini::INI("Units/CampaignUnitStrings.txt"), units_meta_slk);
+	}
+
+	void load_abilities_data() {
+		abilities_slk = slk::SLK("Units/AbilityData.slk");
+		abilities_meta_slk = slk::SLK("Units/AbilityMetaData.slk");
+		abilities_meta_slk.substitute(world_edit_strings, "WorldEditStrings");
+
+		// Patch the SLKs
+		abilities_slk.add_column("buttonpos2");
+		abilities_slk.add_column("unbuttonpos2");
+		abilities_slk.add_column("researchbuttonpos2");
+		abilities_meta_slk.set_shadow_data("field", "abpy", "buttonpos2");
+		abilities_meta_slk.set_shadow_data("field", "auby", "unbuttonpos2");
+		abilities_meta_slk.set_shadow_data("field", "arpy", "researchbuttonpos2");
+		abilities_meta_slk.build_meta_map();
+
+		abilities_slk.merge(ini::INI("Units/AbilitySkin.txt"), abilities_meta_slk);
+		abilities_slk.merge(ini::INI("Units/AbilitySkinStrings.txt"), abilities_meta_slk);
+		abilities_slk.merge(ini::INI("Units/HumanAbilityFunc.txt"), abilities_meta_slk);
+		abilities_slk.merge(ini::INI("Units/OrcAbilityFunc.txt"), abilities_meta_slk);
+		abilities_slk.merge(ini::INI("Units/UndeadAbilityFunc.txt"), abilities_meta_slk);
+		abilities_slk.merge(ini::INI("Units/NightElfAbilityFunc.txt"), abilities_meta_slk);
+		abilities_slk.merge(ini::INI("Units/NeutralAbilityFunc.txt"), abilities_meta_slk);
+		abilities_slk.merge(ini::INI("Units/ItemAbilityFunc.txt"), abilities_meta_slk);
+		abilities_slk.merge(ini::INI("Units/CommonAbilityFunc.txt"), abilities_meta_slk);
+		abilities_slk.merge(ini::INI("Units/CampaignAbilityFunc.txt"), abilities_meta_slk);
+
+		abilities_slk.merge(ini::INI("Units/HumanAbilityStrings.txt"), abilities_meta_slk);
+		abilities_slk.merge(ini::INI("Units/OrcAbilityStrings.txt"), abilities_meta_slk);
+		abilities_slk.merge(ini::INI("Units/UndeadAbilityStrings.txt"), abilities_meta_slk);
+		abilities_slk.merge(ini::INI("Units/NightElfAbilityStrings.txt"), abilities_meta_slk);
+		abilities_slk.merge(ini::INI("Units/NeutralAbilityStrings.txt"), abilities_meta_slk);
+		abilities_slk.merge(ini::INI("Units/ItemAbilityStrings.txt"), abilities_meta_slk);
+		abilities_slk.merge(ini::INI("Units/CommonAbilityStrings.txt"), abilities_meta_slk);
+		abilities_slk.merge(ini::INI("Units/CampaignAbilityStrings.txt"), abilities_meta_slk);
+	}
+
+	void load_items_data() {
+		items_slk = slk::SLK("Units/ItemData.slk");
+		items_meta_slk = slk::SLK("Data/Warcraft/ItemMetaData.slk", true);
+		items_meta_slk.substitute(world_edit_strings, "WorldEditStrings");
+		items_meta_slk.build_meta_map();
+
+		items_slk.merge(ini::INI("Units/ItemSkin.txt"), items_meta_slk);
+		items_slk.merge(ini::INI("Units/ItemFunc.txt"), items_meta_slk);
+		items_slk.merge(ini::INI("Units/ItemStrings.txt"), items_meta_slk);
+	}
+
+	void load_doodads_data() {
+		doodads_slk = slk::SLK("Doodads/Doodads.slk");
+		doodads_meta_slk = slk::SLK("Doodads/DoodadMetaData.slk");
+		doodads_meta_slk.substitute(world_edit_strings, "WorldEditStrings");
+		doodads_meta_slk.build_meta_map();
+
+		doodads_slk.merge(ini::INI("Doodads/DoodadSkins.txt"), doodads_meta_slk);
+		doodads_slk.substitute(world_edit_strings, "WorldEditStrings");
+		doodads_slk.substitute(world_edit_game_strings, "WorldEditStrings");
+	}
+
+	void load_destructibles_data() {
+		destructibles_slk = slk::SLK("Units/DestructableData.slk");
+		destructibles_slk.substitute(world_edit_strings, "WorldEditStrings");
+
+		destructibles_meta_slk = slk::SLK("Units/DestructableMetaData.slk");
+		destructibles_meta_slk.substitute(world_edit_strings, "WorldEditStrings");
+		destructibles_meta_slk.build_meta_map();
+
+		// Fix Scorched tree
+		destructibles_slk.merge(ini::INI("Data/Warcraft/DestructableSkin.txt", true), destructibles_meta_slk);
+
+		destructibles_slk.merge(ini::INI("Units/DestructableSkin.txt"), destructibles_meta_slk);
+		destructibles_slk.substitute(world_edit_strings, "WorldEditStrings");
+		destructibles_slk.substitute(world_edit_game_strings, "WorldEditStrings");
+	}
+
+	void load_upgrades_data() {
+		upgrade_slk = slk::SLK("Units/UpgradeData.slk");
+		upgrade_meta_slk = slk::SLK("Units/UpgradeMetaData.slk");
+		upgrade_meta_slk.substitute(world_edit_strings, "WorldEditStrings");
+
+		// Patch the SLKs
+		upgrade_slk.add_column("buttonpos2");
+		upgrade_meta_slk.set_shadow_data("field", "gbpy", "buttonpos2");
+		upgrade_meta_slk.build_meta_map();
+
+		upgrade_slk.merge(ini::INI("Units/AbilitySkin.txt"), upgrade_meta_slk);
+		upgrade_slk.merge(ini::INI("Units/UpgradeSkin.txt"), upgrade_meta_slk);
+		upgrade_slk.merge(ini::INI("Units/HumanUpgradeFunc.txt"), upgrade_meta_slk);
+		upgrade_slk.merge(ini::INI("Units/OrcUpgradeFunc.txt"), upgrade_meta_slk);
+		upgrade_slk.merge(ini::INI("Units/UndeadUpgradeFunc.txt"), upgrade_meta_slk);
+		upgrade_slk.merge(ini::INI("Units/NightElfUpgradeFunc.txt"), upgrade_meta_slk);
+		upgrade_slk.merge(ini::INI("Units/NeutralUpgradeFunc.txt"), upgrade_meta_slk);
+		upgrade_slk.merge(ini::INI("Units/CampaignUpgradeFunc.txt"), upgrade_meta_slk);
+
+		upgrade_slk.merge(ini::INI("Units/CampaignUpgradeStrings.txt"), upgrade_meta_slk);
+		upgrade_slk.merge(ini::INI("Units/HumanUpgradeStrings.txt"), upgrade_meta_slk);
+		upgrade_slk.merge(ini::INI("Units/NeutralUpgradeStrings.txt"), upgrade_meta_slk);
+		upgrade_slk.merge(ini::INI("Units/NightElfUpgradeStrings.txt"), upgrade_meta_slk);
+		upgrade_slk.merge(ini::INI("Units/OrcUpgradeStrings.txt"), upgrade_meta_slk);
+		upgrade_slk.merge(ini::INI("Units/UndeadUpgradeStrings.txt"), upgrade_meta_slk);
+		upgrade_slk.merge(ini::INI("Units/UpgradeSkinStrings.txt"), upgrade_meta_slk);
+		upgrade_slk.merge(ini::INI("Units/CampaignUpgradeFunc.txt"), upgrade_meta_slk);
+	}
+
+	void load_buffs_data() {
+		buff_slk = slk::SLK("Units/AbilityBuffData.slk");
+		buff_meta_slk = slk::SLK("Units/AbilityBuffMetaData.slk");
+		buff_meta_slk.substitute(world_edit_strings, "WorldEditStrings");
+		buff_meta_slk.build_meta_map();
+
+		buff_slk.merge(ini::INI("Units/AbilitySkin.txt"), buff_meta_slk);
+		buff_slk.merge(ini::INI("Units/AbilitySkinStrings.txt"), buff_meta_slk);
+		buff_slk.merge(ini::INI("Units/HumanAbilityFunc.txt"), buff_meta_slk);
+		buff_slk.merge(ini::INI("Units/OrcAbilityFunc.txt"), buff_meta_slk);
+		buff_slk.merge(ini::INI("Units/UndeadAbilityFunc.txt"), buff_meta_slk);
+		buff_slk.merge(ini::INI("Units/NightElfAbilityFunc.txt"), buff_meta_slk);
+		buff_slk.merge(ini::INI("Units/NeutralAbilityFunc.txt"), buff_meta_slk);
+		buff_slk.merge(ini::INI("Units/ItemAbilityFunc.txt"), buff_meta_slk);
+		buff_slk.merge(ini::INI("Units/CommonAbilityFunc.txt"), buff_meta_slk);
+		buff_slk.merge(ini::INI("Units/CampaignAbilityFunc.txt"), buff_meta_slk);
+
+		buff_slk.merge(ini::INI("Units/HumanAbilityStrings.txt"), buff_meta_slk);
+		buff_slk.merge(ini::INI("Units/OrcAbilityStrings.txt"), buff_meta_slk);
+		buff_slk.merge(ini::INI("Units/UndeadAbilityStrings.txt"), buff_meta_slk);
+		buff_slk.merge(ini::INI("Units/NightElfAbilityStrings.txt"), buff_meta_slk);
+		buff_slk.merge(ini::INI("Units/NeutralAbilityStrings.txt"), buff_meta_slk);
+		buff_slk.merge(ini::INI("Units/ItemAbilityStrings.txt"), buff_meta_slk);
+		buff_slk.merge(ini::INI("Units/CommonAbilityStrings.txt"), buff_meta_slk);
+		buff_slk.merge(ini::INI("Units/CampaignAbilityStrings.txt"), buff_meta_slk);
+	}
 };
 
 #include "map.moc"
\ No newline at end of file
@@ -1,6 +1,10 @@
 module;
 
 #include <memory>
+#include <vector>
+#include <span>
+#include <algorithm>
+#include <cmath>
 #include <print>
 
 #include <glad/glad.h>
@@ -16,6 +20,8 @@ import PathingTexture;
 import TerrainUndo;
 import OpenGLUtilities;
 import Hierarchy;
+import Grid;
+import DirtyRegion;
 
 export class PathingMap {
 	static constexpr int write_version = 0;
@@ -35,12 +41,16 @@ export class PathingMap {
 	std::vector<uint8_t> pathing_cells_static;
 	std::vector<uint8_t> pathing_cells_dynamic;
 
-	// For undo/redo
-	std::vector<uint8_t> old_pathing_cells_static;
+	// The parts of the cells that still have to be uploaded, see upload_dirty()
+	DirtyRegion dirty_static;
+	DirtyRegion dirty_dynamic;
+
+	// For undo/redo, the static pathing as it was at the start of the current undo group
+	TileSnapshot<uint8_t> old_pathing_cells_static;
 
 	bool load(size_t terrain_width, size_t terrain_height) {
 		BinaryReader reader = hierarchy.map_file_read("war3map.wpm");
-		const std::string magic_number = reader.read_string(4);
+		const std::string_view magic_number = reader.read_string_view(4);
 		if (magic_number != "MP3W") {
 			std::print("Invalid war3map.wpm magic number, expected MP3W but got {}", magic_number);
 			return false;
@@ -61,6 +71,9 @@ export class PathingMap {
 
 		pathing_cells_static = reader.read_vector<uint8_t>(width * height);
 		pathing_cells_dynamic.resize(width * height);
+		old_pathing_cells_static.begin(pathing_cells_static.data(), width, height);
+		dirty_static.reset(width, height);
+		dirty_dynamic.reset(width, height);
 
 		glCreateTextures(GL_TEXTURE_2D, 1, &texture_static);
 		glTextureStorage2D(texture_static, 1, GL_R8UI, width, height);
@@ -102,6 +115,7 @@ export class PathingMap {
 				pathing_cells_dynamic[j * width + i] = 0;
 			}
 		}
+		dirty_dynamic.add(t);
 	}
 
 	/// Checks for every cell on the supplied pathing_texture where (pathing_texture & mask == true) whether (existing_pathing & mask == true) and if so returns false
@@ -150,7 +164,7 @@ export class PathingMap {
 		return true;
 	}
 
-	/// Blits a pathing texture to the specified location on the pathing map. Manually call update_dynamic() afterwards to upload the changes to the GPU
+	/// Blits a pathing texture to the specified location on the pathing map. The changes are uploaded to the GPU by upload_dirty()
 	/// Expects position in whole grid tiles and draws the texture centered around this position
 	/// Rotation in multiples of 90
 	/// Blits the texture upside down as OpenGL uses the bottom-left as 0,0
@@ -192,26 +206,53 @@ export class PathingMap {
 				pathing_cells_dynamic[yy * width + xx] |= bytes;
 			}
 		}
+		// One cell wider, the cell positions above are truncated rather than floored
+		dirty_dynamic.add(QRect(std::floor(position.x * 4) - div_w / 2, std::floor(position.y * 4) - div_h / 2, div_w + 1, div_h + 1));
 	}
 
-	void upload_static_pathing() {
-		glTextureSubImage2D(texture_static, 0, 0, 0, width, height, GL_RED_INTEGER, GL_UNSIGNED_BYTE, pathing_cells_static.data());
-	}
+	/// Uploads the areas marked in dirty_static and dirty_dynamic. Called once per frame, so all edits of a frame are merged
+	void upload_dirty() {
+		if (dirty_static.empty() && dirty_dynamic.empty()) {
+			return;
+		}
 
-	void upload_dynamic_pathing() {
-		glTextureSubImage2D(texture_dynamic, 0, 0, 0, width, height, GL_RED_INTEGER, GL_UNSIGNED_BYTE, pathing_cells_dynamic.data());
+		const auto upload_area = [&](const GLuint texture, const std::vector<uint8_t>& cells, const QRect& area) {
+			glPixelStorei(GL_UNPACK_SKIP_PIXELS, area.x());
+			glPixelStorei(GL_UNPACK_SKIP_ROWS, area.y());
+			glTextureSubImage2D(texture, 0, area.x(), area.y(), area.width(), area.height(), GL_RED_INTEGER, GL_UNSIGNED_BYTE, cells.data());
+		};
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+		dirty_static.flush([&](const QRect& area) {
+			upload_area(texture_static, pathing_cells_static, area);
+		});
+		dirty_dynamic.flush([&](const QRect& area) {
+			upload_area(texture_dynamic, pathing_cells_dynamic, area);
+		});
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 	}
 
+	/// Nothing is copied until preserve() is called
 	void new_undo_group() {
-		old_pathing_cells_static = pathing_cells_static;
+		old_pathing_cells_static.begin(pathing_cells_static.data(), width, height);
+	}
+
+	/// Has to be called before the static pathing in the area is modified during the current undo group
+	void preserve(const QRect& area) {
+		old_pathing_cells_static.preserve(area.x(), area.y(), area.width(), area.height());
 	}
 
 	// Undo/redo structures
 	class PathingMapAction : public TerrainUndoAction {
 	  public:
 		QRect area;
-		std::vector<uint8_t> old_pathing;
-		std::vector<uint8_t> new_pathing;
+		/// The cells of the area row by row. The new cells are stored as their difference to the old ones
+		UndoBlob old_pathing;
+		UndoBlob new_pathing;
 		PathingMap& pathing_map;
 
 		PathingMapAction(PathingMap& pathing_map)
@@ -219,21 +260,28 @@ export class PathingMap {
 		}
 
 		void undo() override {
-			for (int j = area.top(); j <= area.bottom(); j++) {
-				for (int i = area.left(); i <= area.right(); i++) {
-					pathing_map.pathing_cells_static[j * pathing_map.width + i] = old_pathing[(j - area.top()) * area.width() + i - area.left()];
-				}
-			}
-			pathing_map.upload_static_pathing();
+			apply(old_pathing.unpack<uint8_t>());
 		}
 
 		void redo() override {
+			apply(new_pathing.unpack<uint8_t>(old_pathing.unpack<uint8_t>()));
+		}
+
+		size_t memory_usage() const override {
+			return old_pathing.memory_usage() + new_pathing.memory_usage();
+		}
+
+		void spill(const std::shared_ptr<UndoSpillFile>& file) override {
+			old_pathing.spill(file);
+			new_pathing.spill(file);
+		}
+
+	  private:
+		void apply(const std::vector<uint8_t>& cells) {
 			for (int j = area.top(); j <= area.bottom(); j++) {
-				for (int i = area.left(); i <= area.right(); i++) {
-					pathing_map.pathing_cells_static[j * pathing_map.width + i] = new_pathing[(j - area.top()) * area.width() + i - area.left()];
-				}
+				std::copy_n(cells.begin() + (j - area.top()) * area.width(), area.width(), pathing_map.pathing_cells_static.begin() + j * pathing_map.width + area.left());
 			}
-			pathing_map.upload_static_pathing();
+			pathing_map.dirty_static.add(area);
 		}
 	};
 
@@ -242,22 +290,20 @@ export class PathingMap {
 
 		undo_action->area = area;
 
-		// Copy old corners
-		undo_action->old_pathing.reserve(area.width() * area.height());
-		for (int j = area.top(); j <= area.bottom(); j++) {
-			for (int i = area.left(); i <= area.right(); i++) {
-				undo_action->old_pathing.push_back(old_pathing_cells_static[j * width + i]);
-			}
-		}
+		// Copy old cells, tiles that were not preserved have not changed
+		std::vector<uint8_t> old_area(area.width() * area.height());
+		old_pathing_cells_static.read_area(area.x(), area.y(), area.width(), area.height(), old_area.data());
 
-		// Copy new corners
-		undo_action->new_pathing.reserve(area.width() * area.height());
+		// Copy new cells
+		std::vector<uint8_t> new_area;
+		new_area.reserve(area.width() * area.height());
 		for (int j = area.top(); j <= area.bottom(); j++) {
-			for (int i = area.left(); i <= area.right(); i++) {
-				undo_action->new_pathing.push_back(pathing_cells_static[j * width + i]);
-			}
+			new_area.insert(new_area.end(), pathing_cells_static.begin() + j * width + area.left(), pathing_cells_static.begin() + j * width + area.left() + area.width());
 		}
 
+		undo_action->old_pathing = UndoBlob(std::span<const uint8_t>(old_area));
+		undo_action->new_pathing = UndoBlob(std::span<const uint8_t>(new_area), old_area);
+
 		//map->terrain_undo.add_undo_action(std::move(undo_action));
 		return std::move(undo_action);
 	}
@@ -268,8 +314,9 @@ export class PathingMap {
 
 		pathing_cells_static.resize(width * height);
 		pathing_cells_dynamic.resize(width * height);
-
-		old_pathing_cells_static.resize(width * height);
+		old_pathing_cells_static.begin(pathing_cells_static.data(), width, height);
+		dirty_static.reset(width, height);
+		dirty_dynamic.reset(width, height);
 
 		glDeleteTextures(1, &texture_static);
 		glCreateTextures(GL_TEXTURE_2D, 1, &texture_static);
@@ -1,6 +1,9 @@
 module;
 
 #include <vector>
+#include <array>
+#include <algorithm>
+#include <cstddef>
 #include <glad/glad.h>
 #include <memory>
 #include <optional>
@@ -21,6 +24,7 @@ import ResourceManager;
 import Timer;
 import MDX;
 import Camera;
+import StreamingBuffer;
 
 export class RenderManager {
   public:
@@ -34,56 +38,145 @@ export class RenderManager {
 	std::shared_ptr<Shader> instance_skinned_mesh_shader_hd;
 	std::shared_ptr<Shader> skinned_mesh_shader_sd;
 	std::shared_ptr<Shader> skinned_mesh_shader_hd;
+	std::shared_ptr<Shader> batched_skinned_mesh_shader_sd;
+	std::shared_ptr<Shader> batched_skinned_mesh_shader_hd;
 	std::shared_ptr<Shader> preskin_mesh_shader;
-	std::shared_ptr<Shader> colored_skinned_shader;
+	std::shared_ptr<Shader> pick_shader;
 
 	std::vector<SkinnedMesh*> skinned_meshes;
 	std::vector<SkinnedInstance> skinned_transparent_instances;
 
-	GLuint color_buffer;
-	GLuint depth_buffer;
-	GLuint color_picking_framebuffer;
+	/// Draw opaque layers of all meshes with state bucketed glMultiDrawElementsIndirect calls instead of one call per layer per mesh
+	bool batch_opaque_meshes = true;
+
+	struct Statistics {
+		/// The number of opaque draw calls without batching (one per layer per mesh)
+		size_t opaque_layers = 0;
+		/// The number of opaque draw calls that were issued
+		size_t opaque_draw_calls = 0;
+	};
+
+	/// Of the last rendered frame
+	Statistics statistics;
+
+	/// Shared by all skinned meshes for their per frame instance data
+	StreamingBuffer stream;
+
+	/// Instances queued with a pick id are drawn with that id into an id buffer. Units and doodads get separate buffers so that they do not occlude each other
+	static constexpr uint32_t doodad_pick_bit = 1u << 31;
+
+	static uint32_t unit_pick_id(const uint32_t index) {
+		return index + 1;
+	}
+
+	static uint32_t doodad_pick_id(const uint32_t index) {
+		return (index + 1) | doodad_pick_bit;
+	}
+
+	/// The window position (in pixels, origin top left) under which the ids are read back every frame, usually the mouse.
+	/// The id pass is skipped when not set
+	std::optional<glm::ivec2> pick_position;
+	/// The SlotMap::layout_version() of the units and doodads when their pick ids were queued.
+	/// Ids read back from a frame with another version are dropped as they may refer to other instances by now
+	std::array<uint64_t, 2> pick_versions = {};
 
 	int window_width;
 	int window_height;
 
+	GLuint batch_vao;
+	std::vector<SkinnedMesh::BatchedDraw> batched_draws;
+	std::vector<SkinnedMesh::DrawElementsIndirectCommand> batched_commands;
+	std::vector<SkinnedMesh::BatchInstance> batch_instances;
+
+	GLuint pick_vao;
+	std::vector<SkinnedMesh::DrawElementsIndirectCommand> pick_commands;
+	std::vector<SkinnedMesh::PickInstance> pick_instances;
+
 	RenderManager() {
 		instance_skinned_mesh_shader_sd = resource_manager.load<Shader>({ "Data/Shaders/skinned_mesh_instanced_sd.vs", "Data/Shaders/skinned_mesh_instanced_sd.fs" });
 		instance_skinned_mesh_shader_hd = resource_manager.load<Shader>({ "Data/Shaders/skinned_mesh_instanced_hd.vs", "Data/Shaders/skinned_mesh_instanced_hd.fs" });
 		skinned_mesh_shader_sd = resource_manager.load<Shader>({ "Data/Shaders/skinned_mesh_sd.vs", "Data/Shaders/skinned_mesh_sd.fs" });
 		skinned_mesh_shader_hd = resource_manager.load<Shader>({ "Data/Shaders/skinned_mesh_hd.vs", "Data/Shaders/skinned_mesh_hd.fs" });
+		batched_skinned_mesh_shader_sd = resource_manager.load<Shader>({ "Data/Shaders/skinned_mesh_batched_sd.vs", "Data/Shaders/skinned_mesh_instanced_sd.fs" });
+		batched_skinned_mesh_shader_hd = resource_manager.load<Shader>({ "Data/Shaders/skinned_mesh_batched_hd.vs", "Data/Shaders/skinned_mesh_instanced_hd.fs" });
 		preskin_mesh_shader = resource_manager.load<Shader>({ "Data/Shaders/preskin_mesh.cs" });
-		colored_skinned_shader = resource_manager.load<Shader>({ "Data/Shaders/skinned_mesh_instance_color_coded.vs", "Data/Shaders/skinned_mesh_instance_color_coded.fs" });
-
-		glCreateFramebuffers(1, &color_picking_framebuffer);
-
-		glCreateRenderbuffers(1, &color_buffer);
-		glNamedRenderbufferStorage(color_buffer, GL_RGBA8, 800, 600);
-		glNamedFramebufferRenderbuffer(color_picking_framebuffer, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_buffer);
-
-		glCreateRenderbuffers(1, &depth_buffer);
-		glNamedRenderbufferStorage(depth_buffer, GL_DEPTH24_STENCIL8, 800, 600);
-		glNamedFramebufferRenderbuffer(color_picking_framebuffer, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth_buffer);
+		pick_shader = resource_manager.load<Shader>({ "Data/Shaders/skinned_mesh_pick.vs", "Data/Shaders/skinned_mesh_pick.fs" });
+
+		// The per instance data of batched draws is read as instanced vertex attributes
+		glCreateVertexArrays(1, &batch_vao);
+		glEnableVertexArrayAttrib(batch_vao, 0);
+		glVertexArrayAttribFormat(batch_vao, 0, 4, GL_FLOAT, false, offsetof(SkinnedMesh::BatchInstance, color));
+		glVertexArrayAttribBinding(batch_vao, 0, 0);
+		glEnableVertexArrayAttrib(batch_vao, 1);
+		glVertexArrayAttribIFormat(batch_vao, 1, 3, GL_UNSIGNED_INT, offsetof(SkinnedMesh::BatchInstance, preskinned_offset));
+		glVertexArrayAttribBinding(batch_vao, 1, 0);
+		glVertexArrayBindingDivisor(batch_vao, 0, 1);
+
+		glCreateVertexArrays(1, &pick_vao);
+		glEnableVertexArrayAttrib(pick_vao, 0);
+		glVertexArrayAttribIFormat(pick_vao, 0, 3, GL_UNSIGNED_INT, 0);
+		glVertexArrayAttribBinding(pick_vao, 0, 0);
+		glVertexArrayBindingDivisor(pick_vao, 0, 1);
+
+		for (auto& i : pick_targets) {
+			glCreateFramebuffers(1, &i.framebuffer);
+
+			glCreateRenderbuffers(1, &i.color_buffer);
+			glNamedRenderbufferStorage(i.color_buffer, GL_R32UI, 800, 600);
+			glNamedFramebufferRenderbuffer(i.framebuffer, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, i.color_buffer);
+
+			glCreateRenderbuffers(1, &i.depth_buffer);
+			glNamedRenderbufferStorage(i.depth_buffer, GL_DEPTH24_STENCIL8, 800, 600);
+			glNamedFramebufferRenderbuffer(i.framebuffer, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, i.depth_buffer);
+
+			if (glCheckNamedFramebufferStatus(i.framebuffer, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+				std::print("ERROR::FRAMEBUFFER:: Framebuffer is not complete!\n");
+			}
+		}
 
-		if (glCheckNamedFramebufferStatus(color_picking_framebuffer, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-			std::print("ERROR::FRAMEBUFFER:: Framebuffer is not complete!\n");
+		// Persistently mapped so that a finished readback can be read without any GL call other than checking its fence
+		for (auto& i : pick_readbacks) {
+			constexpr GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glCreateBuffers(1, &i.buffer);
+			glNamedBufferStorage(i.buffer, pick_targets.size() * sizeof(uint32_t), nullptr, flags);
+			i.ids = static_cast<const uint32_t*>(glMapNamedBufferRange(i.buffer, 0, pick_targets.size() * sizeof(uint32_t), flags));
 		}
 	}
 
 	~RenderManager() {
-		glDeleteRenderbuffers(1, &color_buffer);
-		glDeleteRenderbuffers(1, &depth_buffer);
-		glDeleteFramebuffers(1, &color_picking_framebuffer);
+		for (auto& i : pick_targets) {
+			glDeleteRenderbuffers(1, &i.color_buffer);
+			glDeleteRenderbuffers(1, &i.depth_buffer);
+			glDeleteFramebuffers(1, &i.framebuffer);
+		}
+		for (auto& i : pick_readbacks) {
+			glDeleteSync(i.fence);
+			glDeleteBuffers(1, &i.buffer);
+		}
+		glDeleteVertexArrays(1, &batch_vao);
+		glDeleteVertexArrays(1, &pick_vao);
 	}
 
-	void render_queue(SkinnedMesh& skinned_mesh, const SkeletalModelInstance& skeleton, glm::vec3 color) {
+	/// pick_id is the id the instance is picked as (see unit_pick_id()/doodad_pick_id()), 0 if it can not be picked
+	void render_queue(SkinnedMesh& skinned_mesh, const SkeletalModelInstance& skeleton, glm::vec3 color, uint32_t pick_id = 0) {
 		mdx::Extent& extent = skinned_mesh.model->sequences[skeleton.sequence_index].extent;
 		if (!camera.inside_frustrum(skeleton.matrix * glm::vec4(extent.minimum, 1.f), skeleton.matrix * glm::vec4(extent.maximum, 1.f))) {
 			return;
 		}
 
+		render_queue_visible(skinned_mesh, skeleton, color, pick_id);
+	}
+
+	/// Same as render_queue() but without the frustum test, for instances that have already been culled.
+	/// Instances without a pose yet (see SkeletalModelInstance::node_matrices()) are skipped, they are drawn once the AnimationScheduler gave them one
+	void render_queue_visible(SkinnedMesh& skinned_mesh, const SkeletalModelInstance& skeleton, glm::vec3 color, uint32_t pick_id = 0) {
+		if (!skeleton.node_matrices()) {
+			return;
+		}
+
 		skinned_mesh.render_jobs.push_back(skeleton.matrix);
 		skinned_mesh.render_colors.push_back(color);
+		skinned_mesh.pick_ids.push_back(pick_id);
 		skinned_mesh.skeletons.push_back(&skeleton);
 
 		// Register for opaque drawing
@@ -110,9 +203,11 @@ export class RenderManager {
 		GLint old_vao;
 		glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &old_vao);
 
+		stream.begin_frame();
 		for (const auto& i : skinned_meshes) {
-			i->upload_render_data();
+			i->upload_render_data(stream);
 		}
+		skinned_mesh_arenas.reserve_preskinned();
 
 		preskin_mesh_shader->use();
 		glUniformMatrix4fv(0, 1, false, &camera.projection_view[0][0]);
@@ -120,22 +215,32 @@ export class RenderManager {
 		for (const auto& i : skinned_meshes) {
 			i->preskin_geometry();
 		}
+
+		if (pick_position) {
+			render_pick_ids();
+		}
 		// Render opaque meshes
 		// These don't have to be sorted and can thus be drawn instanced (one draw call per type of mesh)
-		instance_skinned_mesh_shader_sd->use();
-		glUniform1i(2, render_lighting);
-		glUniform3fv(3, 1, &light_direction.x);
-		glBlendFunc(GL_ONE, GL_ZERO);
+		statistics = {};
+		if (batch_opaque_meshes) {
+			render_opaque_batched(render_lighting, light_direction);
+		} else {
+			instance_skinned_mesh_shader_sd->use();
+			glUniform1i(2, render_lighting);
+			glUniform3fv(3, 1, &light_direction.x);
+			glBlendFunc(GL_ONE, GL_ZERO);
 
-		for (const auto& i : skinned_meshes) {
-			i->render_opaque(false);
-		}
+			for (const auto& i : skinned_meshes) {
+				statistics.opaque_draw_calls += i->render_opaque(false);
+			}
 
-		instance_skinned_mesh_shader_hd->use();
-		glUniform1i(2, render_lighting);
+			instance_skinned_mesh_shader_hd->use();
+			glUniform1i(2, render_lighting);
 
-		for (const auto& i : skinned_meshes) {
-			i->render_opaque(true);
+			for (const auto& i : skinned_meshes) {
+				statistics.opaque_draw_calls += i->render_opaque(true);
+			}
+			statistics.opaque_layers = statistics.opaque_draw_calls;
 		}
 
 		// Render transparent meshes
@@ -159,12 +264,13 @@ export class RenderManager {
 		}
 
 		glBindVertexArray(old_vao);
+		stream.end_frame();
 
 		for (const auto& i : skinned_meshes) {
 			i->render_jobs.clear();
 			i->render_colors.clear();
+			i->pick_ids.clear();
 			i->skeletons.clear();
-			i->instance_bone_matrices.clear();
 		}
 
 		glDepthMask(true);
@@ -173,99 +279,248 @@ export class RenderManager {
 		skinned_transparent_instances.clear();
 	}
 
-	void resize_framebuffers(int width, int height) {
-		glNamedRenderbufferStorage(color_buffer, GL_RGBA8, width, height);
-		glNamedRenderbufferStorage(depth_buffer, GL_DEPTH24_STENCIL8, width, height);
-		window_width = width;
-		window_height = height;
-	}
+	/// Draws the opaque layers of all queued meshes. Layers that share the same shader, textures and render state are submitted with a single glMultiDrawElementsIndirect
+	void render_opaque_batched(bool render_lighting, glm::vec3 light_direction) {
+		batched_draws.clear();
+		batch_instances.clear();
+		for (const auto& i : skinned_meshes) {
+			i->batch_opaque(batched_draws, batch_instances);
+		}
 
-	/// Requires the OpenGL context to be active/current
-	/// Returns the unit ID of the unit that is currently under the mouse coordinates
-	/// Renders the meshes currently inside the view frustrum coded by unit ID and then reads the pixel under the mouse coordinates
-	std::optional<size_t> pick_unit_id_under_mouse(Units& units, glm::vec2 mouse_position) {
-		GLint old_fbo;
-		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_fbo);
-		GLint old_vao;
-		glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &old_vao);
+		statistics.opaque_layers = batched_draws.size();
+		if (batched_draws.empty()) {
+			return;
+		}
 
-		glBindFramebuffer(GL_FRAMEBUFFER, color_picking_framebuffer);
+		// SD layers come first as hd is the first member of the state
+		std::ranges::stable_sort(batched_draws, {}, &SkinnedMesh::BatchedDraw::state);
 
-		glClearColor(0, 0, 0, 1);
-		glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-		glViewport(0, 0, window_width, window_height);
+		batched_commands.clear();
+		for (const auto& i : batched_draws) {
+			batched_commands.push_back(i.command);
+		}
 
-		glDepthMask(true);
-		glDisable(GL_BLEND);
+		const StreamingBuffer::Allocation commands = stream.upload(batched_commands);
+		const StreamingBuffer::Allocation instances = stream.upload(batch_instances);
 
-		colored_skinned_shader->use();
-		for (size_t i = 0; i < units.units.size(); i++) {
-			const Unit& unit = units.units[i];
-			if (unit.id == "sloc") {
-				continue;
-			} // ToDo handle starting locations
+		glVertexArrayElementBuffer(batch_vao, skinned_mesh_arenas.indices.buffer);
+		glVertexArrayVertexBuffer(batch_vao, 0, instances.buffer, instances.offset, sizeof(SkinnedMesh::BatchInstance));
+		glBindVertexArray(batch_vao);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands.buffer);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, skinned_mesh_arenas.uvs.buffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, skinned_mesh_arenas.preskinned_vertices);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, skinned_mesh_arenas.preskinned_tangent_light_directions);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, skinned_mesh_arenas.normals.buffer);
+
+		for (size_t start = 0; start < batched_draws.size();) {
+			const SkinnedMesh::BatchState& state = batched_draws[start].state;
+
+			size_t end = start + 1;
+			while (end < batched_draws.size() && batched_draws[end].state == state) {
+				end++;
+			}
 
-			mdx::Extent& extent = unit.mesh->model->sequences[unit.skeleton.sequence_index].extent;
-			if (camera.inside_frustrum(unit.skeleton.matrix * glm::vec4(extent.minimum, 1.f), unit.skeleton.matrix * glm::vec4(extent.maximum, 1.f))) {
-				unit.mesh->render_color_coded(unit.skeleton, i + 1);
+			if (start == 0 || state.hd != batched_draws[start - 1].state.hd) {
+				if (state.hd) {
+					batched_skinned_mesh_shader_hd->use();
+				} else {
+					batched_skinned_mesh_shader_sd->use();
+					glUniform3fv(3, 1, &light_direction.x);
+				}
+				glUniform1i(2, render_lighting);
 			}
+
+			glUniform1f(1, state.blend_mode == 1 ? 0.75f : -1.f);
+			apply_layer_state(state.blend_mode, state.shading_flags);
+
+			for (size_t texture_slot = 0; texture_slot < state.textures.size(); texture_slot++) {
+				if (state.textures[texture_slot] != 0) {
+					glBindTextureUnit(texture_slot, state.textures[texture_slot]);
+				}
+			}
+
+			const GLintptr indirect = commands.offset + start * sizeof(SkinnedMesh::DrawElementsIndirectCommand);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT, reinterpret_cast<void*>(indirect), end - start, 0);
+			statistics.opaque_draw_calls++;
+
+			start = end;
 		}
 
-		glm::u8vec4 color;
-		glReadPixels(mouse_position.x, window_height - mouse_position.y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, &color);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
 
-		glBindFramebuffer(GL_FRAMEBUFFER, old_fbo);
-		glBindVertexArray(old_vao);
-		glEnable(GL_BLEND);
+	void resize_framebuffers(int width, int height) {
+		for (auto& i : pick_targets) {
+			glNamedRenderbufferStorage(i.color_buffer, GL_R32UI, width, height);
+			glNamedRenderbufferStorage(i.depth_buffer, GL_DEPTH24_STENCIL8, width, height);
+		}
+		window_width = width;
+		window_height = height;
 
-		const int index = color.r + (color.g << 8) + (color.b << 16);
-		if (index != 0) {
-			return { index - 1 };
-		} else {
-			return {};
+		// The contents of the id buffers are gone
+		latest_pick.reset();
+		for (auto& i : pick_readbacks) {
+			i.valid = false;
 		}
 	}
 
 	/// Requires the OpenGL context to be active/current
-	/// Returns the doodad ID of the doodad that is currently under the mouse coordinates
-	/// Renders the meshes currently inside the view frustrum coded by unit ID and then reads the pixel under the mouse coordinates
-	std::optional<size_t> pick_doodad_id_under_mouse(Doodads& doodads, glm::vec2 mouse_position) {
-		GLint old_fbo;
-		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_fbo);
-		GLint old_vao;
-		glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &old_vao);
+	/// Returns the index of the unit under the mouse coordinates. layout_version is the current SlotMap::layout_version() of the units.
+	/// Uses the ids read back for pick_position during the last frames so normally it does not have to wait for the GPU
+	std::optional<size_t> pick_unit_id_under_mouse(glm::vec2 mouse_position, const uint64_t layout_version) {
+		return pick_id_under(mouse_position, 0, layout_version);
+	}
 
-		glBindFramebuffer(GL_FRAMEBUFFER, color_picking_framebuffer);
+	/// Requires the OpenGL context to be active/current
+	/// Returns the index of the doodad under the mouse coordinates. layout_version is the current SlotMap::layout_version() of the doodads.
+	/// Uses the ids read back for pick_position during the last frames so normally it does not have to wait for the GPU
+	std::optional<size_t> pick_doodad_id_under_mouse(glm::vec2 mouse_position, const uint64_t layout_version) {
+		return pick_id_under(mouse_position, 1, layout_version);
+	}
 
-		glClearColor(0, 0, 0, 1);
-		glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-		glViewport(0, 0, window_width, window_height);
+  private:
+	struct PickTarget {
+		GLuint framebuffer = 0;
+		GLuint color_buffer = 0;
+		GLuint depth_buffer = 0;
+	};
 
-		glDepthMask(true);
-		glDisable(GL_BLEND);
+	/// The ids under a position as read back from the id buffers of the units and doodads
+	struct PickResult {
+		glm::ivec2 position;
+		std::array<uint32_t, 2> ids;
+		std::array<uint64_t, 2> versions;
+	};
 
-		colored_skinned_shader->use();
-		for (size_t i = 0; i < doodads.doodads.size(); i++) {
-			const Doodad& doodad = doodads.doodads[i];
+	struct PickReadback {
+		GLuint buffer = 0;
+		const uint32_t* ids = nullptr;
+		GLsync fence = nullptr;
+		glm::ivec2 position;
+		std::array<uint64_t, 2> versions;
+		bool valid = false;
+	};
 
-			mdx::Extent& extent = doodad.mesh->model->sequences[doodad.skeleton.sequence_index].extent;
-			if (camera.inside_frustrum(doodad.skeleton.matrix * glm::vec4(extent.minimum, 1.f), doodad.skeleton.matrix * glm::vec4(extent.maximum, 1.f))) {
-				doodad.mesh->render_color_coded(doodad.skeleton, i + 1);
-			}
+	/// Index 0 holds the units, 1 the doodads
+	std::array<PickTarget, 2> pick_targets;
+	std::array<PickReadback, StreamingBuffer::frame_count> pick_readbacks;
+	size_t pick_readback_index = 0;
+	/// The most recent readback that has completed
+	std::optional<PickResult> latest_pick;
+	/// The pick_versions of the ids currently in the id buffers
+	std::array<uint64_t, 2> drawn_pick_versions = {};
+
+	/// Draws the pickable instances into the id buffers using the vertices preskin_geometry() produced and starts reading back the ids under pick_position
+	void render_pick_ids() {
+		pick_commands.clear();
+		pick_instances.clear();
+		for (const auto& i : skinned_meshes) {
+			i->batch_pick(pick_commands, pick_instances);
 		}
 
-		glm::u8vec4 color;
-		glReadPixels(mouse_position.x, window_height - mouse_position.y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, &color);
+		GLint old_fbo;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_fbo);
+
+		StreamingBuffer::Allocation commands;
+		if (!pick_commands.empty()) {
+			commands = stream.upload(pick_commands);
+			const StreamingBuffer::Allocation instances = stream.upload(pick_instances);
+
+			glVertexArrayElementBuffer(pick_vao, skinned_mesh_arenas.indices.buffer);
+			glVertexArrayVertexBuffer(pick_vao, 0, instances.buffer, instances.offset, sizeof(SkinnedMesh::PickInstance));
+			glBindVertexArray(pick_vao);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands.buffer);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, skinned_mesh_arenas.preskinned_vertices);
+
+			pick_shader->use();
+			glDisable(GL_BLEND);
+			glDisable(GL_CULL_FACE);
+			glEnable(GL_DEPTH_TEST);
+			glDepthMask(true);
+		}
+
+		constexpr GLuint clear_id = 0;
+		constexpr GLfloat clear_depth = 1.f;
+		for (GLuint kind = 0; kind < pick_targets.size(); kind++) {
+			glClearNamedFramebufferuiv(pick_targets[kind].framebuffer, GL_COLOR, 0, &clear_id);
+			glClearNamedFramebufferfv(pick_targets[kind].framebuffer, GL_DEPTH, 0, &clear_depth);
+			if (pick_commands.empty()) {
+				continue;
+			}
+
+			glBindFramebuffer(GL_FRAMEBUFFER, pick_targets[kind].framebuffer);
+			glUniform1ui(0, kind);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT, reinterpret_cast<void*>(commands.offset), pick_commands.size(), 0);
+		}
 
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
 		glBindFramebuffer(GL_FRAMEBUFFER, old_fbo);
-		glBindVertexArray(old_vao);
 		glEnable(GL_BLEND);
 
-		const int index = color.r + (color.g << 8) + (color.b << 16);
-		if (index != 0) {
-			return { index - 1 };
-		} else {
+		drawn_pick_versions = pick_versions;
+		read_back_pick(*pick_position);
+	}
+
+	/// Copies the ids under the window position into the next readback buffer and places a fence after the copy
+	void read_back_pick(const glm::ivec2 position) {
+		pick_readback_index = (pick_readback_index + 1) % pick_readbacks.size();
+		PickReadback& readback = pick_readbacks[pick_readback_index];
+		glDeleteSync(readback.fence);
+
+		GLint old_read_fbo;
+		glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &old_read_fbo);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+		for (size_t i = 0; i < pick_targets.size(); i++) {
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, pick_targets[i].framebuffer);
+			glReadPixels(position.x, window_height - position.y, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, reinterpret_cast<void*>(i * sizeof(uint32_t)));
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, old_read_fbo);
+
+		readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		readback.position = position;
+		readback.versions = drawn_pick_versions;
+		readback.valid = true;
+	}
+
+	/// Moves the results of all readbacks that have completed into latest_pick without waiting for the ones that have not
+	void collect_picks() {
+		for (size_t i = 1; i <= pick_readbacks.size(); i++) {
+			// Oldest first so that the newest completed readback ends up in latest_pick
+			PickReadback& readback = pick_readbacks[(pick_readback_index + i) % pick_readbacks.size()];
+			if (!readback.valid) {
+				continue;
+			}
+			const GLenum status = glClientWaitSync(readback.fence, 0, 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+				continue;
+			}
+			latest_pick = PickResult { readback.position, { readback.ids[0], readback.ids[1] }, readback.versions };
+			readback.valid = false;
+		}
+	}
+
+	std::optional<size_t> pick_id_under(const glm::vec2 mouse_position, const size_t kind, const uint64_t layout_version) {
+		const glm::ivec2 position(mouse_position);
+		collect_picks();
+
+		uint32_t id = 0;
+		if (latest_pick && latest_pick->position == position) {
+			id = latest_pick->ids[kind];
+		} else if (drawn_pick_versions[kind] == layout_version) {
+			// The mouse moved since the last frame was drawn. The id buffers still hold the last frame, so read from them directly.
+			// This does wait for the GPU but only happens when clicking right after moving
+			read_back_pick(position);
+			glClientWaitSync(pick_readbacks[pick_readback_index].fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+			collect_picks();
+			id = latest_pick ? latest_pick->ids[kind] : 0;
+		}
+
+		// Instances were erased since the ids were drawn, so the index may belong to another instance now
+		if (id == 0 || latest_pick->versions[kind] != layout_version) {
 			return {};
 		}
+		return { id - 1 };
 	}
 };
\ No newline at end of file
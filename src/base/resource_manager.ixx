@@ -4,6 +4,18 @@ module;
 #include <string>
 #include <memory>
 #include <filesystem>
+#include <array>
+#include <mutex>
+#include <future>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <vector>
+#include <concepts>
+#include <exception>
+#include <print>
+#include <cassert>
+#include <tbb/task_group.h>
 
 export module ResourceManager;
 
@@ -14,22 +26,69 @@ export class Resource {
 	virtual ~Resource() = default;
 };
 
+/// A resource that is split in a CPU side decode step, which may run on any thread, and a constructor taking the decoded data which creates the OpenGL objects.
+/// The constructor always runs on the OpenGL context thread
+template <typename T, typename... Args>
+concept DecodableResource = requires(const fs::path& path, Args... args) {
+	typename T::Decoded;
+	{ T::decode(path, args...) } -> std::same_as<typename T::Decoded>;
+};
+
+/// A resource that does not touch OpenGL or Qt and can thus be constructed entirely on a worker thread
+template <typename T>
+concept ThreadSafeResource = T::thread_safe_construction;
+
+class ResourceManager;
+
+/// The result of ResourceManager::load_async
+export template <typename T>
+class ResourceFuture {
+  public:
+	ResourceFuture() = default;
+	ResourceFuture(ResourceManager* manager, std::shared_future<std::shared_ptr<Resource>> future)
+		: manager(manager), future(std::move(future)) {
+	}
+
+	bool valid() const {
+		return future.valid();
+	}
+
+	bool ready() const {
+		return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	}
+
+	/// Blocks until the resource is loaded. Rethrows the exception if loading failed.
+	/// When called from the OpenGL context thread it processes the pending GPU uploads while waiting
+	std::shared_ptr<T> get() const;
+
+  private:
+	ResourceManager* manager = nullptr;
+	std::shared_future<std::shared_ptr<Resource>> future;
+};
+
 export class ResourceManager {
   public:
+	/// The thread that owns the OpenGL context. Defaults to the thread that constructed the resource manager (the main thread)
+	std::thread::id context_thread = std::this_thread::get_id();
+
+	~ResourceManager() {
+		workers.wait();
+	}
+
 	/// Loads and caches a resource in memory until no longer referenced.
 	/// Whether two load paths lead to different cached instances is determined by the path, T::name and custom_identifier
 	/// Any additional arguments are passed to your type its constructor
+	/// If the same resource is already being loaded (asynchronously or by another thread) then this waits for that load instead of loading it twice.
+	/// Resources that are not thread safe create OpenGL objects and may only be constructed here on the context thread, other threads have to use load_async()
 	template <typename T, typename... Args>
 	std::shared_ptr<T> load(const fs::path& path, const std::string& custom_identifier = "", Args... args) {
 		static_assert(std::is_base_of<Resource, T>::value, "T must inherit from Resource");
 		const std::string resource = path.string() + T::name + custom_identifier;
 
-		auto res = resources[resource].lock();
-		if (!res) {
-			resources[resource] = res = std::make_shared<T>(path, args...);
-		}
-
-		return std::dynamic_pointer_cast<T>(res);
+		return std::dynamic_pointer_cast<T>(acquire(resource, [&]() -> std::shared_ptr<Resource> {
+			assert_constructible_here<T>();
+			return std::make_shared<T>(path, args...);
+		}));
 	}
 
 	template <typename T>
@@ -42,16 +101,204 @@ export class ResourceManager {
 		}
 		resource += T::name;
 
-		auto res = resources[resource].lock();
-		if (!res) {
-			resources[resource] = res = std::make_shared<T>(paths);
+		return std::dynamic_pointer_cast<T>(acquire(resource, [&]() -> std::shared_ptr<Resource> {
+			assert_constructible_here<T>();
+			return std::make_shared<T>(paths);
+		}));
+	}
+
+	/// Same as load(), but returns immediately and loads the resource on the worker pool.
+	/// Decodable resources are decoded on a worker and only have their GPU objects created on the context thread (see process_context_tasks()).
+	/// Resources that are neither decodable nor thread safe are constructed entirely on the context thread.
+	/// The resource stays alive for as long as the returned future does
+	template <typename T, typename... Args>
+	ResourceFuture<T> load_async(const fs::path& path, const std::string& custom_identifier = "", Args... args) {
+		static_assert(std::is_base_of<Resource, T>::value, "T must inherit from Resource");
+		const std::string resource = path.string() + T::name + custom_identifier;
+
+		Shard& shard = shard_for(resource);
+		std::unique_lock lock(shard.mutex);
+
+		if (auto res = shard.resources[resource].lock()) {
+			std::promise<std::shared_ptr<Resource>> promise;
+			promise.set_value(std::move(res));
+			return ResourceFuture<T>(this, promise.get_future().share());
+		}
+
+		if (const auto found = shard.pending.find(resource); found != shard.pending.end()) {
+			return ResourceFuture<T>(this, found->second);
+		}
+
+		auto promise = std::make_shared<std::promise<std::shared_ptr<Resource>>>();
+		std::shared_future<std::shared_ptr<Resource>> future = promise->get_future().share();
+		shard.pending.emplace(resource, future);
+		lock.unlock();
+
+		if constexpr (DecodableResource<T, Args...>) {
+			workers.run([this, resource, promise, path, args...] {
+				try {
+					auto decoded = std::make_shared<typename T::Decoded>(T::decode(path, args...));
+					run_on_context([this, resource, promise, decoded] {
+						complete_async(resource, *promise, [&] { return std::make_shared<T>(std::move(*decoded)); });
+					});
+				} catch (...) {
+					log_failure(resource, std::current_exception());
+					fail(resource, *promise, std::current_exception());
+				}
+			});
+		} else if constexpr (ThreadSafeResource<T>) {
+			workers.run([this, resource, promise, path, args...] {
+				complete_async(resource, *promise, [&] { return std::make_shared<T>(path, args...); });
+			});
+		} else {
+			run_on_context([this, resource, promise, path, args...] {
+				complete_async(resource, *promise, [&] { return std::make_shared<T>(path, args...); });
+			});
+		}
+
+		return ResourceFuture<T>(this, std::move(future));
+	}
+
+	/// Runs the GPU uploads (and other context bound work) queued by load_async. Has to be called on the OpenGL context thread
+	void process_context_tasks() {
+		std::vector<std::function<void()>> tasks;
+		{
+			std::lock_guard lock(context_mutex);
+			tasks.swap(context_tasks);
+		}
+
+		for (auto& task : tasks) {
+			task();
 		}
+	}
 
-		return std::dynamic_pointer_cast<T>(res);
+	/// Waits for an asynchronous load. Keeps processing context tasks if called from the context thread as the load might be waiting on them
+	std::shared_ptr<Resource> wait(const std::shared_future<std::shared_ptr<Resource>>& future) {
+		if (std::this_thread::get_id() == context_thread) {
+			process_context_tasks();
+			while (future.wait_for(std::chrono::microseconds(250)) != std::future_status::ready) {
+				process_context_tasks();
+			}
+		}
+		return future.get();
 	}
 
   private:
-	std::unordered_map<std::string, std::weak_ptr<Resource>> resources;
+	static constexpr size_t shard_count = 16;
+
+	/// The cache is split in shards that each have their own lock so that loads of unrelated resources do not contend
+	struct Shard {
+		std::mutex mutex;
+		std::unordered_map<std::string, std::weak_ptr<Resource>> resources;
+		/// Resources that are currently being loaded
+		std::unordered_map<std::string, std::shared_future<std::shared_ptr<Resource>>> pending;
+	};
+
+	std::array<Shard, shard_count> shards;
+
+	tbb::task_group workers;
+
+	std::mutex context_mutex;
+	std::vector<std::function<void()>> context_tasks;
+
+	Shard& shard_for(const std::string& resource) {
+		return shards[std::hash<std::string>{}(resource) % shard_count];
+	}
+
+	/// Synchronous loads construct the resource on the calling thread, which for resources that create OpenGL objects has to be the context thread
+	template <typename T>
+	void assert_constructible_here() const {
+		if constexpr (!ThreadSafeResource<T>) {
+			assert(std::this_thread::get_id() == context_thread && "Resources that create OpenGL objects have to be loaded on the context thread, use load_async() instead");
+		}
+	}
+
+	void run_on_context(std::function<void()> task) {
+		if (std::this_thread::get_id() == context_thread) {
+			task();
+			return;
+		}
+		std::lock_guard lock(context_mutex);
+		context_tasks.push_back(std::move(task));
+	}
+
+	/// Returns the cached resource, waits for an in flight load of the resource or loads it using create
+	template <typename F>
+	std::shared_ptr<Resource> acquire(const std::string& resource, F&& create) {
+		Shard& shard = shard_for(resource);
+		std::unique_lock lock(shard.mutex);
+
+		if (auto res = shard.resources[resource].lock()) {
+			return res;
+		}
+
+		if (const auto found = shard.pending.find(resource); found != shard.pending.end()) {
+			const auto future = found->second;
+			lock.unlock();
+			return wait(future);
+		}
+
+		std::promise<std::shared_ptr<Resource>> promise;
+		shard.pending.emplace(resource, promise.get_future().share());
+		lock.unlock();
+
+		return complete(resource, promise, create);
+	}
+
+	/// Creates the resource, publishes it in the cache and fulfills the promise of everyone waiting on it
+	template <typename F>
+	std::shared_ptr<Resource> complete(const std::string& resource, std::promise<std::shared_ptr<Resource>>& promise, F&& create) {
+		std::shared_ptr<Resource> res;
+		try {
+			res = create();
+		} catch (...) {
+			fail(resource, promise, std::current_exception());
+			throw;
+		}
+
+		{
+			Shard& shard = shard_for(resource);
+			std::lock_guard lock(shard.mutex);
+			shard.resources[resource] = res;
+			shard.pending.erase(resource);
+		}
+		promise.set_value(res);
+		return res;
+	}
+
+	/// Asynchronous loads rethrow the failure to whoever calls ResourceFuture::get(). It is logged as well since nobody may be waiting
+	template <typename F>
+	void complete_async(const std::string& resource, std::promise<std::shared_ptr<Resource>>& promise, F&& create) {
+		try {
+			complete(resource, promise, create);
+		} catch (...) {
+			log_failure(resource, std::current_exception());
+		}
+	}
+
+	static void log_failure(const std::string& resource, const std::exception_ptr exception) {
+		try {
+			std::rethrow_exception(exception);
+		} catch (const std::exception& e) {
+			std::print("Failed to load {}: {}\n", resource, e.what());
+		} catch (...) {
+			std::print("Failed to load {}\n", resource);
+		}
+	}
+
+	void fail(const std::string& resource, std::promise<std::shared_ptr<Resource>>& promise, std::exception_ptr exception) {
+		{
+			Shard& shard = shard_for(resource);
+			std::lock_guard lock(shard.mutex);
+			shard.pending.erase(resource);
+		}
+		promise.set_exception(exception);
+	}
 };
 
+template <typename T>
+std::shared_ptr<T> ResourceFuture<T>::get() const {
+	return std::dynamic_pointer_cast<T>(manager->wait(future));
+}
+
 export inline ResourceManager resource_manager;
\ No newline at end of file
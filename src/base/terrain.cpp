@@ -1,6 +1,8 @@
 #include <set>
 #include <bitset>
 #include <iostream>
+#include <span>
+#include <cctype>
 
 #include "Terrain.h"
 
@@ -18,6 +20,33 @@ import SLK;
 
 using namespace std::literals::string_literals;
 
+/// Cliff and ramp models exist for corners up to this many layers above the lowest corner of their tile
+static constexpr int max_layer_difference = 2;
+/// A corner of a cliff model is one of the letters A, B or C in its name
+static constexpr int cliff_corner_keys = max_layer_difference + 1;
+/// A corner of a ramp model can also be one of the letters L, H or D for ramp corners
+static constexpr int ramp_corner_keys = 2 * cliff_corner_keys;
+
+/// The letter of a corner key in cliff and ramp model names
+static char corner_letter(const int key) {
+	return key < cliff_corner_keys ? 'A' + key : 'L' - 4 * (key - cliff_corner_keys);
+}
+
+/// The layer height of the corner above base or -1 if no model has such a corner
+static int layer_key(const Corner& corner, const int base) {
+	const int difference = corner.layer_height - base;
+	return difference >= 0 && difference <= max_layer_difference ? difference : -1;
+}
+
+static std::string ramp_file_name(int key) {
+	std::string corners;
+	for (int i = 0; i < 4; i++) {
+		corners.insert(corners.begin(), corner_letter(key % ramp_corner_keys));
+		key /= ramp_corner_keys;
+	}
+	return "doodads/terrain/clifftrans/clifftrans" + corners + "0.mdx";
+}
+
 float Corner::final_ground_height() const {
 	return height + layer_height - 2.0;
 }
@@ -45,7 +74,7 @@ Terrain::~Terrain() {
 bool Terrain::load() {
 	BinaryReader reader = hierarchy.map_file_read("war3map.w3e");
 
-	const std::string magic_number = reader.read_string(4);
+	const std::string_view magic_number = reader.read_string_view(4);
 	if (magic_number != "W3E!") {
 		std::cout << "Invalid war3map.w3e file: Magic number is not W3E!" << std::endl;
 		return false;
@@ -71,34 +100,31 @@ bool Terrain::load() {
 
 	offset = reader.read<glm::vec2>();
 
-	// Parse all tilepoints
-	corners.resize(width, std::vector<Corner>(height));
-	for (int j = 0; j < height; j++) {
-		for (int i = 0; i < width; i++) {
-			Corner& corner = corners[i][j];
+	// Parse all tilepoints, they are stored row by row like the grid
+	corners.resize(width, height);
+	old_corners.begin(corners);
+	for (Corner& corner : corners) {
+		corner.height = (reader.read<uint16_t>() - 8192.f) / 512.f;
 
-			corners[i][j].height = (reader.read<uint16_t>() - 8192.f) / 512.f;
+		const uint16_t water_and_edge = reader.read<uint16_t>();
+		corner.water_height = ((water_and_edge & 0x3FFF) - 8192.f) / 512.f;
+		corner.map_edge = water_and_edge & 0x4000;
 
-			const uint16_t water_and_edge = reader.read<uint16_t>();
-			corners[i][j].water_height = ((water_and_edge & 0x3FFF) - 8192.f) / 512.f;
-			corner.map_edge = water_and_edge & 0x4000;
+		const uint8_t texture_and_flags = reader.read<uint8_t>();
+		corner.ground_texture = texture_and_flags & 0b00001111;
 
-			const uint8_t texture_and_flags = reader.read<uint8_t>();
-			corner.ground_texture = texture_and_flags & 0b00001111;
+		corner.ramp = texture_and_flags & 0b00010000;
+		corner.blight = texture_and_flags & 0b00100000;
+		corner.water = texture_and_flags & 0b01000000;
+		corner.boundary = texture_and_flags & 0b10000000;
 
-			corner.ramp = texture_and_flags & 0b00010000;
-			corner.blight = texture_and_flags & 0b00100000;
-			corner.water = texture_and_flags & 0b01000000;
-			corner.boundary = texture_and_flags & 0b10000000;
+		const uint8_t variation = reader.read<uint8_t>();
+		corner.ground_variation = variation & 0b00011111;
+		corner.cliff_variation = (variation & 0b11100000) >> 5;
 
-			const uint8_t variation = reader.read<uint8_t>();
-			corner.ground_variation = variation & 0b00011111;
-			corner.cliff_variation = (variation & 0b11100000) >> 5;
-
-			const uint8_t misc = reader.read<uint8_t>();
-			corner.cliff_texture = (misc & 0b11110000) >> 4;
-			corner.layer_height = misc & 0b00001111;
-		}
+		const uint8_t misc = reader.read<uint8_t>();
+		corner.cliff_texture = (misc & 0b11110000) >> 4;
+		corner.layer_height = misc & 0b00001111;
 	}
 
 	create();
@@ -108,12 +134,12 @@ bool Terrain::load() {
 
 void Terrain::create() {
 	// Determine if cliff
-	for (int i = 0; i < width - 1; i++) {
-		for (int j = 0; j < height - 1; j++) {
-			Corner& bottom_left = corners[i][j];
-			Corner& bottom_right = corners[i + 1][j];
-			Corner& top_left = corners[i][j + 1];
-			Corner& top_right = corners[i + 1][j + 1];
+	for (int j = 0; j < height - 1; j++) {
+		for (int i = 0; i < width - 1; i++) {
+			Corner& bottom_left = corners(i, j);
+			Corner& bottom_right = corners(i + 1, j);
+			Corner& top_left = corners(i, j + 1);
+			Corner& top_right = corners(i + 1, j + 1);
 
 			bottom_left.cliff = bottom_left.layer_height != bottom_right.layer_height
 				|| bottom_left.layer_height != top_left.layer_height
@@ -168,13 +194,34 @@ void Terrain::create() {
 
 	// Cliff Meshes
 	slk::SLK cliffs_variation_slk("Data/Warcraft/Cliffs.slk", true);
+	cliff_lookup.assign(cliff_corner_keys * cliff_corner_keys * cliff_corner_keys * cliff_corner_keys, glm::ivec2(-1));
 	for (size_t i = 0; i < cliffs_variation_slk.rows(); i++) {
-		for (int j = 0; j < cliffs_variation_slk.data<int>("variations", i) + 1; j++) {
-			std::string file_name = "Doodads/Terrain/Cliffs/Cliffs" + cliffs_variation_slk.index_to_row.at(i) + std::to_string(j) + ".mdx";
+		const std::string& name = cliffs_variation_slk.index_to_row.at(i);
+		const int variations = cliffs_variation_slk.data<int>("variations", i);
+		const int first = static_cast<int>(cliff_meshes.size());
+		for (int j = 0; j < variations + 1; j++) {
+			std::string file_name = "Doodads/Terrain/Cliffs/Cliffs" + name + std::to_string(j) + ".mdx";
 			cliff_meshes.push_back(resource_manager.load<CliffMesh>(file_name));
-			path_to_cliff.emplace(cliffs_variation_slk.index_to_row.at(i) + std::to_string(j), static_cast<int>(cliff_meshes.size()) - 1);
 		}
-		cliff_variations.emplace(cliffs_variation_slk.index_to_row.at(i), cliffs_variation_slk.data<int>("variations", i));
+
+		int key = 0;
+		bool valid = name.size() == 4;
+		for (const char letter : name) {
+			const int corner = std::toupper(letter) - 'A';
+			valid = valid && corner >= 0 && corner < cliff_corner_keys;
+			key = key * cliff_corner_keys + corner;
+		}
+		if (valid) {
+			cliff_lookup[key] = { first, variations };
+		}
+	}
+
+	// Check which ramp models exist once instead of for every tile the cliff brush touches. Their meshes are loaded on first use
+	ramp_lookup.assign(ramp_corner_keys * ramp_corner_keys * ramp_corner_keys * ramp_corner_keys, -1);
+	for (size_t key = 0; key < ramp_lookup.size(); key++) {
+		if (hierarchy.file_exists(ramp_file_name(key))) {
+			ramp_lookup[key] = -2;
+		}
 	}
 
 	// Ground textures
@@ -202,12 +249,12 @@ void Terrain::create() {
 	water_heights.resize(width * height);
 	water_exists_data.resize(width * height);
 
-	for (int i = 0; i < width; i++) {
-		for (int j = 0; j < height; j++) {
-			ground_corner_heights[j * width + i] = corners[i][j].final_ground_height();
-			water_exists_data[j * width + i] = corners[i][j].water;
-			ground_heights[j * width + i] = corners[i][j].height;
-			water_heights[j * width + i] = corners[i][j].water_height;
+	for (int j = 0; j < height; j++) {
+		for (int i = 0; i < width; i++) {
+			ground_corner_heights[j * width + i] = corners(i, j).final_ground_height();
+			water_exists_data[j * width + i] = corners(i, j).water;
+			ground_heights[j * width + i] = corners(i, j).height;
+			water_heights[j * width + i] = corners(i, j).water_height;
 		}
 	}
 
@@ -271,6 +318,13 @@ void Terrain::create() {
 	}
 	glGenerateTextureMipmap(water_texture_array);
 
+	dirty_heights.reset(width, height);
+	dirty_ground_textures.reset(width - 1, height - 1);
+	dirty_ground_exists.reset(width, height);
+	dirty_water.reset(width, height);
+
+	cliffs.clear();
+	tile_cliffs.resize(width - 1, height - 1, -1);
 	update_cliff_meshes({ 0, 0, width - 1, height - 1 });
 	update_ground_textures({ 0, 0, width - 1, height - 1 });
 	update_ground_heights({ 0, 0, width - 1, height - 1 });
@@ -308,7 +362,7 @@ void Terrain::save() const {
 
 	for (int j = 0; j < height; j++) {
 		for (int i = 0; i < width; i++) {
-			const Corner& corner = corners[i][j];
+			const Corner& corner = corners(i, j);
 
 			writer.write<uint16_t>(corner.height * 512.f + 8192.f);
 
@@ -373,10 +427,10 @@ void Terrain::render_ground(bool render_pathing, bool render_lighting) const {
 
 	// Render cliffs
 	for (const auto& i : cliffs) {
-		const Corner& bottom_left = corners[i.x][i.y];
-		const Corner& bottom_right = corners[i.x + 1][i.y];
-		const Corner& top_left = corners[i.x][i.y + 1];
-		const Corner& top_right = corners[i.x + 1][i.y + 1];
+		const Corner& bottom_left = corners(i.x, i.y);
+		const Corner& bottom_right = corners(i.x + 1, i.y);
+		const Corner& top_left = corners(i.x, i.y + 1);
+		const Corner& top_right = corners(i.x + 1, i.y + 1);
 
 		const float min = std::min({ bottom_left.layer_height - 2,	bottom_right.layer_height - 2,
 									top_left.layer_height - 2,		top_right.layer_height - 2 });
@@ -442,10 +496,8 @@ void Terrain::change_tileset(const std::vector<std::string>& new_tileset_ids, st
 	new_to_old.push_back(new_tileset_ids.size());
 
 	// Map old ids to the new ids
-	for (auto& i : corners) {
-		for (auto& j : i) {
-			j.ground_texture = new_to_old[j.ground_texture];
-		}
+	for (Corner& corner : corners) {
+		corner.ground_texture = new_to_old[corner.ground_texture];
 	}
 
 	// Reload tile textures
@@ -473,12 +525,12 @@ int Terrain::real_tile_texture(const int x, const int y) const {
 	for (int i = -1; i < 1; i++) {
 		for (int j = -1; j < 1; j++) {
 			if (x + i >= 0 && x + i < width && y + j >= 0 && y + j < height) {
-				if (corners[x + i][y + j].cliff) {
+				if (corners(x + i, y + j).cliff) {
 					if (x + i < width - 1 && y + j < height - 1) {
-						const Corner& bottom_left = corners[x + i][y + j];
-						const Corner& bottom_right = corners[x + i + 1][y + j];
-						const Corner& top_left = corners[x + i][y + j + 1];
-						const Corner& top_right = corners[x + i + 1][y + j + 1];
+						const Corner& bottom_left = corners(x + i, y + j);
+						const Corner& bottom_right = corners(x + i + 1, y + j);
+						const Corner& top_left = corners(x + i, y + j + 1);
+						const Corner& top_right = corners(x + i + 1, y + j + 1);
 
 						if (bottom_left.ramp && top_left.ramp && bottom_right.ramp && top_right.ramp && !bottom_left.romp && !bottom_right.romp && !top_left.romp && !top_right.romp) {
 							goto out_of_loop;
@@ -486,8 +538,8 @@ int Terrain::real_tile_texture(const int x, const int y) const {
 					}
 				}
 
-				if (corners[x + i][y + j].romp || corners[x + i][y + j].cliff) {
-					int texture = corners[x + i][y + j].cliff_texture;
+				if (corners(x + i, y + j).romp || corners(x + i, y + j).cliff) {
+					int texture = corners(x + i, y + j).cliff_texture;
 					// Number 15 seems to be something
 					if (texture == 15) {
 						texture -= 14;
@@ -500,11 +552,11 @@ int Terrain::real_tile_texture(const int x, const int y) const {
 	}
 out_of_loop:
 
-	if (corners[x][y].blight) {
+	if (corners(x, y).blight) {
 		return blight_texture;
 	}
 
-	return corners[x][y].ground_texture;
+	return corners(x, y).ground_texture;
 }
 
 /// The subtexture of a groundtexture to use.
@@ -537,7 +589,7 @@ glm::u16vec4 Terrain::get_texture_variations(const int x, const int y) const {
 	glm::u16vec4 tiles(17); // 17 is a black transparent texture
 	int component = 1;
 
-	tiles.x = *set.begin() + (get_tile_variation(*set.begin(), corners[x][y].ground_variation) << 5);
+	tiles.x = *set.begin() + (get_tile_variation(*set.begin(), corners(x, y).ground_variation) << 5);
 	set.erase(set.begin());
 
 	std::bitset<4> index;
@@ -557,8 +609,8 @@ float Terrain::interpolated_height(float x, float y) const {
 	y = std::clamp(y, 0.f, height - 1.01f);
 
 	// Biliniear interpolation
-	float xx = glm::mix(corners[x][y].final_ground_height(), corners[std::ceil(x)][y].final_ground_height(), x - floor(x));
-	float yy = glm::mix(corners[x][std::ceil(y)].final_ground_height(), corners[std::ceil(x)][std::ceil(y)].final_ground_height(), x - floor(x));
+	float xx = glm::mix(corners(x, y).final_ground_height(), corners(std::ceil(x), y).final_ground_height(), x - floor(x));
+	float yy = glm::mix(corners(x, std::ceil(y)).final_ground_height(), corners(std::ceil(x), std::ceil(y)).final_ground_height(), x - floor(x));
 	return glm::mix(xx, yy, y - floor(y));
 }
 
@@ -567,10 +619,10 @@ bool Terrain::is_corner_ramp_entrance(int x, int y) {
 		return false;
 	}
 
-	Corner& bottom_left = corners[x][y];
-	Corner& bottom_right = corners[x + 1][y];
-	Corner& top_left = corners[x][y + 1];
-	Corner& top_right = corners[x + 1][y + 1];
+	Corner& bottom_left = corners(x, y);
+	Corner& bottom_right = corners(x + 1, y);
+	Corner& top_left = corners(x, y + 1);
+	Corner& top_right = corners(x + 1, y + 1);
 
 	return bottom_left.ramp && top_left.ramp && bottom_right.ramp && top_right.ramp && !(bottom_left.layer_height == top_right.layer_height && top_left.layer_height == bottom_right.layer_height);
 }
@@ -588,14 +640,14 @@ Texture Terrain::minimap_image() {
 		for (int i = 0; i < width; i++) {
 			glm::vec4 color;
 
-			if (corners[i][j].cliff || (i > 0 && corners[i - 1][j].cliff) || (j > 0 && corners[i][j - 1].cliff) || (i > 0 && j > 0 && corners[i - 1][j - 1].cliff)) {
+			if (corners(i, j).cliff || (i > 0 && corners(i - 1, j).cliff) || (j > 0 && corners(i, j - 1).cliff) || (i > 0 && j > 0 && corners(i - 1, j - 1).cliff)) {
 				color = glm::vec4(128.f, 128.f, 128.f, 255.f);
 			} else {
 				color = ground_textures[real_tile_texture(i, j)]->minimap_color;
 			}
 
-			if (corners[i][j].water && corners[i][j].final_water_height() > corners[i][j].final_ground_height()) {
-				if (corners[i][j].final_water_height() - corners[i][j].final_ground_height() > 0.5f) {
+			if (corners(i, j).water && corners(i, j).final_water_height() > corners(i, j).final_ground_height()) {
+				if (corners(i, j).final_water_height() - corners(i, j).final_ground_height() > 0.5f) {
 					color *= 0.5625f;
 					color += glm::vec4(0, 0, 80, 112);
 				} else {
@@ -616,9 +668,14 @@ Texture Terrain::minimap_image() {
 	return new_minimap_image;
 }
 
-/// Backups the old corners for a new undo group
+/// Starts a snapshot of the corners for a new undo group. Nothing is copied until preserve_corners() is called
 void Terrain::new_undo_group() {
-	old_corners = corners;
+	old_corners.begin(corners);
+}
+
+/// Has to be called before the corners in the area are modified during the current undo group
+void Terrain::preserve_corners(const QRect& area) {
+	old_corners.preserve(area.x(), area.y(), area.width(), area.height());
 }
 
 /// Adds the undo to the current undo group
@@ -628,70 +685,70 @@ void Terrain::add_undo(const QRect& area, undo_type type) {
 	undo_action->area = area;
 	undo_action->undo_type = type;
 
-	// Copy old corners
-	undo_action->old_corners.reserve(area.width() * area.height());
-	for (int j = area.top(); j <= area.bottom(); j++) {
-		for (int i = area.left(); i <= area.right(); i++) {
-			undo_action->old_corners.push_back(old_corners[i][j]);
-		}
-	}
+	// Copy old and new corners, row by row. Tiles that were not preserved have not changed
+	std::vector<Corner> old_area(area.width() * area.height());
+	old_corners.read_area(area.x(), area.y(), area.width(), area.height(), old_area.data());
 
-	// Copy new corners
-	undo_action->new_corners.reserve(area.width() * area.height());
-	for (int j = area.top(); j <= area.bottom(); j++) {
-		for (int i = area.left(); i <= area.right(); i++) {
-			undo_action->new_corners.push_back(corners[i][j]);
-		}
-	}
+	std::vector<Corner> new_area(area.width() * area.height());
+	corners.read_area(area.x(), area.y(), area.width(), area.height(), new_area.data());
+
+	undo_action->old_corners = UndoBlob(std::span<const Corner>(old_area));
+	undo_action->new_corners = UndoBlob(std::span<const Corner>(new_area), old_area);
 
 	map->terrain_undo.add_undo_action(std::move(undo_action));
 }
 
-void Terrain::upload_ground_heights() const {
-	glTextureSubImage2D(ground_height, 0, 0, 0, width, height, GL_RED, GL_FLOAT, ground_heights.data());
+/// Uploads the part of the width by height CPU side data in area to the same area of texture
+static void upload_area(const GLuint texture, const QRect& area, const GLenum format, const GLenum type, const void* data, const int width) {
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, area.x());
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, area.y());
+	glTextureSubImage2D(texture, 0, area.x(), area.y(), area.width(), area.height(), format, type, data);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
 }
 
-void Terrain::upload_corner_heights() const {
-	glTextureSubImage2D(ground_corner_height, 0, 0, 0, width, height, GL_RED, GL_FLOAT, ground_corner_heights.data());
-}
+/// Uploads the areas changed by the update_* functions since the last call. Called once per frame, so all edits of a frame are merged
+void Terrain::upload_dirty() {
+	dirty_heights.flush([&](const QRect& area) {
+		upload_area(ground_height, area, GL_RED, GL_FLOAT, ground_heights.data(), width);
+		upload_area(ground_corner_height, area, GL_RED, GL_FLOAT, ground_corner_heights.data(), width);
+	});
 
-void Terrain::upload_ground_texture() const {
-	glTextureSubImage2D(ground_texture_data, 0, 0, 0, width - 1, height - 1, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, ground_texture_list.data());
-}
-
-void Terrain::upload_ground_exists() const {
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTextureSubImage2D(ground_exists, 0, 0, 0, width, height, GL_RED, GL_UNSIGNED_BYTE, ground_exists_data.data());
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-}
+	dirty_ground_textures.flush([&](const QRect& area) {
+		upload_area(ground_texture_data, area, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, ground_texture_list.data(), width - 1);
+	});
 
-void Terrain::upload_water_exists() const {
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	glTextureSubImage2D(water_exists, 0, 0, 0, width, height, GL_RED, GL_UNSIGNED_BYTE, water_exists_data.data());
+	dirty_ground_exists.flush([&](const QRect& area) {
+		upload_area(ground_exists, area, GL_RED, GL_UNSIGNED_BYTE, ground_exists_data.data(), width);
+	});
+
+	dirty_water.flush([&](const QRect& area) {
+		upload_area(water_exists, area, GL_RED, GL_UNSIGNED_BYTE, water_exists_data.data(), width);
+		upload_area(water_height, area, GL_RED, GL_FLOAT, water_heights.data(), width);
+	});
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 }
 
-void Terrain::upload_water_heights() const {
-	glTextureSubImage2D(water_height, 0, 0, 0, width, height, GL_RED, GL_FLOAT, water_heights.data());
-}
-
 void Terrain::update_ground_heights(const QRect& area) {
 	for (int j = area.y(); j < area.y() + area.height(); j++) {
 		for (int i = area.x(); i < area.x() + area.width(); i++) {
-			ground_heights[j * width + i] = corners[i][j].height; // todo 15.998???
+			ground_heights[j * width + i] = corners(i, j).height; // todo 15.998???
 
 			float ramp_height = 0.f;
 			// Check if in one of the configurations the bottom_left is a ramp
 			for (int x_offset = -1; x_offset <= 0; x_offset++) {
 				for (int y_offset = -1; y_offset <= 0; y_offset++) {
 					if (i + x_offset >= 0 && i + x_offset < width - 1 && j + y_offset >= 0 && j + y_offset < height - 1) {
-						const Corner& bottom_left = corners[i + x_offset][j + y_offset];
-						const Corner& bottom_right = corners[i + 1 + x_offset][j + y_offset];
-						const Corner& top_left = corners[i + x_offset][j + 1 + y_offset];
-						const Corner& top_right = corners[i + 1 + x_offset][j + 1 + y_offset];
+						const Corner& bottom_left = corners(i + x_offset, j + y_offset);
+						const Corner& bottom_right = corners(i + 1 + x_offset, j + y_offset);
+						const Corner& top_left = corners(i + x_offset, j + 1 + y_offset);
+						const Corner& top_right = corners(i + 1 + x_offset, j + 1 + y_offset);
 
 						const int base = std::min({ bottom_left.layer_height, bottom_right.layer_height, top_left.layer_height, top_right.layer_height });
-						if (corners[i][j].layer_height != base) {
+						if (corners(i, j).layer_height != base) {
 							continue;
 						}
 
@@ -704,15 +761,14 @@ void Terrain::update_ground_heights(const QRect& area) {
 			}
 		exit_loop:
 
-			ground_corner_heights[j * width + i] = corners[i][j].final_ground_height() + ramp_height;
+			ground_corner_heights[j * width + i] = corners(i, j).final_ground_height() + ramp_height;
 		}
 	}
 
-	upload_ground_heights();
-	upload_corner_heights();
+	dirty_heights.add(area);
 }
 
-/// Updates the ground texture variation information and uploads it to the GPU
+/// Updates the ground texture variation information. Uploaded to the GPU by upload_dirty()
 void Terrain::update_ground_textures(const QRect& area) {
 	const QRect update_area = area.adjusted(-1, -1, 1, 1).intersected({ 0, 0, width - 1, height - 1 });
 
@@ -722,7 +778,7 @@ void Terrain::update_ground_textures(const QRect& area) {
 		}
 	}
 
-	upload_ground_texture();
+	dirty_ground_textures.add(update_area);
 }
 
 void Terrain::update_ground_exists(const QRect& area) {
@@ -730,57 +786,101 @@ void Terrain::update_ground_exists(const QRect& area) {
 
 	for (int j = update_area.top(); j <= update_area.bottom(); j++) {
 		for (int i = update_area.left(); i <= update_area.right(); i++) {
-			ground_exists_data[j * (width - 1) + i] = !(((corners[i][j].cliff || corners[i][j].romp) && !is_corner_ramp_entrance(i, j)) || corners[i][j].special_doodad);
+			ground_exists_data[j * width + i] = !(((corners(i, j).cliff || corners(i, j).romp) && !is_corner_ramp_entrance(i, j)) || corners(i, j).special_doodad);
 		}
 	}
 
-	upload_ground_exists();
+	dirty_ground_exists.add(update_area);
 }
 
-/// Updates and uploads the water data for the GPU
+/// Updates the water data for the GPU. Uploaded by upload_dirty()
 void Terrain::update_water(const QRect& area) {
-	for (int i = area.x(); i < area.x() + area.width(); i++) {
-		for (int j = area.y(); j < area.y() + area.height(); j++) {
-			map->terrain.water_exists_data[j * width + i] = corners[i][j].water;
-			map->terrain.water_heights[j * width + i] = corners[i][j].water_height;
+	for (int j = area.y(); j < area.y() + area.height(); j++) {
+		for (int i = area.x(); i < area.x() + area.width(); i++) {
+			map->terrain.water_exists_data[j * width + i] = corners(i, j).water;
+			map->terrain.water_heights[j * width + i] = corners(i, j).water_height;
+		}
+	}
+	dirty_water.add(area);
+}
+
+/// The index in cliff_meshes of the ramp whose corners in model name order are a, b, c and d, or -1 if there is no such ramp
+int Terrain::ramp_mesh(const Corner& a, const Corner& b, const Corner& c, const Corner& d, const int base) {
+	int key = 0;
+	for (const Corner* corner : { &a, &b, &c, &d }) {
+		const int layer = layer_key(*corner, base);
+		if (layer == -1) {
+			return -1;
 		}
+		key = key * ramp_corner_keys + layer + (corner->ramp ? cliff_corner_keys : 0);
 	}
-	upload_water_exists();
-	upload_water_heights();
+
+	int& mesh = ramp_lookup[key];
+	if (mesh == -2) {
+		cliff_meshes.push_back(resource_manager.load<CliffMesh>(ramp_file_name(key)));
+		mesh = static_cast<int>(cliff_meshes.size()) - 1;
+	}
+	return mesh;
+}
+
+/// Places the mesh on the tile, replacing the mesh that was there. A mesh of -1 only removes it
+void Terrain::set_tile_cliff(const int x, const int y, const int mesh) {
+	int& index = tile_cliffs(x, y);
+	if (index == -1) {
+		if (mesh != -1) {
+			index = static_cast<int>(cliffs.size());
+			cliffs.emplace_back(x, y, mesh);
+		}
+		return;
+	}
+
+	if (mesh != -1) {
+		cliffs[index].z = mesh;
+		return;
+	}
+
+	// Fill the gap with the last cliff so that removing is O(1)
+	const glm::ivec3 last = cliffs.back();
+	cliffs[index] = last;
+	tile_cliffs(last.x, last.y) = index;
+	cliffs.pop_back();
+	index = -1;
 }
 
 /// ToDo clean
 /// Function is a bit of a mess
 /// Updates the cliff and ramp meshes for an area
 void Terrain::update_cliff_meshes(const QRect& area) {
-	// Remove all existing cliff meshes in area
-	for (size_t i = cliffs.size(); i-- > 0;) {
-		glm::ivec3& pos = cliffs[i];
-		if (area.contains(pos.x, pos.y)) {
-			cliffs.erase(cliffs.begin() + i);
+	QRect ramp_area = area.adjusted(-2, -2, 2, 2).intersected({ 0, 0, width, height });
+
+	// Remove the meshes of all tiles that are rebuilt below
+	for (int j = ramp_area.y(); j < ramp_area.bottom(); j++) {
+		for (int i = ramp_area.x(); i < ramp_area.right(); i++) {
+			set_tile_cliff(i, j, -1);
 		}
 	}
 
-	for (int i = area.x(); i < area.right(); i++) {
-		for (int j = area.y(); j < area.bottom(); j++) {
-			corners[i][j].romp = false;
+	// Ramps flag the corners they cover so they are part of the undo snapshot too
+	preserve_corners(ramp_area);
+
+	for (int j = area.y(); j < area.bottom(); j++) {
+		for (int i = area.x(); i < area.right(); i++) {
+			corners(i, j).romp = false;
 		}
 	}
 
-	QRect ramp_area = area.adjusted(-2, -2, 2, 2).intersected({ 0, 0, width, height });
-
 	// Add new cliff meshes
-	for (int i = ramp_area.x(); i < ramp_area.right(); i++) {
-		for (int j = ramp_area.y(); j < ramp_area.bottom(); j++) {
-			Corner& bottom_left = corners[i][j];
-			Corner& bottom_right = corners[i + 1][j];
-			Corner& top_left = corners[i][j + 1];
-			Corner& top_right = corners[i + 1][j + 1];
+	for (int j = ramp_area.y(); j < ramp_area.bottom(); j++) {
+		for (int i = ramp_area.x(); i < ramp_area.right(); i++) {
+			Corner& bottom_left = corners(i, j);
+			Corner& bottom_right = corners(i + 1, j);
+			Corner& top_left = corners(i, j + 1);
+			Corner& top_right = corners(i + 1, j + 1);
 
 			// Vertical ramps
 			if (j < height - 2) {
-				const Corner& top_top_left = corners[i][j + 2];
-				const Corner& top_top_right = corners[i + 1][j + 2];
+				const Corner& top_top_left = corners(i, j + 2);
+				const Corner& top_top_right = corners(i + 1, j + 2);
 				const int ae = std::min(bottom_left.layer_height, top_top_left.layer_height);
 				const int cf = std::min(bottom_right.layer_height, top_top_right.layer_height);
 
@@ -792,20 +892,9 @@ void Terrain::update_cliff_meshes(const QRect& area) {
 						&& bottom_right.ramp == top_top_right.ramp 
 						&& bottom_left.ramp != bottom_right.ramp) {
 
-						std::string file_name = ""s
-							+ char((top_top_left.ramp ? 'L' : 'A') + (top_top_left.layer_height - base) * (top_top_left.ramp ? -4 : 1))
-							+ char((top_top_right.ramp ? 'L' : 'A') + (top_top_right.layer_height - base) * (top_top_right.ramp ? -4 : 1))
-							+ char((bottom_right.ramp ? 'L' : 'A') + (bottom_right.layer_height - base) * (bottom_right.ramp ? -4 : 1))
-							+ char((bottom_left.ramp ? 'L' : 'A') + (bottom_left.layer_height - base) * (bottom_left.ramp ? -4 : 1));
-
-						file_name = "doodads/terrain/clifftrans/clifftrans" + file_name + "0.mdx";
-						if (hierarchy.file_exists(file_name)) {
-							if (!path_to_cliff.contains(file_name)) {
-								cliff_meshes.push_back(resource_manager.load<CliffMesh>(file_name));
-								path_to_cliff.emplace(file_name, static_cast<int>(cliff_meshes.size()) - 1);
-							}
-
-							cliffs.emplace_back(i, j, path_to_cliff[file_name]);
+						const int mesh = ramp_mesh(top_top_left, top_top_right, bottom_right, bottom_left, base);
+						if (mesh != -1) {
+							set_tile_cliff(i, j, mesh);
 							bottom_left.romp = true;
 							top_left.romp = true;
 
@@ -817,8 +906,8 @@ void Terrain::update_cliff_meshes(const QRect& area) {
 
 			// Horizontal ramps
 			if (i < width - 2) {
-				const Corner& bottom_right_right = corners[i + 2][j];
-				const Corner& top_right_right = corners[i + 2][j + 1];
+				const Corner& bottom_right_right = corners(i + 2, j);
+				const Corner& top_right_right = corners(i + 2, j + 1);
 				const int ae = std::min(bottom_left.layer_height, bottom_right_right.layer_height);
 				const int bf = std::min(top_left.layer_height, top_right_right.layer_height);
 
@@ -830,20 +919,9 @@ void Terrain::update_cliff_meshes(const QRect& area) {
 						&& top_left.ramp == top_right_right.ramp 
 						&& bottom_left.ramp != top_left.ramp) {
 
-						std::string file_name = ""s
-							+ char((top_left.ramp ? 'L' : 'A') + (top_left.layer_height - base) * (top_left.ramp ? -4 : 1))
-							+ char((top_right_right.ramp ? 'L' : 'A') + (top_right_right.layer_height - base) * (top_right_right.ramp ? -4 : 1))
-							+ char((bottom_right_right.ramp ? 'L' : 'A') + (bottom_right_right.layer_height - base) * (bottom_right_right.ramp ? -4 : 1))
-							+ char((bottom_left.ramp ? 'L' : 'A') + (bottom_left.layer_height - base) * (bottom_left.ramp ? -4 : 1));
-
-						file_name = "doodads/terrain/clifftrans/clifftrans" + file_name + "0.mdx";
-						if (hierarchy.file_exists(file_name)) {
-							if (!path_to_cliff.contains(file_name)) {
-								cliff_meshes.push_back(resource_manager.load<CliffMesh>(file_name));
-								path_to_cliff.emplace(file_name, static_cast<int>(cliff_meshes.size()) - 1);
-							}
-
-							cliffs.emplace_back(i, j, path_to_cliff[file_name]);
+						const int mesh = ramp_mesh(top_left, top_right_right, bottom_right_right, bottom_left, base);
+						if (mesh != -1) {
+							set_tile_cliff(i, j, mesh);
 							bottom_left.romp = true;
 							bottom_right.romp = true;
 
@@ -863,20 +941,22 @@ void Terrain::update_cliff_meshes(const QRect& area) {
 
 			const int base = std::min({bottom_left.layer_height, bottom_right.layer_height, top_left.layer_height, top_right.layer_height});
 
-			// Cliff model path
-			std::string file_name = ""s + char('A' + top_left.layer_height - base)
-				+ char('A' + top_right.layer_height - base)
-				+ char('A' + bottom_right.layer_height - base)
-				+ char('A' + bottom_left.layer_height - base);
+			// Cliff model, the corners in model name order
+			int key = 0;
+			bool valid = true;
+			for (const Corner* corner : { &top_left, &top_right, &bottom_right, &bottom_left }) {
+				const int layer = layer_key(*corner, base);
+				valid = valid && layer != -1;
+				key = key * cliff_corner_keys + layer;
+			}
 
-			if (file_name == "AAAA") {
+			// AAAA is flat ground
+			if (!valid || key == 0 || cliff_lookup[key].x == -1) {
 				continue;
 			}
 
 			// Clamp to within max variations
-			file_name += std::to_string(std::clamp(bottom_left.cliff_variation, 0, cliff_variations[file_name]));
-
-			cliffs.emplace_back(i, j, path_to_cliff[file_name]);
+			set_tile_cliff(i, j, cliff_lookup[key].x + std::clamp<int>(bottom_left.cliff_variation, 0, cliff_lookup[key].y));
 		}
 	}
 
@@ -897,9 +977,10 @@ void Terrain::resize(size_t new_width, size_t new_height) {
 
 	//offset = 
 
-	auto t = corners[0][0];
-	corners.clear();
-	corners.resize(width, std::vector<Corner>(height, t));
+	const Corner t = corners(0, 0);
+	corners.resize(width, height, t);
+	// The snapshot refers to the old corners
+	old_corners.begin(corners);
 
 	ground_heights.resize(width * height);
 	ground_corner_heights.resize(width * height);
@@ -909,21 +990,21 @@ void Terrain::resize(size_t new_width, size_t new_height) {
 	water_heights.resize(width * height);
 	water_exists_data.resize(width * height);
 
-	for (int i = 0; i < width; i++) {
-		for (int j = 0; j < height; j++) {
-			ground_corner_heights[j * width + i] = corners[i][j].final_ground_height();
-			water_exists_data[j * width + i] = corners[i][j].water;
-			ground_heights[j * width + i] = corners[i][j].height;
-			water_heights[j * width + i] = corners[i][j].water_height;
+	for (int j = 0; j < height; j++) {
+		for (int i = 0; i < width; i++) {
+			ground_corner_heights[j * width + i] = corners(i, j).final_ground_height();
+			water_exists_data[j * width + i] = corners(i, j).water;
+			ground_heights[j * width + i] = corners(i, j).height;
+			water_heights[j * width + i] = corners(i, j).water_height;
 		}
 	}
 
-	for (int i = 0; i < width - 1; i++) {
-		for (int j = 0; j < height - 1; j++) {
-			Corner& bottom_left = corners[i][j];
-			Corner& bottom_right = corners[i + 1][j];
-			Corner& top_left = corners[i][j + 1];
-			Corner& top_right = corners[i + 1][j + 1];
+	for (int j = 0; j < height - 1; j++) {
+		for (int i = 0; i < width - 1; i++) {
+			Corner& bottom_left = corners(i, j);
+			Corner& bottom_right = corners(i + 1, j);
+			Corner& top_left = corners(i, j + 1);
+			Corner& top_right = corners(i + 1, j + 1);
 
 			bottom_left.cliff = bottom_left.layer_height != bottom_right.layer_height || bottom_left.layer_height != top_left.layer_height || bottom_left.layer_height != top_right.layer_height;
 		}
@@ -960,6 +1041,13 @@ void Terrain::resize(size_t new_width, size_t new_height) {
 	glTextureSubImage2D(water_exists, 0, 0, 0, width, height, GL_RED, GL_UNSIGNED_BYTE, water_exists_data.data());
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
+	dirty_heights.reset(width, height);
+	dirty_ground_textures.reset(width - 1, height - 1);
+	dirty_ground_exists.reset(width, height);
+	dirty_water.reset(width, height);
+
+	cliffs.clear();
+	tile_cliffs.resize(width - 1, height - 1, -1);
 	update_cliff_meshes({ 0, 0, width - 1, height - 1 });
 	update_ground_textures({ 0, 0, width - 1, height - 1 });
 	update_ground_heights({ 0, 0, width - 1, height - 1 });
@@ -983,11 +1071,8 @@ void Terrain::update_minimap() {
 }
 
 void TerrainGenericAction::undo() {
-	for (int j = area.top(); j <= area.bottom(); j++) {
-		for (int i = area.left(); i <= area.right(); i++) {
-			map->terrain.corners[i][j] = old_corners[(j - area.top()) * area.width() + i - area.left()];
-		}
-	}
+	const std::vector<Corner> corners = old_corners.unpack<Corner>();
+	map->terrain.corners.write_area(area.x(), area.y(), area.width(), area.height(), corners.data());
 
 	if (undo_type == Terrain::undo_type::height) {
 		map->terrain.update_ground_heights(area);
@@ -1009,11 +1094,8 @@ void TerrainGenericAction::undo() {
 }
 
 void TerrainGenericAction::redo() {
-	for (int j = area.top(); j <= area.bottom(); j++) {
-		for (int i = area.left(); i <= area.right(); i++) {
-			map->terrain.corners[i][j] = new_corners[(j - area.top()) * area.width() + i - area.left()];
-		}
-	}
+	const std::vector<Corner> corners = new_corners.unpack<Corner>(old_corners.unpack<Corner>());
+	map->terrain.corners.write_area(area.x(), area.y(), area.width(), area.height(), corners.data());
 
 	if (undo_type == Terrain::undo_type::height) {
 		map->terrain.update_ground_heights(area);
@@ -24,27 +24,28 @@ import CliffMesh;
 import Shader;
 import SLK;
 import TerrainUndo;
+import Grid;
+import DirtyRegion;
 
+/// A tilepoint of the terrain. Packed into 16 bytes so that the corner grid stays compact for the brushes, the GPU staging and undo snapshots
 struct Corner {
-	bool map_edge;
-
-	int ground_texture;
-
 	float height;
 	float water_height;
-	bool ramp;
-	bool blight;
-	bool water;
-	bool boundary;
-	bool cliff = false;
-	bool romp = false;
-	bool special_doodad = false;
-
-	int ground_variation;
-	int cliff_variation;
 
-	int cliff_texture;
-	int layer_height;
+	uint8_t ground_texture;
+	uint8_t ground_variation;
+	uint8_t cliff_variation;
+	uint8_t cliff_texture;
+	uint8_t layer_height;
+
+	bool map_edge : 1;
+	bool ramp : 1;
+	bool blight : 1;
+	bool water : 1;
+	bool boundary : 1;
+	bool cliff : 1 = false;
+	bool romp : 1 = false;
+	bool special_doodad : 1 = false;
 
 	float final_ground_height() const;
 	float final_water_height() const;
@@ -77,9 +78,18 @@ class Terrain : public QObject {
 
 	std::vector<float> water_heights;
 	std::vector<unsigned char> water_exists_data;
+
+	// The parts of the above that still have to be uploaded, see upload_dirty()
+	DirtyRegion dirty_heights;
+	DirtyRegion dirty_ground_textures;
+	DirtyRegion dirty_ground_exists;
+	DirtyRegion dirty_water;
 	
 	btHeightfieldTerrainShape* collision_shape;
 	btRigidBody* collision_body;
+
+	int ramp_mesh(const Corner& a, const Corner& b, const Corner& c, const Corner& d, int base);
+	void set_tile_cliff(int x, int y, int mesh);
 public:
 	char tileset;
 	std::vector<std::string> tileset_ids;
@@ -103,9 +113,9 @@ public:
 	GLuint water_height;
 	GLuint water_exists;
 
-	std::vector<std::vector<Corner>> corners;
-	// For undo/redo operations
-	std::vector<std::vector<Corner>> old_corners;
+	Grid<Corner> corners;
+	// For undo/redo operations, the corners as they were at the start of the current undo group
+	TileSnapshot<Corner> old_corners;
 
 	int variation_size = 64;
 	int blight_texture;
@@ -114,9 +124,14 @@ public:
 	slk::SLK cliff_slk;
 
 	// Cliffs
+	/// The cliff and ramp meshes on the map as x, y and index in cliff_meshes. Unordered
 	std::vector<glm::ivec3> cliffs;
-	std::map<std::string, int> path_to_cliff;
-	std::map<std::string, int> cliff_variations;
+	/// The index in cliffs of the mesh at every tile or -1
+	Grid<int> tile_cliffs;
+	/// The first index in cliff_meshes and the number of extra variations of every cliff model, indexed on the layer heights of its corners. -1 if there is no such cliff
+	std::vector<glm::ivec2> cliff_lookup;
+	/// The index in cliff_meshes of every ramp model, indexed on the layer heights and ramp flags of its corners. -1 if there is no such ramp, -2 if its mesh is not loaded yet
+	std::vector<int> ramp_lookup;
 	std::vector<int> cliff_to_ground_texture;
 	
 	std::shared_ptr<Shader> cliff_shader;
@@ -176,14 +191,10 @@ public:
 	};
 
 	void new_undo_group();
+	void preserve_corners(const QRect& area);
 	void add_undo(const QRect& area, undo_type type);
 
-	void upload_ground_heights() const;
-	void upload_corner_heights() const;
-	void upload_ground_texture() const;
-	void upload_ground_exists() const;
-	void upload_water_exists() const;
-	void upload_water_heights() const;
+	void upload_dirty();
 
 	void update_ground_heights(const QRect& area);
 	void update_ground_textures(const QRect& area);
@@ -203,10 +214,20 @@ signals:
 class TerrainGenericAction : public TerrainUndoAction {
 public:
 	QRect area;
-	std::vector<Corner> old_corners;
-	std::vector<Corner> new_corners;
+	/// The corners of the area row by row. The new corners are stored as their difference to the old ones
+	UndoBlob old_corners;
+	UndoBlob new_corners;
 	Terrain::undo_type undo_type;
 
 	void undo() override;
 	void redo() override;
+
+	size_t memory_usage() const override {
+		return old_corners.memory_usage() + new_corners.memory_usage();
+	}
+
+	void spill(const std::shared_ptr<UndoSpillFile>& file) override {
+		old_corners.spill(file);
+		new_corners.spill(file);
+	}
 };
\ No newline at end of file
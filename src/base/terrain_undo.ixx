@@ -2,30 +2,220 @@ module;
 
 #include <vector>
 #include <memory>
+#include <span>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <print>
+
+#include <QByteArray>
+#include <QTemporaryFile>
+#include <QDir>
 
 export module TerrainUndo;
 
+/// An append only temporary file that the undo history spills its oldest data to once it exceeds its memory budget.
+/// The file is truncated when all data in it has been released and removed when it is destroyed
+export class UndoSpillFile {
+  public:
+	struct Range {
+		uint64_t offset = 0;
+		uint64_t size = 0;
+	};
+
+	UndoSpillFile() {
+		file.setFileTemplate(QDir::tempPath() + "/HiveWE_undo_XXXXXX.bin");
+		if (!file.open()) {
+			throw std::runtime_error("Could not create the undo spill file in " + QDir::tempPath().toStdString());
+		}
+	}
+
+	Range write(const QByteArray& data) {
+		file.seek(end);
+		if (file.write(data) != data.size()) {
+			throw std::runtime_error("Could not write to the undo spill file");
+		}
+
+		const Range range = { end, static_cast<uint64_t>(data.size()) };
+		end += data.size();
+		live += data.size();
+		return range;
+	}
+
+	QByteArray read(const Range range) {
+		file.seek(range.offset);
+		QByteArray data = file.read(range.size);
+		if (static_cast<uint64_t>(data.size()) != range.size) {
+			throw std::runtime_error("Could not read from the undo spill file");
+		}
+		return data;
+	}
+
+	void release(const Range range) {
+		live -= range.size;
+		if (live == 0) {
+			file.resize(0);
+			end = 0;
+		}
+	}
+
+	/// The bytes of data in the file that have not been released
+	uint64_t size() const {
+		return live;
+	}
+
+  private:
+	QTemporaryFile file;
+	uint64_t end = 0;
+	uint64_t live = 0;
+};
+
+/// A block of undo data kept compressed with zlib, in memory or, after spill(), in an UndoSpillFile.
+/// When a base of the same size is given only the difference to it is stored, which for the before/after copies of an edit is mostly zeros and compresses very well
+export class UndoBlob {
+  public:
+	UndoBlob() = default;
+
+	template <typename T>
+		requires std::is_trivially_copyable_v<T>
+	explicit UndoBlob(std::span<const T> data, std::type_identity_t<std::span<const T>> base = {})
+		: size(data.size_bytes()) {
+		if (base.size() != data.size()) {
+			compressed = qCompress(reinterpret_cast<const uchar*>(data.data()), data.size_bytes(), compression_level);
+			return;
+		}
+
+		QByteArray difference(data.size_bytes(), Qt::Uninitialized);
+		const auto* a = reinterpret_cast<const uint8_t*>(data.data());
+		const auto* b = reinterpret_cast<const uint8_t*>(base.data());
+		for (size_t i = 0; i < data.size_bytes(); i++) {
+			difference[i] = static_cast<char>(a[i] ^ b[i]);
+		}
+		compressed = qCompress(difference, compression_level);
+	}
+
+	UndoBlob(UndoBlob&& other) noexcept {
+		*this = std::move(other);
+	}
+
+	UndoBlob& operator=(UndoBlob&& other) noexcept {
+		release();
+		compressed = std::move(other.compressed);
+		file = std::move(other.file);
+		range = other.range;
+		size = other.size;
+		other.file.reset();
+		return *this;
+	}
+
+	~UndoBlob() {
+		release();
+	}
+
+	/// Restores the data. base has to be the base the blob was created with
+	template <typename T>
+		requires std::is_trivially_copyable_v<T>
+	std::vector<T> unpack(std::span<const T> base = {}) const {
+		const QByteArray data = qUncompress(file ? file->read(range) : compressed);
+		if (static_cast<size_t>(data.size()) != size) {
+			throw std::runtime_error("Corrupt undo data");
+		}
+
+		std::vector<T> result(size / sizeof(T));
+		std::memcpy(result.data(), data.data(), size);
+		if (base.size_bytes() == size) {
+			auto* a = reinterpret_cast<uint8_t*>(result.data());
+			const auto* b = reinterpret_cast<const uint8_t*>(base.data());
+			for (size_t i = 0; i < size; i++) {
+				a[i] ^= b[i];
+			}
+		}
+		return result;
+	}
+
+	/// Moves the compressed data to the spill file
+	void spill(const std::shared_ptr<UndoSpillFile>& spill_file) {
+		if (file) {
+			return;
+		}
+		range = spill_file->write(compressed);
+		file = spill_file;
+		compressed = QByteArray();
+	}
+
+	size_t memory_usage() const {
+		return compressed.size();
+	}
+
+	size_t disk_usage() const {
+		return file ? range.size : 0;
+	}
+
+  private:
+	/// Favour speed, a brush stroke should not stall on compressing its undo data
+	static constexpr int compression_level = 1;
+
+	QByteArray compressed;
+	std::shared_ptr<UndoSpillFile> file;
+	UndoSpillFile::Range range;
+	/// The uncompressed size in bytes
+	size_t size = 0;
+
+	void release() {
+		if (file) {
+			file->release(range);
+			file.reset();
+		}
+	}
+};
+
 export class TerrainUndoAction {
   public:
 	virtual void undo() = 0;
 	virtual void redo() = 0;
 
+	/// The bytes the action keeps in memory. Used to keep the undo history within its memory budget
+	virtual size_t memory_usage() const {
+		return 0;
+	}
+
+	/// Moves the data of the action to the spill file. Actions whose data can not be written to disk keep it in memory
+	virtual void spill(const std::shared_ptr<UndoSpillFile>& file) {
+	}
+
 	virtual ~TerrainUndoAction() {
 	}
 };
 
 export class TerrainUndo {
-	std::vector<std::vector<std::unique_ptr<TerrainUndoAction>>> undo_actions;
-	std::vector<std::vector<std::unique_ptr<TerrainUndoAction>>> redo_actions;
+	struct Group {
+		std::vector<std::unique_ptr<TerrainUndoAction>> actions;
+		/// The memory_usage() of all actions
+		size_t memory = 0;
+		bool spilled = false;
+	};
+
+	std::vector<Group> undo_actions;
+	std::vector<Group> redo_actions;
+
+	/// The memory of all groups
+	size_t memory = 0;
+	/// Created when the history first exceeds its budget
+	std::shared_ptr<UndoSpillFile> spill_file;
 
   public:
+	/// The bytes the undo history may keep in memory. Beyond that the data of the oldest groups is spilled to a temporary file
+	size_t memory_budget = 256 * 1024 * 1024;
+
 	void undo() {
 		if (undo_actions.empty()) {
 			return;
 		}
 
 		auto& actions = undo_actions.back();
-		for (const auto& i : actions) {
+		for (const auto& i : actions.actions) {
 			i->undo();
 		}
 
@@ -39,7 +229,7 @@ export class TerrainUndo {
 		}
 
 		auto& actions = redo_actions.back();
-		for (const auto& i : actions) {
+		for (const auto& i : actions.actions) {
 			i->redo();
 		}
 
@@ -56,10 +246,66 @@ export class TerrainUndo {
 			return;
 		}
 
-		undo_actions.back().push_back(std::move(action));
+		Group& group = undo_actions.back();
+		const size_t action_memory = action->memory_usage();
+		group.actions.push_back(std::move(action));
+		group.memory += action_memory;
+		group.spilled = false;
+		memory += action_memory;
+
+		for (const auto& i : redo_actions) {
+			memory -= i.memory;
+		}
 		redo_actions.clear();
+
+		enforce_budget();
 	};
-};
 
+	/// The bytes the undo history keeps in memory
+	size_t memory_usage() const {
+		return memory;
+	}
+
+	/// The bytes the undo history has spilled to disk
+	size_t disk_usage() const {
+		return spill_file ? spill_file->size() : 0;
+	}
+
+  private:
+	/// Spills the oldest groups, the bottom of the undo stack first, until the history fits in its budget
+	void enforce_budget() {
+		for (auto& group : undo_actions) {
+			if (memory <= memory_budget) {
+				return;
+			}
+			spill(group);
+		}
+	}
+
+	void spill(Group& group) {
+		if (group.spilled) {
+			return;
+		}
 
+		// Without a spill file the history just stays in memory
+		try {
+			if (!spill_file) {
+				spill_file = std::make_shared<UndoSpillFile>();
+			}
 
+			for (const auto& action : group.actions) {
+				action->spill(spill_file);
+			}
+		} catch (const std::exception& e) {
+			std::print("Spilling undo history failed: {}\n", e.what());
+		}
+
+		size_t remaining = 0;
+		for (const auto& action : group.actions) {
+			remaining += action->memory_usage();
+		}
+		memory -= group.memory - remaining;
+		group.memory = remaining;
+		group.spilled = true;
+	}
+};
@@ -3,6 +3,7 @@ module;
 #include <map>
 #include <string>
 #include <sstream>
+#include <string_view>
 #include <iostream>
 
 export module TriggerStrings;
@@ -21,7 +22,7 @@ export class TriggerStrings {
 		BinaryReader reader = hierarchy.map_file_read("war3map.wts");
 
 		std::stringstream file;
-		file << reader.buffer.data();
+		file << std::string_view(reinterpret_cast<const char*>(reader.bytes.data()), reader.bytes.size());
 
 		std::string key;
 		std::string line;
@@ -1,8 +1,11 @@
 ﻿#include "units.h"
 
 
+#include <functional>
 #include <filesystem>
 #include <iostream>
+#include <unordered_set>
+#include <optional>
 using namespace std::literals::string_literals;
 namespace fs = std::filesystem;
 
@@ -14,6 +17,39 @@ namespace fs = std::filesystem;
 
 import BinaryWriter;
 import Hierarchy;
+import ResourceManager;
+import Camera;
+import RenderManager;
+import MathOperations;
+
+/// The transformed extent of the current sequence, the same box the frustum tests use. Starting locations have no mesh
+static SpatialGrid::Bounds grid_bounds(const Unit& unit) {
+	if (!unit.mesh || unit.skeleton.sequence_index < 0 || static_cast<size_t>(unit.skeleton.sequence_index) >= unit.mesh->model->sequences.size()) {
+		return { glm::vec2(unit.position), unit.position, unit.position };
+	}
+
+	const auto& extent = unit.mesh->model->sequences[unit.skeleton.sequence_index].extent;
+	SpatialGrid::Bounds bounds = { glm::vec2(unit.position) };
+	transform_box(unit.skeleton.matrix, extent.minimum, extent.maximum, bounds.minimum, bounds.maximum);
+	return bounds;
+}
+
+size_t Unit::memory_usage() const {
+	size_t total = sizeof(Unit) + string_memory(id) + string_memory(skin_id) + skeleton.memory_usage();
+	total += item_sets.capacity() * sizeof(ItemSet);
+	for (const auto& i : item_sets) {
+		total += i.memory_usage();
+	}
+	total += items.capacity() * sizeof(std::pair<uint32_t, std::string>);
+	for (const auto& [slot, item_id] : items) {
+		total += string_memory(item_id);
+	}
+	total += abilities.capacity() * sizeof(std::tuple<std::string, uint32_t, uint32_t>);
+	for (const auto& [ability_id, autocast, ability_level] : abilities) {
+		total += string_memory(ability_id);
+	}
+	return total + random.capacity();
+}
 
 void Unit::update() {
 	const float model_scale = units_slk.data<float>("modelscale", id);
@@ -27,6 +63,8 @@ void Unit::update() {
 	color.r = units_slk.data<float>("red", id) / 255.f;
 	color.g = units_slk.data<float>("green", id) / 255.f;
 	color.b = units_slk.data<float>("blue", id) / 255.f;
+
+	map->units.update_spatial_grid(*this);
 }
 
 void Units::load() {
@@ -47,6 +85,9 @@ void Units::load() {
 		std::cout << "Unknown war3mapUnits.doo subversion: " << subversion << " Attempting to load but may crash\nPlease send this map to eejin\n";
 	}
 
+	units.clear();
+	creation_number_to_handle.clear();
+
 	const int unit_count = reader.read<uint32_t>();
 	for (int k = 0; k < unit_count; k++) {
 		Unit i;
@@ -129,14 +170,14 @@ void Units::load() {
 		i.waygate = reader.read<uint32_t>();
 		i.creation_number = reader.read<uint32_t>();
 
+		Unit::auto_increment = std::max(Unit::auto_increment, i.creation_number);
+
 		// Either a unit or an item
 		if (units_slk.row_headers.contains(i.id) || i.id == "sloc" || i.id == "uDNR" || i.id == "bDNR") {
-			units.push_back(i);
+			add_unit(std::move(i));
 		} else {
-			items.push_back(i);
+			items.push_back(std::move(i));
 		}
-
-		Unit::auto_increment = std::max(Unit::auto_increment, i.creation_number);
 	}
 }
 
@@ -149,7 +190,7 @@ void Units::save() const {
 
 	writer.write<uint32_t>(units.size() + items.size());
 
-	auto write_units = [&](const std::vector<Unit>& to_write) {
+	auto write_units = [&](const auto& to_write) {
 		for (auto&& i : to_write) {
 			writer.write_string(i.id);
 			writer.write<uint32_t>(i.variation);
@@ -217,13 +258,37 @@ void Units::save() const {
 }
 
 void Units::update_area(const QRect& area) {
-	for (auto&& i : query_area(area)) {
+	for (const auto& handle : query_area(area)) {
+		Unit* i = units.get(handle);
 		i->position.z = map->terrain.interpolated_height(i->position.x, i->position.y);
 		i->update();
 	}
 }
 
 void Units::create() {
+	// Load all the meshes in parallel first
+	std::vector<std::pair<std::string, ResourceFuture<SkinnedMesh>>> meshes;
+	std::unordered_set<std::string> requested;
+
+	const auto request = [&](const std::string& id) {
+		if (!id_to_mesh.contains(id) && requested.insert(id).second) {
+			meshes.emplace_back(id, resource_manager.load_async<SkinnedMesh>(mesh_path(id), "", std::optional<std::pair<int, std::string>>()));
+		}
+	};
+
+	for (const auto& i : units) {
+		if (i.id != "sloc") {
+			request(i.id);
+		}
+	}
+	for (const auto& i : items) {
+		request(i.id);
+	}
+
+	for (auto& [id, mesh] : meshes) {
+		id_to_mesh.emplace(id, mesh.get());
+	}
+
 	for (auto& i : units) {
 		// ToDo handle starting location
 		if (i.id == "sloc") {
@@ -245,13 +310,10 @@ void Units::create() {
 }
 
 void Units::render() {
-	for (auto& i : units) {
-		if (i.id == "sloc") {
-			continue;
-		} // ToDo handle starting locations
-
+	for (const uint32_t index : visible_units()) {
+		const Unit& i = units[index];
 		//i.mesh->render_queue(i.skeleton, i.color);
-		map->render_manager.render_queue(*i.mesh, i.skeleton, glm::vec3(1.f));
+		map->render_manager.render_queue_visible(*i.mesh, i.skeleton, glm::vec3(1.f), RenderManager::unit_pick_id(index));
 	}
 	for (auto& i : items) {
 		//i.mesh->render_queue(i.skeleton, i.color);
@@ -261,9 +323,7 @@ void Units::render() {
 
 // Will assign a unique creation number
 Unit& Units::add_unit(std::string id, glm::vec3 position) {
-	// ToDo change this once SkeletalModelInstance doesn't use pointers anymore
-	units.push_back(Unit());
-	Unit& unit = units.back();
+	Unit unit;
 	unit.id = id;
 	unit.skin_id = id;
 	unit.mesh = get_mesh(id);
@@ -275,33 +335,50 @@ Unit& Units::add_unit(std::string id, glm::vec3 position) {
 	unit.skeleton = SkeletalModelInstance(unit.mesh->model);
 	unit.update();
 
-	return units.back();
+	return add_unit(std::move(unit));
 }
 
-// Assumes you will set a unique creation number yourself
+// Assumes you have set a unique creation number yourself before adding
 Unit& Units::add_unit(Unit unit) {
-	units.push_back(unit);
-	return units.back();
+	const int creation_number = unit.creation_number;
+	const UnitHandle handle = units.insert(std::move(unit));
+	creation_number_to_handle[creation_number] = handle;
+	invalidate_spatial_grid();
+	return *units.get(handle);
 }
 
-void Units::remove_unit(Unit* unit) {
-	auto iterator = units.begin() + std::distance(units.data(), unit);
-	units.erase(iterator);
+void Units::remove_unit(UnitHandle unit) {
+	const Unit* target = units.get(unit);
+	if (!target) {
+		return;
+	}
+	creation_number_to_handle.erase(target->creation_number);
+	units.erase(unit);
+	invalidate_spatial_grid();
 }
 
-std::vector<Unit*> Units::query_area(const QRectF& area) {
-	std::vector<Unit*> result;
+UnitHandle Units::find(int creation_number) const {
+	const auto found = creation_number_to_handle.find(creation_number);
+	return found != creation_number_to_handle.end() ? found->second : UnitHandle();
+}
 
-	for (auto& i : units) {
-		if (area.contains(i.position.x, i.position.y) && i.id != "sloc") {
-			result.push_back(&i);
+std::vector<UnitHandle> Units::query_area(const QRectF& area) {
+	std::vector<UnitHandle> result;
+
+	const QRectF bounds = area.normalized();
+	spatial_grid().query_area({ bounds.left(), bounds.top() }, { bounds.right(), bounds.bottom() }, [&](const uint32_t index) {
+		const Unit& unit = units[index];
+		if (area.contains(unit.position.x, unit.position.y) && unit.id != "sloc") {
+			result.push_back(units.handle(index));
 		}
-	}
+	});
 	return result;
 }
 
-void Units::remove_units(const std::vector<Unit*>& list) {
-	std::erase_if(units, [&](Unit& unit) { return std::find(list.begin(), list.end(), &unit) != list.end(); });
+void Units::remove_units(const std::vector<UnitHandle>& list) {
+	for (const auto& i : list) {
+		remove_unit(i);
+	}
 }
 
 void Units::process_field_change(const std::string& id, const std::string& field) {
@@ -329,6 +406,80 @@ std::shared_ptr<SkinnedMesh> Units::get_mesh(const std::string& id) {
 		return id_to_mesh[id];
 	}
 
+	id_to_mesh.emplace(id, resource_manager.load<SkinnedMesh>(mesh_path(id), "", std::nullopt));
+
+	return id_to_mesh[id];
+}
+
+const SpatialGrid& Units::spatial_grid() {
+	if (grid.is_dirty()) {
+		grid.build(map->terrain.width, map->terrain.height, units.size(), [&](const size_t i) {
+			return grid_bounds(units[i]);
+		});
+	}
+	return grid;
+}
+
+std::optional<size_t> Units::pick(const Ray& ray) {
+	return ray_pick(spatial_grid(), ray, [&](const uint32_t i) { return grid_bounds(units[i]); }, [&](const uint32_t i) -> std::optional<float> {
+		const Unit& unit = units[i];
+		if (unit.id == "sloc" || !unit.mesh) {
+			return std::nullopt;
+		} // ToDo handle starting locations
+		return unit.mesh->intersect(ray, unit.skeleton);
+	});
+}
+
+void Units::invalidate_spatial_grid() {
+	grid.invalidate();
+	visible_dirty = true;
+}
+
+void Units::cull() {
+	visible.clear();
+	spatial_grid().cull(
+		[](const glm::vec3& minimum, const glm::vec3& maximum) {
+			return camera.frustum_visibility(minimum, maximum);
+		},
+		[&](const SpatialGrid::Cell& cell, const bool fully_inside) {
+			for (const uint32_t index : cell.items) {
+				const Unit& unit = units[index];
+				if (unit.id == "sloc") {
+					continue;
+				} // ToDo handle starting locations
+
+				if (fully_inside) {
+					visible.push_back(index);
+					continue;
+				}
+
+				const SpatialGrid::Bounds bounds = grid_bounds(unit);
+				if (camera.inside_frustrum(bounds.minimum, bounds.maximum)) {
+					visible.push_back(index);
+				}
+			}
+		});
+	visible_dirty = false;
+}
+
+const std::vector<uint32_t>& Units::visible_units() {
+	if (visible_dirty) {
+		cull();
+	}
+	return visible;
+}
+
+void Units::update_spatial_grid(const Unit& unit) {
+	// Items and copies of units (e.g. in undo actions) are not part of the grid
+	// Comparing pointers into different arrays with < is unspecified, std::less gives them a total order
+	const std::less<const Unit*> before;
+	if (units.empty() || before(&unit, units.data()) || !before(&unit, units.data() + units.size())) {
+		return;
+	}
+	grid.move(static_cast<uint32_t>(&unit - units.data()), grid_bounds(unit));
+}
+
+fs::path Units::mesh_path(const std::string& id) const {
 	fs::path mesh_path = units_slk.data("file", id);
 	if (mesh_path.empty()) {
 		mesh_path = items_slk.data("file", id);
@@ -340,21 +491,21 @@ std::shared_ptr<SkinnedMesh> Units::get_mesh(const std::string& id) {
 	// Mesh doesnt exist at all
 	if (!hierarchy.file_exists(mesh_path)) {
 		std::cout << "Invalid model file for " << id << " With file path: " << mesh_path << "\n";
-		id_to_mesh.emplace(id, resource_manager.load<SkinnedMesh>("Objects/Invalidmodel/Invalidmodel.mdx", "", std::nullopt));
-		return id_to_mesh[id];
+		return "Objects/Invalidmodel/Invalidmodel.mdx";
 	}
-
-	id_to_mesh.emplace(id, resource_manager.load<SkinnedMesh>(mesh_path, "", std::nullopt));
-
-	return id_to_mesh[id];
+	return mesh_path;
 }
 
 void UnitAddAction::undo() {
-	map->units.units.resize(map->units.units.size() - units.size());
+	for (const auto& i : units) {
+		map->units.remove_unit(map->units.find(i.creation_number));
+	}
 }
 
 void UnitAddAction::redo() {
-	map->units.units.insert(map->units.units.end(), units.begin(), units.end());
+	for (const auto& i : units) {
+		map->units.add_unit(i);
+	}
 }
 
 void UnitDeleteAction::undo() {
@@ -362,7 +513,9 @@ void UnitDeleteAction::undo() {
 		map->brush->clear_selection();
 	}
 
-	map->units.units.insert(map->units.units.end(), units.begin(), units.end());
+	for (const auto& i : units) {
+		map->units.add_unit(i);
+	}
 }
 
 void UnitDeleteAction::redo() {
@@ -370,25 +523,25 @@ void UnitDeleteAction::redo() {
 		map->brush->clear_selection();
 	}
 
-	map->units.units.resize(map->units.units.size() - units.size());
+	for (const auto& i : units) {
+		map->units.remove_unit(map->units.find(i.creation_number));
+	}
 }
 
-void UnitStateAction::undo() {
-	for (auto& i : old_units) {
-		for (auto& j : map->units.units) {
-			if (i.creation_number == j.creation_number) {
-				j = i;
-			}
+/// Replaces the current state of the units with the given state, matched by creation number
+static void apply_unit_state(const std::vector<Unit>& state) {
+	for (const auto& i : state) {
+		if (Unit* j = map->units.units.get(map->units.find(i.creation_number))) {
+			*j = i;
+			map->units.update_spatial_grid(*j);
 		}
 	}
 }
 
-void UnitStateAction::redo() {
-	for (auto& i : new_units) {
-		for (auto& j : map->units.units) {
-			if (i.creation_number == j.creation_number) {
-				j = i;
-			}
-		}
-	}
+void UnitStateAction::undo() {
+	apply_unit_state(old_units);
 }
+
+void UnitStateAction::redo() {
+	apply_unit_state(new_units);
+}
\ No newline at end of file
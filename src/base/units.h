@@ -3,6 +3,7 @@
 #include <vector>
 #include <unordered_map>
 #include <memory>
+#include <optional>
 #include <string>
 #include <filesystem>
 
@@ -10,11 +11,16 @@
 
 #include <glm/glm.hpp>
 
+#include "unordered_dense.h"
+
 import BinaryReader;
 import Utilities;
 import SkinnedMesh;
 import SkeletalModelInstance;
 import TerrainUndo;
+import SpatialGrid;
+import SlotMap;
+import RayCast;
 
 struct Unit {
 	static inline int auto_increment;
@@ -68,19 +74,45 @@ struct Unit {
 	}
 
 	void update();
+	/// An estimate of the memory a copy of this unit takes, including what it owns but not the shared mesh
+	size_t memory_usage() const;
 };
 
+using UnitHandle = SlotHandle<Unit>;
+
+/// The memory_usage() of all units
+inline size_t memory_usage_of(const std::vector<Unit>& units) {
+	size_t total = 0;
+	for (const auto& i : units) {
+		total += i.memory_usage();
+	}
+	return total;
+}
+
 class Units : public QObject {
 	Q_OBJECT
 
 	std::unordered_map<std::string, std::shared_ptr<SkinnedMesh>> id_to_mesh;
 
+	/// The model file of the unit/item, or the invalid model if it does not exist
+	std::filesystem::path mesh_path(const std::string& id) const;
+
+	/// Buckets the units (not the items) on their tile position. Rebuilt lazily by spatial_grid() after units were added or removed
+	SpatialGrid grid;
+
+	/// Creation numbers are unique and survive undo/redo (which recreates units with new handles)
+	ankerl::unordered_dense::map<int, UnitHandle> creation_number_to_handle;
+
+	/// Indices of the units inside the view frustum as determined by the last cull()
+	std::vector<uint32_t> visible;
+	bool visible_dirty = true;
+
 	static constexpr int write_version = 8;
 	static constexpr int write_subversion = 11;
 
 	//static constexpr int mod_table_write_version = 2;
 public:
-	std::vector<Unit> units;
+	SlotMap<Unit> units;
 	std::vector<Unit> items;
 
 	void load();
@@ -89,17 +121,37 @@ public:
 	void create();
 	void render();
 
+	/// The returned reference is only valid until the next unit is added or removed
 	Unit& add_unit(std::string id, glm::vec3 position);
 	Unit& add_unit(Unit unit);
 
-	void remove_unit(Unit* unit);
+	void remove_unit(UnitHandle unit);
 
-	std::vector<Unit*> query_area(const QRectF& area);
-	void remove_units(const std::vector<Unit*>& list);
+	/// Returns a null handle if no unit with this creation number exists
+	UnitHandle find(int creation_number) const;
+
+	std::vector<UnitHandle> query_area(const QRectF& area);
+	void remove_units(const std::vector<UnitHandle>& list);
 
 	void process_field_change(const std::string& id, const std::string& field);
 
 	std::shared_ptr<SkinnedMesh> get_mesh(const std::string& id);
+
+	const SpatialGrid& spatial_grid();
+
+	/// Returns the index of the unit (not item) whose mesh the ray hits first in its current pose, using the spatial grid to find the candidates.
+	/// Runs entirely on the CPU, see ray_pick()
+	std::optional<size_t> pick(const Ray& ray);
+
+	/// Determines which units are inside the view frustum using the bounding volume hierarchy of the spatial grid.
+	/// Done once per frame so that animation, rendering and picking can share the result
+	void cull();
+	/// The result of the last cull(). Culls again if units were added or removed since
+	const std::vector<uint32_t>& visible_units();
+	/// Has to be called whenever units are added to or removed from the units vector
+	void invalidate_spatial_grid();
+	/// Moves the unit to its current cell. Called by Unit::update() so any unit that has been updated after moving is already up to date
+	void update_spatial_grid(const Unit& unit);
 };
 
 // Undo/redo structures
@@ -109,6 +161,10 @@ public:
 
 	void undo() override;
 	void redo() override;
+
+	size_t memory_usage() const override {
+		return memory_usage_of(units);
+	}
 };
 
 class UnitDeleteAction : public TerrainUndoAction {
@@ -117,6 +173,10 @@ public:
 
 	void undo() override;
 	void redo() override;
+
+	size_t memory_usage() const override {
+		return memory_usage_of(units);
+	}
 };
 
 class UnitStateAction : public TerrainUndoAction {
@@ -126,4 +186,8 @@ public:
 
 	void undo() override;
 	void redo() override;
+
+	size_t memory_usage() const override {
+		return memory_usage_of(old_units) + memory_usage_of(new_units);
+	}
 };
\ No newline at end of file
@@ -104,7 +104,7 @@ void DoodadBrush::key_press_event(QKeyEvent* event) {
 		bool up = event->key() == Qt::Key_1 || event->key() == Qt::Key_2 || event->key() == Qt::Key_3;
 
 		bool free_movement = true;
-		for (const auto& i : selections) {
+		for (Doodad* i : selected_doodads()) {
 			free_movement = free_movement && !i->pathing;
 		}
 
@@ -118,7 +118,7 @@ void DoodadBrush::key_press_event(QKeyEvent* event) {
 			y_displacement = -0.5f * up + 0.5f * down;
 		}
 
-		for (const auto& i : selections) {
+		for (Doodad* i : selected_doodads()) {
 			i->position.x += x_displacement;
 			i->position.y += y_displacement;
 			if (!lock_doodad_z) {
@@ -136,8 +136,8 @@ void DoodadBrush::key_press_event(QKeyEvent* event) {
 			case Qt::Key_A:
 				selections.clear();
 				selections.reserve(map->doodads.doodads.size());
-				for (auto& i : map->doodads.doodads) {
-					selections.emplace(&i);
+				for (size_t i = 0; i < map->doodads.doodads.size(); i++) {
+					selections.emplace(map->doodads.doodads.handle(i));
 				}
 
 				emit selection_changed();
@@ -146,7 +146,7 @@ void DoodadBrush::key_press_event(QKeyEvent* event) {
 				if (action == Action::none) {
 					start_action(Action::move);
 				}
-				for (const auto& i : selections) {
+				for (Doodad* i : selected_doodads()) {
 					i->position.z += 0.1f;
 					i->update();
 				}
@@ -156,7 +156,7 @@ void DoodadBrush::key_press_event(QKeyEvent* event) {
 				if (action == Action::none) {
 					start_action(Action::move);
 				}
-				for (const auto& i : selections) {
+				for (Doodad* i : selected_doodads()) {
 					i->position.z -= 0.1f;
 					i->update();
 				}
@@ -171,7 +171,7 @@ void DoodadBrush::key_press_event(QKeyEvent* event) {
 				if (action == Action::none) {
 					start_action(Action::move);
 				}
-				for (const auto& i : selections) {
+				for (Doodad* i : selected_doodads()) {
 					i->scale.z += 0.1f;
 					i->update();
 				}
@@ -181,7 +181,7 @@ void DoodadBrush::key_press_event(QKeyEvent* event) {
 				if (action == Action::none) {
 					start_action(Action::move);
 				}
-				for (const auto& i : selections) {
+				for (Doodad* i : selected_doodads()) {
 					i->scale.z -= 0.1f;
 					i->update();
 				}
@@ -208,33 +208,35 @@ void DoodadBrush::mouse_press_event(QMouseEvent* event, double frame_delta) {
 	if (event->button() == Qt::LeftButton && input_handler.mouse.y > 0.f) {
 		if (mode == Mode::selection) {
 			if (event->modifiers() & Qt::KeyboardModifier::ShiftModifier) {
-				auto id = map->render_manager.pick_doodad_id_under_mouse(map->doodads, input_handler.mouse);
+				auto id = map->doodad_under_mouse();
 				if (id) {
-					if (selections.contains(&map->doodads.doodads[id.value()])) {
-						selections.erase(&map->doodads.doodads[id.value()]);
+					const DoodadHandle handle = map->doodads.doodads.handle(id.value());
+					if (selections.contains(handle)) {
+						selections.erase(handle);
 					} else {
-						selections.emplace(&map->doodads.doodads[id.value()]);
+						selections.emplace(handle);
 					}
 					return;
 				}
 			}
 
 			if (!event->modifiers()) {
-				auto id = map->render_manager.pick_doodad_id_under_mouse(map->doodads, input_handler.mouse);
+				auto id = map->doodad_under_mouse();
 				if (id) {
-					Doodad& doodad = map->doodads.doodads[id.value()];
+					const DoodadHandle handle = map->doodads.doodads.handle(id.value());
+					const Doodad& doodad = map->doodads.doodads[id.value()];
 
 					drag_start = input_handler.mouse_world;
 					dragging = true;
 
 					// If the current index is already in a selection then we want to drag the entire group
-					if (std::find(selections.begin(), selections.end(), &doodad) != selections.end()) {
+					if (selections.contains(handle)) {
 						drag_offsets.clear();
-						for (const auto& i : selections) {
+						for (Doodad* i : selected_doodads()) {
 							drag_offsets.push_back(input_handler.mouse_world - i->position);
 						}
 					} else {
-						selections = { &doodad };
+						selections = { handle };
 						drag_offsets = { input_handler.mouse_world - doodad.position };
 						emit selection_changed();
 					}
@@ -257,7 +259,7 @@ void DoodadBrush::mouse_move_event(QMouseEvent* event, double frame_delta) {
 				}
 
 				bool free_movement = true;
-				for (const auto& i : selections) {
+				for (Doodad* i : selected_doodads()) {
 					free_movement = free_movement && !i->pathing;
 				}
 
@@ -275,7 +277,7 @@ void DoodadBrush::mouse_move_event(QMouseEvent* event, double frame_delta) {
 				}
 				drag_start = input_handler.mouse_world;
 
-				for (const auto& doodad : selections) {
+				for (Doodad* doodad : selected_doodads()) {
 					doodad->position += offset;
 					if (!lock_doodad_z) {
 						doodad->position.z = map->terrain.interpolated_height(doodad->position.x, doodad->position.y);
@@ -289,7 +291,7 @@ void DoodadBrush::mouse_move_event(QMouseEvent* event, double frame_delta) {
 					start_action(Action::rotate);
 				}
 
-				for (auto&& i : selections) {
+				for (Doodad* i : selected_doodads()) {
 					float target_rotation = std::atan2(input_handler.mouse_world.y - i->position.y, input_handler.mouse_world.x - i->position.x);
 					if (target_rotation < 0) {
 						target_rotation += 2.f * glm::pi<float>();
@@ -342,7 +344,7 @@ void DoodadBrush::delete_selection() {
 	QRectF update_pathing_area;
 	// Undo/redo
 	auto action = std::make_unique<DoodadDeleteAction>();
-	for (const auto& i : selections) {
+	for (Doodad* i : selected_doodads()) {
 		action->doodads.push_back(*i);
 
 		if (update_pathing_area.width() == 0 || update_pathing_area.height() == 0) {
@@ -366,7 +368,7 @@ void DoodadBrush::copy_selection() {
 	// Mouse position is average location
 	clipboard_free_placement = true;
 	glm::vec3 average_position = {};
-	for (const auto& i : selections) {
+	for (Doodad* i : selected_doodads()) {
 		if (i->pathing) {
 			clipboard_free_placement = false;
 		}
@@ -390,7 +392,7 @@ void DoodadBrush::clear_selection() {
 void DoodadBrush::place_clipboard() {
 	apply_begin();
 	for (const auto& i : clipboard) {
-		Doodad& new_doodad = map->doodads.add_doodad(i);
+		Doodad new_doodad = i;
 		new_doodad.creation_number = ++Doodad::auto_increment;
 		glm::vec3 final_position;
 		if (clipboard_free_placement) {
@@ -409,8 +411,8 @@ void DoodadBrush::place_clipboard() {
 		if (new_doodad.pathing) {
 			map->pathing_map.blit_pathing_texture(new_doodad.position, glm::degrees(rotation) + 90, new_doodad.pathing);
 		}
+		map->doodads.add_doodad(std::move(new_doodad));
 	}
-	map->pathing_map.upload_dynamic_pathing();
 	apply_end();
 }
 
@@ -440,7 +442,6 @@ void DoodadBrush::apply(double frame_delta) {
 
 	if (pathing_texture) {
 		map->pathing_map.blit_pathing_texture(doodad_position, glm::degrees(rotation) + 90, pathing_texture);
-		map->pathing_map.upload_dynamic_pathing();
 	}
 
 	if (random_rotation) {
@@ -502,7 +503,7 @@ void DoodadBrush::render_selection() const {
 	selection_circle_shader->use();
 	glEnableVertexAttribArray(0);
 
-	for (const auto& i : selections) {
+	for (Doodad* i : selected_doodads()) {
 		float selection_scale = 1.f;
 		if (i->mesh->model->sequences.empty()) {
 			selection_scale = i->mesh->model->extent.bounds_radius / 128.f;
@@ -664,17 +665,28 @@ void DoodadBrush::set_doodad(const std::string& id) {
 	set_random_variation();
 }
 
+std::vector<Doodad*> DoodadBrush::selected_doodads() const {
+	std::vector<Doodad*> result;
+	result.reserve(selections.size());
+	for (const auto& i : selections) {
+		if (Doodad* doodad = map->doodads.doodads.get(i)) {
+			result.push_back(doodad);
+		}
+	}
+	return result;
+}
+
 void DoodadBrush::start_action(Action new_action) {
 	action = new_action;
 	map->terrain_undo.new_undo_group();
 	doodad_state_undo = std::make_unique<DoodadStateAction>();
-	for (const auto& i : selections) {
+	for (Doodad* i : selected_doodads()) {
 		doodad_state_undo->old_doodads.push_back(*i);
 	}
 }
 
 void DoodadBrush::end_action() {
-	for (const auto& i : selections) {
+	for (Doodad* i : selected_doodads()) {
 		doodad_state_undo->new_doodads.push_back(*i);
 	}
 	map->terrain_undo.add_undo_action(std::move(doodad_state_undo));
@@ -683,7 +695,7 @@ void DoodadBrush::end_action() {
 
 void DoodadBrush::set_selection_angle(float angle) {
 	start_action(Action::rotate);
-	for (auto& i : selections) {
+	for (Doodad* i : selected_doodads()) {
 		i->angle = Doodad::acceptable_angle(i->id, i->pathing, i->angle, angle);
 		i->update();
 	}
@@ -692,7 +704,7 @@ void DoodadBrush::set_selection_angle(float angle) {
 
 void DoodadBrush::set_selection_absolute_height(float height) {
 	start_action(Action::move);
-	for (auto& i : selections) {
+	for (Doodad* i : selected_doodads()) {
 		i->position.z = height;
 		i->update();
 	}
@@ -701,7 +713,7 @@ void DoodadBrush::set_selection_absolute_height(float height) {
 
 void DoodadBrush::set_selection_relative_height(float height) {
 	start_action(Action::move);
-	for (auto& i : selections) {
+	for (Doodad* i : selected_doodads()) {
 		i->position.z = map->terrain.interpolated_height(i->position.x, i->position.y) + height;
 		i->update();
 	}
@@ -710,7 +722,7 @@ void DoodadBrush::set_selection_relative_height(float height) {
 
 void DoodadBrush::set_selection_scale_component(int component, float scale) {
 	start_action(Action::scale);
-	for (auto& i : selections) {
+	for (Doodad* i : selected_doodads()) {
 		bool is_doodad = doodads_slk.row_headers.contains(i->id);
 		slk::SLK& slk = is_doodad ? doodads_slk : destructibles_slk;
 
@@ -45,8 +45,7 @@ public:
 	std::unique_ptr<DoodadAddAction> doodad_undo;
 	std::unique_ptr<DoodadStateAction> doodad_state_undo;
 
-	//std::vector<Doodad*> selections;
-	std::unordered_set<Doodad*> selections;
+	std::unordered_set<DoodadHandle> selections;
 
 	glm::vec2 clipboard_mouse_offset;
 	std::vector<Doodad> clipboard;
@@ -99,6 +98,9 @@ public:
 
 	void set_doodad(const std::string& id);
 
+	/// The selected doodads that still exist. The pointers are only valid until doodads are added or removed
+	std::vector<Doodad*> selected_doodads() const;
+
 	void start_action(Action new_action);
 	void end_action();
 
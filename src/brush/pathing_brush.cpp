@@ -34,6 +34,8 @@ void PathingBrush::apply(double frame_delta) {
 		return;
 	}
 
+	map->pathing_map.preserve(area);
+
 	const int offset = area.y() * map->pathing_map.width + area.x();
 
 	for (int i = 0; i < area.width(); i++) {
@@ -60,7 +62,7 @@ void PathingBrush::apply(double frame_delta) {
 
 	applied_area = applied_area.united(area);
 
-	map->pathing_map.upload_static_pathing();
+	map->pathing_map.dirty_static.add(area);
 }
 
 void PathingBrush::apply_end() {
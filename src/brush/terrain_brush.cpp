@@ -23,10 +23,11 @@ void TerrainBrush::check_nearby(const int begx, const int begy, const int i, con
 				continue;
 			}
 
-			int difference = map->terrain.corners[i][j].layer_height - map->terrain.corners[k][l].layer_height;
+			int difference = map->terrain.corners(i, j).layer_height - map->terrain.corners(k, l).layer_height;
 			if (std::abs(difference) > 2 && !contains(begx + (k - i), begy + (l - k))) {
-				map->terrain.corners[k][l].layer_height = map->terrain.corners[i][j].layer_height - std::clamp(difference, -2, 2);
-				map->terrain.corners[k][l].ramp = false;
+				map->terrain.preserve_corners(QRect(k, l, 1, 1));
+				map->terrain.corners(k, l).layer_height = map->terrain.corners(i, j).layer_height - std::clamp(difference, -2, 2);
+				map->terrain.corners(k, l).ramp = false;
 
 				area.setX(std::min(area.x(), k - 1));
 				area.setY(std::min(area.y(), l - 1));
@@ -58,16 +59,16 @@ void TerrainBrush::apply_begin() {
 	cliff_area = area;
 
 	if (apply_height) {
-		deformation_height = corners[center_x][center_y].height;
+		deformation_height = corners(center_x, center_y).height;
 	}
 
 	if (apply_cliff) {
-		layer_height = corners[center_x][center_y].layer_height;
+		layer_height = corners(center_x, center_y).layer_height;
 		switch (cliff_operation_type) {
 			case cliff_operation::shallow_water:
-				if (!corners[center_x][center_y].water) {
+				if (!corners(center_x, center_y).water) {
 					layer_height -= 1;
-				} else if (corners[center_x][center_y].final_water_height() > corners[center_x][center_y].final_ground_height() + 1) {
+				} else if (corners(center_x, center_y).final_water_height() > corners(center_x, center_y).final_ground_height() + 1) {
 					layer_height += 1;
 				}
 				break;
@@ -78,9 +79,9 @@ void TerrainBrush::apply_begin() {
 				layer_height -= 2;
 				break;
 			case cliff_operation::deep_water:
-				if (!corners[center_x][center_y].water) {
+				if (!corners(center_x, center_y).water) {
 					layer_height -= 2;
-				} else if (corners[center_x][center_y].final_water_height() < corners[center_x][center_y].final_ground_height() + 1) {
+				} else if (corners(center_x, center_y).final_water_height() < corners(center_x, center_y).final_ground_height() + 1) {
 					layer_height -= 1;
 				}
 				break;
@@ -115,10 +116,11 @@ void TerrainBrush::apply(double frame_delta) {
 
 	if (apply_texture) {
 		const int id = map->terrain.ground_texture_to_id[tile_id];
+		map->terrain.preserve_corners(area);
 
 		// Update textures
-		for (int i = area.x(); i < area.x() + area.width(); i++) {
-			for (int j = area.y(); j < area.y() + area.height(); j++) {
+		for (int j = area.y(); j < area.y() + area.height(); j++) {
+			for (int i = area.x(); i < area.x() + area.width(); i++) {
 				if (!contains(i - area.x() - std::min(position.x + 1, 0), j - area.y() - std::min(position.y + 1, 0))) {
 					continue;
 				}
@@ -126,8 +128,8 @@ void TerrainBrush::apply(double frame_delta) {
 				bool cliff_near = false;
 				for (int k = -1; k < 1 && !cliff_near; k++) {
 					for (int l = -1; l < 1 && !cliff_near; l++) {
-						if (i + k >= 0 && i + k <= width && j + l >= 0 && j + l <= height) {
-							cliff_near = corners[i + k][j + l].cliff;
+						if (i + k >= 0 && i + k < width && j + l >= 0 && j + l < height) {
+							cliff_near = corners(i + k, j + l).cliff;
 						}
 					}
 				}
@@ -138,11 +140,11 @@ void TerrainBrush::apply(double frame_delta) {
 						continue;
 					}
 
-					corners[i][j].blight = true;
+					corners(i, j).blight = true;
 				} else {
-					corners[i][j].blight = false;
-					corners[i][j].ground_texture = id;
-					corners[i][j].ground_variation = get_random_variation();
+					corners(i, j).blight = false;
+					corners(i, j).ground_texture = id;
+					corners(i, j).ground_variation = get_random_variation();
 				}
 			}
 		}
@@ -152,11 +154,12 @@ void TerrainBrush::apply(double frame_delta) {
 	}
 
 	if (apply_height) {
+		map->terrain.preserve_corners(area);
 		std::vector<std::vector<float>> heights(area.width(), std::vector<float>(area.height()));
 
 		for (int i = area.x(); i < area.x() + area.width(); i++) {
 			for (int j = area.y(); j < area.y() + area.height(); j++) {
-				float new_height = corners[i][j].height;
+				float new_height = corners(i, j).height;
 				heights[i - area.x()][j - area.y()] = new_height;
 
 				if (!contains(i - area.x() - std::min(position.x + 1, 0), j - area.y() - std::min(position.y + 1, 0))) {
@@ -194,7 +197,7 @@ void TerrainBrush::apply(double frame_delta) {
 									k - area.x() >= 0 && l - area.y() >= 0 && k < area.right() + 1 && l < area.bottom() + 1) {
 									accumulate += heights[k - area.x()][l - area.y()];
 								} else {
-									accumulate += corners[k][l].height;
+									accumulate += corners(k, l).height;
 								}
 							}
 						}
@@ -204,7 +207,7 @@ void TerrainBrush::apply(double frame_delta) {
 					}
 				}
 
-				corners[i][j].height = std::clamp(new_height, -16.f, 15.98f); // ToDo why 15.98?
+				corners(i, j).height = std::clamp(new_height, -16.f, 15.98f); // ToDo why 15.98?
 			}
 		}
 
@@ -223,12 +226,12 @@ void TerrainBrush::apply(double frame_delta) {
 
 		//	glm::vec2 p = glm::vec2(input_handler.mouse_world) - get_position();
 
-		//	int cliff_count = corners[center_x][center_y].cliff + corners[center_x - 1][center_y].cliff + corners[center_x][center_y - 1].cliff + corners[center_x - 1][center_y - 1].cliff;
+		//	int cliff_count = corners(center_x, center_y).cliff + corners(center_x - 1, center_y).cliff + corners(center_x, center_y - 1).cliff + corners(center_x - 1, center_y - 1).cliff;
 
 		//	// Cliff count 1 and 4 are nothing
 
 		//	if (cliff_count == 2 ) {
-		//		corners[center_x][center_y].ramp = true;
+		//		corners(center_x, center_y).ramp = true;
 
 		//		// possibly place a new ramp
 		//	} else if (cliff_count == 3) {
@@ -237,24 +240,25 @@ void TerrainBrush::apply(double frame_delta) {
 
 		//	std::cout << cliff_count << "\n";
 
-		//	if (corners[center_x - (p.x < 1)][center_y - (p.y < 1)].cliff) {
-		//	//	corners[center_x][center_y].ramp = true;
+		//	if (corners(center_x - (p.x < 1), center_y - (p.y < 1)).cliff) {
+		//	//	corners(center_x, center_y).ramp = true;
 		//	//	std::cout << "Ramp set\n";
 		//	}
 
-		//	//if (corners[center_x][center_y].cliff) {
-		//	//	corners[i][j].ramp = true;
+		//	//if (corners(center_x, center_y).cliff) {
+		//	//	corners(i, j).ramp = true;
 		//	//}
 		//} else {
-			for (int i = area.x(); i < area.x() + area.width(); i++) {
-				for (int j = area.y(); j < area.y() + area.height(); j++) {
+			map->terrain.preserve_corners(area);
+			for (int j = area.y(); j < area.y() + area.height(); j++) {
+				for (int i = area.x(); i < area.x() + area.width(); i++) {
 					const int xx = i - area.x() - std::min(position.x + 1, 0);
 					const int yy = j - area.y() - std::min(position.y + 1, 0);
 					if (!contains(xx, yy)) {
 						continue;
 					}
-					corners[i][j].ramp = false;
-					corners[i][j].layer_height = layer_height;
+					corners(i, j).ramp = false;
+					corners(i, j).layer_height = layer_height;
 
 					switch (cliff_operation_type) {
 						case cliff_operation::lower1:
@@ -262,19 +266,19 @@ void TerrainBrush::apply(double frame_delta) {
 						case cliff_operation::level:
 						case cliff_operation::raise1:
 						case cliff_operation::raise2:
-							if (corners[i][j].water) {
-								if (enforce_water_height_limits && corners[i][j].final_water_height() < corners[i][j].final_ground_height()) {
-									corners[i][j].water = false;
+							if (corners(i, j).water) {
+								if (enforce_water_height_limits && corners(i, j).final_water_height() < corners(i, j).final_ground_height()) {
+									corners(i, j).water = false;
 								}
 							}
 							break;
 						case cliff_operation::shallow_water:
-							corners[i][j].water = true;
-							corners[i][j].water_height = corners[i][j].layer_height - 1;
+							corners(i, j).water = true;
+							corners(i, j).water_height = corners(i, j).layer_height - 1;
 							break;
 						case cliff_operation::deep_water:
-							corners[i][j].water = true;
-							corners[i][j].water_height = corners[i][j].layer_height;
+							corners(i, j).water = true;
+							corners(i, j).water_height = corners(i, j).layer_height;
 							break;
 						case cliff_operation::ramp:
 							break;
@@ -289,12 +293,13 @@ void TerrainBrush::apply(double frame_delta) {
 		updated_area = updated_area.intersected({ 0, 0, width - 1, height - 1 });
 
 		// Determine if cliff
-		for (int i = updated_area.x(); i <= updated_area.right(); i++) {
-			for (int j = updated_area.y(); j <= updated_area.bottom(); j++) {
-				Corner& bottom_left = map->terrain.corners[i][j];
-				Corner& bottom_right = map->terrain.corners[i + 1][j];
-				Corner& top_left = map->terrain.corners[i][j + 1];
-				Corner& top_right = map->terrain.corners[i + 1][j + 1];
+		map->terrain.preserve_corners(updated_area);
+		for (int j = updated_area.y(); j <= updated_area.bottom(); j++) {
+			for (int i = updated_area.x(); i <= updated_area.right(); i++) {
+				Corner& bottom_left = map->terrain.corners(i, j);
+				Corner& bottom_right = map->terrain.corners(i + 1, j);
+				Corner& top_left = map->terrain.corners(i, j + 1);
+				Corner& top_right = map->terrain.corners(i + 1, j + 1);
 
 				bottom_left.cliff = bottom_left.layer_height != bottom_right.layer_height
 					|| bottom_left.layer_height != top_left.layer_height
@@ -314,16 +319,13 @@ void TerrainBrush::apply(double frame_delta) {
 		map->terrain.update_water(tile_area.adjusted(0, 0, 1, 1));
 
 		cliff_area = cliff_area.united(updated_area);
-
-		if (cliff_operation_type == cliff_operation::shallow_water || cliff_operation_type == cliff_operation::deep_water) {
-			map->terrain.upload_water_heights();
-		}
 	}
 
 	// Apply pathing
-	for (int i = updated_area.x(); i <= updated_area.right(); i++) {
-		for (int j = updated_area.y(); j <= updated_area.bottom(); j++) {
-			Corner& bottom_left = map->terrain.corners[i][j];
+	map->pathing_map.preserve(QRect(updated_area.x() * 4, updated_area.y() * 4, updated_area.width() * 4, updated_area.height() * 4));
+	for (int j = updated_area.y(); j <= updated_area.bottom(); j++) {
+		for (int i = updated_area.x(); i <= updated_area.right(); i++) {
+			Corner& bottom_left = map->terrain.corners(i, j);
 
 			for (int k = 0; k < 4; k++) {
 				for (int l = 0; l < 4; l++) {
@@ -335,7 +337,7 @@ void TerrainBrush::apply(double frame_delta) {
 					} 
 					
 					if (!bottom_left.cliff || (bottom_left.ramp && !bottom_left.romp)) {
-						Corner& corner = map->terrain.corners[i + k / 2][j + l / 2];
+						Corner& corner = map->terrain.corners(i + k / 2, j + l / 2);
 						if (apply_tile_pathing) {
 							const int id = corner.ground_texture;
 							mask |= map->terrain.pathing_options[map->terrain.tileset_ids[id]].mask();
@@ -356,19 +358,18 @@ void TerrainBrush::apply(double frame_delta) {
 		}
 	}
 
-	map->pathing_map.upload_static_pathing();
+	map->pathing_map.dirty_static.add(QRect(updated_area.x() * 4, updated_area.y() * 4, updated_area.width() * 4, updated_area.height() * 4));
 
 	if (apply_height || apply_cliff) {
 		if (change_doodad_heights) {
-			for (auto&& i : map->doodads.doodads) {
-				if (area.contains(i.position.x, i.position.y)) {
-					if (std::find_if(pre_change_doodads.begin(), pre_change_doodads.end(), [i](const Doodad& doodad) { return doodad.creation_number == i.creation_number; }) == pre_change_doodads.end()) {
-						pre_change_doodads.push_back(i);
-					}
-					i.position.z = map->terrain.interpolated_height(i.position.x, i.position.y);
-					i.update();
-					post_change_doodads[i.creation_number] = i;
+			for (const auto& handle : map->doodads.query_area(area)) {
+				Doodad& i = *map->doodads.doodads.get(handle);
+				if (std::find_if(pre_change_doodads.begin(), pre_change_doodads.end(), [&i](const Doodad& doodad) { return doodad.creation_number == i.creation_number; }) == pre_change_doodads.end()) {
+					pre_change_doodads.push_back(i);
 				}
+				i.position.z = map->terrain.interpolated_height(i.position.x, i.position.y);
+				i.update();
+				post_change_doodads[i.creation_number] = i;
 			}
 		}
 		map->units.update_area(updated_area);
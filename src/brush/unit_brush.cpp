@@ -29,7 +29,7 @@ void UnitBrush::key_press_event(QKeyEvent* event) {
 		if (!event->isAutoRepeat()) {
 			map->terrain_undo.new_undo_group();
 			unit_state_undo = std::make_unique<UnitStateAction>();
-			for (const auto& i : selections) {
+			for (Unit* i : selected_units()) {
 				unit_state_undo->old_units.push_back(*i);
 			}
 		}
@@ -42,7 +42,7 @@ void UnitBrush::key_press_event(QKeyEvent* event) {
 		float x_displacement = -0.25f * left + 0.25f * right;
 		float y_displacement = -0.25f * up + 0.25f * down;
 
-		for (const auto& i : selections) {
+		for (Unit* i : selected_units()) {
 			i->position.x += x_displacement;
 			i->position.y += y_displacement;
 			i->update();
@@ -54,8 +54,8 @@ void UnitBrush::key_press_event(QKeyEvent* event) {
 			case Qt::Key_A:
 				selections.clear();
 				selections.reserve(map->units.units.size());
-				for (auto& i : map->units.units) {
-					selections.push_back(&i);
+				for (size_t i = 0; i < map->units.units.size(); i++) {
+					selections.push_back(map->units.units.handle(i));
 				}
 				break;
 			default:
@@ -69,7 +69,7 @@ void UnitBrush::key_press_event(QKeyEvent* event) {
 void UnitBrush::key_release_event(QKeyEvent* event) {
 	if (!event->isAutoRepeat()) {
 		if (unit_state_undo) {
-			for (const auto& i : selections) {
+			for (Unit* i : selected_units()) {
 				unit_state_undo->new_units.push_back(*i);
 			}
 			map->terrain_undo.add_undo_action(std::move(unit_state_undo));
@@ -87,10 +87,10 @@ void UnitBrush::key_release_event(QKeyEvent* event) {
 
 void UnitBrush::mouse_press_event(QMouseEvent* event, double frame_delta) {
 	if (event->button() == Qt::LeftButton && mode == Mode::selection && !event->modifiers() && input_handler.mouse.y > 0.f) {
-		auto id = map->render_manager.pick_unit_id_under_mouse(map->units, input_handler.mouse);
+		auto id = map->unit_under_mouse();
 		if (id) {
-			Unit& unit = map->units.units[id.value()];
-			selections = { &unit };
+			const Unit& unit = map->units.units[id.value()];
+			selections = { map->units.units.handle(id.value()) };
 			dragging = true;
 			drag_x_offset = input_handler.mouse_world.x - unit.position.x;
 			drag_y_offset = input_handler.mouse_world.y - unit.position.y;
@@ -111,18 +111,18 @@ void UnitBrush::mouse_move_event(QMouseEvent* event, double frame_delta) {
 					dragged = true;
 					map->terrain_undo.new_undo_group();
 					unit_state_undo = std::make_unique<UnitStateAction>();
-					for (const auto& i : selections) {
+					for (Unit* i : selected_units()) {
 						unit_state_undo->old_units.push_back(*i);
 					}
 				}
-				for (auto& i : selections) {
+				for (Unit* i : selected_units()) {
 					i->position.x = input_handler.mouse_world.x - drag_x_offset;
 					i->position.y = input_handler.mouse_world.y - drag_y_offset;
 					i->position.z = map->terrain.interpolated_height(i->position.x, i->position.y);
 					i->update();
 				}
 			} else if (event->modifiers() & Qt::ControlModifier) {
-				for (auto&& i : selections) {
+				for (Unit* i : selected_units()) {
 					float target_rotation = std::atan2(input_handler.mouse_world.y - i->position.y, input_handler.mouse_world.x - i->position.x);
 					if (target_rotation < 0) {
 						target_rotation = (glm::pi<float>() + target_rotation) + glm::pi<float>();
@@ -143,7 +143,7 @@ void UnitBrush::mouse_release_event(QMouseEvent* event) {
 	dragging = false;
 	if (dragged) {
 		dragged = false;
-		for (const auto& i : selections) {
+		for (Unit* i : selected_units()) {
 			unit_state_undo->new_units.push_back(*i);
 		}
 		map->terrain_undo.add_undo_action(std::move(unit_state_undo));
@@ -158,7 +158,7 @@ void UnitBrush::delete_selection() {
 		// Undo/redo
 		map->terrain_undo.new_undo_group();
 		auto action = std::make_unique<UnitDeleteAction>();
-		for (const auto& i : selections) {
+		for (Unit* i : selected_units()) {
 			action->units.push_back(*i);
 		}
 		map->terrain_undo.add_undo_action(std::move(action));
@@ -174,7 +174,7 @@ void UnitBrush::copy_selection() {
 	// Mouse position is average location
 	clipboard_free_placement = true;
 	glm::vec3 average_position = {};
-	for (const auto& i : selections) {
+	for (Unit* i : selected_units()) {
 		clipboard.push_back(*i);
 		average_position += i->position;
 	}
@@ -194,7 +194,7 @@ void UnitBrush::clear_selection() {
 void UnitBrush::place_clipboard() {
 	apply_begin();
 	for (const auto& i : clipboard) {
-		Unit& new_unit = map->units.add_unit(i);
+		Unit new_unit = i;
 		new_unit.creation_number = ++Unit::auto_increment;
 		glm::vec3 final_position = glm::vec3(glm::vec2(input_handler.mouse_world + i.position) - clipboard_mouse_offset, 0);
 
@@ -203,6 +203,7 @@ void UnitBrush::place_clipboard() {
 		new_unit.position = final_position;
 		new_unit.update();
 		unit_undo->units.push_back(new_unit);
+		map->units.add_unit(std::move(new_unit));
 	}
 	apply_end();
 }
@@ -254,7 +255,7 @@ void UnitBrush::render_selection() const {
 	selection_circle_shader->use();
 	glEnableVertexAttribArray(0);
 
-	for (const auto& i : selections) {
+	for (Unit* i : selected_units()) {
 		float selection_scale = i->mesh->model->sequences[i->skeleton.sequence_index].extent.bounds_radius / 128.f;
 
 		glm::mat4 model(1.f);
@@ -292,6 +293,17 @@ void UnitBrush::render_clipboard() {
 	}
 }
 
+std::vector<Unit*> UnitBrush::selected_units() const {
+	std::vector<Unit*> result;
+	result.reserve(selections.size());
+	for (const auto& i : selections) {
+		if (Unit* unit = map->units.units.get(i)) {
+			result.push_back(unit);
+		}
+	}
+	return result;
+}
+
 void UnitBrush::set_random_rotation() {
 	std::random_device rd;
 	std::mt19937 gen(rd());
@@ -29,7 +29,7 @@ class UnitBrush : public Brush {
 	std::unique_ptr<UnitAddAction> unit_undo;
 	std::unique_ptr<UnitStateAction> unit_state_undo;
 
-	std::vector<Unit*> selections;
+	std::vector<UnitHandle> selections;
 	glm::vec2 clipboard_mouse_offset;
 	bool clipboard_free_placement = false;
 	std::vector<Unit> clipboard;
@@ -62,6 +62,9 @@ class UnitBrush : public Brush {
 	void render_selection() const override;
 	void render_clipboard() override;
 
+	/// The selected units that still exist. The pointers are only valid until units are added or removed
+	std::vector<Unit*> selected_units() const;
+
 	void set_random_rotation();
 	void set_unit(const std::string& id);
 };
\ No newline at end of file
@@ -4,6 +4,16 @@ module;
 #include <vector>
 #include <span>
 #include <print>
+#include <format>
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cctype>
+#include <mutex>
+
+#include "unordered_dense.h"
 
 #define __CASCLIB_SELF__
 #define WIN32_LEAN_AND_MEAN
@@ -12,11 +22,17 @@ module;
 export module CASC;
 
 import no_init_allocator;
+import BinaryReader;
+import BinaryWriter;
 
 namespace fs = std::filesystem;
 
 // A thin wrapper around CascLib https://github.com/ladislav-zezula/CascLib
 namespace casc {
+	/// CascLib does not guarantee that a storage handle and the file handles opened from it can be used from several threads at once,
+	/// while the game data is loaded on the TBB worker threads. So every CascLib call on them is serialized
+	std::mutex casc_mutex;
+
 	export class File {
 	  public:
 		HANDLE handle = nullptr;
@@ -39,6 +55,7 @@ namespace casc {
 
 		// std::span<uint8_t> read() const;
 		std::vector<uint8_t, default_init_allocator<uint8_t>> read() const {
+			std::lock_guard lock(casc_mutex);
 			const uint32_t size = CascGetFileSize(handle, 0);
 			std::vector<uint8_t, default_init_allocator<uint8_t>> buffer(size);
 
@@ -55,11 +72,33 @@ namespace casc {
 		}
 		// std::pair<std::unique_ptr<uint8_t[]>, std::size_t> read() const;
 
+		/// The CASC content key (MD5 of the file contents) as a hex string. Changes whenever the file contents change
+		std::string content_key() const {
+			CASC_FILE_FULL_INFO info;
+			std::unique_lock lock(casc_mutex);
+			if (!CascGetFileInfo(handle, CascFileFullInfo, &info, sizeof(info), nullptr)) {
+				return "";
+			}
+			lock.unlock();
+
+			std::string key;
+			key.reserve(MD5_HASH_SIZE * 2);
+			for (const auto byte : info.CKey) {
+				key += std::format("{:02x}", byte);
+			}
+			return key;
+		}
+
 		size_t size() const noexcept {
+			std::lock_guard lock(casc_mutex);
 			return CascGetFileSize(handle, 0);
 		}
 
 		void close() const noexcept {
+			if (handle == nullptr) {
+				return;
+			}
+			std::lock_guard lock(casc_mutex);
 			CascCloseFile(handle);
 		}
 	};
@@ -82,18 +121,26 @@ namespace casc {
 		noexcept {
 			handle = move.handle;
 			move.handle = nullptr;
+			index_names = std::move(move.index_names);
+			index = std::move(move.index);
+		}
+		CASC(const CASC& copy) {
+			handle = copy.handle;
+			set_index(copy.index_names);
 		}
-		CASC(const CASC&) = default;
 		CASC& operator=(const CASC&) = delete;
 		CASC& operator=(CASC&& move) noexcept {
 			handle = move.handle;
 			move.handle = nullptr;
+			index_names = std::move(move.index_names);
+			index = std::move(move.index);
 			return *this;
 		}
 
 		bool open(const fs::path& path) {
 			if (handle != nullptr)
 				close();
+			std::lock_guard lock(casc_mutex);
 			const bool opened = CascOpenStorage(path.c_str(), CASC_LOCALE_ALL, &handle);
 			if (!opened) {
 				std::print("Error opening {} with error: {}\n", path.string(), GetCascError());
@@ -102,12 +149,17 @@ namespace casc {
 		}
 
 		void close() {
+			std::unique_lock lock(casc_mutex);
 			CascCloseStorage(handle);
+			lock.unlock();
 			handle = nullptr;
+			index.clear();
+			index_names.clear();
 		}
 
 		File file_open(const fs::path& path) const {
 			File file;
+			std::lock_guard lock(casc_mutex);
 			const bool opened = CascOpenFile(handle, path.string().c_str(), 0, CASC_OPEN_BY_NAME, &file.handle);
 			if (!opened) {
 				std::print("Error opening {} with error: {}\n", path.string(), GetCascError());
@@ -115,10 +167,129 @@ namespace casc {
 			return file;
 		}
 
-		/// ToDo is there a better way to check if a file exists?
+		/// Uses the file name index if it has been built, otherwise has to try opening the file
 		bool file_exists(const fs::path& path) const {
+			if (!index.empty()) {
+				return index.contains(normalize_name(path.string()));
+			}
+
+			// Declared after file so that it is unlocked before file closes itself
 			File file;
+			std::lock_guard lock(casc_mutex);
 			return CascOpenFile(handle, path.string().c_str(), 0, CASC_OPEN_BY_NAME, &file.handle);
 		}
+
+		/// All files whose (normalized) name starts with prefix, e.g. "war3.w3mod:_hd.w3mod:units/". Requires the index
+		std::vector<std::string_view> files_with_prefix(const std::string_view prefix) const {
+			const std::string normalized = normalize_name(prefix);
+
+			std::vector<std::string_view> result;
+			for (auto i = std::lower_bound(index_names.begin(), index_names.end(), normalized); i != index_names.end() && i->starts_with(normalized); ++i) {
+				result.push_back(*i);
+			}
+			return result;
+		}
+
+		bool has_index() const {
+			return !index.empty();
+		}
+
+		/// Enumerates every file in the storage and builds an in memory index of their names
+		bool build_index() {
+			std::vector<std::string> names;
+
+			{
+				std::lock_guard lock(casc_mutex);
+				CASC_FIND_DATA find_data;
+				HANDLE find = CascFindFirstFile(handle, "*", &find_data, nullptr);
+				if (find == nullptr || find == INVALID_HANDLE_VALUE) {
+					return false;
+				}
+
+				do {
+					names.push_back(normalize_name(find_data.szFileName));
+				} while (CascFindNextFile(find, &find_data));
+				CascFindClose(find);
+			}
+
+			set_index(std::move(names));
+			return has_index();
+		}
+
+		/// Loads an index written by save_index. Returns false if there is none or it was written for a different build of the storage
+		bool load_index(const fs::path& path) {
+			std::ifstream stream(path, std::ios::binary);
+			if (!stream) {
+				return false;
+			}
+
+			try {
+				BinaryReader reader(std::vector<uint8_t, default_init_allocator<uint8_t>>(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>()));
+				if (reader.read<uint32_t>() != index_version || reader.read_c_string() != storage_identifier()) {
+					return false;
+				}
+
+				std::vector<std::string> names(reader.read<uint32_t>());
+				for (auto& name : names) {
+					name = reader.read_c_string();
+				}
+				set_index(std::move(names));
+			} catch (const std::out_of_range&) {
+				return false;
+			}
+			return has_index();
+		}
+
+		void save_index(const fs::path& path) const {
+			BinaryWriter writer;
+			writer.write<uint32_t>(index_version);
+			writer.write_c_string(storage_identifier());
+			writer.write<uint32_t>(index_names.size());
+			for (const auto& name : index_names) {
+				writer.write_c_string(name);
+			}
+
+			std::error_code error;
+			fs::create_directories(path.parent_path(), error);
+			std::ofstream output(path, std::ios::binary);
+			output.write(reinterpret_cast<const char*>(writer.buffer.data()), writer.buffer.size());
+		}
+
+	  private:
+		static constexpr uint32_t index_version = 1;
+
+		/// Sorted for prefix queries
+		std::vector<std::string> index_names;
+		/// Views into index_names
+		ankerl::unordered_dense::set<std::string_view> index;
+
+		/// CascLib matches names case insensitively and treats / and \ the same
+		static std::string normalize_name(const std::string_view name) {
+			std::string result(name);
+			for (auto& i : result) {
+				i = i == '\\' ? '/' : static_cast<char>(std::tolower(static_cast<unsigned char>(i)));
+			}
+			return result;
+		}
+
+		void set_index(std::vector<std::string> names) {
+			std::ranges::sort(names);
+			names.erase(std::unique(names.begin(), names.end()), names.end());
+
+			index.clear();
+			index_names = std::move(names);
+			index.reserve(index_names.size());
+			for (const auto& name : index_names) {
+				index.emplace(name);
+			}
+		}
+
+		/// Identifies the storage and its build so that a persisted index is not used after a game update
+		std::string storage_identifier() const {
+			CASC_STORAGE_PRODUCT product {};
+			std::lock_guard lock(casc_mutex);
+			CascGetStorageInfo(handle, CascStorageProduct, &product, sizeof(product), nullptr);
+			return std::string(product.szCodeName) + ":" + std::to_string(product.BuildNumber);
+		}
 	};
 } // namespace casc
\ No newline at end of file
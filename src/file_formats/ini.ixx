@@ -2,11 +2,14 @@ module;
 
 #include <map>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <sstream>
+#include <memory>
 #include <filesystem>
 #include <fstream>
-#include <absl/strings/str_split.h>
+#include <algorithm>
+
+#include "unordered_dense.h"
 
 export module INI;
 
@@ -17,11 +20,121 @@ import no_init_allocator;
 namespace fs = std::filesystem;
 
 namespace ini {
+	/// The value of an INI key. Views into the buffer of the INI file and is only split on its commas when a part is requested.
+	/// Quoted values ("a","b") are split on "," and have their surrounding quotes stripped
+	export class Value {
+	  public:
+		Value() = default;
+
+		explicit Value(const std::string_view raw)
+			: raw(raw) {
+		}
+
+		/// A value that has already been split, e.g. after substituting some of its parts
+		explicit Value(std::vector<std::string_view> parts)
+			: parts(std::move(parts)), is_split(true) {
+		}
+
+		/// The number of comma separated parts
+		size_t size() const {
+			size_t count = 0;
+			visit([&](std::string_view) {
+				count++;
+				return true;
+			});
+			return count;
+		}
+
+		/// Returns an empty string if the part does not exist
+		std::string_view operator[](const size_t index) const {
+			std::string_view result;
+			size_t i = 0;
+			visit([&](std::string_view part) {
+				if (i++ == index) {
+					result = part;
+					return false;
+				}
+				return true;
+			});
+			return result;
+		}
+
+		std::vector<std::string_view> split() const {
+			std::vector<std::string_view> result;
+			visit([&](std::string_view part) {
+				result.push_back(part);
+				return true;
+			});
+			return result;
+		}
+
+		/// Joins the parts with , without the quotes. Unquoted values that were never modified are returned as is
+		std::string join() const {
+			if (!is_split && !raw.starts_with('\"')) {
+				return std::string(raw);
+			}
+
+			std::string result;
+			visit([&](std::string_view part) {
+				if (!result.empty()) {
+					result += ',';
+				}
+				result += part;
+				return true;
+			});
+			return result;
+		}
+
+		/// Calls callback for every part until it returns false
+		template <typename F>
+		void visit(F&& callback) const {
+			if (is_split) {
+				for (const auto& part : parts) {
+					if (!callback(part)) {
+						return;
+					}
+				}
+				return;
+			}
+
+			const std::string_view delimiter = raw.starts_with('\"') ? "\",\"" : ",";
+			std::string_view rest = raw;
+			while (true) {
+				const size_t found = rest.find(delimiter);
+				std::string_view part = rest.substr(0, found);
+
+				// Strip off quotes at the front/back
+				if (part.size() >= 2) {
+					if (part.front() == '\"') {
+						part.remove_prefix(1);
+					}
+					if (part.back() == '\"') {
+						part.remove_suffix(1);
+					}
+				}
+
+				if (!callback(part) || found == std::string_view::npos) {
+					return;
+				}
+				rest.remove_prefix(found + delimiter.size());
+			}
+		}
+
+	  private:
+		std::string_view raw;
+		std::vector<std::string_view> parts;
+		bool is_split = false;
+	};
+
 	export class INI {
 	  public:
-		/// header to items to list of values to value
-		// ToDo use ankerl::unordered_dense
-		std::map<std::string, std::map<std::string, std::vector<std::string>>> ini_data;
+		using Section = ankerl::unordered_dense::map<std::string_view, Value>;
+
+		/// header to items to value. All views point into storage which is kept alive by this INI (and its copies)
+		ankerl::unordered_dense::map<std::string_view, Section> ini_data;
+
+		/// The files whose contents ended up in this INI, either by loading or substituting
+		std::vector<SourceFile> source_files;
 
 		INI() = default;
 		explicit INI(const fs::path& path, bool local = false) {
@@ -29,14 +142,17 @@ namespace ini {
 		}
 
 		void load(const fs::path& path, bool local = false) {
-			std::vector<uint8_t, default_init_allocator<uint8_t>> buffer;
+			auto buffer = std::make_shared<std::vector<uint8_t, default_init_allocator<uint8_t>>>();
 			if (local) {
 				std::ifstream stream(path, std::ios::binary);
-				buffer = std::vector<uint8_t, default_init_allocator<uint8_t>>(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+				*buffer = std::vector<uint8_t, default_init_allocator<uint8_t>>(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
 			} else {
-				buffer = hierarchy.open_file(path).buffer;
+				*buffer = hierarchy.open_file(path).buffer;
 			}
-			std::string_view view(reinterpret_cast<char*>(buffer.data()), buffer.size());
+			source_files.push_back({ path, local });
+			storage.push_back(buffer);
+
+			std::string_view view(reinterpret_cast<char*>(buffer->data()), buffer->size());
 
 			// Strip byte order marking
 			if (view.starts_with(std::string{ static_cast<char>(0xEF), static_cast<char>(0xBB), static_cast<char>(0xBF) })) {
@@ -73,28 +189,7 @@ namespace ini {
 						continue;
 					}
 
-					std::vector<std::string> parts;
-
-					if (value.front() == '\"') {
-						parts = absl::StrSplit(value, "\",\"");
-					} else {
-						parts = absl::StrSplit(value, ',');
-					}
-
-					// Strip off quotes at the front/back
-					for (auto&& i : parts) {
-						if (i.size() < 2) {
-							continue;
-						}
-						if (i.front() == '\"') {
-							i.erase(i.begin());
-						}
-						if (i.back() == '\"') {
-							i.pop_back();
-						}
-					}
-
-					ini_data[std::string(current_section)][std::string(key)] = parts;
+					ini_data[current_section][key] = Value(value);
 				}
 				view.remove_prefix(eol + 1);
 			}
@@ -102,63 +197,137 @@ namespace ini {
 
 		/// Replaces all values (not keys) which match one of the keys in substitution INI
 		void substitute(const INI& ini, const std::string& section) {
+			add_source_files(ini.source_files);
+
+			const auto found_section = ini.ini_data.find(section);
+			if (found_section == ini.ini_data.end()) {
+				return;
+			}
+
+			// The replacements point into the storage of the other INI
+			storage.insert(storage.end(), ini.storage.begin(), ini.storage.end());
+
 			for (auto&& [section_key, section_value] : ini_data) {
 				for (auto&& [key, value] : section_value) {
-					for (auto&& part : value) {
-						std::string westring = ini.data(section, part);
+					std::vector<std::string_view> parts = value.split();
+
+					bool substituted = false;
+					for (auto& part : parts) {
+						const auto found = found_section->second.find(part);
+						if (found == found_section->second.end()) {
+							continue;
+						}
+
+						const std::string_view westring = found->second[0];
 						if (!westring.empty()) {
 							part = westring;
+							substituted = true;
 						}
 					}
+
+					if (substituted) {
+						value = Value(std::move(parts));
+					}
 				}
 			}
 		}
 
-		std::map<std::string, std::vector<std::string>> section(const std::string& section) const {
-			if (ini_data.contains(section)) {
-				return ini_data.at(section);
-			} else {
-				return {};
+		/// Returns a sorted copy of the section
+		std::map<std::string, std::vector<std::string>> section(const std::string_view section) const {
+			std::map<std::string, std::vector<std::string>> result;
+			if (const auto found = ini_data.find(section); found != ini_data.end()) {
+				for (const auto& [key, value] : found->second) {
+					std::vector<std::string>& parts = result[std::string(key)];
+					value.visit([&](std::string_view part) {
+						parts.emplace_back(part);
+						return true;
+					});
+				}
 			}
+			return result;
 		}
 
 		/// Sets the data of a whole key
-		void set_whole_data(const std::string& section, const std::string& key, std::string value) {
-			ini_data[section][key] = { value };
+		void set_whole_data(const std::string_view section, const std::string_view key, const std::string_view value) {
+			const std::string_view section_key = ini_data.contains(section) ? ini_data.find(section)->first : own(section);
+			Section& items = ini_data[section_key];
+			const std::string_view item_key = items.contains(key) ? items.find(key)->first : own(key);
+			items[item_key] = Value(std::vector { own(value) });
 		}
 
 		/// Retrieves the list of key values
-		std::vector<std::string> whole_data(const std::string& section, const std::string& key) const {
-			if (ini_data.contains(section) && ini_data.at(section).contains(key)) { // ToDo C++20 contains
-				return ini_data.at(section).at(key);
-			} else {
-				return {};
+		std::vector<std::string> whole_data(const std::string_view section, const std::string_view key) const {
+			std::vector<std::string> result;
+			if (const Value* value = find(section, key)) {
+				value->visit([&](std::string_view part) {
+					result.emplace_back(part);
+					return true;
+				});
 			}
+			return result;
 		}
 
-		bool key_exists(const std::string& section, const std::string& key) const {
-			return ini_data.contains(section) && ini_data.at(section).contains(key);
+		bool key_exists(const std::string_view section, const std::string_view key) const {
+			return find(section, key) != nullptr;
 		}
 
-		bool section_exists(const std::string& section) const {
+		bool section_exists(const std::string_view section) const {
 			return ini_data.contains(section);
 		}
 
+		/// Returns the value of the key or nullptr if the section or key do not exist
+		const Value* find(const std::string_view section, const std::string_view key) const {
+			if (const auto found_section = ini_data.find(section); found_section != ini_data.end()) {
+				if (const auto found = found_section->second.find(key); found != found_section->second.end()) {
+					return &found->second;
+				}
+			}
+			return nullptr;
+		}
+
 		/// To access key data where the value of the key is comma seperated
 		template <typename T = std::string>
-		T data(const std::string& section, const std::string& key, const size_t argument = 0) const {
-			if (ini_data.contains(section) && ini_data.at(section).contains(key) && argument < ini_data.at(section).at(key).size()) {
-				if constexpr (std::is_same<T, std::string>()) {
-					return ini_data.at(section).at(key)[argument];
-				} else if constexpr (std::is_same<T, int>()) {
-					return std::stoi(ini_data.at(section).at(key)[argument]);
-				} else if constexpr (std::is_same<T, float>()) {
-					return std::stof(ini_data.at(section).at(key)[argument]);
-				}
-				static_assert("Type not supported. Convert yourself or add conversion here if it makes sense");
-			} else {
+		T data(const std::string_view section, const std::string_view key, const size_t argument = 0) const {
+			const Value* value = find(section, key);
+			if (!value) {
 				return T();
 			}
+
+			// Missing arguments are returned as T() just like missing keys
+			const std::string_view part = (*value)[argument];
+			if (part.empty() && argument >= value->size()) {
+				return T();
+			}
+
+			if constexpr (std::is_same<T, std::string>()) {
+				return std::string(part);
+			} else if constexpr (std::is_same<T, int>()) {
+				return std::stoi(std::string(part));
+			} else if constexpr (std::is_same<T, float>()) {
+				return std::stof(std::string(part));
+			} else {
+				static_assert(sizeof(T) == 0, "Type not supported. Convert yourself or add conversion here if it makes sense");
+			}
+		}
+
+		void add_source_files(const std::vector<SourceFile>& files) {
+			for (const auto& file : files) {
+				if (std::find(source_files.begin(), source_files.end(), file) == source_files.end()) {
+					source_files.push_back(file);
+				}
+			}
+		}
+
+	  private:
+		/// File buffers and owned strings that the views in ini_data point into. Shared so that copies of this INI stay valid
+		std::vector<std::shared_ptr<const void>> storage;
+
+		/// Copies the string into storage owned by this INI so that it can be referenced by a view
+		std::string_view own(const std::string_view string) {
+			auto owned = std::make_shared<const std::string>(string);
+			const std::string_view view = *owned;
+			storage.push_back(std::move(owned));
+			return view;
 		}
 	};
 } // namespace ini
\ No newline at end of file
@@ -1,6 +1,7 @@
 module;
 
 #include <string>
+#include <string_view>
 #include <print>
 
 #include <glm/glm.hpp>
@@ -59,12 +60,12 @@ namespace mdx {
 				geoset.extents.emplace_back(Extent(reader));
 			}
 
-			std::string tag = reader.read_string(4);
+			std::string_view tag = reader.read_string_view(4);
 
 			if (tag == "TANG") {
 				uint32_t structure_count = reader.read<uint32_t>();
 				geoset.tangents = reader.read_vector<glm::vec4>(structure_count);
-				tag = reader.read_string(4); // Maybe SKIN, maybe UVAS
+				tag = reader.read_string_view(4); // Maybe SKIN, maybe UVAS
 			}
 
 			if (tag == "SKIN") {
@@ -272,7 +273,7 @@ namespace mdx {
 			if (version < 1100) {
 				bool is_hd = false;
 				if (version == 900 || version == 1000) {
-					is_hd = !reader.read_string(80).empty();
+					is_hd = !reader.read_string_view(80).empty();
 				}
 				read_MTLS_texs_pre_v1100(reader, is_hd, version, material, unique_tracks);
 			} else {
@@ -797,7 +798,7 @@ namespace mdx {
 	}
 
 	void MDX::load(BinaryReader& reader) {
-		const std::string magic_number = reader.read_string(4);
+		const std::string_view magic_number = reader.read_string_view(4);
 		if (magic_number != "MDLX") {
 			std::print("Incorrect file magic number, expected MDLX but got {}\n", magic_number);
 			return;
@@ -1,6 +1,8 @@
 module;
 
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <unordered_map>
 #include <filesystem>
 #include <cassert>
@@ -9,12 +11,20 @@ module;
 #include <string_view>
 #include <charconv>
 #include <print>
+#include <bit>
+#include <optional>
+#include <deque>
+#include <limits>
+#include <stdexcept>
 
 #include <absl/strings/str_split.h>
-#include <absl/strings/str_join.h>
 
 #include "unordered_dense.h"
 
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#endif
+
 export module SLK;
 
 namespace fs = std::filesystem;
@@ -49,19 +59,167 @@ namespace slk {
 		}
 	};
 
-	export class SLK {
+	/// Returns the offsets of all '\n' characters in buffer one byte at a time
+	export std::vector<uint32_t> find_line_ends_scalar(const std::string_view buffer) {
+		std::vector<uint32_t> ends;
+		ends.reserve(buffer.size() / 16);
+		for (size_t i = 0; i < buffer.size(); i++) {
+			if (buffer[i] == '\n') {
+				ends.push_back(static_cast<uint32_t>(i));
+			}
+		}
+		return ends;
+	}
+
+	/// Returns the offsets of all '\n' characters in buffer.
+	/// Compares 32 (AVX2) or 16 (SSE2) bytes at a time and turns the matches into a bitmask that is walked with countr_zero
+	export std::vector<uint32_t> find_line_ends(const std::string_view buffer) {
+		std::vector<uint32_t> ends;
+		ends.reserve(buffer.size() / 16);
+
+		size_t i = 0;
+#if defined(__AVX2__)
+		const __m256i newline = _mm256_set1_epi8('\n');
+		for (; i + 32 <= buffer.size(); i += 32) {
+			const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buffer.data() + i));
+			uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline)));
+			while (mask) {
+				ends.push_back(static_cast<uint32_t>(i + std::countr_zero(mask)));
+				mask &= mask - 1;
+			}
+		}
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		const __m128i newline = _mm_set1_epi8('\n');
+		for (; i + 16 <= buffer.size(); i += 16) {
+			const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer.data() + i));
+			uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+			while (mask) {
+				ends.push_back(static_cast<uint32_t>(i + std::countr_zero(mask)));
+				mask &= mask - 1;
+			}
+		}
+#endif
+		// Tail (or everything if there is no SIMD support)
+		for (; i < buffer.size(); i++) {
+			if (buffer[i] == '\n') {
+				ends.push_back(static_cast<uint32_t>(i));
+			}
+		}
+		return ends;
+	}
+
+	/// A parsed numeric interpretation of an interned string
+	struct Number {
+		int integer = 0;
+		float real = 0.f;
+		bool is_integer = false;
+		bool is_real = false;
+	};
+
+	/// Stores every distinct cell value of an SLK only once.
+	/// Numeric values are parsed once when they are interned so that data<int>()/data<float>() do not have to parse on every lookup
+	export class StringPool {
+	  public:
+		/// The id of cells that do not have a value. Different from the empty string
+		static constexpr uint32_t none = 0;
+
+		StringPool() {
+			strings.emplace_back();
+			numbers.emplace_back();
+		}
+
+		StringPool(const StringPool& other)
+			: strings(other.strings), numbers(other.numbers) {
+			rebuild_ids();
+		}
+
+		StringPool& operator=(const StringPool& other) {
+			if (this != &other) {
+				strings = other.strings;
+				numbers = other.numbers;
+				rebuild_ids();
+			}
+			return *this;
+		}
 
+		// std::deque keeps its elements in place when moved so the views in ids stay valid
+		StringPool(StringPool&&) = default;
+		StringPool& operator=(StringPool&&) = default;
+
+		uint32_t intern(const std::string_view string) {
+			if (const auto found = ids.find(string); found != ids.end()) {
+				return found->second;
+			}
+
+			const uint32_t id = static_cast<uint32_t>(strings.size());
+			const std::string& stored = strings.emplace_back(string);
+			numbers.push_back(parse(stored));
+			ids.emplace(stored, id);
+			return id;
+		}
+
+		const std::string& string(const uint32_t id) const {
+			return strings[id];
+		}
+
+		const Number& number(const uint32_t id) const {
+			return numbers[id];
+		}
+
+		/// Includes the none entry
+		size_t size() const {
+			return strings.size();
+		}
+
+	  private:
+		// A deque so that references to the strings stay valid when interning new strings
+		std::deque<std::string> strings;
+		std::vector<Number> numbers;
+		ankerl::unordered_dense::map<std::string_view, uint32_t> ids;
+
+		void rebuild_ids() {
+			ids.clear();
+			ids.reserve(strings.size());
+			for (size_t i = 1; i < strings.size(); i++) {
+				ids.emplace(strings[i], static_cast<uint32_t>(i));
+			}
+		}
+
+		static Number parse(const std::string_view string) {
+			Number number;
+			const char* first = string.data();
+			const char* last = string.data() + string.size();
+
+			if (const auto [end, error] = std::from_chars(first, last, number.integer); error == std::errc() && end == last) {
+				number.is_integer = true;
+				number.real = static_cast<float>(number.integer);
+				number.is_real = true;
+			} else if (const auto [end, error] = std::from_chars(first, last, number.real); error == std::errc() && end == last) {
+				number.is_real = true;
+			}
+			return number;
+		}
+	};
+
+	export class SLK {
 	  public:
-		ankerl::unordered_dense::map<size_t, std::string> index_to_row;
-		ankerl::unordered_dense::map<size_t, std::string> index_to_column;
+		std::vector<std::string> index_to_row;
+		std::vector<std::string> index_to_column;
 		ankerl::unordered_dense::map<std::string, size_t, string_hash, std::equal_to<>> row_headers;
 		ankerl::unordered_dense::map<std::string, size_t, string_hash, std::equal_to<>> column_headers;
-		ankerl::unordered_dense::map<std::string, ankerl::unordered_dense::map<std::string, std::string, string_hash, std::equal_to<>>, string_hash, std::equal_to<>> base_data;
+
+		/// The base data is stored per column with one string pool id per row. Rows past the end of a column have no value
+		std::vector<std::vector<uint32_t>> base_columns;
+		StringPool strings;
+
 		ankerl::unordered_dense::map<std::string, ankerl::unordered_dense::map<std::string, std::string, string_hash, std::equal_to<>>, string_hash, std::equal_to<>> shadow_data;
 
 		// The following map is only used in meta SLKs and maps the field (+unit/ability ID) to a meta ID
 		ankerl::unordered_dense::map<std::string, std::string, string_hash, std::equal_to<>> meta_map;
 
+		/// The files whose contents ended up in this SLK through loading, merging or substituting
+		std::vector<SourceFile> source_files;
+
 		SLK() = default;
 		explicit SLK(const fs::path& path, const bool local = false) {
 			load(path, local);
@@ -75,101 +233,113 @@ namespace slk {
 			} else {
 				buffer = hierarchy.open_file(path).buffer;
 			}
+			source_files.push_back({ path, local });
 
-			std::string_view view(reinterpret_cast<char*>(buffer.data()), buffer.size());
+			parse(std::string_view(reinterpret_cast<char*>(buffer.data()), buffer.size()));
+		}
 
-			if (!view.starts_with("ID")) {
+		/// Parses the SYLK records in buffer. The record boundaries are classified in bulk first after which every record is split into its fields.
+		/// Cell values are interned straight from the buffer without intermediate strings
+		void parse(const std::string_view buffer) {
+			if (!buffer.starts_with("ID")) {
 				std::print("Invalid SLK file, does not contain \"ID\" as first record\n");
 				return;
 			}
 
-			const auto parse_integer = [&]() {
-				size_t value;
-				size_t separator = view.find(';');
-				std::from_chars(&view[1], &view[separator], value);
-				view.remove_prefix(separator + 1);
-				return value;
-			};
-
-			// Skip first ID line
-			view.remove_prefix(view.find('\n') + 1);
+			const std::vector<uint32_t> line_ends = find_line_ends(buffer);
 
 			size_t column = 0;
 			size_t row = 0;
 
-			while (view.size()) {
-				switch (view.front()) {
-					case 'C':
-						view.remove_prefix(2);
-
-						if (view.front() == 'X') {
-							column = parse_integer() - 1;
+			// Map the row/column numbers in the file to our dense indices. Duplicate headers end up in the same row/column
+			std::vector<size_t> file_rows;
+			std::vector<size_t> file_columns;
+			const auto dense_index = [](std::vector<size_t>& indices, const size_t file_index, const auto& add) {
+				if (file_index >= indices.size()) {
+					indices.resize(file_index + 1, std::numeric_limits<size_t>::max());
+				}
+				if (indices[file_index] == std::numeric_limits<size_t>::max()) {
+					indices[file_index] = add("");
+				}
+				return indices[file_index];
+			};
 
-							if (view.front() == 'Y') {
-								row = parse_integer() - 1;
-							}
-						} else {
-							row = parse_integer() - 1;
+			const auto parse_integer = [](std::string_view field) {
+				size_t value = 0;
+				std::from_chars(field.data() + 1, field.data() + field.size(), value);
+				return value;
+			};
 
-							if (view.front() == 'X') {
-								column = parse_integer() - 1;
-							}
-						}
+			size_t line_start = 0;
+			for (size_t i = 0; i <= line_ends.size(); i++) {
+				const size_t line_end = i < line_ends.size() ? line_ends[i] : buffer.size();
+				std::string_view record = buffer.substr(line_start, line_end - line_start);
+				line_start = line_end + 1;
 
-						if (row == 0 && column == 0) {
-							view.remove_prefix(view.find('\n') + 1);
-							break;
-						}
+				if (record.ends_with('\r')) {
+					record.remove_suffix(1);
+				}
 
-						view.remove_prefix(1);
-
-						{
-							std::string data;
-							if (view.front() == '\"') {
-								data = view.substr(1, view.find('"', 1) - 1);
-							} else {
-								data = view.substr(0, view.find_first_of("\r\n"));
-							}
-
-							if (data == "-" || data == "_") {
-								data = "";
-							}
-
-							if (column == 0) {
-								// -1 as 0,0 is unitid/doodadid etc.
-								row_headers.emplace(data, row - 1);
-								index_to_row.emplace(row - 1, data);
-							} else if (row == 0) {
-								// If it is a column header we need to lowercase it as column headers are case insensitive
-								to_lowercase(data);
-								// -1 as 0,0 is unitid/doodadid etc.
-								column_headers.emplace(data, column - 1);
-								index_to_column.emplace(column - 1, data);
-							} else {
-								base_data[index_to_row[row - 1]][index_to_column[column - 1]] = data;
-							}
-
-							view.remove_prefix(view.find('\n') + 1);
-						}
+				if (record.size() < 2 || record[1] != ';' || (record[0] != 'C' && record[0] != 'F')) {
+					continue;
+				}
+				const bool is_cell = record[0] == 'C';
+				record.remove_prefix(2);
+
+				// Fields are separated by ';' and start with a single letter. K (the value) is always the last field as it may contain ';'
+				std::optional<std::string_view> value;
+				while (!record.empty()) {
+					if (record.front() == 'K') {
+						value = record.substr(1);
 						break;
-					case 'F':
-						if (view.front() == 'X') {
-							column = parse_integer() - 1;
+					}
 
-							if (view.front() == 'Y') {
-								row = parse_integer() - 1;
-							}
-						} else {
-							row = parse_integer() - 1;
+					const size_t separator = record.find(';');
+					const std::string_view field = record.substr(0, separator);
+					if (field.starts_with('X')) {
+						column = parse_integer(field) - 1;
+					} else if (field.starts_with('Y')) {
+						row = parse_integer(field) - 1;
+					}
 
-							if (view.front() == 'X') {
-								column = parse_integer() - 1;
-							}
-						}
-						view.remove_prefix(view.find('\n') + 1);
+					if (separator == std::string_view::npos) {
 						break;
-					default:
-						view.remove_prefix(view.find_first_of('\n') + 1);
+					}
+					record.remove_prefix(separator + 1);
+				}
+
+				if (!is_cell || !value || (row == 0 && column == 0)) {
+					continue;
+				}
+
+				std::string_view data = *value;
+				if (data.starts_with('\"')) {
+					data = data.substr(1, data.find('"', 1) - 1);
+				}
+
+				if (data == "-" || data == "_") {
+					data = "";
+				}
+
+				if (column == 0) {
+					// -1 as 0,0 is unitid/doodadid etc.
+					if (row - 1 >= file_rows.size()) {
+						file_rows.resize(row, std::numeric_limits<size_t>::max());
+					}
+					file_rows[row - 1] = add_row(data);
+				} else if (row == 0) {
+					// If it is a column header we need to lowercase it as column headers are case insensitive
+					std::string header(data);
+					to_lowercase(header);
+					// -1 as 0,0 is unitid/doodadid etc.
+					if (column - 1 >= file_columns.size()) {
+						file_columns.resize(column, std::numeric_limits<size_t>::max());
+					}
+					file_columns[column - 1] = add_column(header);
+				} else {
+					const size_t dense_row = dense_index(file_rows, row - 1, [&](std::string_view header) { return add_row(header); });
+					const size_t dense_column = dense_index(file_columns, column - 1, [&](std::string_view header) { return add_column(header); });
+					set_base_data(dense_column, dense_row, strings.intern(data));
 				}
 			}
 		}
@@ -202,55 +372,20 @@ namespace slk {
 			}
 		}
 
+		// Gets the data by first checking the shadow table and then checking the base table
+		// Also does :hd tag resolution
 		// column_header should be lowercase
 		template <typename T = std::string>
 		T data(std::string_view column_header, std::string_view row_header) const {
 			assert(to_lowercase_copy(column_header) == column_header);
 
-			// Shadow data
-			if (const auto found_row = shadow_data.find(row_header); found_row != shadow_data.end()) {
-				if (const auto found_column = found_row->second.find(column_header); found_column != found_row->second.end()) {
-					if constexpr (std::is_same<T, std::string>()) {
-						return found_column->second;
-					} else if constexpr (std::is_same<T, float>()) {
-						return std::stof(found_column->second);
-					} else if constexpr (std::is_same<T, int>() || std::is_same<T, bool>()) {
-						return std::stoi(found_column->second);
-					}
-				}
-			}
-
-			if (hierarchy.hd) {
-				const auto column_header_hd = std::string(column_header) + ":hd";
-				if (const auto found = column_headers.find(column_header_hd); found != column_headers.end()) {
-					const std::string hd_data = data(column_header_hd, row_header);
-					if (!hd_data.empty()) { // ToDo What if I clear the model field in HD mode. Will it try loading the SD model then because we don't return the blank line?
-						if constexpr (std::is_same<T, std::string>()) {
-							return hd_data;
-						} else if constexpr (std::is_same<T, float>()) {
-							return std::stof(hd_data);
-						} else if constexpr (std::is_same<T, int>() || std::is_same<T, bool>()) {
-							return std::stoi(hd_data);
-						}
-					}
-				}
-			}
-
-			// Base data
-			if (const auto found_row = base_data.find(row_header); found_row != base_data.end()) {
-				if (const auto found_column = found_row->second.find(column_header); found_column != found_row->second.end()) {
-					if constexpr (std::is_same<T, std::string>()) {
-						return found_column->second;
-					} else if constexpr (std::is_same<T, float>()) {
-						return std::stof(found_column->second);
-					} else if constexpr (std::is_same<T, int>() || std::is_same<T, bool>()) {
-						return std::stoi(found_column->second);
-					}
-				}
+			const auto found_column = column_headers.find(column_header);
+			const auto found_row = row_headers.find(row_header);
+			if (found_column == column_headers.end() || found_row == row_headers.end()) {
+				return T();
 			}
 
-			static_assert("Type not supported. Convert yourself or add conversion here if it makes sense");
-			return T();
+			return data<T>(found_column->second, found_row->second);
 		}
 
 		// Gets the data by first checking the shadow table and then checking the base table
@@ -259,42 +394,69 @@ namespace slk {
 		// If you have both an integer row index and the string row name then use the overload that takes string_view as it will do a index->name conversion internally
 		template <typename T = std::string>
 		T data(const std::string_view column_header, size_t row) const {
-			if (row >= index_to_row.size()) {
-				throw;
+			const auto found_column = column_headers.find(column_header);
+			if (found_column == column_headers.end()) {
+				return T();
 			}
 
-			return data<T>(column_header, index_to_row.at(row));
+			return data<T>(found_column->second, row);
 		}
 
 		// Gets the data by first checking the shadow table and then checking the base table
+		// Also does :hd tag resolution
 		template <typename T = std::string>
 		T data(size_t column, size_t row) const {
-			if (row >= index_to_row.size()) {
-				throw;
+			if (row >= rows() || column >= columns()) {
+				throw std::out_of_range("SLK cell out of range");
+			}
+
+			if (const std::string* shadow = shadow_value(column, row)) {
+				return convert<T>(*shadow);
 			}
 
-			if (column >= index_to_column.size()) {
-				throw;
+			if (hierarchy.hd) {
+				if (const size_t hd_column = hd_columns[column]; hd_column != no_column) {
+					if (const std::string* shadow = shadow_value(hd_column, row)) {
+						if (!shadow->empty()) { // ToDo What if I clear the model field in HD mode. Will it try loading the SD model then because we don't return the blank line?
+							return convert<T>(*shadow);
+						}
+					} else if (const uint32_t id = base_value(hd_column, row); id != StringPool::none && !strings.string(id).empty()) {
+						return convert<T>(id);
+					}
+				}
 			}
 
-			return data<T>(index_to_column.at(column), index_to_row.at(row));
+			if (const uint32_t id = base_value(column, row); id != StringPool::none) {
+				return convert<T>(id);
+			}
+
+			return T();
 		}
 
 		// Merges the base data of the files
 		// Shadow data is not merged
 		// Any unknown columns are appended
 		void merge(const slk::SLK& slk) {
-			for (const auto& [header, index] : slk.column_headers) {
-				if (!column_headers.contains(header)) {
-					add_column(header);
-				}
+			add_source_files(slk.source_files);
+
+			std::vector<size_t> columns_mapping(slk.columns());
+			for (size_t i = 0; i < slk.columns(); i++) {
+				columns_mapping[i] = add_column(slk.index_to_column[i]);
 			}
 
-			for (const auto& [id, properties] : slk.base_data) {
-				if (!base_data.contains(id)) {
+			for (size_t other_row = 0; other_row < slk.rows(); other_row++) {
+				const auto found = row_headers.find(slk.index_to_row[other_row]);
+				if (found == row_headers.end()) {
 					continue;
 				}
-				base_data[id].insert(properties.begin(), properties.end());
+
+				// Existing values are kept
+				for (size_t other_column = 0; other_column < slk.columns(); other_column++) {
+					const uint32_t id = slk.base_value(other_column, other_row);
+					if (id != StringPool::none && base_value(columns_mapping[other_column], found->second) == StringPool::none) {
+						set_base_data(columns_mapping[other_column], found->second, strings.intern(slk.strings.string(id)));
+					}
+				}
 			}
 		}
 
@@ -302,24 +464,27 @@ namespace slk {
 		/// If an unknown section key is encountered then that section is skipped
 		/// If an unknown column key is encountered then the column is added
 		void merge(const ini::INI& ini, const SLK& meta_slk) {
+			add_source_files(ini.source_files);
+			add_source_files(meta_slk.source_files);
+
 			for (const auto& [section_key, section_value] : ini.ini_data) {
-				if (!base_data.contains(section_key)) {
+				const auto found_row = row_headers.find(section_key);
+				if (found_row == row_headers.end()) {
 					continue;
 				}
+				const size_t row = found_row->second;
 
 				for (const auto& [key, value] : section_value) {
 					std::string key_lower = to_lowercase_copy(key);
 
-					if (!column_headers.contains(key_lower)) {
-						add_column(key_lower);
-					}
+					const size_t column = add_column(key_lower);
 
 					// By making some changes to unitmetadata.slk and unitdata.slk we can avoid the 1->2->2 mapping for SLK->OE->W3U files.
 					// This means we have to manually split these into the correct column
 					if (value.size() > 1 && (key_lower == "missilearc" || key_lower == "missileart" || key_lower == "missilehoming" || key_lower == "missilespeed" || key_lower == "buttonpos" || key_lower == "unbuttonpos" || key_lower == "researchbuttonpos") && column_headers.contains(key_lower + "2")) {
 
-						base_data[section_key][key_lower] = value[0];
-						base_data[section_key][key_lower + "2"] = value[1];
+						set_base_data(column, row, strings.intern(value[0]));
+						set_base_data(column_headers.at(key_lower + "2"), row, strings.intern(value[1]));
 						continue;
 					}
 
@@ -328,8 +493,8 @@ namespace slk {
 					std::string id;
 					if (meta_slk.meta_map.contains(key_lower_stripped)) {
 						id = meta_slk.meta_map.at(key_lower_stripped);
-					} else if (meta_slk.meta_map.contains(key_lower_stripped + section_key)) {
-						id = meta_slk.meta_map.at(key_lower_stripped + section_key);
+					} else if (const auto found = meta_slk.meta_map.find(key_lower_stripped + std::string(section_key)); found != meta_slk.meta_map.end()) {
+						id = found->second;
 					} else {
 						size_t nr_position = key_lower_stripped.find_first_of("0123456789");
 						std::string without_numbers = key_lower_stripped.substr(0, nr_position);
@@ -344,18 +509,15 @@ namespace slk {
 					const int repeat = meta_slk.data<int>("repeat", id);
 					if (repeat > 0 && !(meta_slk.column_headers.contains("appendindex") && meta_slk.data<int>("appendindex", id) > 0)) {
 						for (size_t i = 0; i < value.size(); i++) {
-							const std::string new_key = key_lower + std::to_string(i + 1);
-							if (!column_headers.contains(new_key)) {
-								add_column(new_key);
-							}
-							base_data[section_key][new_key] = value[i];
+							const size_t new_column = add_column(key_lower + std::to_string(i + 1));
+							set_base_data(new_column, row, strings.intern(value[i]));
 						}
 						continue;
 					} else {
 						if (meta_slk.data<std::string>("type", id).ends_with("List")) {
-							base_data[section_key][key_lower] = absl::StrJoin(value, ",");
+							set_base_data(column, row, strings.intern(value.join()));
 						} else {
-							base_data[section_key][key_lower] = value[0];
+							set_base_data(column, row, strings.intern(value[0]));
 						}
 					}
 				}
@@ -366,25 +528,37 @@ namespace slk {
 		/// The keys of the section are matched with all the cells in the table and if they match will replace the value
 		void substitute(const ini::INI& ini, const std::string& section) {
 			assert(ini.section_exists(section));
+			add_source_files(ini.source_files);
+
+			// Every distinct value only has to be looked up once
+			const size_t count = strings.size();
+			std::vector<uint32_t> replacements(count);
+			for (uint32_t i = 1; i < count; i++) {
+				const std::string data = ini.data(section, strings.string(i));
+				replacements[i] = data.empty() ? i : strings.intern(data);
+			}
 
-			for (auto& [id, properties] : base_data) {
-				for (auto& [prop_id, prop_value] : properties) {
-					std::string data = ini.data(section, prop_value);
-					if (!data.empty()) {
-						prop_value = data;
-					}
+			for (auto& column : base_columns) {
+				for (auto& id : column) {
+					id = replacements[id];
 				}
 			}
 		}
 
 		/// Copies the row with header row_header to a new line with the new header as new_row_header
 		void copy_row(const std::string_view row_header, std::string_view new_row_header, bool copy_shadow_data) {
-			assert(base_data.contains(row_header));
-			assert(!base_data.contains(new_row_header));
+			assert(row_headers.contains(row_header));
+			assert(!row_headers.contains(new_row_header));
+
+			const size_t source = row_headers.at(row_header);
+			const size_t index = add_row(new_row_header);
 
-			// Get a weird allocation error if not done via a temporary 19/06/2021
-			const auto t = base_data.at(row_header);
-			base_data[new_row_header] = t;
+			for (auto& column : base_columns) {
+				if (source < column.size()) {
+					column.resize(std::max(column.size(), index + 1), StringPool::none);
+					column[index] = column[source];
+				}
+			}
 
 			if (copy_shadow_data && shadow_data.contains(row_header)) {
 				// Get a weird allocation error if not done via a temporary 19/06/2021
@@ -392,10 +566,6 @@ namespace slk {
 				shadow_data[new_row_header] = tt;
 			}
 
-			size_t index = row_headers.size();
-			row_headers.emplace(new_row_header, index);
-			index_to_row[index] = new_row_header;
-
 			// Only set/change oldid if the row didn't have one (which means it is a default unit/item/...)
 			if (!shadow_data[new_row_header].contains("oldid")) {
 				shadow_data[new_row_header]["oldid"] = row_header;
@@ -403,47 +573,83 @@ namespace slk {
 		}
 
 		void remove_row(const std::string_view row_header) {
-			assert(base_data.contains(row_header));
+			assert(row_headers.contains(row_header));
 
-			base_data.erase(row_header);
-			shadow_data.erase(row_header);
+			// row_header might point into index_to_row which we are about to modify
+			const std::string id(row_header);
+			shadow_data.erase(id);
 
-			const size_t index = row_headers.at(row_header);
-			if (index == rows() - 1) {
-				index_to_row.erase(index);
-				row_headers.erase(row_header);
-			} else {
-				// Swap with a element from the end to avoid having to change all indices
-				const std::string replacement_id = index_to_row.at(rows() - 1);
-				index_to_row[index] = replacement_id;
-				row_headers[replacement_id] = index;
-				index_to_row.erase(rows() - 1);
+			// Swap with a element from the end to avoid having to change all indices
+			const size_t index = row_headers.at(id);
+			const size_t last = rows() - 1;
 
-				row_headers.erase(row_header);
+			for (auto& column : base_columns) {
+				if (index < column.size()) {
+					column[index] = last < column.size() ? column[last] : StringPool::none;
+				}
+				if (column.size() > last) {
+					column.resize(last);
+				}
 			}
+
+			if (index != last) {
+				index_to_row[index] = std::move(index_to_row[last]);
+				row_headers[index_to_row[index]] = index;
+			}
+			index_to_row.pop_back();
+			row_headers.erase(id);
+		}
+
+		/// Adds a row and returns its index. If the row already exists the existing index is returned
+		size_t add_row(const std::string_view row_header) {
+			if (const auto found = row_headers.find(row_header); found != row_headers.end()) {
+				return found->second;
+			}
+
+			const size_t index = index_to_row.size();
+			row_headers.emplace(row_header, index);
+			index_to_row.emplace_back(row_header);
+			return index;
 		}
 
-		/// Adds a (virtual) column
-		/// Since SLK2 is only a key/pair store it emulates being table like and thus this call is very cheap memory/cpu wise
+		/// Adds a (virtual) column and returns its index. If the column already exists the existing index is returned
+		/// Columns only take up memory for the rows that actually have a value in them so this call is very cheap memory/cpu wise
 		/// column_header must be lowercase
-		void add_column(const std::string_view column_header) {
+		size_t add_column(const std::string_view column_header) {
 			assert(to_lowercase_copy(column_header) == column_header);
 
-			size_t index = column_headers.size();
+			if (const auto found = column_headers.find(column_header); found != column_headers.end()) {
+				return found->second;
+			}
+
+			const size_t index = index_to_column.size();
 			column_headers.emplace(column_header, index);
-			index_to_column[index] = column_header;
+			index_to_column.emplace_back(column_header);
+			base_columns.emplace_back();
+			hd_columns.push_back(no_column);
+
+			// Link the column with its :hd variant
+			if (column_header.ends_with(":hd")) {
+				const auto found = column_headers.find(column_header.substr(0, column_header.size() - 3));
+				if (found != column_headers.end()) {
+					hd_columns[found->second] = index;
+				}
+			} else if (const auto found = column_headers.find(std::string(column_header) + ":hd"); found != column_headers.end()) {
+				hd_columns[index] = found->second;
+			}
+
+			return index;
 		}
 
 		// column_header should be lowercase
 		void set_shadow_data(const std::string_view column_header, const std::string_view row_header, std::string data) {
 			assert(to_lowercase_copy(column_header) == column_header);
 
-			if (!column_headers.contains(column_header)) {
-				add_column(column_header);
-			}
+			const size_t column = add_column(column_header);
 
-			if (base_data.contains(row_header) && base_data.at(row_header).contains(column_header)) {
-				if (base_data.at(row_header).at(column_header) == data) {
+			if (const auto found_row = row_headers.find(row_header); found_row != row_headers.end()) {
+				const uint32_t id = base_value(column, found_row->second);
+				if (id != StringPool::none && strings.string(id) == data) {
 					if (shadow_data.contains(row_header)) {
 						shadow_data.at(row_header).erase(column_header);
 						if (shadow_data.at(row_header).empty()) {
@@ -461,12 +667,78 @@ namespace slk {
 			set_shadow_data(index_to_column.at(column), index_to_row.at(row), data);
 		}
 
+		/// Returns the string pool id of the base value of the cell or StringPool::none if the cell has no value
+		uint32_t base_value(const size_t column, const size_t row) const {
+			const auto& cells = base_columns[column];
+			return row < cells.size() ? cells[row] : StringPool::none;
+		}
+
+		void set_base_data(const size_t column, const size_t row, const uint32_t id) {
+			auto& cells = base_columns[column];
+			if (row >= cells.size()) {
+				cells.resize(row + 1, StringPool::none);
+			}
+			cells[row] = id;
+		}
+
+		void add_source_files(const std::vector<SourceFile>& files) {
+			for (const auto& file : files) {
+				if (std::find(source_files.begin(), source_files.end(), file) == source_files.end()) {
+					source_files.push_back(file);
+				}
+			}
+		}
+
 		size_t rows() const {
-			return row_headers.size();
+			return index_to_row.size();
 		}
 
 		size_t columns() const {
-			return column_headers.size();
+			return index_to_column.size();
+		}
+
+	  private:
+		static constexpr size_t no_column = std::numeric_limits<size_t>::max();
+
+		/// For every column the index of its :hd variant or no_column
+		std::vector<size_t> hd_columns;
+
+		const std::string* shadow_value(const size_t column, const size_t row) const {
+			if (shadow_data.empty()) {
+				return nullptr;
+			}
+
+			if (const auto found_row = shadow_data.find(index_to_row[row]); found_row != shadow_data.end()) {
+				if (const auto found_column = found_row->second.find(index_to_column[column]); found_column != found_row->second.end()) {
+					return &found_column->second;
+				}
+			}
+			return nullptr;
+		}
+
+		template <typename T>
+		T convert(const std::string& value) const {
+			if constexpr (std::is_same<T, std::string>()) {
+				return value;
+			} else if constexpr (std::is_same<T, float>()) {
+				return std::stof(value);
+			} else if constexpr (std::is_same<T, int>() || std::is_same<T, bool>()) {
+				return std::stoi(value);
+			} else {
+				static_assert(sizeof(T) == 0, "Type not supported. Convert yourself or add conversion here if it makes sense");
+			}
+		}
+
+		template <typename T>
+		T convert(const uint32_t id) const {
+			const Number& number = strings.number(id);
+			if constexpr (std::is_same<T, float>()) {
+				return number.is_real ? number.real : std::stof(strings.string(id));
+			} else if constexpr (std::is_same<T, int>() || std::is_same<T, bool>()) {
+				return number.is_integer ? number.integer : std::stoi(strings.string(id));
+			} else {
+				return convert<T>(strings.string(id));
+			}
 		}
 	};
-} // namespace slk
+} // namespace slk
\ No newline at end of file
@@ -0,0 +1,341 @@
+module;
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <span>
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include "unordered_dense.h"
+
+export module SLKSnapshot;
+
+namespace fs = std::filesystem;
+
+import SLK;
+import Hierarchy;
+import BinaryWriter;
+import MappedFile;
+
+namespace slk {
+	constexpr uint32_t snapshot_magic = 'HSLK';
+	// Increment whenever the layout below or the layout of slk::SLK changes.
+	// Changes to how a table is built (the Map::load_*_data chains) are covered by the per entry chain version instead, bump that one in Map::load_game_data()
+	constexpr uint32_t snapshot_version = 2;
+
+	/// Reads directly from the mapped snapshot without copying the file
+	class SnapshotReader {
+	  public:
+		std::span<const uint8_t> buffer;
+		size_t position = 0;
+
+		template <typename T>
+		T read() {
+			static_assert(std::is_standard_layout<T>::value, "T must be of standard layout.");
+
+			if (position + sizeof(T) > buffer.size()) {
+				throw std::out_of_range("Trying to read out of range of buffer");
+			}
+			T result;
+			std::memcpy(&result, buffer.data() + position, sizeof(T));
+			position += sizeof(T);
+			return result;
+		}
+
+		std::string_view read_string() {
+			const uint32_t size = read<uint32_t>();
+			if (position + size > buffer.size()) {
+				throw std::out_of_range("Trying to read out of range of buffer");
+			}
+			std::string_view result(reinterpret_cast<const char*>(buffer.data() + position), size);
+			position += size;
+			return result;
+		}
+	};
+
+	void write_string(BinaryWriter& writer, const std::string_view string) {
+		writer.write<uint32_t>(string.size());
+		writer.buffer.insert(writer.buffer.end(), string.begin(), string.end());
+	}
+
+	std::vector<SourceFile> read_source_files(SnapshotReader& reader) {
+		std::vector<SourceFile> files(reader.read<uint32_t>());
+		for (auto& file : files) {
+			file.path = reader.read_string();
+			file.local = reader.read<uint8_t>();
+		}
+		return files;
+	}
+
+	void write_source_files(BinaryWriter& writer, const std::vector<SourceFile>& files) {
+		writer.write<uint32_t>(files.size());
+		for (const auto& file : files) {
+			write_string(writer, file.path.string());
+			writer.write<uint8_t>(file.local);
+		}
+	}
+
+	/// Hashes the current version of every source file together with the hierarchy settings that influence file resolution
+	/// and the version of the load chain that built the tables from them
+	uint64_t source_files_key(const std::vector<SourceFile>& files, const uint32_t chain_version) {
+		std::string key = std::to_string(chain_version);
+		key += '\n';
+		key += hierarchy.hd ? 'h' : '-';
+		key += hierarchy.teen ? 't' : '-';
+		key += hierarchy.ptr ? 'p' : '-';
+		key += hierarchy.local_files ? 'l' : '-';
+		key += hierarchy.tileset;
+		key += '\n';
+
+		for (const auto& file : files) {
+			key += hierarchy.file_version(file);
+			key += '\n';
+		}
+
+		return ankerl::unordered_dense::hash<std::string_view>{}(key);
+	}
+
+	using ShadowMap = decltype(SLK::shadow_data);
+
+	void write_shadow_data(BinaryWriter& writer, const ShadowMap& data) {
+		writer.write<uint32_t>(data.size());
+		for (const auto& [row, columns] : data) {
+			write_string(writer, row);
+			writer.write<uint32_t>(columns.size());
+			for (const auto& [column, value] : columns) {
+				write_string(writer, column);
+				write_string(writer, value);
+			}
+		}
+	}
+
+	void read_shadow_data(SnapshotReader& reader, ShadowMap& data) {
+		const uint32_t rows = reader.read<uint32_t>();
+		data.reserve(rows);
+		for (size_t i = 0; i < rows; i++) {
+			auto& row = data[std::string(reader.read_string())];
+			const uint32_t columns = reader.read<uint32_t>();
+			row.reserve(columns);
+			for (size_t j = 0; j < columns; j++) {
+				const std::string_view column = reader.read_string();
+				row.emplace(column, reader.read_string());
+			}
+		}
+	}
+
+	void write_table(BinaryWriter& writer, const SLK& slk) {
+		write_source_files(writer, slk.source_files);
+
+		// Interned strings in id order, so interning them again on load recreates the same ids
+		writer.write<uint32_t>(slk.strings.size());
+		for (size_t i = 1; i < slk.strings.size(); i++) {
+			write_string(writer, slk.strings.string(i));
+		}
+
+		writer.write<uint32_t>(slk.columns());
+		for (const auto& header : slk.index_to_column) {
+			write_string(writer, header);
+		}
+
+		writer.write<uint32_t>(slk.rows());
+		for (const auto& header : slk.index_to_row) {
+			write_string(writer, header);
+		}
+
+		for (const auto& column : slk.base_columns) {
+			writer.write<uint32_t>(column.size());
+			writer.write_vector(column);
+		}
+
+		write_shadow_data(writer, slk.shadow_data);
+
+		writer.write<uint32_t>(slk.meta_map.size());
+		for (const auto& [field, id] : slk.meta_map) {
+			write_string(writer, field);
+			write_string(writer, id);
+		}
+	}
+
+	void read_table(SnapshotReader& reader, SLK& slk) {
+		slk = SLK();
+		slk.source_files = read_source_files(reader);
+
+		const uint32_t strings = reader.read<uint32_t>();
+		for (size_t i = 1; i < strings; i++) {
+			slk.strings.intern(reader.read_string());
+		}
+
+		const uint32_t columns = reader.read<uint32_t>();
+		slk.column_headers.reserve(columns);
+		for (size_t i = 0; i < columns; i++) {
+			slk.add_column(reader.read_string());
+		}
+
+		const uint32_t rows = reader.read<uint32_t>();
+		slk.row_headers.reserve(rows);
+		for (size_t i = 0; i < rows; i++) {
+			slk.add_row(reader.read_string());
+		}
+
+		// The cells are plain string pool ids and can be copied as is
+		for (auto& column : slk.base_columns) {
+			const uint32_t size = reader.read<uint32_t>();
+			if (reader.position + size * sizeof(uint32_t) > reader.buffer.size()) {
+				throw std::out_of_range("Trying to read out of range of buffer");
+			}
+			column.resize(size);
+			std::memcpy(column.data(), reader.buffer.data() + reader.position, size * sizeof(uint32_t));
+			reader.position += size * sizeof(uint32_t);
+
+			if (std::ranges::any_of(column, [&](uint32_t id) { return id >= slk.strings.size(); })) {
+				throw std::out_of_range("Snapshot cell refers to a string that does not exist");
+			}
+		}
+
+		read_shadow_data(reader, slk.shadow_data);
+
+		const uint32_t fields = reader.read<uint32_t>();
+		slk.meta_map.reserve(fields);
+		for (size_t i = 0; i < fields; i++) {
+			const std::string_view field = reader.read_string();
+			slk.meta_map.emplace(field, reader.read_string());
+		}
+	}
+
+	/// An on disk cache of fully merged SLK tables so that a warm start does not have to parse and merge all the SLK/INI files again.
+	/// The cache consists of named entries which each hold a group of tables (e.g. the unit data and unit meta data).
+	/// An entry is only used if the hash of the versions of all files it was built from still matches.
+	export class SnapshotCache {
+	  public:
+		struct Entry {
+			std::string_view name;
+			/// The version of the code that built the tables, see load()
+			uint32_t chain_version;
+			std::vector<const SLK*> tables;
+		};
+
+		SnapshotCache() = default;
+		explicit SnapshotCache(const fs::path& path) {
+			open(path);
+		}
+
+		/// Maps the cache file and indexes its entries. Returns false if there is no usable cache
+		bool open(const fs::path& path) {
+			entries.clear();
+			if (!file.open(path)) {
+				return false;
+			}
+
+			try {
+				SnapshotReader reader { file.data() };
+				if (reader.read<uint32_t>() != snapshot_magic || reader.read<uint32_t>() != snapshot_version) {
+					file.close();
+					return false;
+				}
+
+				const uint32_t entry_count = reader.read<uint32_t>();
+				for (size_t i = 0; i < entry_count; i++) {
+					const std::string_view name = reader.read_string();
+					const uint64_t size = reader.read<uint64_t>();
+					if (reader.position + size > reader.buffer.size()) {
+						throw std::out_of_range("Snapshot entry exceeds the file size");
+					}
+					entries.emplace(name, reader.buffer.subspan(reader.position, size));
+					reader.position += size;
+				}
+			} catch (const std::out_of_range&) {
+				entries.clear();
+				file.close();
+				return false;
+			}
+			return true;
+		}
+
+		void close() {
+			entries.clear();
+			file.close();
+		}
+
+		/// Restores the tables of the entry if it exists and none of its source files changed. The number of tables has to match the stored entry.
+		/// chain_version has to change whenever the code that builds the tables changes, otherwise stale tables are restored.
+		/// Safe to call concurrently for different entries
+		bool load(const std::string_view name, const uint32_t chain_version, std::span<SLK* const> tables) const {
+			const auto found = entries.find(name);
+			if (found == entries.end()) {
+				return false;
+			}
+
+			try {
+				SnapshotReader reader { found->second };
+				const uint64_t key = reader.read<uint64_t>();
+				if (key != source_files_key(read_source_files(reader), chain_version)) {
+					return false;
+				}
+
+				if (reader.read<uint32_t>() != tables.size()) {
+					return false;
+				}
+
+				for (SLK* table : tables) {
+					read_table(reader, *table);
+				}
+			} catch (const std::out_of_range&) {
+				return false;
+			}
+			return true;
+		}
+
+		/// Writes a new cache file containing all the given entries. The cache may not have the file mapped while saving
+		static void save(const fs::path& path, std::span<const Entry> entries) {
+			BinaryWriter writer;
+			writer.write<uint32_t>(snapshot_magic);
+			writer.write<uint32_t>(snapshot_version);
+			writer.write<uint32_t>(entries.size());
+
+			for (const auto& entry : entries) {
+				std::vector<SourceFile> files;
+				for (const SLK* table : entry.tables) {
+					for (const auto& i : table->source_files) {
+						if (std::find(files.begin(), files.end(), i) == files.end()) {
+							files.push_back(i);
+						}
+					}
+				}
+
+				BinaryWriter entry_writer;
+				entry_writer.write<uint64_t>(source_files_key(files, entry.chain_version));
+				write_source_files(entry_writer, files);
+				entry_writer.write<uint32_t>(entry.tables.size());
+				for (const SLK* table : entry.tables) {
+					write_table(entry_writer, *table);
+				}
+
+				write_string(writer, entry.name);
+				writer.write<uint64_t>(entry_writer.buffer.size());
+				writer.buffer.insert(writer.buffer.end(), entry_writer.buffer.begin(), entry_writer.buffer.end());
+			}
+
+			std::error_code error;
+			fs::create_directories(path.parent_path(), error);
+
+			// Write to a temporary file first so that a crash halfway does not leave a truncated cache behind
+			const fs::path temporary = fs::path(path).concat(".tmp");
+			{
+				std::ofstream output(temporary, std::ios::binary);
+				if (!output) {
+					return;
+				}
+				output.write(reinterpret_cast<const char*>(writer.buffer.data()), writer.buffer.size());
+			}
+			fs::rename(temporary, path, error);
+		}
+
+	  private:
+		MappedFile file;
+		ankerl::unordered_dense::map<std::string_view, std::span<const uint8_t>> entries;
+	};
+} // namespace slk
\ No newline at end of file
@@ -83,6 +83,17 @@ int main(int argc, char *argv[]) {
 	
 	QApplication a(argc, argv);
 
+	// HiveWE --test runs the checks in test.ixx that do not need any game data
+	if (QCoreApplication::arguments().contains("--test")) {
+		return run_tests();
+	}
+
+	// HiveWE --benchmark runs the benchmarks in test.ixx on the game data instead of opening the editor
+	if (QCoreApplication::arguments().contains("--benchmark")) {
+		QSettings settings;
+		return run_benchmarks(settings.value("warcraftDirectory").toString().toStdWString());
+	}
+
 	ads::CDockManager::setConfigFlag(ads::CDockManager::FocusHighlighting);
 	ads::CDockManager::setConfigFlag(ads::CDockManager::AllTabsHaveCloseButton);
 	ads::CDockManager::setConfigFlag(ads::CDockManager::DockAreaDynamicTabsMenuButtonVisibility);
@@ -14,6 +14,8 @@
 
 import OpenGLUtilities;
 import Camera;
+import ResourceManager;
+import Hierarchy;
 
 void APIENTRY gl_debug_output(const GLenum source, const GLenum type, const GLuint id, const GLenum severity, const GLsizei, const GLchar *message, void *) {
 	// Skip buffer info messages, framebuffer info messages, texture usage state warning, redundant state change buffer
@@ -136,6 +138,9 @@ void GLWidget::update_scene() {
 }
 
 void GLWidget::paintGL() {
+	// Finish the GPU side of resources that were loaded in the background
+	resource_manager.process_context_tasks();
+
 	if (!map) {
 		return;
 	}
@@ -174,6 +179,16 @@ void GLWidget::paintGL() {
 
 		p.drawText(300, 50, QString::fromStdString(std::format("Camera Horizontal Angle: {:.4f}", camera.horizontal_angle)));
 		p.drawText(300, 64, QString::fromStdString(std::format("Camera Vertical Angle: {:.4f}", camera.vertical_angle)));
+		p.drawText(300, 78, QString::fromStdString(std::format("Hierarchy Cache Hits: {} Misses: {}", hierarchy.cache_hit_count(), hierarchy.cache_miss_count())));
+
+		const auto& statistics = map->render_manager.statistics;
+		p.drawText(300, 92, QString::fromStdString(std::format("Opaque Draw Calls: {} (Unbatched: {})", statistics.opaque_draw_calls, statistics.opaque_layers)));
+
+		const auto& animation = map->animation_scheduler.statistics;
+		p.drawText(300, 106, QString::fromStdString(std::format("Skeleton Updates: {} Shared: {} Throttled: {} Cached Poses: {}", animation.evaluated, animation.shared, animation.throttled, map->animation_scheduler.pose_cache.size())));
+
+		const auto& undo = map->terrain_undo;
+		p.drawText(300, 120, QString::fromStdString(std::format("Undo History: {:.1f}MB in memory {:.1f}MB on disk", undo.memory_usage() / 1048576.0, undo.disk_usage() / 1048576.0)));
 
 		p.end();
 
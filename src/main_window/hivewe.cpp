@@ -22,6 +22,7 @@ namespace fs = std::filesystem;
 #include "map_global.h"
 
 #include <soil2/SOIL2.h>
+#include <QStandardPaths>
 
 #define STORMLIB_NO_AUTO_LINK
 #include <StormLib.h>
@@ -31,6 +32,14 @@ import MPQ;
 import OpenGLUtilities;
 import Camera;
 
+/// Creates an empty map with the user settings that apply to every map
+static Map* create_map() {
+	QSettings settings;
+	Map* result = new Map();
+	result->terrain_undo.memory_budget = settings.value("undoMemoryBudget", 256).toULongLong() * 1024 * 1024;
+	return result;
+}
+
 HiveWE::HiveWE(QWidget* parent) : QMainWindow(parent) {
 	setAutoFillBackground(true);
 
@@ -43,6 +52,7 @@ HiveWE::HiveWE(QWidget* parent) : QMainWindow(parent) {
 	hierarchy.teen = settings.value("teen", "False").toString() != "False";
 	QSettings war3reg("HKEY_CURRENT_USER\\Software\\Blizzard Entertainment\\Warcraft III", QSettings::NativeFormat);
 	hierarchy.local_files = war3reg.value("Allow Local Files", 0).toInt() != 0;
+	hierarchy.casc_index_path = fs::path(QStandardPaths::writableLocation(QStandardPaths::AppConfigLocation).toStdWString()) / "casc_index.bin";
 	while (!hierarchy.open_casc(directory)) {
 		directory = QFileDialog::getExistingDirectory(this, "Select Warcraft Directory", "/home", QFileDialog::ShowDirsOnly | QFileDialog::DontResolveSymlinks).toStdWString();
 		if (directory == "") {
@@ -96,6 +106,7 @@ HiveWE::HiveWE(QWidget* parent) : QMainWindow(parent) {
 	connect(ui.ribbon->wireframe_visible, &QPushButton::toggled, [](bool checked) { map->render_wireframe = checked; });
 	connect(ui.ribbon->debug_visible, &QPushButton::toggled, [](bool checked) { map->render_debug = checked; });
 	connect(ui.ribbon->minimap_visible, &QPushButton::toggled, [&](bool checked) { (checked) ? minimap->show() : minimap->hide(); });
+	connect(ui.ribbon->freeze_animations, &QPushButton::toggled, [](bool checked) { map->animation_scheduler.frozen = checked; });
 
 	connect(new QShortcut(Qt::CTRL | Qt::Key_U, this), &QShortcut::activated, ui.ribbon->units_visible, &QPushButton::click);
 	connect(new QShortcut(Qt::CTRL | Qt::Key_D, this), &QShortcut::activated, ui.ribbon->doodads_visible, &QPushButton::click);
@@ -198,7 +209,7 @@ HiveWE::HiveWE(QWidget* parent) : QMainWindow(parent) {
 
 	connect(minimap, &Minimap::clicked, [](QPointF location) { camera.position = { location.x() * map->terrain.width, (1.0 - location.y()) * map->terrain.height, camera.position.z }; });
 	ui.widget->makeCurrent();
-	map = new Map();
+	map = create_map();
 	connect(&map->terrain, &Terrain::minimap_changed, minimap, &Minimap::set_minimap);
 
 	ui.widget->makeCurrent();
@@ -230,7 +241,7 @@ void HiveWE::load_folder() {
 	loading_box->show();
 
 	delete map;
-	map = new Map();
+	map = create_map();
 
 	connect(&map->terrain, &Terrain::minimap_changed, minimap, &Minimap::set_minimap);
 
@@ -296,7 +307,7 @@ void HiveWE::load_mpq() {
 
 	// Load map
 	delete map;
-	map = new Map();
+	map = create_map();
 
 	connect(&map->terrain, &Terrain::minimap_changed, minimap, &Minimap::set_minimap);
 
@@ -465,7 +476,7 @@ void HiveWE::import_heightmap() {
 
 	for (int j = 0; j < height; j++) {
 		for (int i = 0; i < width; i++) {
-			map->terrain.corners[i][j].height = (image_data[((height - 1 - j) * width + i) * channels] - 128) / 16.f;
+			map->terrain.corners(i, j).height = (image_data[((height - 1 - j) * width + i) * channels] - 128) / 16.f;
 		}
 	}
 
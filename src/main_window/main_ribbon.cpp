@@ -98,6 +98,11 @@ MainRibbon::MainRibbon(QWidget* parent) : QRibbon(parent) {
 	minimap_visible->setCheckable(true);
 	minimap_visible->setChecked(true);
 	visible_section->addWidget(minimap_visible);
+
+	freeze_animations->setIcon(QIcon("Data/Icons/Ribbon/lock.png"));
+	freeze_animations->setText("Freeze\nAnimations");
+	freeze_animations->setCheckable(true);
+	visible_section->addWidget(freeze_animations);
 	// Camera section
 	QRibbonSection* camera_section = new QRibbonSection;
 	camera_section->setText("Camera");
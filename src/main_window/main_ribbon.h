@@ -24,6 +24,7 @@ public:
 	QRibbonButton* wireframe_visible = new QRibbonButton;
 	QRibbonButton* debug_visible = new QRibbonButton;
 	QRibbonButton* minimap_visible = new QRibbonButton;
+	QRibbonButton* freeze_animations = new QRibbonButton;
 
 	QRibbonButton* switch_camera = new QRibbonButton;
 	QRibbonButton* reset_camera = new QRibbonButton;
@@ -328,8 +328,12 @@ DoodadPalette::DoodadPalette(QWidget* parent) : Palette(parent) {
 	
 	connect(edit_in_oe, &QSmallRibbonButton::clicked, [&]() {
 		bool created;
+		const auto selected = brush.selected_doodads();
+		if (selected.empty()) {
+			return;
+		}
 		auto editor = window_handler.create_or_raise<ObjectEditor>(nullptr, created);
-		const Doodad* doodad = *brush.selections.begin();
+		const Doodad* doodad = selected.front();
 		if (destructibles_slk.row_headers.contains(doodad->id)) {
 			editor->select_id(ObjectEditor::Category::destructible, doodad->id);
 		} else {
@@ -338,7 +342,11 @@ DoodadPalette::DoodadPalette(QWidget* parent) : Palette(parent) {
 	});
 
 	connect(select_in_palette, &QSmallRibbonButton::clicked, [&]() {
-		const Doodad* doodad = *brush.selections.begin();
+		const auto selected = brush.selected_doodads();
+		if (selected.empty()) {
+			return;
+		}
+		const Doodad* doodad = selected.front();
 		ui.search->clear();
 
 		if (destructibles_slk.row_headers.contains(doodad->id)) {
@@ -444,7 +452,8 @@ QString toString(float num) {
 }
 
 void DoodadPalette::update_selection_info() {
-	if (brush.selections.empty()) {
+	const auto selected = brush.selected_doodads();
+	if (selected.empty()) {
 		if (current_selection_section->isEnabled()) {
 			current_selection_section->setEnabled(false);
 		}
@@ -452,7 +461,7 @@ void DoodadPalette::update_selection_info() {
 		if (!current_selection_section->isEnabled()) {
 			current_selection_section->setEnabled(true);
 		}
-		const Doodad& doodad = **brush.selections.begin();
+		const Doodad& doodad = *selected.front();
 
 		float first_relative_height = doodad.position.z - map->terrain.interpolated_height(doodad.position.x, doodad.position.y);
 		bool same_object = true;
@@ -462,7 +471,7 @@ void DoodadPalette::update_selection_info() {
 		bool same_angle = true;
 		bool same_absolute_height = true;
 		bool same_relative_height = true;
-		for (const auto& i : brush.selections) {
+		for (const auto& i : selected) {
 			float other_relative_height = i->position.z - map->terrain.interpolated_height(i->position.x, i->position.y);
 
 			same_object = same_object && i->id == doodad.id;
@@ -525,7 +534,7 @@ void DoodadPalette::update_relative_change(const QString& text) {
 
 void DoodadPalette::set_group_height_minimum() {
 	float minimum = std::numeric_limits<float>::max();
-	for (auto& i : brush.selections) {
+	for (const auto& i : brush.selected_doodads()) {
 		minimum = std::min(minimum, i->position.z);
 	}
 
@@ -533,16 +542,21 @@ void DoodadPalette::set_group_height_minimum() {
 }
 
 void DoodadPalette::set_group_height_average() {
+	const auto selected = brush.selected_doodads();
+	if (selected.empty()) {
+		return;
+	}
+
 	float average = 0.f;
-	for (auto& i : brush.selections) {
+	for (const auto& i : selected) {
 		average += i->position.z;
 	}
-	brush.set_selection_absolute_height(average / brush.selections.size());
+	brush.set_selection_absolute_height(average / selected.size());
 }
 
 void DoodadPalette::set_group_height_maximum() {
 	float maximum = std::numeric_limits<float>::min();
-	for (auto& i : brush.selections) {
+	for (const auto& i : brush.selected_doodads()) {
 		maximum = std::max(maximum, i->position.z);
 	}
 
@@ -143,7 +143,7 @@ void TilePather::save_tiles() {
 		}
 	}
 
-	glTextureSubImage2D(map->pathing_map.texture_static, 0, 0, 0, map->pathing_map.width, map->pathing_map.height, GL_RED_INTEGER, GL_UNSIGNED_BYTE, map->pathing_map.pathing_cells_static.data());
+	map->pathing_map.dirty_static.add(QRect(0, 0, map->pathing_map.width, map->pathing_map.height));
 
 	close();
 }
\ No newline at end of file
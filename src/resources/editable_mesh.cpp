@@ -243,7 +243,7 @@ void EditableMesh::render_opaque_hd(const SkeletalModelInstance& skeleton, const
 	glUniform1i(3, mdx->bones.size());
 	glUniformMatrix4fv(4, 1, false, &M[0][0]);
 	glUniform3fv(6, 1, &light_direction.x);
-	glUniformMatrix4fv(8, mdx->bones.size(), false, &skeleton.world_matrices[0][0][0]);
+	glUniformMatrix4fv(8, mdx->bones.size(), false, &skeleton.node_matrices()[0][0][0]);
 
 	for (const auto& i : geosets) {
 		if (!i.hd) {
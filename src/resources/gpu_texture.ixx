@@ -4,6 +4,8 @@ module;
 #include <filesystem>
 #include <glad/glad.h>
 #include <iostream>
+#include <memory>
+#include <vector>
 
 export module GPUTexture;
 
@@ -13,6 +15,7 @@ import BinaryReader;
 import ResourceManager;
 import Hierarchy;
 import BLP;
+import no_init_allocator;
 
 export class GPUTexture : public Resource {
   public:
@@ -20,7 +23,42 @@ export class GPUTexture : public Resource {
 
 	static constexpr const char* name = "GPUTexture";
 
-	explicit GPUTexture(const fs::path& path) {
+	/// The CPU side of loading a texture which can be done on any thread
+	struct Decoded {
+		fs::path path;
+		std::vector<uint8_t, default_init_allocator<uint8_t>> file;
+
+		// Only for BLP files, other formats are decoded by SOIL while uploading
+		int width = 0;
+		int height = 0;
+		std::unique_ptr<uint8_t[]> pixels;
+	};
+
+	explicit GPUTexture(const fs::path& path)
+		: GPUTexture(decode(path)) {
+	}
+
+	explicit GPUTexture(Decoded decoded) {
+		if (decoded.pixels) {
+			glCreateTextures(GL_TEXTURE_2D, 1, &id);
+			glTextureStorage2D(id, log2(std::max(decoded.width, decoded.height)) + 1, GL_RGBA8, decoded.width, decoded.height);
+			glTextureSubImage2D(id, 0, 0, 0, decoded.width, decoded.height, GL_RGBA, GL_UNSIGNED_BYTE, decoded.pixels.get());
+			glGenerateTextureMipmap(id);
+		} else {
+			id = SOIL_load_OGL_texture_from_memory(decoded.file.data(), static_cast<int>(decoded.file.size()), SOIL_LOAD_AUTO, SOIL_LOAD_AUTO, SOIL_FLAG_DDS_LOAD_DIRECT | SOIL_FLAG_SRGB_COLOR_SPACE);
+			if (id == 0) {
+				glCreateTextures(GL_TEXTURE_2D, 1, &id);
+				std::cout << "Error loading texture: " << decoded.path << "\n";
+			}
+		}
+
+		glTextureParameteri(id, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTextureParameteri(id, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTextureParameteri(id, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTextureParameteri(id, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+
+	static Decoded decode(const fs::path& path) {
 		fs::path new_path = path;
 
 		if (hierarchy.hd) {
@@ -38,31 +76,18 @@ export class GPUTexture : public Resource {
 			}
 		}
 
+		Decoded decoded;
+		decoded.path = path;
+
 		BinaryReader reader = hierarchy.open_file(new_path);
 
 		if (new_path.extension() == ".blp" || new_path.extension() == ".BLP") {
-			int width;
-			int height;
 			int channels;
-			uint8_t* data = blp::load(reader, width, height, channels);
-
-			glCreateTextures(GL_TEXTURE_2D, 1, &id);
-			glTextureStorage2D(id, log2(std::max(width, height)) + 1, GL_RGBA8, width, height);
-			glTextureSubImage2D(id, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, data);
-			glGenerateTextureMipmap(id);
-			delete data;
+			decoded.pixels.reset(blp::load(reader, decoded.width, decoded.height, channels));
 		} else {
-			id = SOIL_load_OGL_texture_from_memory(reader.buffer.data(), static_cast<int>(reader.buffer.size()), SOIL_LOAD_AUTO, SOIL_LOAD_AUTO, SOIL_FLAG_DDS_LOAD_DIRECT | SOIL_FLAG_SRGB_COLOR_SPACE);
-			if (id == 0) {
-				glCreateTextures(GL_TEXTURE_2D, 1, &id);
-				std::cout << "Error loading texture: " << path << "\n";
-			}
+			decoded.file = std::move(reader.buffer);
 		}
-
-		glTextureParameteri(id, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTextureParameteri(id, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTextureParameteri(id, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTextureParameteri(id, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		return decoded;
 	}
 
 	virtual ~GPUTexture() {
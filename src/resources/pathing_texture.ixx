@@ -27,6 +27,7 @@ export class PathingTexture : public Resource {
 	bool homogeneous;
 
 	static constexpr const char* name = "PathingTexture";
+	static constexpr bool thread_safe_construction = true;
 
 	explicit PathingTexture(const fs::path& path) {
 		BinaryReader reader = hierarchy.open_file(path);
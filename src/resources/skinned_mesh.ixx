@@ -2,11 +2,19 @@ module;
 
 #include <filesystem>
 #include <memory>
+#include <vector>
+#include <optional>
+#include <stdexcept>
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 
+#include "unordered_dense.h"
+
 export module SkinnedMesh;
 
 import MDX;
@@ -14,11 +22,109 @@ import ResourceManager;
 import GPUTexture;
 import Shader;
 import Hierarchy;
+import BinaryReader;
 import Camera;
 import SkeletalModelInstance;
+import StreamingBuffer;
+import BufferArena;
+import RayCast;
 
 namespace fs = std::filesystem;
 
+/// The index, uv and normal data of all skinned meshes lives in shared arenas so that geosets of different meshes can be drawn with a single multi draw call.
+/// The preskin compute shader also writes the vertices of all meshes into one shared pair of buffers every frame
+export struct SkinnedMeshArenas {
+	BufferArena indices;
+	BufferArena uvs;
+	BufferArena normals;
+
+	GLuint preskinned_vertices = 0;
+	GLuint preskinned_tangent_light_directions = 0;
+	size_t preskinned_capacity = 0;
+	size_t preskinned_used = 0;
+
+	/// Binds a vertex array that uses the index arena as its element buffer
+	void bind_vertex_array() {
+		if (vao == 0) {
+			glCreateVertexArrays(1, &vao);
+		}
+		glVertexArrayElementBuffer(vao, indices.buffer);
+		glBindVertexArray(vao);
+	}
+
+	/// Reserves room for count preskinned vertices in the current frame. Returns the index of the first one.
+	/// Every allocation is a multiple of 16 vec4s (256 bytes) so that it can be bound with glBindBufferRange
+	size_t allocate_preskinned(const size_t count) {
+		const size_t offset = preskinned_used;
+		preskinned_used += std::max<size_t>((count + 15) / 16 * 16, 16);
+		return offset;
+	}
+
+	/// Grows the preskinned buffers to fit all allocations made since the last call and starts over for the next frame
+	void reserve_preskinned() {
+		const size_t size = preskinned_used * sizeof(glm::vec4);
+		preskinned_used = 0;
+		if (size <= preskinned_capacity) {
+			return;
+		}
+
+		if (preskinned_vertices == 0) {
+			glCreateBuffers(1, &preskinned_vertices);
+			glCreateBuffers(1, &preskinned_tangent_light_directions);
+		}
+		preskinned_capacity = std::max(size, preskinned_capacity * 2);
+		glNamedBufferData(preskinned_vertices, preskinned_capacity, nullptr, GL_DYNAMIC_COPY);
+		glNamedBufferData(preskinned_tangent_light_directions, preskinned_capacity, nullptr, GL_DYNAMIC_COPY);
+	}
+
+  private:
+	GLuint vao = 0;
+};
+
+export inline SkinnedMeshArenas skinned_mesh_arenas;
+
+/// Sets the blending, culling and depth state of a material layer.
+/// The transparent pass keeps depth writes disabled for all layers
+export void apply_layer_state(const uint32_t blend_mode, const uint32_t shading_flags, const bool transparent_pass = false) {
+	switch (blend_mode) {
+		case 0:
+		case 1:
+			glBlendFunc(GL_ONE, GL_ZERO);
+			break;
+		case 2:
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			break;
+		case 3:
+			glBlendFunc(GL_ONE, GL_ONE);
+			break;
+		case 4:
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+			break;
+		case 5:
+			glBlendFunc(GL_ZERO, GL_SRC_COLOR);
+			break;
+		case 6:
+			glBlendFunc(GL_DST_COLOR, GL_SRC_COLOR);
+			break;
+	}
+
+	if (shading_flags & 0x10) {
+		glDisable(GL_CULL_FACE);
+	} else {
+		glEnable(GL_CULL_FACE);
+	}
+
+	if (shading_flags & 0x40) {
+		glDisable(GL_DEPTH_TEST);
+	} else {
+		glEnable(GL_DEPTH_TEST);
+	}
+
+	if (!transparent_pass) {
+		glDepthMask(!(shading_flags & 0x80));
+	}
+}
+
 export class SkinnedMesh : public Resource {
   public:
 	struct MeshEntry {
@@ -33,6 +139,51 @@ export class SkinnedMesh : public Resource {
 		mdx::GeosetAnimation* geoset_anim; // can be nullptr, often
 	};
 
+	/// The state an opaque layer is drawn with. Layers with equal state are drawn with a single glMultiDrawElementsIndirect
+	struct BatchState {
+		bool hd = false;
+		uint32_t blend_mode = 0;
+		uint32_t shading_flags = 0;
+		std::array<GLuint, 6> textures = {};
+
+		auto operator<=>(const BatchState&) const = default;
+	};
+
+	/// Matches the layout OpenGL expects in the indirect buffer
+	struct DrawElementsIndirectCommand {
+		uint32_t count;
+		uint32_t instance_count;
+		uint32_t first_index;
+		int32_t base_vertex;
+		uint32_t base_instance;
+	};
+
+	struct BatchedDraw {
+		BatchState state;
+		DrawElementsIndirectCommand command;
+	};
+
+	/// Per instance data of a batched draw. Read as instanced vertex attributes so that the base_instance of the command selects it
+	struct BatchInstance {
+		glm::vec4 color;
+		/// The first preskinned vertex of the instance
+		uint32_t preskinned_offset;
+		/// The first vertex of the mesh in the uv arena
+		uint32_t first_vertex;
+		/// The first vertex of the mesh in the normal arena
+		uint32_t first_normal;
+	};
+
+	/// Per instance data of the picking pass, read as instanced vertex attributes like BatchInstance
+	struct PickInstance {
+		/// The first preskinned vertex of the instance
+		uint32_t preskinned_offset;
+		/// The first vertex of the mesh in the uv arena (which the base vertex of the command refers to)
+		uint32_t first_vertex;
+		/// 0 if the geoset is invisible for this instance
+		uint32_t pick_id;
+	};
+
 	std::shared_ptr<mdx::MDX> model;
 
 	std::vector<MeshEntry> geosets;
@@ -41,22 +192,32 @@ export class SkinnedMesh : public Resource {
 
 	uint32_t instance_vertex_count = 0;
 
-	GLuint vao;
-	GLuint vertex_buffer;
-	GLuint uv_buffer;
-	GLuint normal_buffer;
-	GLuint tangent_buffer;
-	GLuint weight_buffer;
-	GLuint index_buffer;
-	GLuint layer_alpha;
-
-	GLuint instance_ssbo;
-	GLuint layer_colors_ssbo;
-	GLuint bones_ssbo;
-	GLuint bones_ssbo_colored;
-
-	GLuint preskinned_vertex_ssbo;
-	GLuint preskinned_tangent_light_direction_ssbo;
+	GLuint vertex_buffer = 0;
+	GLuint tangent_buffer = 0;
+	GLuint weight_buffer = 0;
+	GLuint layer_alpha = 0;
+
+	/// CPU copies of the LOD 0 vertex data for ray picking, see intersect().
+	/// Kept for every loaded model, which costs 24 bytes per vertex and 2 per index of system memory on top of the GPU buffers
+	std::vector<glm::vec4> cpu_vertices;
+	/// 4 bone indices followed by 4 bone weights per vertex
+	std::vector<uint8_t> cpu_weights;
+	std::vector<uint16_t> cpu_indices;
+
+	/// Ranges of the shared arenas in skinned_mesh_arenas
+	BufferArena::Range index_range;
+	BufferArena::Range uv_range;
+	BufferArena::Range normal_range;
+
+	/// Ranges of the shared streaming buffer that hold the data of the current frame
+	StreamingBuffer::Allocation instance_data;
+	StreamingBuffer::Allocation bone_data;
+	/// For every instance the index of its pose in bone_data
+	StreamingBuffer::Allocation pose_index_data;
+	StreamingBuffer::Allocation layer_color_data;
+
+	/// Where the preskinned vertices of this frame start in the shared preskinned buffers
+	size_t preskinned_offset = 0;
 
 	int skip_count = 0;
 
@@ -64,80 +225,127 @@ export class SkinnedMesh : public Resource {
 	std::vector<std::shared_ptr<GPUTexture>> textures;
 	std::vector<glm::mat4> render_jobs;
 	std::vector<glm::vec3> render_colors;
+	/// The id every instance is drawn with in the picking pass, 0 if it can not be picked
+	std::vector<uint32_t> pick_ids;
 	std::vector<const SkeletalModelInstance*> skeletons;
-	std::vector<glm::mat4> instance_bone_matrices;
 	std::vector<glm::vec4> layer_colors;
+	/// Scratch space to find the distinct poses of the instances
+	ankerl::unordered_dense::map<const glm::mat4*, uint32_t> pose_lookup;
+	std::vector<uint32_t> pose_indices;
 
 	static constexpr const char* name = "SkinnedMesh";
 
-	explicit SkinnedMesh(const fs::path& path, std::optional<std::pair<int, std::string>> replaceable_id_override) {
-		if (path.extension() != ".mdx" && path.extension() != ".MDX") {
-			throw;
-		}
-
-		BinaryReader reader = hierarchy.open_file(path);
-		this->path = path;
-
-		size_t vertices = 0;
-		size_t indices = 0;
-		size_t matrices = 0;
+	/// Everything needed to create a SkinnedMesh that can be prepared on any thread: the parsed model and its vertex data packed in the layout of the GPU buffers
+	struct Decoded {
+		fs::path path;
+		std::shared_ptr<mdx::MDX> model;
+
+		std::vector<MeshEntry> geosets;
+		bool has_transparent_layers = false;
+		int skip_count = 0;
+		uint32_t instance_vertex_count = 0;
+
+		std::vector<glm::vec4> vertices;
+		std::vector<glm::vec2> uvs;
+		std::vector<glm::vec4> normals;
+		std::vector<glm::vec4> tangents;
+		/// 4 bone indices followed by 4 bone weights per vertex
+		std::vector<uint8_t> weights;
+		std::vector<uint16_t> indices;
+
+		/// In the order of model->textures
+		std::vector<ResourceFuture<GPUTexture>> textures;
+	};
 
-		model = std::make_shared<mdx::MDX>(reader);
+	explicit SkinnedMesh(const fs::path& path, std::optional<std::pair<int, std::string>> replaceable_id_override)
+		: SkinnedMesh(decode(path, replaceable_id_override)) {
+	}
 
-		glGenVertexArrays(1, &vao);
-		glBindVertexArray(vao);
+	/// Creates the OpenGL objects. Has to run on the OpenGL context thread
+	explicit SkinnedMesh(Decoded decoded) {
+		path = std::move(decoded.path);
+		model = std::move(decoded.model);
 
 		has_mesh = model->geosets.size();
 		if (!has_mesh) {
 			return;
 		}
 
+		geosets = std::move(decoded.geosets);
+		has_transparent_layers = decoded.has_transparent_layers;
+		skip_count = decoded.skip_count;
+		instance_vertex_count = decoded.instance_vertex_count;
+
+		glCreateBuffers(1, &vertex_buffer);
+		glNamedBufferStorage(vertex_buffer, decoded.vertices.size() * sizeof(glm::vec4), decoded.vertices.data(), GL_DYNAMIC_STORAGE_BIT | GL_MAP_READ_BIT);
+
+		uv_range = skinned_mesh_arenas.uvs.allocate(decoded.uvs.size() * sizeof(glm::vec2), decoded.uvs.data());
+		normal_range = skinned_mesh_arenas.normals.allocate(decoded.normals.size() * sizeof(glm::vec4), decoded.normals.data());
+
+		glCreateBuffers(1, &tangent_buffer);
+		glNamedBufferStorage(tangent_buffer, decoded.tangents.size() * sizeof(glm::vec4), decoded.tangents.data(), GL_DYNAMIC_STORAGE_BIT | GL_MAP_READ_BIT);
+
+		glCreateBuffers(1, &weight_buffer);
+		glNamedBufferStorage(weight_buffer, decoded.weights.size(), decoded.weights.data(), GL_DYNAMIC_STORAGE_BIT | GL_MAP_READ_BIT);
+
+		index_range = skinned_mesh_arenas.indices.allocate(decoded.indices.size() * sizeof(uint16_t), decoded.indices.data());
+
+		cpu_vertices = std::move(decoded.vertices);
+		cpu_weights = std::move(decoded.weights);
+		cpu_indices = std::move(decoded.indices);
+
+		for (size_t i = 0; i < decoded.textures.size(); i++) {
+			const mdx::Texture& texture = model->textures[i];
+			textures.push_back(decoded.textures[i].get());
+			glTextureParameteri(textures.back()->id, GL_TEXTURE_WRAP_S, texture.flags & 1 ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+			glTextureParameteri(textures.back()->id, GL_TEXTURE_WRAP_T, texture.flags & 2 ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+		}
+	}
+
+	/// Parses the model and prepares its vertex data. Does not touch OpenGL so it can run on any thread.
+	/// The textures are requested from the resource manager asynchronously
+	static Decoded decode(const fs::path& path, std::optional<std::pair<int, std::string>> replaceable_id_override) {
+		if (path.extension() != ".mdx" && path.extension() != ".MDX") {
+			throw std::invalid_argument("SkinnedMesh can only be loaded from .mdx files: " + path.string());
+		}
+
+		BinaryReader reader = hierarchy.open_file(path);
+
+		Decoded decoded;
+		decoded.path = path;
+		decoded.model = std::make_shared<mdx::MDX>(reader);
+		const auto& model = decoded.model;
+
+		if (model->geosets.empty()) {
+			return decoded;
+		}
+
 		for (const auto& i : model->geosets) {
 			const auto& layer = model->materials[i.material_id].layers[0];
 			if (layer.blend_mode != 0 && layer.blend_mode != 1) {
-				has_transparent_layers = true;
+				decoded.has_transparent_layers = true;
 				break;
 			}
 		}
 
 		// Calculate required space
+		size_t vertices = 0;
+		size_t indices = 0;
 		for (const auto& i : model->geosets) {
 			if (i.lod != 0) {
 				continue;
 			}
 			vertices += i.vertices.size();
 			indices += i.faces.size();
-			matrices += i.matrix_groups.size();
 		}
 
-		// Allocate space
-		glCreateBuffers(1, &vertex_buffer);
-		glNamedBufferStorage(vertex_buffer, vertices * sizeof(glm::vec4), nullptr, GL_DYNAMIC_STORAGE_BIT | GL_MAP_READ_BIT);
-
-		glCreateBuffers(1, &uv_buffer);
-		glNamedBufferStorage(uv_buffer, vertices * sizeof(glm::vec2), nullptr, GL_DYNAMIC_STORAGE_BIT | GL_MAP_READ_BIT);
-
-		glCreateBuffers(1, &normal_buffer);
-		glNamedBufferStorage(normal_buffer, vertices * sizeof(glm::vec4), nullptr, GL_DYNAMIC_STORAGE_BIT | GL_MAP_READ_BIT);
-
-		glCreateBuffers(1, &tangent_buffer);
-		glNamedBufferStorage(tangent_buffer, vertices * sizeof(glm::vec4), nullptr, GL_DYNAMIC_STORAGE_BIT | GL_MAP_READ_BIT);
-
-		glCreateBuffers(1, &weight_buffer);
-		glNamedBufferStorage(weight_buffer, vertices * sizeof(glm::uvec2), nullptr, GL_DYNAMIC_STORAGE_BIT | GL_MAP_READ_BIT);
-
-		glCreateBuffers(1, &index_buffer);
-		glNamedBufferStorage(index_buffer, indices * sizeof(uint16_t), nullptr, GL_DYNAMIC_STORAGE_BIT | GL_MAP_READ_BIT);
+		decoded.vertices.reserve(vertices);
+		decoded.uvs.reserve(vertices);
+		decoded.normals.reserve(vertices);
+		decoded.tangents.reserve(vertices);
+		decoded.weights.reserve(vertices * 8);
+		decoded.indices.reserve(indices);
 
-		glCreateBuffers(1, &instance_ssbo);
-		glCreateBuffers(1, &layer_colors_ssbo);
-		glCreateBuffers(1, &bones_ssbo);
-		glCreateBuffers(1, &bones_ssbo_colored);
-
-		glCreateBuffers(1, &preskinned_vertex_ssbo);
-		glCreateBuffers(1, &preskinned_tangent_light_direction_ssbo);
-
-		// Buffer Data
 		int base_vertex = 0;
 		int base_index = 0;
 
@@ -156,7 +364,7 @@ export class SkinnedMesh : public Resource {
 			entry.geoset_anim = nullptr;
 			entry.extent = i.extent;
 
-			geosets.push_back(entry);
+			decoded.geosets.push_back(entry);
 
 			// If the skin vector is empty then the model has SD bone weights and we convert them to the HD skin weights.
 			// Technically SD supports infinite bones per vertex, but we limit it to 4 like HD does.
@@ -185,62 +393,55 @@ export class SkinnedMesh : public Resource {
 					bone_offset += group_size;
 				}
 
-				std::vector<glm::u8vec4> skin_weights;
-				skin_weights.reserve(entry.vertices * 2);
 				for (const auto& vertex_group : i.vertex_groups) {
-					skin_weights.push_back(groups[vertex_group]);
-					skin_weights.push_back(weights[vertex_group]);
+					const glm::u8vec4 group = groups[vertex_group];
+					const glm::u8vec4 weight = weights[vertex_group];
+					decoded.weights.insert(decoded.weights.end(), { group.x, group.y, group.z, group.w, weight.x, weight.y, weight.z, weight.w });
 				}
-
-				glNamedBufferSubData(weight_buffer, base_vertex * sizeof(glm::uvec2), entry.vertices * 8, skin_weights.data());
 			} else {
-				glNamedBufferSubData(weight_buffer, base_vertex * sizeof(glm::uvec2), entry.vertices * 8, i.skin.data());
+				decoded.weights.insert(decoded.weights.end(), i.skin.begin(), i.skin.begin() + entry.vertices * 8);
 			}
 
-			std::vector<glm::vec4> vertices_vec4;
 			for (const auto& j : i.vertices) {
-				vertices_vec4.push_back(glm::vec4(j, 1.f));
+				decoded.vertices.push_back(glm::vec4(j, 1.f));
 			}
 
-			std::vector<glm::vec4> normals_vec4;
 			for (const auto& j : i.normals) {
-				normals_vec4.push_back(glm::vec4(j, 1.f));
+				decoded.normals.push_back(glm::vec4(j, 1.f));
 			}
 
-			glNamedBufferSubData(vertex_buffer, base_vertex * sizeof(glm::vec4), entry.vertices * sizeof(glm::vec4), vertices_vec4.data());
-			glNamedBufferSubData(uv_buffer, base_vertex * sizeof(glm::vec2), entry.vertices * sizeof(glm::vec2), i.texture_coordinate_sets.front().data());
-			glNamedBufferSubData(normal_buffer, base_vertex * sizeof(glm::vec4), entry.vertices * sizeof(glm::vec4), normals_vec4.data());
-			//glNamedBufferSubData(tangent_buffer, base_vertex * sizeof(glm::vec4), entry.vertices * sizeof(glm::vec4), i.tangents.data());
+			decoded.uvs.insert(decoded.uvs.end(), i.texture_coordinate_sets.front().begin(), i.texture_coordinate_sets.front().begin() + entry.vertices);
+
 			if (!i.tangents.empty()) {
-				glNamedBufferSubData(tangent_buffer, base_vertex * sizeof(glm::vec4), entry.vertices * sizeof(glm::vec4), i.tangents.data());
+				decoded.tangents.insert(decoded.tangents.end(), i.tangents.begin(), i.tangents.begin() + entry.vertices);
 			} else {
-				glNamedBufferSubData(tangent_buffer, base_vertex * sizeof(glm::vec4), entry.vertices * sizeof(glm::vec4), normals_vec4.data());
+				decoded.tangents.insert(decoded.tangents.end(), decoded.normals.end() - entry.vertices, decoded.normals.end());
 			}
 
-			glNamedBufferSubData(index_buffer, base_index * sizeof(uint16_t), entry.indices * sizeof(uint16_t), i.faces.data());
+			decoded.indices.insert(decoded.indices.end(), i.faces.begin(), i.faces.end());
 
 			base_vertex += entry.vertices;
 			base_index += entry.indices;
 		}
 
-		for (auto& i : geosets) {
-			skip_count += model->materials[i.material_id].layers.size();
+		for (auto& i : decoded.geosets) {
+			decoded.skip_count += model->materials[i.material_id].layers.size();
 		}
 
-		for (const auto& i : geosets) {
-			instance_vertex_count += i.indices;
+		for (const auto& i : decoded.geosets) {
+			decoded.instance_vertex_count += i.indices;
 		}
 
 		// animations geoset ids > geosets
 		for (auto& i : model->animations) {
-			if (i.geoset_id >= 0 && i.geoset_id < geosets.size()) {
-				geosets[i.geoset_id].geoset_anim = &i;
+			if (i.geoset_id >= 0 && i.geoset_id < decoded.geosets.size()) {
+				decoded.geosets[i.geoset_id].geoset_anim = &i;
 			}
 		}
 
 		for (size_t i = 0; i < model->textures.size(); i++) {
 			const mdx::Texture& texture = model->textures[i];
-			
+
 			if (texture.replaceable_id != 0) {
 				// Figure out if this is an HD texture
 				// Unfortunately replaceable ID textures don't have any additional information on whether they are diffuse/normal/orm
@@ -284,49 +485,62 @@ export class SkinnedMesh : public Resource {
 				}
 
 				if (replaceable_id_override && texture.replaceable_id == replaceable_id_override->first) {
-					textures.push_back(resource_manager.load<GPUTexture>(replaceable_id_override->second + suffix, std::to_string(texture.flags)));
+					decoded.textures.push_back(resource_manager.load_async<GPUTexture>(replaceable_id_override->second + suffix, std::to_string(texture.flags)));
 				} else {
-					textures.push_back(resource_manager.load<GPUTexture>(mdx::replacable_id_to_texture.at(texture.replaceable_id) + suffix, std::to_string(texture.flags)));
+					decoded.textures.push_back(resource_manager.load_async<GPUTexture>(mdx::replacable_id_to_texture.at(texture.replaceable_id) + suffix, std::to_string(texture.flags)));
 				}
 			} else {
-				textures.push_back(resource_manager.load<GPUTexture>(texture.file_name, std::to_string(texture.flags)));
+				decoded.textures.push_back(resource_manager.load_async<GPUTexture>(texture.file_name, std::to_string(texture.flags)));
 			}
-			glTextureParameteri(textures.back()->id, GL_TEXTURE_WRAP_S, texture.flags & 1 ? GL_REPEAT : GL_CLAMP_TO_EDGE);
-			glTextureParameteri(textures.back()->id, GL_TEXTURE_WRAP_T, texture.flags & 2 ? GL_REPEAT : GL_CLAMP_TO_EDGE);
 		}
 
-		glVertexArrayElementBuffer(vao, index_buffer);
+		return decoded;
 	}
 
 	~SkinnedMesh() {
 		glDeleteBuffers(1, &vertex_buffer);
-		glDeleteBuffers(1, &uv_buffer);
-		glDeleteBuffers(1, &normal_buffer);
 		glDeleteBuffers(1, &tangent_buffer);
 		glDeleteBuffers(1, &weight_buffer);
-		glDeleteBuffers(1, &index_buffer);
 		glDeleteBuffers(1, &layer_alpha);
-		glDeleteBuffers(1, &layer_colors_ssbo);
-		glDeleteBuffers(1, &instance_ssbo);
-		glDeleteBuffers(1, &bones_ssbo);
-		glDeleteBuffers(1, &bones_ssbo_colored);
 
-		glDeleteBuffers(1, &preskinned_vertex_ssbo);
-		glDeleteBuffers(1, &preskinned_tangent_light_direction_ssbo);
+		skinned_mesh_arenas.indices.free(index_range);
+		skinned_mesh_arenas.uvs.free(uv_range);
+		skinned_mesh_arenas.normals.free(normal_range);
+	}
+
+	/// The position of the first index of the mesh in the index arena
+	uint32_t first_index() const {
+		return index_range.offset / sizeof(uint16_t);
+	}
+
+	/// The position of the first vertex of the mesh in the uv arena
+	int32_t first_vertex() const {
+		return uv_range.offset / sizeof(glm::vec2);
 	}
 
-	void upload_render_data() {
+	void upload_render_data(StreamingBuffer& stream) {
 		if (!has_mesh) {
 			return;
 		}
 
-		glNamedBufferData(instance_ssbo, render_jobs.size() * sizeof(glm::mat4), render_jobs.data(), GL_DYNAMIC_DRAW);
+		instance_data = stream.upload(render_jobs);
 
-		for (int i = 0; i < render_jobs.size(); i++) {
-			instance_bone_matrices.insert(instance_bone_matrices.end(), skeletons[i]->world_matrices.begin(), skeletons[i]->world_matrices.begin() + model->bones.size());
+		// Instances that share a pose (see PoseCache) share their bone matrices, so every distinct pose is only uploaded once
+		pose_lookup.clear();
+		pose_indices.resize(render_jobs.size());
+		for (size_t i = 0; i < render_jobs.size(); i++) {
+			const auto [found, inserted] = pose_lookup.try_emplace(skeletons[i]->node_matrices(), static_cast<uint32_t>(pose_lookup.size()));
+			pose_indices[i] = found->second;
+		}
+		pose_index_data = stream.upload(pose_indices);
+
+		// Copy the bone matrices of every pose straight into the mapped memory
+		const size_t bone_count = model->bones.size();
+		bone_data = stream.allocate(pose_lookup.size() * bone_count * sizeof(glm::mat4));
+		glm::mat4* bones = static_cast<glm::mat4*>(bone_data.data);
+		for (const auto& [matrices, index] : pose_lookup) {
+			std::copy_n(matrices, bone_count, bones + index * bone_count);
 		}
-
-		glNamedBufferData(bones_ssbo, instance_bone_matrices.size() * sizeof(glm::mat4), instance_bone_matrices.data(), GL_DYNAMIC_DRAW);
 
 		layer_colors.clear();
 
@@ -350,14 +564,17 @@ export class SkinnedMesh : public Resource {
 			}
 		}
 
-		glNamedBufferData(layer_colors_ssbo, layer_colors.size() * sizeof(glm::vec4), layer_colors.data(), GL_DYNAMIC_DRAW);
+		layer_color_data = stream.upload(layer_colors);
 
-		size_t total_indices = 0;
-		for (const auto& i : geosets) {
-			total_indices += i.indices;
-		}
-		glNamedBufferData(preskinned_vertex_ssbo, total_indices * sizeof(glm::vec4) * render_jobs.size(), nullptr, GL_DYNAMIC_DRAW);
-		glNamedBufferData(preskinned_tangent_light_direction_ssbo, total_indices * sizeof(glm::vec4) * render_jobs.size(), nullptr, GL_DYNAMIC_DRAW);
+		preskinned_offset = skinned_mesh_arenas.allocate_preskinned(instance_vertex_count * render_jobs.size());
+	}
+
+	/// Binds the preskinned vertices of this mesh for the current frame
+	void bind_preskinned(const GLuint vertex_binding, const GLuint tangent_light_direction_binding) const {
+		const size_t offset = preskinned_offset * sizeof(glm::vec4);
+		const size_t size = std::max<size_t>(instance_vertex_count * render_jobs.size(), 1) * sizeof(glm::vec4);
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, vertex_binding, skinned_mesh_arenas.preskinned_vertices, offset, size);
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, tangent_light_direction_binding, skinned_mesh_arenas.preskinned_tangent_light_directions, offset, size);
 	}
 
 	// Render all geometry and save the resulting vertices in a buffer
@@ -366,40 +583,40 @@ export class SkinnedMesh : public Resource {
 			return;
 		}
 
-		glBindVertexArray(vao);
-
 		glUniform1ui(1, render_jobs.size());
 		glUniform1ui(2, instance_vertex_count);
 		glUniform1ui(3, model->bones.size());
 
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, instance_ssbo);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, bones_ssbo);
+		instance_data.bind(1);
+		bone_data.bind(2);
+		pose_index_data.bind(9);
 		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, vertex_buffer);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, normal_buffer);
+		skinned_mesh_arenas.normals.bind(4, normal_range);
 		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, tangent_buffer);
 		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, weight_buffer);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, preskinned_vertex_ssbo);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, preskinned_tangent_light_direction_ssbo);
+		bind_preskinned(7, 8);
 
 		glDispatchCompute(((instance_vertex_count + 63) / 64) * render_jobs.size(), 1, 1);
 		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 	}
 
-	void render_opaque(bool render_hd) {
+	/// Returns the number of draw calls
+	size_t render_opaque(bool render_hd) {
 		if (!has_mesh) {
-			return;
+			return 0;
 		}
 
-		glBindVertexArray(vao);
+		size_t draw_calls = 0;
+
+		skinned_mesh_arenas.bind_vertex_array();
 
 		glUniform1i(4, skip_count);
 		glUniform1ui(6, instance_vertex_count);
 
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, layer_colors_ssbo);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, uv_buffer);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, preskinned_vertex_ssbo);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, preskinned_tangent_light_direction_ssbo);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, normal_buffer);
+		layer_color_data.bind(0);
+		skinned_mesh_arenas.uvs.bind(1, uv_range);
+		bind_preskinned(2, 3);
+		skinned_mesh_arenas.normals.bind(4, normal_range);
 
 		int lay_index = 0;
 		for (const auto& i : geosets) {
@@ -419,51 +636,62 @@ export class SkinnedMesh : public Resource {
 				glUniform1f(1, j.blend_mode == 1 ? 0.75f : -1.f);
 				glUniform1i(5, lay_index);
 
-				switch (j.blend_mode) {
-					case 0:
-					case 1:
-						glBlendFunc(GL_ONE, GL_ZERO);
-						break;
-					case 2:
-						glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-						break;
-					case 3:
-						glBlendFunc(GL_ONE, GL_ONE);
-						break;
-					case 4:
-						glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-						break;
-					case 5:
-						glBlendFunc(GL_ZERO, GL_SRC_COLOR);
-						break;
-					case 6:
-						glBlendFunc(GL_DST_COLOR, GL_SRC_COLOR);
-						break;
-				}
+				apply_layer_state(j.blend_mode, j.shading_flags);
 
-				if (j.shading_flags & 0x10) {
-					glDisable(GL_CULL_FACE);
-				} else {
-					glEnable(GL_CULL_FACE);
+				for (size_t texture_slot = 0; texture_slot < j.texturess.size(); texture_slot++) {
+					glBindTextureUnit(texture_slot, textures[j.texturess[texture_slot].id]->id);
 				}
 
-				if (j.shading_flags & 0x40) {
-					glDisable(GL_DEPTH_TEST);
-				} else {
-					glEnable(GL_DEPTH_TEST);
-				}
+				glDrawElementsInstancedBaseVertex(GL_TRIANGLES, i.indices, GL_UNSIGNED_SHORT, reinterpret_cast<void*>((first_index() + i.base_index) * sizeof(uint16_t)), render_jobs.size(), i.base_vertex);
+				lay_index += 1;
+				draw_calls += 1;
+			}
+		}
+		return draw_calls;
+	}
 
-				if (j.shading_flags & 0x80) {
-					glDepthMask(false);
-				} else {
-					glDepthMask(true);
-				}
+	/// Appends an indirect draw command for every opaque layer to draws. The per instance data of the commands is appended to instances.
+	/// Has to be called after upload_render_data()
+	void batch_opaque(std::vector<BatchedDraw>& draws, std::vector<BatchInstance>& instances) const {
+		if (!has_mesh) {
+			return;
+		}
 
-				for (size_t texture_slot = 0; texture_slot < j.texturess.size(); texture_slot++) {
-					glBindTextureUnit(texture_slot, textures[j.texturess[texture_slot].id]->id);
+		int lay_index = 0;
+		for (const auto& i : geosets) {
+			const auto& layers = model->materials[i.material_id].layers;
+
+			if (layers[0].blend_mode != 0 && layers[0].blend_mode != 1) {
+				lay_index += layers.size();
+				continue;
+			}
+
+			for (const auto& j : layers) {
+				BatchedDraw draw;
+				draw.state.hd = j.hd;
+				draw.state.blend_mode = j.blend_mode;
+				draw.state.shading_flags = j.shading_flags & (0x10 | 0x40 | 0x80);
+				for (size_t texture_slot = 0; texture_slot < std::min(j.texturess.size(), draw.state.textures.size()); texture_slot++) {
+					draw.state.textures[texture_slot] = textures[j.texturess[texture_slot].id]->id;
 				}
 
-				glDrawElementsInstancedBaseVertex(GL_TRIANGLES, i.indices, GL_UNSIGNED_SHORT, reinterpret_cast<void*>(i.base_index * sizeof(uint16_t)), render_jobs.size(), i.base_vertex);
+				draw.command = {
+					.count = static_cast<uint32_t>(i.indices),
+					.instance_count = static_cast<uint32_t>(render_jobs.size()),
+					.first_index = first_index() + i.base_index,
+					.base_vertex = first_vertex() + i.base_vertex,
+					.base_instance = static_cast<uint32_t>(instances.size()),
+				};
+				draws.push_back(draw);
+
+				for (size_t k = 0; k < render_jobs.size(); k++) {
+					instances.push_back({
+						.color = layer_colors[k * skip_count + lay_index],
+						.preskinned_offset = static_cast<uint32_t>(preskinned_offset + k * instance_vertex_count),
+						.first_vertex = static_cast<uint32_t>(first_vertex()),
+						.first_normal = static_cast<uint32_t>(normal_range.offset / sizeof(glm::vec4)),
+					});
+				}
 				lay_index += 1;
 			}
 		}
@@ -474,18 +702,17 @@ export class SkinnedMesh : public Resource {
 			return;
 		}
 
-		glBindVertexArray(vao);
+		skinned_mesh_arenas.bind_vertex_array();
 
 		glUniform1i(4, instance_id);
 		glUniform1i(6, skip_count);
 
 		glUniform1ui(9, instance_vertex_count);
 
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, layer_colors_ssbo);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, uv_buffer);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, preskinned_vertex_ssbo);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, preskinned_tangent_light_direction_ssbo);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, normal_buffer);
+		layer_color_data.bind(0);
+		skinned_mesh_arenas.uvs.bind(1, uv_range);
+		bind_preskinned(2, 3);
+		skinned_mesh_arenas.normals.bind(4, normal_range);
 
 		int lay_index = 0;
 		for (const auto& i : geosets) {
@@ -509,103 +736,100 @@ export class SkinnedMesh : public Resource {
 				}
 
 				glUniform1i(7, lay_index);
-
-				switch (j.blend_mode) {
-					case 2:
-						glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-						break;
-					case 3:
-						glBlendFunc(GL_ONE, GL_ONE);
-						break;
-					case 4:
-						glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-						break;
-					case 5:
-						glBlendFunc(GL_ZERO, GL_SRC_COLOR);
-						break;
-					case 6:
-						glBlendFunc(GL_DST_COLOR, GL_SRC_COLOR);
-						break;
-				}
-
-				if (j.shading_flags & 0x10) {
-					glDisable(GL_CULL_FACE);
-				} else {
-					glEnable(GL_CULL_FACE);
-				}
-
-				if (j.shading_flags & 0x40) {
-					glDisable(GL_DEPTH_TEST);
-				} else {
-					glEnable(GL_DEPTH_TEST);
-				}
+				apply_layer_state(j.blend_mode, j.shading_flags, true);
 
 				for (size_t texture_slot = 0; texture_slot < j.texturess.size(); texture_slot++) {
 					glBindTextureUnit(texture_slot, textures[j.texturess[texture_slot].id]->id);
 				}
 
-				glDrawElementsBaseVertex(GL_TRIANGLES, i.indices, GL_UNSIGNED_SHORT, reinterpret_cast<void*>(i.base_index * sizeof(uint16_t)), i.base_vertex);
+				glDrawElementsBaseVertex(GL_TRIANGLES, i.indices, GL_UNSIGNED_SHORT, reinterpret_cast<void*>((first_index() + i.base_index) * sizeof(uint16_t)), i.base_vertex);
 				lay_index += 1;
 			}
 		}
 	}
 
-	void render_color_coded(const SkeletalModelInstance& skeleton, int id) {
-		if (!has_mesh) {
+	/// Adds a draw command per geoset that draws all pickable instances with their pick id. Has to be called after upload_render_data()
+	void batch_pick(std::vector<DrawElementsIndirectCommand>& commands, std::vector<PickInstance>& instances) const {
+		if (!has_mesh || std::ranges::all_of(pick_ids, [](const uint32_t id) { return id == 0; })) {
 			return;
 		}
 
-		glBindVertexArray(vao);
-
-		glm::mat4 MVP = camera.projection_view * skeleton.matrix;
-		glUniformMatrix4fv(0, 1, false, &MVP[0][0]);
+		int lay_index = 0;
+		for (const auto& i : geosets) {
+			const size_t layer_count = model->materials[i.material_id].layers.size();
+
+			commands.push_back({
+				.count = static_cast<uint32_t>(i.indices),
+				.instance_count = static_cast<uint32_t>(render_jobs.size()),
+				.first_index = first_index() + i.base_index,
+				.base_vertex = first_vertex() + i.base_vertex,
+				.base_instance = static_cast<uint32_t>(instances.size()),
+			});
+
+			for (size_t k = 0; k < render_jobs.size(); k++) {
+				// The geoset can be picked if any of its layers is visible
+				bool visible = false;
+				for (size_t j = 0; j < layer_count; j++) {
+					visible |= layer_colors[k * skip_count + lay_index + j].a > 0.001f;
+				}
 
-		glUniform1i(7, id);
+				instances.push_back({
+					.preskinned_offset = static_cast<uint32_t>(preskinned_offset + k * instance_vertex_count),
+					.first_vertex = static_cast<uint32_t>(first_vertex()),
+					.pick_id = visible ? pick_ids[k] : 0,
+				});
+			}
+			lay_index += layer_count;
+		}
+	}
 
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, bones_ssbo_colored);
-		glNamedBufferData(bones_ssbo_colored, model->bones.size() * sizeof(glm::mat4), &skeleton.world_matrices[0][0][0], GL_DYNAMIC_DRAW);
+	/// Returns the distance along the ray (in world space) to the nearest triangle of the mesh in the current pose of the skeleton.
+	/// Skins the vertices on the CPU the same way preskin_mesh.cs does. Geosets that are fully transparent are skipped.
+	/// Does not touch OpenGL so it can run on any thread as long as the skeleton is not updated at the same time
+	std::optional<float> intersect(const Ray& ray, const SkeletalModelInstance& skeleton) const {
+		const glm::mat4* bones = skeleton.node_matrices();
+		// Doodads that were never on screen do not have a pose yet
+		if (!has_mesh || !bones) {
+			return std::nullopt;
+		}
 
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, vertex_buffer);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, weight_buffer);
+		thread_local std::vector<glm::vec3> skinned;
 
+		std::optional<float> nearest;
 		for (const auto& i : geosets) {
-			float geoset_anim_visibility = 1.0f;
-			if (i.geoset_anim && skeleton.sequence_index >= 0) {
-				geoset_anim_visibility = skeleton.get_geoset_animation_visiblity(*i.geoset_anim);
+			if (!visible(i, skeleton)) {
+				continue;
 			}
 
-			for (const auto& j : model->materials[i.material_id].layers) {
-				float layer_visibility = 1.0f;
-				if (skeleton.sequence_index >= 0) {
-					layer_visibility = skeleton.get_layer_visiblity(j);
-				}
-
-				float final_visibility = layer_visibility * geoset_anim_visibility;
-				if (final_visibility <= 0.001f) {
-					continue;
-				}
-
-				if (j.shading_flags & 0x40) {
-					glDisable(GL_DEPTH_TEST);
-				} else {
-					glEnable(GL_DEPTH_TEST);
-				}
-
-				if (j.shading_flags & 0x80) {
-					glDepthMask(false);
-				} else {
-					glDepthMask(true);
-				}
+			skinned.resize(i.vertices);
+			for (int j = 0; j < i.vertices; j++) {
+				const uint8_t* skin = &cpu_weights[(i.base_vertex + j) * 8];
+				const glm::mat4 bone = bones[skin[0]] * (skin[4] / 255.f) + bones[skin[1]] * (skin[5] / 255.f) + bones[skin[2]] * (skin[6] / 255.f) + bones[skin[3]] * (skin[7] / 255.f);
+				skinned[j] = glm::vec3(skeleton.matrix * (bone * cpu_vertices[i.base_vertex + j]));
+			}
 
-				if (j.shading_flags & 0x10) {
-					glDisable(GL_CULL_FACE);
-				} else {
-					glEnable(GL_CULL_FACE);
+			for (int j = 0; j + 2 < i.indices; j += 3) {
+				const uint16_t* triangle = &cpu_indices[i.base_index + j];
+				const auto distance = intersect_triangle(ray, skinned[triangle[0]], skinned[triangle[1]], skinned[triangle[2]]);
+				if (distance && (!nearest || *distance < *nearest)) {
+					nearest = distance;
 				}
-
-				glDrawElementsBaseVertex(GL_TRIANGLES, i.indices, GL_UNSIGNED_SHORT, reinterpret_cast<void*>(i.base_index * sizeof(uint16_t)), i.base_vertex);
-				break;
 			}
 		}
+		return nearest;
+	}
+
+  private:
+	/// Whether any layer of the geoset is visible in the current pose of the skeleton
+	bool visible(const MeshEntry& geoset, const SkeletalModelInstance& skeleton) const {
+		if (skeleton.sequence_index < 0) {
+			return true;
+		}
+		if (geoset.geoset_anim && skeleton.get_geoset_animation_visiblity(*geoset.geoset_anim) <= 0.001f) {
+			return false;
+		}
+		return std::ranges::any_of(model->materials[geoset.material_id].layers, [&](const mdx::Layer& layer) {
+			return skeleton.get_layer_visiblity(layer) > 0.001f;
+		});
 	}
 };
\ No newline at end of file
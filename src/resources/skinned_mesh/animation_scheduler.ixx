@@ -0,0 +1,246 @@
+module;
+
+#include <vector>
+#include <span>
+#include <memory>
+#include <atomic>
+#include <execution>
+#include <algorithm>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "unordered_dense.h"
+
+export module AnimationScheduler;
+
+import Camera;
+import SkeletalModelInstance;
+import MDX;
+import PoseCache;
+
+/// Decides which skeletons are animated each frame.
+/// Instances that appear small on screen are updated at a reduced rate, the time they skipped is caught up on their next update.
+/// Instances that never diverge in how they animate (e.g. doodads) can instead take their pose from a PoseCache. Their frame is quantized
+/// (coarser for smaller instances) and every model, sequence and quantized frame is evaluated only once and shared by all instances in that state
+export class AnimationScheduler {
+  public:
+	struct Statistics {
+		/// Skeletons that were evaluated
+		size_t evaluated = 0;
+		/// Skeletons that reference a pose evaluated for another instance or an earlier frame
+		size_t shared = 0;
+		/// Skeletons that were skipped or kept their previous pose because of their level of detail
+		size_t throttled = 0;
+	};
+
+	/// Stops all animation, e.g. to keep the scene still while editing
+	bool frozen = false;
+
+	/// Instances covering at least this fraction of the screen height animate every frame. Every halving of the size halves the update rate
+	float full_rate_size = 0.1f;
+	/// The lowest update rate is once every max_interval frames
+	int max_interval = 8;
+	/// The most instances of the same model that are evaluated together
+	size_t max_batch_size = 16;
+	/// Poses taken from the cache are evaluated at multiples of this many milliseconds times the update interval of the instance
+	int pose_quantum = 33;
+
+	PoseCache pose_cache;
+
+	/// The counters of the current frame
+	Statistics statistics;
+
+	void begin_frame(const double delta) {
+		frame++;
+		frame_delta = delta;
+		statistics = {};
+		if (!frozen) {
+			pose_cache.collect();
+		}
+	}
+
+	/// Animates the instances according to their level of detail.
+	/// With share_identical set, the instances take their pose from the pose cache. Only use it for instances that never diverge in how they animate (e.g. doodads)
+	void update(std::span<SkeletalModelInstance* const> instances, const bool share_identical) {
+		// Frozen instances without a pose yet still get one so that they can be rendered
+		if (frozen && !share_identical) {
+			return;
+		}
+
+		std::atomic<size_t> shared = 0;
+		std::atomic<size_t> throttled = 0;
+
+		if (!share_identical) {
+			due.resize(instances.size());
+			std::for_each(std::execution::par_unseq, instances.begin(), instances.end(), [&](SkeletalModelInstance* const& instance) {
+				const size_t index = &instance - instances.data();
+				due[index] = false;
+				if (!animates(*instance)) {
+					return;
+				}
+				due[index] = step(*instance, interval(*instance), index);
+				if (!due[index]) {
+					throttled++;
+				}
+			});
+
+			// Instances of the same model are evaluated together so that their nodes fill the SIMD lanes
+			batched.clear();
+			for (size_t i = 0; i < instances.size(); i++) {
+				if (due[i]) {
+					batched.push_back(instances[i]);
+				}
+			}
+			std::ranges::sort(batched, {}, [](const SkeletalModelInstance* instance) { return instance->model.get(); });
+
+			batches.clear();
+			for (size_t i = 0; i < batched.size();) {
+				size_t end = i + 1;
+				while (end < batched.size() && end - i < max_batch_size && batched[end]->model == batched[i]->model) {
+					end++;
+				}
+				batches.push_back(std::span(batched).subspan(i, end - i));
+				i = end;
+			}
+
+			std::for_each(std::execution::par_unseq, batches.begin(), batches.end(), [](const std::span<SkeletalModelInstance* const> batch) {
+				SkeletalModelInstance::update_nodes(batch);
+			});
+
+			statistics.evaluated += batched.size();
+			statistics.throttled += throttled;
+			return;
+		}
+
+		// Find the pose of every instance in the cache. The first instance of every missing pose evaluates it
+		groups.clear();
+		group_lookup.clear();
+		group_of.resize(instances.size());
+		for (size_t i = 0; i < instances.size(); i++) {
+			SkeletalModelInstance& instance = *instances[i];
+			group_of[i] = -1;
+			if (!animates(instance)) {
+				instance.allocate_own_pose();
+				continue;
+			}
+
+			if (frozen) {
+				if (instance.shared_pose) {
+					continue;
+				}
+			} else {
+				instance.advance_frame(frame_delta);
+			}
+
+			const int update_interval = interval(instance);
+			const PoseCache::Key key = { instance.model.get(), instance.sequence_index, quantize(instance, update_interval) };
+			// The pose is shared with instances in the same state, so the reduced rate shows as keeping the previous pose longer
+			if (update_interval > 1 && instance.shared_pose && instance.shared_pose->frame == key.frame && quantize(instance, 1) != key.frame) {
+				throttled++;
+			}
+
+			if (auto pose = pose_cache.find(key)) {
+				instance.shared_pose = std::move(pose);
+				shared++;
+				continue;
+			}
+
+			const auto [found, inserted] = group_lookup.try_emplace(key, static_cast<uint32_t>(groups.size()));
+			if (inserted) {
+				groups.push_back({ instances[i], key, nullptr });
+			}
+			group_of[i] = found->second;
+		}
+
+		std::for_each(std::execution::par_unseq, groups.begin(), groups.end(), [&](Group& group) {
+			group.pose = group.leader->evaluate_pose(group.key.frame);
+		});
+
+		for (const auto& group : groups) {
+			pose_cache.insert(group.key, group.pose);
+		}
+
+		std::for_each(std::execution::par_unseq, instances.begin(), instances.end(), [&](SkeletalModelInstance* const& instance) {
+			const int32_t group_index = group_of[&instance - instances.data()];
+			if (group_index != -1) {
+				instance->shared_pose = groups[group_index].pose;
+			}
+		});
+
+		statistics.evaluated += groups.size();
+		statistics.shared += shared + std::ranges::count_if(group_of, [](const int32_t group) { return group != -1; }) - groups.size();
+		statistics.throttled += throttled;
+	}
+
+  private:
+	struct KeyHash {
+		using is_avalanching = void;
+
+		uint64_t operator()(const PoseCache::Key& key) const noexcept {
+			return ankerl::unordered_dense::detail::wyhash::hash(&key, sizeof(PoseCache::Key));
+		}
+	};
+
+	/// A pose that is not cached yet and the instances that need it
+	struct Group {
+		SkeletalModelInstance* leader;
+		PoseCache::Key key;
+		std::shared_ptr<const Pose> pose;
+	};
+
+	uint64_t frame = 0;
+	double frame_delta = 0.0;
+
+	/// Whether every instance is updated this frame
+	std::vector<uint8_t> due;
+	/// The instances that are updated this frame sorted on model and split in batches
+	std::vector<SkeletalModelInstance*> batched;
+	std::vector<std::span<SkeletalModelInstance* const>> batches;
+
+	std::vector<Group> groups;
+	ankerl::unordered_dense::map<PoseCache::Key, uint32_t, KeyHash> group_lookup;
+	/// The group of every instance or -1 if the instance does not animate or its pose was cached
+	std::vector<int32_t> group_of;
+
+	static bool animates(const SkeletalModelInstance& instance) {
+		return !instance.model->sequences.empty() && instance.sequence_index != -1;
+	}
+
+	/// Every how many frames the instance should be updated based on how large it appears on screen
+	int interval(const SkeletalModelInstance& instance) const {
+		const mdx::Extent& extent = instance.model->sequences[instance.sequence_index].extent;
+		const float radius = std::max(extent.bounds_radius, glm::distance(extent.minimum, extent.maximum) * 0.5f) * glm::length(glm::vec3(instance.matrix[0]));
+
+		const glm::vec3 eye = camera.position - camera.direction * camera.distance;
+		const float distance = std::max(glm::distance(eye, glm::vec3(instance.matrix[3])), 0.001f);
+		const float size = 2.f * radius / (camera.tan_height * distance);
+
+		int result = 1;
+		float threshold = full_rate_size;
+		while (size < threshold && result < max_interval) {
+			result *= 2;
+			threshold *= 0.5f;
+		}
+		return result;
+	}
+
+	/// The frame the pose of the instance is evaluated at when it is updated every interval frames
+	int quantize(const SkeletalModelInstance& instance, const int interval) const {
+		const int start = instance.model->sequences[instance.sequence_index].start_frame;
+		const int quantum = pose_quantum * interval;
+		return start + (instance.current_frame - start) / quantum * quantum;
+	}
+
+	/// Advances the instance if it is due this frame, its nodes still have to be updated afterwards. Instances with the same interval are spread over the frames using phase
+	bool step(SkeletalModelInstance& instance, const int interval, const size_t phase) const {
+		instance.pending_delta += frame_delta;
+		if ((frame + phase) % interval != 0) {
+			return false;
+		}
+
+		instance.advance(instance.pending_delta);
+		instance.pending_delta = 0.0;
+		return true;
+	}
+};
@@ -0,0 +1,66 @@
+module;
+
+#include <memory>
+#include <cstdint>
+#include <utility>
+
+#include "unordered_dense.h"
+
+export module PoseCache;
+
+import SkeletalModelInstance;
+import MDX;
+
+/// Keeps the poses evaluated for a model, sequence and (quantized) frame so that all instances in that state can reference the same pose.
+/// Poses that were not used for a whole frame are dropped
+export class PoseCache {
+  public:
+	struct Key {
+		const mdx::MDX* model;
+		int sequence_index;
+		int frame;
+
+		bool operator==(const Key&) const = default;
+	};
+
+	/// Returns nullptr if the pose is not cached
+	std::shared_ptr<const Pose> find(const Key& key) {
+		const auto found = poses.find(key);
+		if (found == poses.end()) {
+			return nullptr;
+		}
+		found->second.used = true;
+		return found->second.pose;
+	}
+
+	void insert(const Key& key, std::shared_ptr<const Pose> pose) {
+		poses[key] = { std::move(pose), true };
+	}
+
+	/// Drops the poses that have not been used since the last call. Call once per frame
+	void collect() {
+		std::erase_if(poses, [](auto& entry) {
+			return !std::exchange(entry.second.used, false);
+		});
+	}
+
+	size_t size() const {
+		return poses.size();
+	}
+
+  private:
+	struct KeyHash {
+		using is_avalanching = void;
+
+		uint64_t operator()(const Key& key) const noexcept {
+			return ankerl::unordered_dense::detail::wyhash::hash(&key, sizeof(Key));
+		}
+	};
+
+	struct Entry {
+		std::shared_ptr<const Pose> pose;
+		bool used = false;
+	};
+
+	ankerl::unordered_dense::map<Key, Entry, KeyHash> poses;
+};
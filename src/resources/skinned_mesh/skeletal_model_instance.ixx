@@ -3,6 +3,7 @@ module;
 #include <chrono>
 #include <vector>
 #include <memory>
+#include <span>
 #include <unordered_map>
 
 #include <glm/glm.hpp>
@@ -15,6 +16,7 @@ import Camera;
 import Utilities;
 import MathOperations;
 import RenderNode;
+import SkeletonLayout;
 import MDX;
 
 // Ghostwolf mentioned this to me once, so I used it,
@@ -30,6 +32,13 @@ struct CurrentKeyFrame {
 	int right = 0;
 };
 
+/// The state of a skeleton at a certain frame of a sequence. Instances of the same model in the same animation state can share one (see PoseCache)
+export struct Pose {
+	int frame = 0;
+	std::vector<CurrentKeyFrame> keyframes;
+	std::vector<glm::mat4> world_matrices;
+};
+
 export class SkeletalModelInstance {
   public:
 	std::shared_ptr<mdx::MDX> model;
@@ -47,9 +56,19 @@ export class SkeletalModelInstance {
 	std::vector<CurrentKeyFrame> current_keyframes;
 	std::vector<RenderNode> render_nodes;
 	std::vector<glm::mat4> world_matrices;
+	std::shared_ptr<const SkeletonLayout> layout;
+
+	/// Time that passed since the last update. Only non zero when the AnimationScheduler skipped updates of this instance
+	double pending_delta = 0.0;
+
+	/// Set when this instance uses a pose evaluated once for many instances instead of its own world_matrices/current_keyframes
+	std::shared_ptr<const Pose> shared_pose;
 
 	SkeletalModelInstance() = default;
-	explicit SkeletalModelInstance(std::shared_ptr<mdx::MDX> model) : model(model) {
+
+	/// With shared_poses set the instance is meant to take its pose from a PoseCache (see AnimationScheduler) and world_matrices/current_keyframes
+	/// are only allocated once it evaluates a pose of its own
+	explicit SkeletalModelInstance(std::shared_ptr<mdx::MDX> model, const bool shared_poses = false) : model(model) {
 		size_t node_count = model->bones.size() +
 							model->lights.size() +
 							model->help_bones.size() +
@@ -63,7 +82,6 @@ export class SkeletalModelInstance {
 
 		// ToDo: for each camera: add camera source node to renderNodes
 		render_nodes.resize(node_count);
-		world_matrices.resize(node_count);
 		model->for_each_node([&](mdx::Node& node) {
 			// Seen it happen with Emmitter1, is this an error in the model?
 			// ToDo purge (when adding a validation layer or just crashing)
@@ -81,7 +99,11 @@ export class SkeletalModelInstance {
 			render_nodes[node.id] = renderNode;
 		});
 
-		current_keyframes.resize(model->unique_tracks);
+		layout = SkeletonLayout::get(model);
+		// Models without sequences are never animated so they never get a shared pose either
+		if (!shared_poses || model->sequences.empty()) {
+			allocate_own_pose();
+		}
 
 		for (size_t i = 0; i < model->sequences.size(); i++) {
 			if (model->sequences[i].name.find("Stand") != std::string::npos) {
@@ -102,12 +124,35 @@ export class SkeletalModelInstance {
 	}
 
 
+	/// The matrices of all nodes of the current pose. The first model->bones.size() are the bones.
+	/// nullptr for instances created with shared_poses that did not get a pose yet
+	const glm::mat4* node_matrices() const {
+		if (shared_pose) {
+			return shared_pose->world_matrices.data();
+		}
+		return own_pose ? world_matrices.data() : nullptr;
+	}
+
 	void update(double delta) {
 		if (model->sequences.empty() || sequence_index == -1) {
+			allocate_own_pose();
 			return;
 		}
 
-		// Advance current frame
+		advance(delta);
+		update_nodes();
+	}
+
+	/// Advances the animation without evaluating the world matrices, which update_nodes() does afterwards (possibly batched with other instances)
+	void advance(double delta) {
+		shared_pose.reset();
+		allocate_own_pose();
+		advance_frame(delta);
+		advance_tracks();
+	}
+
+	/// Only advances current_frame, for when the pose itself comes from a PoseCache
+	void advance_frame(double delta) {
 		const mdx::Sequence& sequence = model->sequences[sequence_index];
 		if (sequence.flags & mdx::Sequence::non_looping) {
 			current_frame = std::min<int>(current_frame + delta * 1000.0, sequence.end_frame);
@@ -117,11 +162,54 @@ export class SkeletalModelInstance {
 				current_frame = sequence.start_frame;
 			}
 		}
+	}
 
-		for (const auto& i : render_nodes) {
-			advance_keyframes(i.node->KGTR);
-			advance_keyframes(i.node->KGRT);
-			advance_keyframes(i.node->KGSC);
+	/// Evaluates the pose of this model at the given frame of the current sequence. Leaves current_frame untouched
+	std::shared_ptr<const Pose> evaluate_pose(const int frame) {
+		shared_pose.reset();
+		const bool had_own_pose = own_pose;
+		allocate_own_pose();
+
+		const int own_frame = current_frame;
+		current_frame = frame;
+		advance_tracks();
+		update_nodes();
+		current_frame = own_frame;
+
+		if (had_own_pose) {
+			return std::make_shared<const Pose>(Pose { frame, current_keyframes, world_matrices });
+		}
+
+		// An instance that only uses shared poses hands its storage over to the pose instead of keeping a copy
+		auto pose = std::make_shared<const Pose>(Pose { frame, std::move(current_keyframes), std::move(world_matrices) });
+		release_own_pose();
+		return pose;
+	}
+
+	/// The heap memory this instance owns. A shared_pose is not counted as it is owned by the pose cache
+	size_t memory_usage() const {
+		return current_keyframes.capacity() * sizeof(CurrentKeyFrame) + render_nodes.capacity() * sizeof(RenderNode) + world_matrices.capacity() * sizeof(glm::mat4);
+	}
+
+	/// Allocates world_matrices and current_keyframes if this instance does not have them yet
+	void allocate_own_pose() {
+		if (own_pose) {
+			return;
+		}
+		own_pose = true;
+		world_matrices.resize(render_nodes.size());
+		current_keyframes.resize(model->unique_tracks);
+		if (sequence_set) {
+			calculate_sequence_extents();
+		}
+	}
+
+	/// Moves the keyframes of all tracks to current_frame
+	void advance_tracks() {
+		for (size_t i = 0; i < layout->node_ids.size(); i++) {
+			advance_keyframes(layout->translations[i]);
+			advance_keyframes(layout->rotations[i]);
+			advance_keyframes(layout->scalings[i]);
 		}
 
 		for (const auto& i : model->animations) {
@@ -135,18 +223,68 @@ export class SkeletalModelInstance {
 				// Add more when required
 			}
 		}
-
-		update_nodes();
 	}
 
 	void update_nodes() {
+		SkeletalModelInstance* self = this;
+		update_nodes(std::span(&self, 1));
+	}
+
+	/// Evaluates the world matrices of several instances of the same model at once.
+	/// The node transforms of all instances are gathered into arrays which are interpolated and turned into matrices 4 at a time,
+	/// the parent matrices are then applied in a single pass over the topologically sorted nodes
+	static void update_nodes(std::span<SkeletalModelInstance* const> instances) {
+		if (instances.empty()) {
+			return;
+		}
+
+		const SkeletonLayout& layout = *instances.front()->layout;
+		const size_t node_count = layout.node_ids.size();
+
+		thread_local NodeBatch batch;
+		batch.resize(instances.size() * node_count);
+
+		for (size_t i = 0; i < instances.size(); i++) {
+			const SkeletalModelInstance& instance = *instances[i];
+			assert(instance.sequence_index >= 0 && instance.sequence_index < instance.model->sequences.size());
+
+			for (size_t j = 0; j < node_count; j++) {
+				const size_t k = i * node_count + j;
+				instance.gather_keyframes(layout.translations[j], TRANSLATION_IDENTITY, batch.translation_from, batch.translation_to, batch.translation_factors, k);
+				instance.gather_keyframes(layout.rotations[j], ROTATION_IDENTITY, batch.rotation_from, batch.rotation_to, batch.rotation_factors, k);
+				instance.gather_keyframes(layout.scalings[j], SCALE_IDENTITY, batch.scaling_from, batch.scaling_to, batch.scaling_factors, k);
+				batch.pivots.set(k, layout.pivots[j]);
+			}
+		}
+
+		lerp_batch(batch.translation_from, batch.translation_to, batch.translation_factors.data(), batch.translations);
+		slerp_batch(batch.rotation_from, batch.rotation_to, batch.rotation_factors.data(), batch.rotations);
+		lerp_batch(batch.scaling_from, batch.scaling_to, batch.scaling_factors.data(), batch.scalings);
+		compose_batch(batch.rotations, batch.translations, batch.scalings, batch.pivots, batch.local_matrices.data());
+
+		for (size_t i = 0; i < instances.size(); i++) {
+			std::vector<glm::mat4>& world = instances[i]->world_matrices;
+			const glm::mat4* local = batch.local_matrices.data() + i * node_count;
+
+			for (size_t j = 0; j < node_count; j++) {
+				const uint32_t id = layout.node_ids[j];
+				const int32_t parent = layout.parents[j];
+				world[id] = parent == -1 ? local[j] : world[parent] * local[j];
+
+				if (layout.billboarded[j]) {
+					clear_billboard_rotation(world[id]);
+				}
+			}
+		}
+	}
+
+	/// Evaluates the world matrices one node at a time. Slower than update_nodes(), kept as a reference for benchmarking
+	void update_nodes_scalar() {
 		assert(sequence_index >= 0 && sequence_index < model->sequences.size());
 
 		// update skeleton to position based on animation @ time
-		for (auto& node : render_nodes) {
-			// node.position = interpolate_keyframes(node.node->KGTR, TRANSLATION_IDENTITY);
-			// node.rotation = interpolate_keyframes(node.node->KGRT, ROTATION_IDENTITY);
-			// node.scale = interpolate_keyframes(node.node->KGSC, SCALE_IDENTITY);
+		for (size_t i = 0; i < layout->node_ids.size(); i++) {
+			const RenderNode& node = render_nodes[layout->node_ids[i]];
 
 			glm::vec3 position = interpolate_keyframes(node.node->KGTR, TRANSLATION_IDENTITY);
 			glm::quat rotation = interpolate_keyframes(node.node->KGRT, ROTATION_IDENTITY);
@@ -154,34 +292,12 @@ export class SkeletalModelInstance {
 
 			fromRotationTranslationScaleOrigin(rotation, position, scale, world_matrices[node.node->id], node.pivot);
 
-			if (node.node->parent_id != -1) {
-				world_matrices[node.node->id] = world_matrices[node.node->parent_id] * world_matrices[node.node->id];
+			if (layout->parents[i] != -1) {
+				world_matrices[node.node->id] = world_matrices[layout->parents[i]] * world_matrices[node.node->id];
 			}
 
 			if (node.billboarded || node.billboardedX) {
-
-				world_matrices[node.node->id][1][0] = 0.f;
-				world_matrices[node.node->id][2][0] = 0.f;
-				world_matrices[node.node->id][3][0] = 0.f;
-				world_matrices[node.node->id][2][1] = 0.f;
-				world_matrices[node.node->id][3][1] = 0.f;
-				world_matrices[node.node->id][3][2] = 0.f;
-
-				world_matrices[node.node->id][0][1] = 0.f;
-				world_matrices[node.node->id][0][2] = 0.f;
-				world_matrices[node.node->id][0][3] = 0.f;
-				world_matrices[node.node->id][1][2] = 0.f;
-				world_matrices[node.node->id][1][3] = 0.f;
-				world_matrices[node.node->id][2][3] = 0.f;
-
-				// Cancel the parent's rotation
-				/*if (node.parent) {
-					node.localRotation = node.parent->inverseWorldRotation * inverseInstanceRotation;
-				} else {
-					node.localRotation = inverseInstanceRotation;
-				}
-
-				node.localRotation *= camera->decomposed_rotation;*/
+				clear_billboard_rotation(world_matrices[node.node->id]);
 			}
 		}
 	}
@@ -189,8 +305,18 @@ export class SkeletalModelInstance {
 	/// Sets the current sequence to sequence_index and recalculates required keyframe data
 	void set_sequence(int sequence_index) {
 		this->sequence_index = sequence_index;
+		shared_pose.reset();
 		current_frame = model->sequences[sequence_index].start_frame;
+		sequence_set = true;
 
+		// Otherwise done by allocate_own_pose()
+		if (own_pose) {
+			calculate_sequence_extents();
+		}
+	}
+
+	/// Recalculates the keyframe extents of all tracks for the current sequence
+	void calculate_sequence_extents() {
 		for (const auto& i : render_nodes) {
 			calculate_sequence_extents(i.node->KGTR);
 			calculate_sequence_extents(i.node->KGRT);
@@ -262,12 +388,24 @@ export class SkeletalModelInstance {
 		if (header.id == -1) {
 			return;
 		}
-		CurrentKeyFrame& current = current_keyframes[header.id];
+		advance_keyframes(current_keyframes[header.id], header.global_sequence_ID, [&](const int i) { return header.tracks[i].frame; });
+	}
+
+	template <typename T>
+	void advance_keyframes(const TrackArrays<T>& track) {
+		if (track.id == -1) {
+			return;
+		}
+		advance_keyframes(current_keyframes[track.id], track.global_sequence_ID, [&](const int i) { return track.frames[i]; });
+	}
 
+	/// frame_at(i) returns the frame of the ith keyframe of the track
+	template <typename F>
+	void advance_keyframes(CurrentKeyFrame& current, const int32_t global_sequence_ID, const F& frame_at) {
 		int local_current_frame = current_frame;
 
-		if (header.global_sequence_ID >= 0 && model->global_sequences.size()) {
-			int local_sequence_end = model->global_sequences[header.global_sequence_ID];
+		if (global_sequence_ID >= 0 && model->global_sequences.size()) {
+			int local_sequence_end = model->global_sequences[global_sequence_ID];
 			if (local_sequence_end == 0) {
 				local_current_frame = 0;
 			} else {
@@ -286,13 +424,13 @@ export class SkeletalModelInstance {
 		}
 
 		// Detect if we looped
-		if (header.tracks[current.left].frame > local_current_frame) {
+		if (frame_at(current.left) > local_current_frame) {
 			current.left = current.start;
 			current.right = current.start + 1;
 		}
 
 		// Scan till we find two tracks
-		while (header.tracks[current.right].frame < local_current_frame) {
+		while (frame_at(current.right) < local_current_frame) {
 			current.left = current.right;
 			current.right++;
 
@@ -302,14 +440,14 @@ export class SkeletalModelInstance {
 			}
 
 			// No need for interpolation if current_frame is exactly on a track
-			if (header.tracks[current.right].frame == local_current_frame) {
+			if (frame_at(current.right) == local_current_frame) {
 				current.left = current.right;
 			}
 		}
 
 		// The first/last tracks are not always exactly at the sequence start/end
-		const bool past_end = header.tracks[current.end].frame < local_current_frame;
-		const bool before_start = header.tracks[current.start].frame > local_current_frame;
+		const bool past_end = frame_at(current.end) < local_current_frame;
+		const bool before_start = frame_at(current.start) > local_current_frame;
 		if (past_end || before_start) {
 			current.left = current.end;
 			current.right = current.start;
@@ -335,16 +473,88 @@ export class SkeletalModelInstance {
 			return default_value;
 		}
 
-		const CurrentKeyFrame& current = current_keyframes[header.id];
+		const CurrentKeyFrame& current = shared_pose ? shared_pose->keyframes[header.id] : current_keyframes[header.id];
+		const Interval interval = keyframe_interval(current, header.global_sequence_ID, [&](const int i) { return header.tracks[i].frame; });
+
+		// If there are no tracks in sequence
+		if (interval.left == -1) {
+			return default_value;
+		}
+
+		// If there is only 1 track
+		if (current.start == current.end) {
+			return header.tracks[interval.left].value;
+		}
+
+		const mdx::Track<T>& floor = header.tracks[interval.left];
+		const mdx::Track<T>& ceil = header.tracks[interval.right];
+		return interpolate(floor.value, floor.outTan, ceil.inTan, ceil.value, interval.factor, header.interpolation_type);
+	}
+
+  private:
+	/// Whether world_matrices and current_keyframes are allocated
+	bool own_pose = false;
+	/// Whether set_sequence() was called, the keyframe extents are only calculated then
+	bool sequence_set = false;
+
+	void release_own_pose() {
+		own_pose = false;
+		world_matrices = {};
+		current_keyframes = {};
+	}
+
+	/// The keyframes left and right of the current frame and how far along the current frame is between them
+	struct Interval {
+		/// -1 if the track has no keyframes in the sequence
+		int left = -1;
+		int right = -1;
+		float factor = 0.f;
+	};
+
+	/// The arrays update_nodes() gathers the node transforms of a batch of instances in
+	struct NodeBatch {
+		Vec3Batch translation_from;
+		Vec3Batch translation_to;
+		std::vector<float> translation_factors;
+		QuatBatch rotation_from;
+		QuatBatch rotation_to;
+		std::vector<float> rotation_factors;
+		Vec3Batch scaling_from;
+		Vec3Batch scaling_to;
+		std::vector<float> scaling_factors;
+		Vec3Batch pivots;
+
+		Vec3Batch translations;
+		QuatBatch rotations;
+		Vec3Batch scalings;
+		std::vector<glm::mat4> local_matrices;
+
+		void resize(const size_t count) {
+			for (auto batch : { &translation_from, &translation_to, &scaling_from, &scaling_to, &pivots, &translations, &scalings }) {
+				batch->resize(count);
+			}
+			for (auto batch : { &rotation_from, &rotation_to, &rotations }) {
+				batch->resize(count);
+			}
+			for (auto factors : { &translation_factors, &rotation_factors, &scaling_factors }) {
+				factors->resize(count);
+			}
+			local_matrices.resize(count);
+		}
+	};
+
+	/// frame_at(i) returns the frame of the ith keyframe of the track
+	template <typename F>
+	Interval keyframe_interval(const CurrentKeyFrame& current, const int32_t global_sequence_ID, const F& frame_at) const {
 		const mdx::Sequence& sequence = model->sequences[sequence_index];
 
-		int local_current_frame = current_frame;
+		int local_current_frame = shared_pose ? shared_pose->frame : current_frame;
 		int local_sequence_start = sequence.start_frame;
 		int local_sequence_end = sequence.end_frame;
 
-		if (header.global_sequence_ID >= 0 && model->global_sequences.size()) {
+		if (global_sequence_ID >= 0 && model->global_sequences.size()) {
 			local_sequence_start = 0;
-			local_sequence_end = model->global_sequences[header.global_sequence_ID];
+			local_sequence_end = model->global_sequences[global_sequence_ID];
 			if (local_sequence_end == 0) {
 				local_current_frame = 0;
 			} else {
@@ -354,21 +564,16 @@ export class SkeletalModelInstance {
 
 		// If there are no tracks in sequence
 		if (current.start == -1) {
-			return default_value;
+			return {};
 		}
 
 		// If there is only 1 track
 		if (current.start == current.end) {
-			return header.tracks[current.left].value;
+			return { current.left, current.left, 0.f };
 		}
 
-		const T ceil_in_tan = header.tracks[current.right].inTan;
-		const T floor_out_tan = header.tracks[current.left].outTan;
-
-		int floor_time = header.tracks[current.left].frame;
-		const int ceil_time = header.tracks[current.right].frame;
-		const T floor_value = header.tracks[current.left].value;
-		const T ceil_value = header.tracks[current.right].value;
+		int floor_time = frame_at(current.left);
+		const int ceil_time = frame_at(current.right);
 
 		// This is the implementation that correctly handles missing start/end frames.
 		// The game and WE however have a buggy implementation which is the one we end up using for compatibility
@@ -395,6 +600,61 @@ export class SkeletalModelInstance {
 		}
 		const float t = time_between_frames == 0 ? 0.f : ((local_current_frame - floor_time) / static_cast<float>(time_between_frames));
 
-		return interpolate(floor_value, floor_out_tan, ceil_in_tan, ceil_value, t, header.interpolation_type);
+		return { current.left, current.right, t };
+	}
+
+	/// Writes the keyframes around the current frame of the track to from[index] and to[index] and the interpolation factor between them to factors[index].
+	/// Only linear tracks are left to be interpolated in batch, the others are interpolated here and stored with a factor of 0
+	template <typename T, typename B>
+	void gather_keyframes(const TrackArrays<T>& track, const T& default_value, B& from, B& to, std::vector<float>& factors, const size_t index) const {
+		T value = default_value;
+		factors[index] = 0.f;
+
+		if (track.id != -1) {
+			const CurrentKeyFrame& current = current_keyframes[track.id];
+			const Interval interval = keyframe_interval(current, track.global_sequence_ID, [&](const int i) { return track.frames[i]; });
+
+			if (interval.left != -1) {
+				if (current.start == current.end || track.interpolation_type < 1) {
+					value = track.values[interval.left];
+				} else if (track.interpolation_type == 1) {
+					from.set(index, track.values[interval.left]);
+					to.set(index, track.values[interval.right]);
+					factors[index] = interval.factor;
+					return;
+				} else {
+					value = interpolate(track.values[interval.left], track.out_tans[interval.left], track.in_tans[interval.right], track.values[interval.right], interval.factor, track.interpolation_type);
+				}
+			}
+		}
+
+		from.set(index, value);
+		to.set(index, value);
+	}
+
+	/// Removes the rotation (and scale) of a billboarded node
+	static void clear_billboard_rotation(glm::mat4& matrix) {
+		matrix[1][0] = 0.f;
+		matrix[2][0] = 0.f;
+		matrix[3][0] = 0.f;
+		matrix[2][1] = 0.f;
+		matrix[3][1] = 0.f;
+		matrix[3][2] = 0.f;
+
+		matrix[0][1] = 0.f;
+		matrix[0][2] = 0.f;
+		matrix[0][3] = 0.f;
+		matrix[1][2] = 0.f;
+		matrix[1][3] = 0.f;
+		matrix[2][3] = 0.f;
+
+		// Cancel the parent's rotation
+		/*if (node.parent) {
+			node.localRotation = node.parent->inverseWorldRotation * inverseInstanceRotation;
+		} else {
+			node.localRotation = inverseInstanceRotation;
+		}
+
+		node.localRotation *= camera->decomposed_rotation;*/
 	}
 };
\ No newline at end of file
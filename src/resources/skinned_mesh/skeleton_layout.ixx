@@ -0,0 +1,128 @@
+module;
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+export module SkeletonLayout;
+
+import MDX;
+
+/// A node track with its frames, values and tangents in separate arrays so that searching for the current keyframes only touches the frames.
+/// The tangents are only stored for hermite/bezier tracks
+export template <typename T>
+struct TrackArrays {
+	int32_t interpolation_type = 0;
+	int32_t global_sequence_ID = -1;
+	int id = -1;
+
+	std::vector<int32_t> frames;
+	std::vector<T> values;
+	std::vector<T> in_tans;
+	std::vector<T> out_tans;
+
+	TrackArrays() = default;
+	explicit TrackArrays(const mdx::TrackHeader<T>& header)
+		: interpolation_type(header.interpolation_type), global_sequence_ID(header.global_sequence_ID), id(header.id) {
+		frames.reserve(header.tracks.size());
+		values.reserve(header.tracks.size());
+		for (const auto& track : header.tracks) {
+			frames.push_back(track.frame);
+			values.push_back(track.value);
+			if (interpolation_type > 1) {
+				in_tans.push_back(track.inTan);
+				out_tans.push_back(track.outTan);
+			}
+		}
+	}
+};
+
+/// The skeleton of a model flattened for evaluation. The nodes are sorted so that every parent comes before its children,
+/// which lets the world matrices be computed in a single pass. All other arrays are indexed by the position in this order.
+/// Shared by all instances of a model, use SkeletonLayout::get()
+export struct SkeletonLayout {
+	/// The id of the node at every position
+	std::vector<uint32_t> node_ids;
+	/// The id of the parent node or -1
+	std::vector<int32_t> parents;
+	std::vector<glm::vec3> pivots;
+	std::vector<uint8_t> billboarded;
+
+	std::vector<TrackArrays<glm::vec3>> translations;
+	std::vector<TrackArrays<glm::quat>> rotations;
+	std::vector<TrackArrays<glm::vec3>> scalings;
+
+	explicit SkeletonLayout(std::shared_ptr<mdx::MDX> model)
+		: model(std::move(model)) {
+		std::vector<mdx::Node*> nodes;
+		this->model->for_each_node([&](mdx::Node& node) {
+			// Seen it happen with Emmitter1, see SkeletalModelInstance
+			if (node.id != -1) {
+				nodes.push_back(&node);
+			}
+		});
+
+		std::vector<mdx::Node*> by_id;
+		for (const auto node : nodes) {
+			by_id.resize(std::max<size_t>(by_id.size(), node->id + 1));
+			by_id[node->id] = node;
+		}
+
+		const auto parent_of = [&](const mdx::Node& node) {
+			if (node.parent_id < 0 || static_cast<size_t>(node.parent_id) >= by_id.size() || node.parent_id == node.id || !by_id[node.parent_id]) {
+				return -1;
+			}
+			return node.parent_id;
+		};
+
+		// Sorting on depth puts parents before their children. The depth is capped so that broken models with cycles do not hang
+		std::vector<uint32_t> depths(nodes.size());
+		for (size_t i = 0; i < nodes.size(); i++) {
+			for (int parent = parent_of(*nodes[i]); parent != -1 && depths[i] <= nodes.size(); parent = parent_of(*by_id[parent])) {
+				depths[i]++;
+			}
+		}
+
+		std::vector<uint32_t> order(nodes.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::ranges::stable_sort(order, {}, [&](const uint32_t i) { return depths[i]; });
+
+		for (const uint32_t i : order) {
+			const mdx::Node& node = *nodes[i];
+			node_ids.push_back(node.id);
+			parents.push_back(parent_of(node));
+			pivots.push_back(static_cast<size_t>(node.id) < this->model->pivots.size() ? this->model->pivots[node.id] : glm::vec3(0.f));
+			billboarded.push_back((node.flags & (mdx::Node::Flags::billboarded | mdx::Node::Flags::billboarded_lock_x)) != 0);
+			translations.emplace_back(node.KGTR);
+			rotations.emplace_back(node.KGRT);
+			scalings.emplace_back(node.KGSC);
+		}
+	}
+
+	/// Returns the layout of the model, building it if no instance of the model holds one
+	static std::shared_ptr<const SkeletonLayout> get(const std::shared_ptr<mdx::MDX>& model) {
+		static std::mutex mutex;
+		static std::unordered_map<const mdx::MDX*, std::weak_ptr<const SkeletonLayout>> layouts;
+
+		std::lock_guard lock(mutex);
+		if (auto layout = layouts[model.get()].lock()) {
+			return layout;
+		}
+
+		// A layout keeps its model alive, so the entry of a model that was freed (and whose address may be reused) has always expired
+		std::erase_if(layouts, [](const auto& entry) { return entry.second.expired(); });
+		auto layout = std::make_shared<const SkeletonLayout>(model);
+		layouts[model.get()] = layout;
+		return layout;
+	}
+
+  private:
+	std::shared_ptr<mdx::MDX> model;
+};
@@ -21,6 +21,7 @@ export class Texture : public Resource {
 	std::vector<uint8_t> data;
 
 	static constexpr const char* name = "Texture";
+	static constexpr bool thread_safe_construction = true;
 
 	explicit Texture() = default;
 	Texture(const fs::path& path) {
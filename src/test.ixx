@@ -6,6 +6,20 @@ module;
 #include <execution>
 #include <filesystem>
 #include <print>
+#include <string_view>
+#include <memory>
+#include <span>
+#include <algorithm>
+#include <cstdint>
+#include <chrono>
+#include <optional>
+#include <cmath>
+#include <charconv>
+#include <limits>
+#include <stdexcept>
+#include <system_error>
+
+#include <glm/glm.hpp>
 
 export module test;
 
@@ -14,11 +28,22 @@ namespace fs = std::filesystem;
 import BinaryReader;
 import MDX;
 import no_init_allocator;
+import Hierarchy;
+import SLK;
+import Utilities;
+import Timer;
+import SkeletalModelInstance;
+import RayCast;
+import SpatialGrid;
+import TerrainUndo;
+
+/// A directory with extracted MDX files
+const fs::path mdx_directory = "C:/Users/User/Desktop/1.00/";
 
 void parse_all_mdx() {
 	std::vector<fs::path> paths;
 
-	for (const auto i : fs::recursive_directory_iterator("C:/Users/User/Desktop/1.00/")) {
+	for (const auto i : fs::recursive_directory_iterator(mdx_directory)) {
 		if (i.is_regular_file() && (i.path().extension() == ".mdx" || i.path().extension() == ".MDX")) {
 			paths.push_back(i.path());
 		}
@@ -33,10 +58,325 @@ void parse_all_mdx() {
 	});
 }
 
-export void execute_tests() {
-	std::print("[INFO] Parsing all MDX files\n");
-	auto begin = std::chrono::steady_clock::now();
-	parse_all_mdx();
-	auto delta = (std::chrono::steady_clock::now() - begin).count() / 1'000'000.f;
-	std::print("[INFO] Done parsing in {}ms\n", delta);
+/// The parser that SLK::load used before SLK::parse(), which scans for every field with find(). Only kept as the baseline for benchmark_slk_parsing()
+void parse_slk_reference(slk::SLK& slk, const std::string_view buffer) {
+	std::string_view view = buffer;
+
+	if (!view.starts_with("ID")) {
+		std::print("Invalid SLK file, does not contain \"ID\" as first record\n");
+		return;
+	}
+
+	const auto parse_integer = [&]() {
+		const size_t separator = view.find(';');
+		if (separator == std::string_view::npos) {
+			throw std::runtime_error("Invalid SLK record, missing ';'");
+		}
+		size_t value = 0;
+		const auto [end, error] = std::from_chars(view.data() + 1, view.data() + separator, value);
+		if (error != std::errc()) {
+			throw std::runtime_error("Invalid SLK record, expected a row or column number");
+		}
+		view.remove_prefix(separator + 1);
+		return value;
+	};
+
+	// Skip first ID line
+	view.remove_prefix(view.find('\n') + 1);
+
+	size_t column = 0;
+	size_t row = 0;
+
+	// Map the row/column numbers in the file to our dense indices. Duplicate headers end up in the same row/column
+	std::vector<size_t> file_rows;
+	std::vector<size_t> file_columns;
+	const auto dense_index = [](std::vector<size_t>& indices, const size_t file_index, const auto& add) {
+		if (file_index >= indices.size()) {
+			indices.resize(file_index + 1, std::numeric_limits<size_t>::max());
+		}
+		if (indices[file_index] == std::numeric_limits<size_t>::max()) {
+			indices[file_index] = add("");
+		}
+		return indices[file_index];
+	};
+
+	while (view.size()) {
+		switch (view.front()) {
+			case 'C':
+				view.remove_prefix(2);
+
+				if (view.front() == 'X') {
+					column = parse_integer() - 1;
+
+					if (view.front() == 'Y') {
+						row = parse_integer() - 1;
+					}
+				} else if (view.front() == 'Y') {
+					row = parse_integer() - 1;
+
+					if (view.front() == 'X') {
+						column = parse_integer() - 1;
+					}
+				}
+
+				if (row == 0 && column == 0) {
+					view.remove_prefix(view.find('\n') + 1);
+					break;
+				}
+
+				view.remove_prefix(1);
+
+				{
+					std::string_view data;
+					if (view.front() == '\"') {
+						data = view.substr(1, view.find('"', 1) - 1);
+					} else {
+						data = view.substr(0, view.find_first_of("\r\n"));
+					}
+
+					if (data == "-" || data == "_") {
+						data = "";
+					}
+
+					if (column == 0) {
+						// -1 as 0,0 is unitid/doodadid etc.
+						if (row - 1 >= file_rows.size()) {
+							file_rows.resize(row, std::numeric_limits<size_t>::max());
+						}
+						file_rows[row - 1] = slk.add_row(data);
+					} else if (row == 0) {
+						// If it is a column header we need to lowercase it as column headers are case insensitive
+						std::string header(data);
+						to_lowercase(header);
+						// -1 as 0,0 is unitid/doodadid etc.
+						if (column - 1 >= file_columns.size()) {
+							file_columns.resize(column, std::numeric_limits<size_t>::max());
+						}
+						file_columns[column - 1] = slk.add_column(header);
+					} else {
+						const size_t dense_row = dense_index(file_rows, row - 1, [&](std::string_view header) { return slk.add_row(header); });
+						const size_t dense_column = dense_index(file_columns, column - 1, [&](std::string_view header) { return slk.add_column(header); });
+						slk.set_base_data(dense_column, dense_row, slk.strings.intern(data));
+					}
+
+					view.remove_prefix(view.find('\n') + 1);
+				}
+				break;
+			case 'F':
+				view.remove_prefix(2);
+
+				if (view.front() == 'X') {
+					column = parse_integer() - 1;
+
+					if (view.front() == 'Y') {
+						row = parse_integer() - 1;
+					}
+				} else if (view.front() == 'Y') {
+					row = parse_integer() - 1;
+
+					if (view.front() == 'X') {
+						column = parse_integer() - 1;
+					}
+				}
+				view.remove_prefix(view.find('\n') + 1);
+				break;
+			default:
+				view.remove_prefix(view.find_first_of('\n') + 1);
+		}
+	}
+}
+
+/// Measures the SLK tokenizer throughput on UnitData.slk, which is the largest SLK that is loaded at startup
+void benchmark_slk_parsing() {
+	const BinaryReader reader = hierarchy.open_file("Units/UnitData.slk");
+	const std::string_view buffer(reinterpret_cast<const char*>(reader.buffer.data()), reader.buffer.size());
+	const double megabytes = buffer.size() / (1024.0 * 1024.0);
+	constexpr int iterations = 100;
+
+	const auto measure = [&](std::string_view name, const auto& function) {
+		Timer timer;
+		for (int i = 0; i < iterations; i++) {
+			function();
+		}
+		const double seconds = timer.elapsed_ms() / 1000.0;
+		std::print("[INFO] {:<24} {:>8.1f} MB/s\n", name, megabytes * iterations / seconds);
+	};
+
+	size_t lines = 0;
+	measure("Line ends (scalar)", [&] { lines += slk::find_line_ends_scalar(buffer).size(); });
+	measure("Line ends (SIMD)", [&] { lines += slk::find_line_ends(buffer).size(); });
+	measure("Old SLK parser", [&] {
+		slk::SLK slk;
+		parse_slk_reference(slk, buffer);
+		lines += slk.rows();
+	});
+	measure("SLK::parse", [&] {
+		slk::SLK slk;
+		slk.parse(buffer);
+		lines += slk.rows();
+	});
+	// Keeps the compiler from optimizing the work away
+	std::print("[INFO] {} lines/rows\n", lines);
+}
+
+/// Measures how many bones per second the skeleton evaluation gets through on the footman, a typical unit model.
+/// Compares evaluating one node at a time with evaluating batches of instances
+void benchmark_skeleton_evaluation() {
+	BinaryReader reader = hierarchy.open_file("units/human/Footman/Footman.mdx");
+	const auto model = std::make_shared<mdx::MDX>(reader);
+	constexpr int instance_count = 1024;
+	constexpr int iterations = 100;
+
+	std::vector<SkeletalModelInstance> instances;
+	instances.reserve(instance_count);
+	for (int i = 0; i < instance_count; i++) {
+		instances.emplace_back(model);
+		// Spread the instances over the sequence so that they do not all sample the same keyframes
+		instances.back().update(i * 0.001);
+	}
+
+	std::vector<SkeletalModelInstance*> pointers;
+	for (auto& i : instances) {
+		pointers.push_back(&i);
+	}
+
+	const double bones = static_cast<double>(instances.front().layout->node_ids.size()) * instance_count * iterations;
+	const auto measure = [&](std::string_view name, const auto& function) {
+		Timer timer;
+		for (int i = 0; i < iterations; i++) {
+			function();
+		}
+		const double seconds = timer.elapsed_ms() / 1000.0;
+		std::print("[INFO] {:<24} {:>8.2f} M bones/s\n", name, bones / seconds / 1'000'000.0);
+	};
+
+	measure("Per node (scalar)", [&] {
+		for (auto& i : instances) {
+			i.update_nodes_scalar();
+		}
+	});
+	measure("Batched (SIMD)", [&] {
+		for (size_t i = 0; i < pointers.size(); i += 16) {
+			SkeletalModelInstance::update_nodes(std::span(pointers).subspan(i, std::min<size_t>(16, pointers.size() - i)));
+		}
+	});
+}
+
+/// Prints a failed check and counts it
+void check(const bool condition, std::string_view name, int& failures) {
+	if (!condition) {
+		std::print("[ERROR] Check failed: {}\n", name);
+		failures++;
+	}
+}
+
+bool near(const std::optional<float> distance, const float expected) {
+	return distance && std::abs(*distance - expected) < 1e-4f;
+}
+
+/// Rays against boxes and triangles and ray_pick() choosing between overlapping candidates
+void test_ray_cast(int& failures) {
+	const glm::vec3 minimum(-1.f);
+	const glm::vec3 maximum(1.f);
+	check(near(intersect_box({ { -5.f, 0.f, 0.f }, { 1.f, 0.f, 0.f } }, minimum, maximum), 4.f), "ray hits box", failures);
+	check(!intersect_box({ { -5.f, 2.f, 0.f }, { 1.f, 0.f, 0.f } }, minimum, maximum), "ray passes box", failures);
+	check(!intersect_box({ { -5.f, 0.f, 0.f }, { -1.f, 0.f, 0.f } }, minimum, maximum), "ray points away from box", failures);
+	check(near(intersect_box({ { 0.f, 0.f, 0.f }, { 0.f, 0.f, 1.f } }, minimum, maximum), 0.f), "ray starts inside box", failures);
+
+	const glm::vec3 a(0.f, 0.f, 0.f);
+	const glm::vec3 b(2.f, 0.f, 0.f);
+	const glm::vec3 c(0.f, 2.f, 0.f);
+	const glm::vec3 down(0.f, 0.f, -1.f);
+	check(near(intersect_triangle({ { 0.5f, 0.5f, 3.f }, down }, a, b, c), 3.f), "ray hits triangle inside", failures);
+	check(near(intersect_triangle({ { 1.f, 0.f, 3.f }, down }, a, b, c), 3.f), "ray hits triangle edge", failures);
+	check(near(intersect_triangle({ { 0.5f, 0.5f, -3.f }, -down }, a, b, c), 3.f), "ray hits triangle back side", failures);
+	check(!intersect_triangle({ { 1.5f, 1.5f, 3.f }, down }, a, b, c), "ray misses triangle", failures);
+	check(!intersect_triangle({ { -1.f, 0.5f, 0.f }, { 1.f, 0.f, 0.f } }, a, b, c), "ray parallel to triangle", failures);
+	check(!intersect_triangle({ { 0.5f, 0.5f, -3.f }, down }, a, b, c), "triangle behind ray", failures);
+
+	// Two boxes on the same tile that overlap along the ray. The far one is listed first so that the order of the items does not decide
+	const std::vector<SpatialGrid::Bounds> items = {
+		{ { 4.f, 4.f }, { 3.f, 3.f, 0.f }, { 5.f, 5.f, 2.f } },
+		{ { 4.f, 4.f }, { 3.f, 3.f, 1.f }, { 5.f, 5.f, 4.f } },
+	};
+	SpatialGrid grid;
+	grid.build(16, 16, items.size(), [&](const size_t i) { return items[i]; });
+
+	const Ray ray = { { 4.f, 4.f, 10.f }, down };
+	const auto bounds = [&](const uint32_t i) { return items[i]; };
+	// The top of the box stands in for the shape
+	const auto refine = [&](const uint32_t i) { return std::optional<float>(ray.origin.z - items[i].maximum.z); };
+	check(ray_pick(grid, ray, bounds, refine) == 1u, "ray_pick picks nearest candidate", failures);
+	check(ray_pick(grid, ray, bounds, [&](const uint32_t i) { return i == 1 ? std::nullopt : refine(i); }) == 0u, "ray_pick skips candidate whose shape is missed", failures);
+	check(ray_pick(grid, ray, bounds, [](uint32_t) { return std::optional<float>(9.f); }) == 0u, "ray_pick breaks ties on lowest index", failures);
+	check(!ray_pick(grid, { { 10.f, 10.f, 10.f }, down }, bounds, refine), "ray_pick misses all candidates", failures);
+}
+
+/// UndoBlob with and without a base, before and after spilling to disk
+void test_undo_blob(int& failures) {
+	// Poorly compressible data, of which an edit changes a small part
+	std::vector<uint32_t> before(4096);
+	for (size_t i = 0; i < before.size(); i++) {
+		before[i] = static_cast<uint32_t>(i * 2654435761u);
+	}
+	std::vector<uint32_t> after = before;
+	for (size_t i = 1000; i < 1100; i++) {
+		after[i] = 0;
+	}
+
+	UndoBlob old_data { std::span<const uint32_t>(before) };
+	UndoBlob new_data { std::span<const uint32_t>(after), before };
+	check(old_data.unpack<uint32_t>() == before, "undo blob round trip", failures);
+	check(new_data.unpack<uint32_t>(before) == after, "undo blob round trip against base", failures);
+	check(new_data.memory_usage() < old_data.memory_usage() / 4, "undo blob stores difference to base", failures);
+
+	const auto spill_file = std::make_shared<UndoSpillFile>();
+	old_data.spill(spill_file);
+	new_data.spill(spill_file);
+	check(old_data.memory_usage() == 0 && new_data.memory_usage() == 0, "spilled undo blob leaves memory", failures);
+	check(spill_file->size() == old_data.disk_usage() + new_data.disk_usage(), "spill file holds spilled undo blobs", failures);
+	check(old_data.unpack<uint32_t>() == before, "spilled undo blob round trip", failures);
+	check(new_data.unpack<uint32_t>(before) == after, "spilled undo blob round trip against base", failures);
+
+	const UndoBlob moved = std::move(new_data);
+	check(moved.unpack<uint32_t>(before) == after, "moved undo blob round trip", failures);
+
+	old_data = UndoBlob();
+	check(spill_file->size() == moved.disk_usage(), "released undo blob leaves spill file", failures);
+}
+
+/// Runs the checks that do not need any game data. Started with the --test command line flag.
+/// Returns the process exit code
+export int run_tests() {
+	int failures = 0;
+	test_ray_cast(failures);
+	test_undo_blob(failures);
+
+	std::print("[INFO] {} checks failed\n", failures);
+	return failures == 0 ? 0 : 1;
+}
+
+/// Runs the benchmarks on the game data in warcraft_directory. Started with the --benchmark command line flag.
+/// Returns the process exit code
+export int run_benchmarks(const fs::path& warcraft_directory) {
+	if (!hierarchy.open_casc(warcraft_directory)) {
+		std::print("[ERROR] Could not open the game data in {}\n", warcraft_directory.string());
+		return 1;
+	}
+
+	if (fs::exists(mdx_directory)) {
+		std::print("[INFO] Parsing all MDX files\n");
+		auto begin = std::chrono::steady_clock::now();
+		parse_all_mdx();
+		auto delta = (std::chrono::steady_clock::now() - begin).count() / 1'000'000.f;
+		std::print("[INFO] Done parsing in {}ms\n", delta);
+	}
+
+	std::print("[INFO] Benchmarking SLK parsing\n");
+	benchmark_slk_parsing();
+
+	std::print("[INFO] Benchmarking skeleton evaluation\n");
+	benchmark_skeleton_evaluation();
+
+	return 0;
 }
@@ -0,0 +1,111 @@
+module;
+
+#include <vector>
+#include <algorithm>
+#include <glad/glad.h>
+
+export module BufferArena;
+
+/// A single OpenGL buffer that many meshes sub-allocate their static data from so that they can be drawn together (e.g. with glMultiDrawElementsIndirect).
+/// The buffer grows (and thus changes name) when it runs out of space, so users should not cache buffer but read it whenever they bind it.
+/// The buffer is created on first use, allocate/free require the OpenGL context to be active/current
+export class BufferArena {
+  public:
+	struct Range {
+		size_t offset = 0;
+		size_t size = 0;
+	};
+
+	GLuint buffer = 0;
+
+	/// All ranges start at a multiple of alignment bytes so that they can also be bound with glBindBufferRange
+	explicit BufferArena(const size_t alignment = 256)
+		: alignment(alignment) {
+	}
+
+	BufferArena(const BufferArena&) = delete;
+	BufferArena& operator=(const BufferArena&) = delete;
+
+	/// Copies size bytes of data into a free range of the buffer
+	Range allocate(const size_t size, const void* data) {
+		const size_t aligned_size = std::max<size_t>((size + alignment - 1) / alignment * alignment, alignment);
+
+		auto found = std::ranges::find_if(free_ranges, [&](const Range& range) {
+			return range.size >= aligned_size;
+		});
+		if (found == free_ranges.end()) {
+			grow(aligned_size);
+			found = free_ranges.end() - 1;
+		}
+
+		const Range range = { found->offset, aligned_size };
+		found->offset += aligned_size;
+		found->size -= aligned_size;
+		if (found->size == 0) {
+			free_ranges.erase(found);
+		}
+
+		if (size > 0) {
+			glNamedBufferSubData(buffer, range.offset, size, data);
+		}
+		return range;
+	}
+
+	/// Returns the range to the arena. The contents of the buffer are not touched
+	void free(const Range range) {
+		if (range.size == 0) {
+			return;
+		}
+
+		// Keep the free list sorted on offset so that neighbours can be merged
+		auto next = std::ranges::upper_bound(free_ranges, range.offset, {}, &Range::offset);
+		next = free_ranges.insert(next, range);
+
+		if (next + 1 != free_ranges.end() && next->offset + next->size == (next + 1)->offset) {
+			next->size += (next + 1)->size;
+			free_ranges.erase(next + 1);
+		}
+		if (next != free_ranges.begin() && (next - 1)->offset + (next - 1)->size == next->offset) {
+			(next - 1)->size += next->size;
+			free_ranges.erase(next);
+		}
+	}
+
+	/// Binds the range to a shader storage buffer binding point
+	void bind(const GLuint index, const Range range) const {
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, index, buffer, range.offset, range.size);
+	}
+
+	size_t capacity() const {
+		return buffer_capacity;
+	}
+
+  private:
+	size_t alignment;
+	size_t buffer_capacity = 0;
+	/// Sorted on offset and never adjacent
+	std::vector<Range> free_ranges;
+
+	/// Replaces the buffer by one with at least extra free bytes at the end and copies the old contents over
+	void grow(const size_t extra) {
+		size_t tail_start = buffer_capacity;
+		if (!free_ranges.empty() && free_ranges.back().offset + free_ranges.back().size == buffer_capacity) {
+			tail_start = free_ranges.back().offset;
+			free_ranges.pop_back();
+		}
+
+		const size_t new_capacity = std::max(buffer_capacity * 2, tail_start + extra);
+
+		GLuint new_buffer;
+		glCreateBuffers(1, &new_buffer);
+		glNamedBufferStorage(new_buffer, new_capacity, nullptr, GL_DYNAMIC_STORAGE_BIT);
+		if (buffer != 0) {
+			glCopyNamedBufferSubData(buffer, new_buffer, 0, 0, buffer_capacity);
+			glDeleteBuffers(1, &buffer);
+		}
+
+		buffer = new_buffer;
+		buffer_capacity = new_capacity;
+		free_ranges.push_back({ tail_start, new_capacity - tail_start });
+	}
+};
@@ -0,0 +1,78 @@
+module;
+
+#include <vector>
+#include <cstdint>
+
+#include <QRect>
+
+export module DirtyRegion;
+
+/// The areas of a texture that were changed on the CPU since they were last uploaded.
+/// Areas are merged as they are added, so the edits of a frame are uploaded with a few glTextureSubImage2D calls instead of reuploading the whole texture on every edit
+export class DirtyRegion {
+  public:
+	/// Forgets all areas. Areas added afterwards are clipped to width by height
+	void reset(const int width, const int height) {
+		bounds = QRect(0, 0, width, height);
+		areas.clear();
+	}
+
+	void add(const QRect& area) {
+		QRect merged = area.intersected(bounds);
+		if (merged.isEmpty()) {
+			return;
+		}
+
+		// A merged area may now be worth merging with areas it was not worth merging with before, so start over after every merge
+		for (size_t i = 0; i < areas.size();) {
+			if (worth_merging(areas[i], merged)) {
+				merged = merged.united(areas[i]);
+				areas[i] = areas.back();
+				areas.pop_back();
+				i = 0;
+			} else {
+				i++;
+			}
+		}
+		areas.push_back(merged);
+
+		if (areas.size() > max_areas) {
+			QRect all;
+			for (const QRect& i : areas) {
+				all = all.united(i);
+			}
+			areas = { all };
+		}
+	}
+
+	bool empty() const {
+		return areas.empty();
+	}
+
+	/// Calls upload(area) for every area and forgets them
+	template <typename F>
+	void flush(F&& upload) {
+		for (const QRect& area : areas) {
+			upload(area);
+		}
+		areas.clear();
+	}
+
+  private:
+	/// Beyond this many areas the bounding box of all is uploaded instead
+	static constexpr size_t max_areas = 16;
+	/// The texels that are worth uploading for nothing to save an upload call
+	static constexpr int64_t merge_slack = 32 * 32;
+
+	QRect bounds;
+	std::vector<QRect> areas;
+
+	static int64_t texels(const QRect& area) {
+		return static_cast<int64_t>(area.width()) * area.height();
+	}
+
+	/// Overlapping areas do not have to be merged, uploading the overlap twice is fine
+	static bool worth_merging(const QRect& a, const QRect& b) {
+		return texels(a.united(b)) <= texels(a) + texels(b) + merge_slack;
+	}
+};
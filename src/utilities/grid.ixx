@@ -0,0 +1,211 @@
+module;
+
+#include <vector>
+#include <span>
+#include <algorithm>
+#include <cstdint>
+
+export module Grid;
+
+/// A width by height grid stored in a single row major allocation, so walking a row touches consecutive memory and copying the whole grid is a single copy.
+/// Indexed as grid(x, y)
+export template <typename T>
+class Grid {
+  public:
+	Grid() = default;
+
+	Grid(const int width, const int height, const T& value = T())
+		: grid_width(width), grid_height(height), cells(static_cast<size_t>(width) * height, value) {
+	}
+
+	/// Discards the contents and fills the new grid with value
+	void resize(const int width, const int height, const T& value = T()) {
+		grid_width = width;
+		grid_height = height;
+		cells.assign(static_cast<size_t>(width) * height, value);
+	}
+
+	T& operator()(const int x, const int y) {
+		return cells[static_cast<size_t>(y) * grid_width + x];
+	}
+
+	const T& operator()(const int x, const int y) const {
+		return cells[static_cast<size_t>(y) * grid_width + x];
+	}
+
+	int width() const {
+		return grid_width;
+	}
+
+	int height() const {
+		return grid_height;
+	}
+
+	std::span<T> row(const int y) {
+		return { cells.data() + static_cast<size_t>(y) * grid_width, static_cast<size_t>(grid_width) };
+	}
+
+	std::span<const T> row(const int y) const {
+		return { cells.data() + static_cast<size_t>(y) * grid_width, static_cast<size_t>(grid_width) };
+	}
+
+	/// Copies the area starting at x, y row by row into out, which has to hold width * height elements
+	void read_area(const int x, const int y, const int width, const int height, T* out) const {
+		for (int j = 0; j < height; j++) {
+			out = std::copy_n(cells.begin() + static_cast<size_t>(y + j) * grid_width + x, width, out);
+		}
+	}
+
+	/// The reverse of read_area()
+	void write_area(const int x, const int y, const int width, const int height, const T* in) {
+		for (int j = 0; j < height; j++) {
+			std::copy_n(in + static_cast<size_t>(j) * width, width, cells.begin() + static_cast<size_t>(y + j) * grid_width + x);
+		}
+	}
+
+	T* data() {
+		return cells.data();
+	}
+
+	const T* data() const {
+		return cells.data();
+	}
+
+	size_t size() const {
+		return cells.size();
+	}
+
+	auto begin() {
+		return cells.begin();
+	}
+
+	auto end() {
+		return cells.end();
+	}
+
+	auto begin() const {
+		return cells.begin();
+	}
+
+	auto end() const {
+		return cells.end();
+	}
+
+  private:
+	int grid_width = 0;
+	int grid_height = 0;
+	std::vector<T> cells;
+};
+
+/// A copy on write snapshot of a row major grid for undo, taken tile by tile.
+/// begin() does not copy anything. Whoever modifies the grid calls preserve() first, which copies the tiles overlapping the area that were not preserved yet.
+/// Tiles that were never preserved have not changed since begin(), so reading them falls through to the live grid.
+/// The live data must not be reallocated between begin() and the last read
+export template <typename T>
+class TileSnapshot {
+  public:
+	static constexpr int tile_size = 32;
+
+	/// Starts a new snapshot of the width by height grid at data. Only releases the tiles preserved by the previous snapshot
+	void begin(const T* data, const int width, const int height) {
+		if (width != grid_width || height != grid_height) {
+			grid_width = width;
+			grid_height = height;
+			columns = (width + tile_size - 1) / tile_size;
+			tiles.clear();
+			tiles.resize(static_cast<size_t>(columns) * ((height + tile_size - 1) / tile_size));
+			preserved.clear();
+		}
+
+		for (const uint32_t index : preserved) {
+			spare.push_back(std::move(tiles[index]));
+			tiles[index].clear();
+		}
+		preserved.clear();
+		live = data;
+	}
+
+	void begin(const Grid<T>& grid) {
+		begin(grid.data(), grid.width(), grid.height());
+	}
+
+	/// Has to be called before the cells in the area are modified
+	void preserve(const int x, const int y, const int width, const int height) {
+		if (width <= 0 || height <= 0 || x >= grid_width || y >= grid_height || x + width <= 0 || y + height <= 0) {
+			return;
+		}
+
+		const int left = std::max(x, 0) / tile_size;
+		const int bottom = std::max(y, 0) / tile_size;
+		const int right = (std::min(x + width, grid_width) - 1) / tile_size;
+		const int top = (std::min(y + height, grid_height) - 1) / tile_size;
+
+		for (int ty = bottom; ty <= top; ty++) {
+			for (int tx = left; tx <= right; tx++) {
+				const uint32_t index = ty * columns + tx;
+				if (!tiles[index].empty()) {
+					continue;
+				}
+
+				std::vector<T>& tile = tiles[index];
+				if (!spare.empty()) {
+					tile = std::move(spare.back());
+					spare.pop_back();
+				}
+				tile.resize(tile_size * tile_size);
+
+				const int tile_width = std::min(tile_size, grid_width - tx * tile_size);
+				const int tile_height = std::min(tile_size, grid_height - ty * tile_size);
+				for (int j = 0; j < tile_height; j++) {
+					std::copy_n(live + static_cast<size_t>(ty * tile_size + j) * grid_width + tx * tile_size, tile_width, tile.begin() + j * tile_size);
+				}
+				preserved.push_back(index);
+			}
+		}
+	}
+
+	/// The value at x, y when begin() was called
+	const T& operator()(const int x, const int y) const {
+		const std::vector<T>& tile = tiles[(y / tile_size) * columns + x / tile_size];
+		if (tile.empty()) {
+			return live[static_cast<size_t>(y) * grid_width + x];
+		}
+		return tile[(y % tile_size) * tile_size + x % tile_size];
+	}
+
+	/// Copies the area starting at x, y as it was when begin() was called row by row into out, which has to hold width * height elements
+	void read_area(const int x, const int y, const int width, const int height, T* out) const {
+		for (int j = y; j < y + height; j++) {
+			const int tile_row = (j / tile_size) * columns;
+			const int tile_y = j % tile_size;
+			// Copy the run of the row that falls within each tile at once, from the tile or from the live grid
+			for (int i = x; i < x + width;) {
+				const int tile_x = i % tile_size;
+				const int run = std::min(tile_size - tile_x, x + width - i);
+				const std::vector<T>& tile = tiles[tile_row + i / tile_size];
+				if (tile.empty()) {
+					out = std::copy_n(live + static_cast<size_t>(j) * grid_width + i, run, out);
+				} else {
+					out = std::copy_n(tile.begin() + tile_y * tile_size + tile_x, run, out);
+				}
+				i += run;
+			}
+		}
+	}
+
+	/// The number of tiles copied since begin()
+	size_t preserved_tiles() const {
+		return preserved.size();
+	}
+
+  private:
+	const T* live = nullptr;
+	int grid_width = 0;
+	int grid_height = 0;
+	int columns = 0;
+	/// Empty for tiles that were not preserved
+	std::vector<std::vector<T>> tiles;
+	std::vector<uint32_t> preserved;
+	/// Allocations of released tiles, reused by the next snapshot
+	std::vector<std::vector<T>> spare;
+};
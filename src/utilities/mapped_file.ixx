@@ -0,0 +1,147 @@
+module;
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+export module MappedFile;
+
+namespace fs = std::filesystem;
+
+/// A read-only memory mapping of a file on disk.
+/// The mapped bytes stay valid until the MappedFile is closed or destroyed
+export class MappedFile {
+  public:
+	MappedFile() = default;
+
+	explicit MappedFile(const fs::path& path) {
+		open(path);
+	}
+
+	~MappedFile() {
+		close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile&& move) noexcept {
+		*this = std::move(move);
+	}
+
+	MappedFile& operator=(MappedFile&& move) noexcept {
+		if (this != &move) {
+			close();
+			bytes = move.bytes;
+			move.bytes = {};
+#ifdef _WIN32
+			file = move.file;
+			mapping = move.mapping;
+			move.file = INVALID_HANDLE_VALUE;
+			move.mapping = nullptr;
+#endif
+		}
+		return *this;
+	}
+
+	/// Returns false if the file does not exist or could not be mapped. Empty files can not be mapped either
+	bool open(const fs::path& path) {
+		close();
+
+#ifdef _WIN32
+		file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+			close();
+			return false;
+		}
+
+		mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping == nullptr) {
+			close();
+			return false;
+		}
+
+		void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (view == nullptr) {
+			close();
+			return false;
+		}
+		bytes = { static_cast<const uint8_t*>(view), static_cast<size_t>(size.QuadPart) };
+#else
+		const int descriptor = ::open(path.c_str(), O_RDONLY);
+		if (descriptor == -1) {
+			return false;
+		}
+
+		struct stat status;
+		if (fstat(descriptor, &status) == -1 || status.st_size == 0) {
+			::close(descriptor);
+			return false;
+		}
+
+		void* view = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		// The mapping keeps its own reference to the file
+		::close(descriptor);
+		if (view == MAP_FAILED) {
+			return false;
+		}
+		bytes = { static_cast<const uint8_t*>(view), static_cast<size_t>(status.st_size) };
+#endif
+		return true;
+	}
+
+	void close() {
+#ifdef _WIN32
+		if (!bytes.empty()) {
+			UnmapViewOfFile(bytes.data());
+		}
+		if (mapping != nullptr) {
+			CloseHandle(mapping);
+			mapping = nullptr;
+		}
+		if (file != INVALID_HANDLE_VALUE) {
+			CloseHandle(file);
+			file = INVALID_HANDLE_VALUE;
+		}
+#else
+		if (!bytes.empty()) {
+			munmap(const_cast<uint8_t*>(bytes.data()), bytes.size());
+		}
+#endif
+		bytes = {};
+	}
+
+	[[nodiscard]] bool is_open() const {
+		return !bytes.empty();
+	}
+
+	[[nodiscard]] std::span<const uint8_t> data() const {
+		return bytes;
+	}
+
+	[[nodiscard]] size_t size() const {
+		return bytes.size();
+	}
+
+  private:
+	std::span<const uint8_t> bytes;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+};
\ No newline at end of file
@@ -1,9 +1,19 @@
 module;
 
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <algorithm>
+
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define MATH_OPERATIONS_SSE
+#endif
+
 export module MathOperations;
 
 export extern const glm::vec3 TRANSLATION_IDENTITY(0);
@@ -192,4 +202,239 @@ export glm::quat safeQuatLookAt(
 	} else {
 		return glm::quatLookAt(direction, up);
 	}
-}
\ No newline at end of file
+}
+
+/// Transforms an axis aligned box and returns the axis aligned box around the result (Arvo's method).
+/// Unlike transforming just the two corners this also contains the box when the matrix rotates it
+export void transform_box(const glm::mat4& matrix, const glm::vec3& minimum, const glm::vec3& maximum, glm::vec3& out_minimum, glm::vec3& out_maximum) {
+	out_minimum = glm::vec3(matrix[3]);
+	out_maximum = glm::vec3(matrix[3]);
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			const float a = matrix[i][j] * minimum[i];
+			const float b = matrix[i][j] * maximum[i];
+			out_minimum[j] += std::min(a, b);
+			out_maximum[j] += std::max(a, b);
+		}
+	}
+}
+
+/// Many vectors stored as one array per component so that they can be processed 4 at a time
+export struct Vec3Batch {
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+
+	void resize(const size_t count) {
+		x.resize(count);
+		y.resize(count);
+		z.resize(count);
+	}
+
+	size_t size() const {
+		return x.size();
+	}
+
+	void set(const size_t i, const glm::vec3& value) {
+		x[i] = value.x;
+		y[i] = value.y;
+		z[i] = value.z;
+	}
+
+	glm::vec3 get(const size_t i) const {
+		return { x[i], y[i], z[i] };
+	}
+};
+
+/// Many quaternions stored as one array per component so that they can be processed 4 at a time
+export struct QuatBatch {
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+	std::vector<float> w;
+
+	void resize(const size_t count) {
+		x.resize(count);
+		y.resize(count);
+		z.resize(count);
+		w.resize(count);
+	}
+
+	size_t size() const {
+		return x.size();
+	}
+
+	void set(const size_t i, const glm::quat& value) {
+		x[i] = value.x;
+		y[i] = value.y;
+		z[i] = value.z;
+		w[i] = value.w;
+	}
+
+	glm::quat get(const size_t i) const {
+		return glm::quat(w[i], x[i], y[i], z[i]);
+	}
+};
+
+/// out[i] = mix(from[i], to[i], t[i]). out has to be as large as from and to
+export void lerp_batch(const Vec3Batch& from, const Vec3Batch& to, const float* t, Vec3Batch& out) {
+	const size_t count = from.size();
+	size_t i = 0;
+#ifdef MATH_OPERATIONS_SSE
+	const __m128 one = _mm_set1_ps(1.f);
+	for (; i + 4 <= count; i += 4) {
+		const __m128 b = _mm_loadu_ps(t + i);
+		const __m128 a = _mm_sub_ps(one, b);
+		_mm_storeu_ps(&out.x[i], _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&from.x[i]), a), _mm_mul_ps(_mm_loadu_ps(&to.x[i]), b)));
+		_mm_storeu_ps(&out.y[i], _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&from.y[i]), a), _mm_mul_ps(_mm_loadu_ps(&to.y[i]), b)));
+		_mm_storeu_ps(&out.z[i], _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&from.z[i]), a), _mm_mul_ps(_mm_loadu_ps(&to.z[i]), b)));
+	}
+#endif
+	for (; i < count; i++) {
+		out.set(i, glm::mix(from.get(i), to.get(i), t[i]));
+	}
+}
+
+// The coefficients of the polynomial approximation of slerp from David Eberly's "A Fast and Accurate Algorithm for Computing SLERP".
+// Unlike glm::slerp it needs no acos/sin or branches so it maps directly onto SIMD. The maximum error is around 2e-5, far below what is visible
+constexpr float slerp_mu = 1.85298109240830f;
+constexpr std::array<float, 8> slerp_u = {
+	1.f / (1 * 3), 1.f / (2 * 5), 1.f / (3 * 7), 1.f / (4 * 9), 1.f / (5 * 11), 1.f / (6 * 13), 1.f / (7 * 15), slerp_mu / (8 * 17)
+};
+constexpr std::array<float, 8> slerp_v = {
+	1.f / 3, 2.f / 5, 3.f / 7, 4.f / 9, 5.f / 11, 6.f / 13, 7.f / 15, slerp_mu * 8 / 17
+};
+
+/// The same approximation as slerp_batch for a single quaternion, takes the shortest path like glm::slerp
+export glm::quat fast_slerp(const glm::quat& from, const glm::quat& to, const float t) {
+	float x = glm::dot(from, to);
+	const float sign = x < 0.f ? -1.f : 1.f;
+	x *= sign;
+
+	const float x_minus_one = x - 1.f;
+	const float d = 1.f - t;
+	float f_t = 1.f;
+	float f_d = 1.f;
+	for (size_t i = slerp_u.size(); i-- > 0;) {
+		f_t = 1.f + (slerp_u[i] * t * t - slerp_v[i]) * x_minus_one * f_t;
+		f_d = 1.f + (slerp_u[i] * d * d - slerp_v[i]) * x_minus_one * f_d;
+	}
+	return from * (d * f_d) + to * (sign * t * f_t);
+}
+
+/// out[i] = slerp(from[i], to[i], t[i]) using fast_slerp. out has to be as large as from and to
+export void slerp_batch(const QuatBatch& from, const QuatBatch& to, const float* t, QuatBatch& out) {
+	const size_t count = from.size();
+	size_t i = 0;
+#ifdef MATH_OPERATIONS_SSE
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 sign_bit = _mm_set1_ps(-0.f);
+	for (; i + 4 <= count; i += 4) {
+		const __m128 ax = _mm_loadu_ps(&from.x[i]);
+		const __m128 ay = _mm_loadu_ps(&from.y[i]);
+		const __m128 az = _mm_loadu_ps(&from.z[i]);
+		const __m128 aw = _mm_loadu_ps(&from.w[i]);
+		const __m128 bx = _mm_loadu_ps(&to.x[i]);
+		const __m128 by = _mm_loadu_ps(&to.y[i]);
+		const __m128 bz = _mm_loadu_ps(&to.z[i]);
+		const __m128 bw = _mm_loadu_ps(&to.w[i]);
+
+		const __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+		const __m128 sign = _mm_and_ps(dot, sign_bit);
+		const __m128 x_minus_one = _mm_sub_ps(_mm_xor_ps(dot, sign), one);
+
+		const __m128 factor = _mm_loadu_ps(t + i);
+		const __m128 d = _mm_sub_ps(one, factor);
+		const __m128 t_squared = _mm_mul_ps(factor, factor);
+		const __m128 d_squared = _mm_mul_ps(d, d);
+
+		__m128 f_t = one;
+		__m128 f_d = one;
+		for (size_t j = slerp_u.size(); j-- > 0;) {
+			const __m128 u = _mm_set1_ps(slerp_u[j]);
+			const __m128 v = _mm_set1_ps(slerp_v[j]);
+			f_t = _mm_add_ps(one, _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_mul_ps(u, t_squared), v), x_minus_one), f_t));
+			f_d = _mm_add_ps(one, _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_mul_ps(u, d_squared), v), x_minus_one), f_d));
+		}
+		const __m128 c_t = _mm_xor_ps(_mm_mul_ps(factor, f_t), sign);
+		const __m128 c_d = _mm_mul_ps(d, f_d);
+
+		_mm_storeu_ps(&out.x[i], _mm_add_ps(_mm_mul_ps(ax, c_d), _mm_mul_ps(bx, c_t)));
+		_mm_storeu_ps(&out.y[i], _mm_add_ps(_mm_mul_ps(ay, c_d), _mm_mul_ps(by, c_t)));
+		_mm_storeu_ps(&out.z[i], _mm_add_ps(_mm_mul_ps(az, c_d), _mm_mul_ps(bz, c_t)));
+		_mm_storeu_ps(&out.w[i], _mm_add_ps(_mm_mul_ps(aw, c_d), _mm_mul_ps(bw, c_t)));
+	}
+#endif
+	for (; i < count; i++) {
+		out.set(i, fast_slerp(from.get(i), to.get(i), t[i]));
+	}
+}
+
+/// fromRotationTranslationScaleOrigin for whole batches, out[i] is the matrix of the ith rotation, translation, scale and pivot
+export void compose_batch(const QuatBatch& rotations, const Vec3Batch& translations, const Vec3Batch& scales, const Vec3Batch& pivots, glm::mat4* out) {
+	const size_t count = rotations.size();
+	size_t i = 0;
+#ifdef MATH_OPERATIONS_SSE
+	const __m128 one = _mm_set1_ps(1.f);
+	for (; i + 4 <= count; i += 4) {
+		const __m128 x = _mm_loadu_ps(&rotations.x[i]);
+		const __m128 y = _mm_loadu_ps(&rotations.y[i]);
+		const __m128 z = _mm_loadu_ps(&rotations.z[i]);
+		const __m128 w = _mm_loadu_ps(&rotations.w[i]);
+		const __m128 x2 = _mm_add_ps(x, x);
+		const __m128 y2 = _mm_add_ps(y, y);
+		const __m128 z2 = _mm_add_ps(z, z);
+		const __m128 xx = _mm_mul_ps(x, x2);
+		const __m128 xy = _mm_mul_ps(x, y2);
+		const __m128 xz = _mm_mul_ps(x, z2);
+		const __m128 yy = _mm_mul_ps(y, y2);
+		const __m128 yz = _mm_mul_ps(y, z2);
+		const __m128 zz = _mm_mul_ps(z, z2);
+		const __m128 wx = _mm_mul_ps(w, x2);
+		const __m128 wy = _mm_mul_ps(w, y2);
+		const __m128 wz = _mm_mul_ps(w, z2);
+		const __m128 sx = _mm_loadu_ps(&scales.x[i]);
+		const __m128 sy = _mm_loadu_ps(&scales.y[i]);
+		const __m128 sz = _mm_loadu_ps(&scales.z[i]);
+
+		// Named after the element of the glm::mat4, m01 is column 0 row 1
+		__m128 m00 = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx);
+		__m128 m01 = _mm_mul_ps(_mm_add_ps(xy, wz), sx);
+		__m128 m02 = _mm_mul_ps(_mm_sub_ps(xz, wy), sx);
+		__m128 m03 = _mm_setzero_ps();
+		__m128 m10 = _mm_mul_ps(_mm_sub_ps(xy, wz), sy);
+		__m128 m11 = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy);
+		__m128 m12 = _mm_mul_ps(_mm_add_ps(yz, wx), sy);
+		__m128 m13 = _mm_setzero_ps();
+		__m128 m20 = _mm_mul_ps(_mm_add_ps(xz, wy), sz);
+		__m128 m21 = _mm_mul_ps(_mm_sub_ps(yz, wx), sz);
+		__m128 m22 = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz);
+		__m128 m23 = _mm_setzero_ps();
+
+		const __m128 px = _mm_loadu_ps(&pivots.x[i]);
+		const __m128 py = _mm_loadu_ps(&pivots.y[i]);
+		const __m128 pz = _mm_loadu_ps(&pivots.z[i]);
+		__m128 m30 = _mm_sub_ps(_mm_add_ps(_mm_loadu_ps(&translations.x[i]), px), _mm_add_ps(_mm_add_ps(_mm_mul_ps(m00, px), _mm_mul_ps(m10, py)), _mm_mul_ps(m20, pz)));
+		__m128 m31 = _mm_sub_ps(_mm_add_ps(_mm_loadu_ps(&translations.y[i]), py), _mm_add_ps(_mm_add_ps(_mm_mul_ps(m01, px), _mm_mul_ps(m11, py)), _mm_mul_ps(m21, pz)));
+		__m128 m32 = _mm_sub_ps(_mm_add_ps(_mm_loadu_ps(&translations.z[i]), pz), _mm_add_ps(_mm_add_ps(_mm_mul_ps(m02, px), _mm_mul_ps(m12, py)), _mm_mul_ps(m22, pz)));
+		__m128 m33 = one;
+
+		// Every register holds one element of 4 matrices, transposing turns them into one column of each matrix
+		_MM_TRANSPOSE4_PS(m00, m01, m02, m03);
+		_MM_TRANSPOSE4_PS(m10, m11, m12, m13);
+		_MM_TRANSPOSE4_PS(m20, m21, m22, m23);
+		_MM_TRANSPOSE4_PS(m30, m31, m32, m33);
+
+		const __m128 columns[16] = { m00, m10, m20, m30, m01, m11, m21, m31, m02, m12, m22, m32, m03, m13, m23, m33 };
+		for (size_t j = 0; j < 4; j++) {
+			float* matrix = &out[i + j][0][0];
+			for (size_t k = 0; k < 4; k++) {
+				_mm_storeu_ps(matrix + k * 4, columns[j * 4 + k]);
+			}
+		}
+	}
+#endif
+	for (; i < count; i++) {
+		fromRotationTranslationScaleOrigin(rotations.get(i), translations.get(i), scales.get(i), out[i], pivots.get(i));
+	}
+}
@@ -31,7 +31,7 @@ void load_modification_table(BinaryReader& reader, uint32_t version, slk::SLK& s
 		if (version >= 3) {
 			reader.advance(4 * reader.read<uint32_t>());
 		}
-		if (modification && !slk.base_data.contains(modified_id)) {
+		if (modification && !slk.row_headers.contains(modified_id)) {
 			slk.copy_row(original_id, modified_id, false);
 		}
 
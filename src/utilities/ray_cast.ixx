@@ -0,0 +1,130 @@
+module;
+
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <utility>
+#include <limits>
+#include <cmath>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+export module RayCast;
+
+import SpatialGrid;
+
+export struct Ray {
+	glm::vec3 origin;
+	/// Normalized, so that distances along the ray are in world units
+	glm::vec3 direction;
+
+	glm::vec3 at(const float distance) const {
+		return origin + direction * distance;
+	}
+};
+
+/// Returns the distance along the ray at which it enters the box, or 0 if the origin lies inside the box
+export std::optional<float> intersect_box(const Ray& ray, const glm::vec3& minimum, const glm::vec3& maximum) {
+	float near = 0.f;
+	float far = std::numeric_limits<float>::max();
+
+	for (int i = 0; i < 3; i++) {
+		// Parallel to the slab, 1/0 would turn into 0 * inf = NaN when the origin lies on the slab
+		if (std::abs(ray.direction[i]) < 1e-8f) {
+			if (ray.origin[i] < minimum[i] || ray.origin[i] > maximum[i]) {
+				return std::nullopt;
+			}
+			continue;
+		}
+
+		const float inverse = 1.f / ray.direction[i];
+		float t0 = (minimum[i] - ray.origin[i]) * inverse;
+		float t1 = (maximum[i] - ray.origin[i]) * inverse;
+		if (t0 > t1) {
+			std::swap(t0, t1);
+		}
+		near = std::max(near, t0);
+		far = std::min(far, t1);
+		if (near > far) {
+			return std::nullopt;
+		}
+	}
+	return near;
+}
+
+/// Möller–Trumbore. Returns the distance along the ray to the triangle. Both sides of the triangle are hit
+export std::optional<float> intersect_triangle(const Ray& ray, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+	const glm::vec3 edge1 = b - a;
+	const glm::vec3 edge2 = c - a;
+	const glm::vec3 p = glm::cross(ray.direction, edge2);
+	const float determinant = glm::dot(edge1, p);
+	if (std::abs(determinant) < 1e-12f) {
+		return std::nullopt;
+	}
+
+	const float inverse = 1.f / determinant;
+	const glm::vec3 s = ray.origin - a;
+	const float u = glm::dot(s, p) * inverse;
+	if (u < 0.f || u > 1.f) {
+		return std::nullopt;
+	}
+
+	const glm::vec3 q = glm::cross(s, edge1);
+	const float v = glm::dot(ray.direction, q) * inverse;
+	if (v < 0.f || u + v > 1.f) {
+		return std::nullopt;
+	}
+
+	const float distance = glm::dot(edge2, q) * inverse;
+	if (distance < 0.f) {
+		return std::nullopt;
+	}
+	return distance;
+}
+
+/// Finds the item of the grid that the ray hits first.
+/// bounds(i) has to return the world space box of item i as a SpatialGrid::Bounds and refine(i) the distance at which the ray hits the actual shape of item i (or std::nullopt).
+/// The boxes are tested through the hierarchy of the grid and only the items whose box is hit are refined, nearest box first, until no box is closer than the best hit.
+/// Does not touch OpenGL. The result only depends on the items, ties are broken on the lowest index
+export template <typename B, typename R>
+std::optional<uint32_t> ray_pick(const SpatialGrid& grid, const Ray& ray, B&& bounds, R&& refine) {
+	enum class Hit {
+		outside,
+		intersecting,
+		inside
+	};
+
+	std::vector<std::pair<float, uint32_t>> candidates;
+	grid.cull(
+		[&](const glm::vec3& minimum, const glm::vec3& maximum) {
+			return intersect_box(ray, minimum, maximum) ? Hit::intersecting : Hit::outside;
+		},
+		[&](const SpatialGrid::Cell& cell, bool) {
+			for (const uint32_t index : cell.items) {
+				const SpatialGrid::Bounds item = bounds(index);
+				if (const auto distance = intersect_box(ray, glm::min(item.minimum, item.maximum), glm::max(item.minimum, item.maximum))) {
+					candidates.emplace_back(*distance, index);
+				}
+			}
+		}
+	);
+
+	std::ranges::sort(candidates);
+
+	std::optional<uint32_t> best;
+	float best_distance = std::numeric_limits<float>::max();
+	for (const auto& [entry, index] : candidates) {
+		// The shape lies inside its box so it can not be hit before the box is entered
+		if (entry > best_distance) {
+			break;
+		}
+
+		const std::optional<float> distance = refine(index);
+		if (distance && (*distance < best_distance || (best && *distance == best_distance && index < *best))) {
+			best = index;
+			best_distance = *distance;
+		}
+	}
+	return best;
+}
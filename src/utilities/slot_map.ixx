@@ -0,0 +1,181 @@
+module;
+
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <functional>
+
+export module SlotMap;
+
+/// Refers to a value in a SlotMap. Stays valid when other values are inserted or erased.
+/// Once the value itself is erased the handle becomes stale and SlotMap::get() returns nullptr for it
+export template <typename T>
+struct SlotHandle {
+	uint32_t slot = std::numeric_limits<uint32_t>::max();
+	uint32_t generation = 0;
+
+	bool operator==(const SlotHandle&) const = default;
+};
+
+template <typename T>
+struct std::hash<SlotHandle<T>> {
+	size_t operator()(const SlotHandle<T>& handle) const noexcept {
+		return std::hash<uint64_t>{}(static_cast<uint64_t>(handle.generation) << 32 | handle.slot);
+	}
+};
+
+/// A container with O(1) insertion, removal and handle lookup that keeps its values densely packed for fast iteration.
+/// Erasing moves the last value into the hole, so the order of values and references/pointers to them are not stable. Use handles to refer to values across modifications
+export template <typename T>
+class SlotMap {
+  public:
+	using Handle = SlotHandle<T>;
+
+	Handle insert(T value) {
+		uint32_t slot;
+		if (free_slots.empty()) {
+			slot = static_cast<uint32_t>(slots.size());
+			slots.emplace_back();
+		} else {
+			slot = free_slots.back();
+			free_slots.pop_back();
+		}
+
+		slots[slot].index = static_cast<uint32_t>(values.size());
+		values.push_back(std::move(value));
+		index_to_slot.push_back(slot);
+		return { slot, slots[slot].generation };
+	}
+
+	/// Does nothing if the handle is stale
+	void erase(const Handle handle) {
+		if (contains(handle)) {
+			erase_at(slots[handle.slot].index);
+		}
+	}
+
+	/// Erases the value at the given position of the dense storage
+	void erase_at(const size_t index) {
+		const uint32_t slot = index_to_slot[index];
+		if (index != values.size() - 1) {
+			values[index] = std::move(values.back());
+			index_to_slot[index] = index_to_slot.back();
+			slots[index_to_slot[index]].index = static_cast<uint32_t>(index);
+		}
+		values.pop_back();
+		index_to_slot.pop_back();
+
+		slots[slot].generation++;
+		free_slots.push_back(slot);
+		version++;
+	}
+
+	/// Erases all values for which predicate(value) returns true. Returns the number of erased values
+	template <typename F>
+	size_t erase_if(F&& predicate) {
+		const size_t old_size = values.size();
+		// Going backwards means the value that is moved into a hole has already been tested
+		for (size_t i = values.size(); i-- > 0;) {
+			if (predicate(values[i])) {
+				erase_at(i);
+			}
+		}
+		return old_size - values.size();
+	}
+
+	/// Changes whenever values are erased, which may move other values to another position of the dense storage.
+	/// Positions stored elsewhere (e.g. pick ids drawn in an earlier frame) still refer to the same values as long as it is unchanged
+	[[nodiscard]] uint64_t layout_version() const {
+		return version;
+	}
+
+	[[nodiscard]] bool contains(const Handle handle) const {
+		return handle.slot < slots.size() && slots[handle.slot].generation == handle.generation;
+	}
+
+	/// Returns nullptr if the handle is stale
+	[[nodiscard]] T* get(const Handle handle) {
+		return contains(handle) ? &values[slots[handle.slot].index] : nullptr;
+	}
+
+	[[nodiscard]] const T* get(const Handle handle) const {
+		return contains(handle) ? &values[slots[handle.slot].index] : nullptr;
+	}
+
+	/// The handle of the value at the given position of the dense storage
+	[[nodiscard]] Handle handle(const size_t index) const {
+		const uint32_t slot = index_to_slot[index];
+		return { slot, slots[slot].generation };
+	}
+
+	T& operator[](const size_t index) {
+		return values[index];
+	}
+
+	const T& operator[](const size_t index) const {
+		return values[index];
+	}
+
+	[[nodiscard]] size_t size() const {
+		return values.size();
+	}
+
+	[[nodiscard]] bool empty() const {
+		return values.empty();
+	}
+
+	T* data() {
+		return values.data();
+	}
+
+	const T* data() const {
+		return values.data();
+	}
+
+	auto begin() {
+		return values.begin();
+	}
+
+	auto end() {
+		return values.end();
+	}
+
+	auto begin() const {
+		return values.begin();
+	}
+
+	auto end() const {
+		return values.end();
+	}
+
+	void reserve(const size_t capacity) {
+		values.reserve(capacity);
+		index_to_slot.reserve(capacity);
+		slots.reserve(capacity);
+	}
+
+	/// Invalidates all handles
+	void clear() {
+		for (const uint32_t slot : index_to_slot) {
+			slots[slot].generation++;
+			free_slots.push_back(slot);
+		}
+		values.clear();
+		index_to_slot.clear();
+		version++;
+	}
+
+  private:
+	struct Slot {
+		/// Position of the value in the dense storage
+		uint32_t index = 0;
+		uint32_t generation = 0;
+	};
+
+	std::vector<T> values;
+	/// The slot of every value in the dense storage
+	std::vector<uint32_t> index_to_slot;
+	std::vector<Slot> slots;
+	std::vector<uint32_t> free_slots;
+	uint64_t version = 0;
+};
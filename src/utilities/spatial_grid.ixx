@@ -0,0 +1,213 @@
+module;
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <limits>
+
+#include <glm/glm.hpp>
+
+export module SpatialGrid;
+
+/// A uniform grid over the map that buckets items (referred to by their index) on their tile position.
+/// Every cell also keeps the bounding box of the items in it so that whole cells can be culled at once.
+/// On top of the cells sits a bounding volume hierarchy where every node covers 2x2 nodes of the level below, so whole regions of the map can be accepted or rejected with a single test.
+/// The grid does not own the items. Whoever owns them has to call move() when an item moves and invalidate() when items are added or removed (which shifts the indices)
+export class SpatialGrid {
+  public:
+	/// The width/height of a cell in tiles
+	static constexpr int cell_size = 8;
+
+	struct Bounds {
+		glm::vec2 position;
+		glm::vec3 minimum;
+		glm::vec3 maximum;
+	};
+
+	struct Cell {
+		std::vector<uint32_t> items;
+	};
+
+	/// Marks the grid as out of date. The owner rebuilds it on the next query
+	void invalidate() {
+		dirty = true;
+	}
+
+	bool is_dirty() const {
+		return dirty;
+	}
+
+	/// Rebuilds the grid for a map of width by height tiles. bounds(i) has to return the Bounds of item i
+	template <typename F>
+	void build(const int width, const int height, const size_t count, F&& bounds) {
+		columns = std::max(1, (width + cell_size - 1) / cell_size);
+		rows = std::max(1, (height + cell_size - 1) / cell_size);
+
+		cells.clear();
+		cells.resize(columns * rows);
+		cell_of.resize(count);
+
+		levels.clear();
+		levels.push_back({ columns, rows, std::vector<Node>(columns * rows) });
+
+		for (size_t i = 0; i < count; i++) {
+			const Bounds item = bounds(i);
+			const uint32_t cell = cell_index(item.position);
+			cells[cell].items.push_back(static_cast<uint32_t>(i));
+			cell_of[i] = cell;
+
+			Node& node = levels[0].nodes[cell];
+			node.count++;
+			grow(node, item);
+		}
+
+		// Merge 2x2 nodes until a single root remains
+		while (levels.back().columns > 1 || levels.back().rows > 1) {
+			const Level& below = levels.back();
+			Level level = { (below.columns + 1) / 2, (below.rows + 1) / 2 };
+			level.nodes.resize(level.columns * level.rows);
+
+			for (int y = 0; y < below.rows; y++) {
+				for (int x = 0; x < below.columns; x++) {
+					const Node& child = below.nodes[y * below.columns + x];
+					Node& parent = level.nodes[(y / 2) * level.columns + x / 2];
+					parent.count += child.count;
+					parent.minimum = glm::min(parent.minimum, child.minimum);
+					parent.maximum = glm::max(parent.maximum, child.maximum);
+				}
+			}
+			levels.push_back(std::move(level));
+		}
+		dirty = false;
+	}
+
+	/// Updates the cell of a single item after it moved or changed shape and refits the hierarchy above it.
+	/// Bounds only ever grow until the next rebuild, which keeps them conservative
+	void move(const uint32_t index, const Bounds& bounds) {
+		if (dirty || index >= cell_of.size()) {
+			return;
+		}
+
+		const uint32_t cell = cell_index(bounds.position);
+		if (cell != cell_of[index]) {
+			std::erase(cells[cell_of[index]].items, index);
+			for_each_ancestor(cell_of[index], [](Node& node) {
+				node.count--;
+			});
+
+			cells[cell].items.push_back(index);
+			cell_of[index] = cell;
+			for_each_ancestor(cell, [](Node& node) {
+				node.count++;
+			});
+		}
+
+		for_each_ancestor(cell, [&](Node& node) {
+			grow(node, bounds);
+		});
+	}
+
+	/// Calls callback(index) for every item in the cells that overlap the area (in tiles).
+	/// Items close to the edge of the area may lie outside of it so the caller still has to do an exact test
+	template <typename F>
+	void query_area(const glm::vec2 minimum, const glm::vec2 maximum, F&& callback) const {
+		const int left = std::clamp(static_cast<int>(minimum.x) / cell_size, 0, columns - 1);
+		const int right = std::clamp(static_cast<int>(maximum.x) / cell_size, 0, columns - 1);
+		const int bottom = std::clamp(static_cast<int>(minimum.y) / cell_size, 0, rows - 1);
+		const int top = std::clamp(static_cast<int>(maximum.y) / cell_size, 0, rows - 1);
+
+		for (int j = bottom; j <= top; j++) {
+			for (int i = left; i <= right; i++) {
+				for (const uint32_t index : cells[j * columns + i].items) {
+					callback(index);
+				}
+			}
+		}
+	}
+
+	/// Walks the hierarchy top down. test(minimum, maximum) has to return an enum with outside, intersecting and inside members (e.g. Camera::Visibility).
+	/// Calls callback(cell, fully_inside) for every non empty cell that is not outside. Items in cells that are fully inside do not need to be tested individually
+	template <typename T, typename F>
+	void cull(T&& test, F&& callback) const {
+		if (!levels.empty()) {
+			cull_node(levels.size() - 1, 0, 0, false, test, callback);
+		}
+	}
+
+  private:
+	/// A node of the bounding volume hierarchy
+	struct Node {
+		glm::vec3 minimum = glm::vec3(std::numeric_limits<float>::max());
+		glm::vec3 maximum = glm::vec3(std::numeric_limits<float>::lowest());
+		/// The number of items in all the cells below this node
+		uint32_t count = 0;
+	};
+
+	struct Level {
+		int columns;
+		int rows;
+		std::vector<Node> nodes;
+	};
+
+	int columns = 1;
+	int rows = 1;
+	std::vector<Cell> cells = std::vector<Cell>(1);
+	/// The cell every item is in
+	std::vector<uint32_t> cell_of;
+	/// Level 0 corresponds to the cells, the last level is the root
+	std::vector<Level> levels;
+	bool dirty = true;
+
+	uint32_t cell_index(const glm::vec2 position) const {
+		// Items off the map are kept in the border cells
+		const int x = std::clamp(static_cast<int>(position.x) / cell_size, 0, columns - 1);
+		const int y = std::clamp(static_cast<int>(position.y) / cell_size, 0, rows - 1);
+		return y * columns + x;
+	}
+
+	static void grow(Node& node, const Bounds& bounds) {
+		node.minimum = glm::min(node.minimum, glm::min(bounds.minimum, bounds.maximum));
+		node.maximum = glm::max(node.maximum, glm::max(bounds.minimum, bounds.maximum));
+	}
+
+	/// Calls callback for the node of the cell and all nodes above it
+	template <typename F>
+	void for_each_ancestor(const uint32_t cell, F&& callback) {
+		int x = cell % columns;
+		int y = cell / columns;
+		for (auto& level : levels) {
+			callback(level.nodes[y * level.columns + x]);
+			x /= 2;
+			y /= 2;
+		}
+	}
+
+	template <typename T, typename F>
+	void cull_node(const size_t level, const int x, const int y, bool inside, T& test, F& callback) const {
+		const Node& node = levels[level].nodes[y * levels[level].columns + x];
+		if (node.count == 0) {
+			return;
+		}
+
+		if (!inside) {
+			using Visibility = decltype(test(node.minimum, node.maximum));
+			const Visibility visibility = test(node.minimum, node.maximum);
+			if (visibility == Visibility::outside) {
+				return;
+			}
+			inside = visibility == Visibility::inside;
+		}
+
+		if (level == 0) {
+			callback(cells[y * columns + x], inside);
+			return;
+		}
+
+		const Level& below = levels[level - 1];
+		for (int j = y * 2; j < std::min(y * 2 + 2, below.rows); j++) {
+			for (int i = x * 2; i < std::min(x * 2 + 2, below.columns); i++) {
+				cull_node(level - 1, i, j, inside, test, callback);
+			}
+		}
+	}
+};
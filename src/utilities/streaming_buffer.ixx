@@ -0,0 +1,130 @@
+module;
+
+#include <array>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <glad/glad.h>
+
+export module StreamingBuffer;
+
+/// A persistently mapped buffer for data that is regenerated by the CPU every frame (instance matrices, bone matrices, colors).
+/// The buffer is split in frame_count regions that are used round robin. Every frame sub-allocates from its own region and
+/// a fence placed at the end of the frame guards the region against being overwritten while the GPU may still read from it.
+/// Uploading thus is a plain memcpy without any driver side allocations. Requires the OpenGL context to be active/current
+export class StreamingBuffer {
+  public:
+	static constexpr size_t frame_count = 3;
+
+	/// A range of the buffer that stays valid until the end of the frame it was allocated in
+	struct Allocation {
+		GLuint buffer = 0;
+		GLintptr offset = 0;
+		GLsizeiptr size = 0;
+		void* data = nullptr;
+
+		void bind(const GLuint index) const {
+			glBindBufferRange(GL_SHADER_STORAGE_BUFFER, index, buffer, offset, size);
+		}
+	};
+
+	/// frame_capacity is the initial size in bytes of a single frame region. The buffer grows when a frame needs more
+	explicit StreamingBuffer(const size_t frame_capacity = 4 * 1024 * 1024) {
+		GLint offset_alignment = 0;
+		glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &offset_alignment);
+		alignment = std::max<size_t>(offset_alignment, 16);
+		create(frame_capacity);
+	}
+
+	~StreamingBuffer() {
+		for (auto& fence : fences) {
+			glDeleteSync(fence);
+		}
+		glDeleteBuffers(1, &buffer);
+		glDeleteBuffers(retired.size(), retired.data());
+	}
+
+	StreamingBuffer(const StreamingBuffer&) = delete;
+	StreamingBuffer& operator=(const StreamingBuffer&) = delete;
+
+	/// Moves on to the next region and waits for the GPU to finish reading from it
+	void begin_frame() {
+		frame = (frame + 1) % frame_count;
+		if (fences[frame]) {
+			while (true) {
+				const GLenum result = glClientWaitSync(fences[frame], GL_SYNC_FLUSH_COMMANDS_BIT, 1'000'000);
+				if (result != GL_TIMEOUT_EXPIRED) {
+					break;
+				}
+			}
+			glDeleteSync(fences[frame]);
+			fences[frame] = nullptr;
+		}
+		offset = 0;
+	}
+
+	/// Has to be called after the last draw call that reads from the allocations of this frame
+	void end_frame() {
+		fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+		// The driver keeps deleted buffers alive until the commands using them have completed
+		glDeleteBuffers(retired.size(), retired.data());
+		retired.clear();
+	}
+
+	/// Returns a mapped range of at least size bytes that is aligned for use as a shader storage buffer
+	Allocation allocate(const size_t size) {
+		const size_t aligned_size = std::max<size_t>((size + alignment - 1) / alignment * alignment, alignment);
+		if (offset + aligned_size > frame_capacity) {
+			// Earlier allocations of this frame still refer to the old buffer so it can only be deleted at the end of the frame
+			retired.push_back(buffer);
+			for (auto& fence : fences) {
+				glDeleteSync(fence);
+				fence = nullptr;
+			}
+			create(std::max(frame_capacity * 2, aligned_size));
+		}
+
+		const size_t start = frame * frame_capacity + offset;
+		offset += aligned_size;
+		return { buffer, static_cast<GLintptr>(start), static_cast<GLsizeiptr>(aligned_size), mapped + start };
+	}
+
+	template <typename T>
+	Allocation upload(const T* data, const size_t count) {
+		const Allocation allocation = allocate(count * sizeof(T));
+		if (count > 0) {
+			std::memcpy(allocation.data, data, count * sizeof(T));
+		}
+		return allocation;
+	}
+
+	template <typename T>
+	Allocation upload(const std::vector<T>& data) {
+		return upload(data.data(), data.size());
+	}
+
+  private:
+	GLuint buffer = 0;
+	uint8_t* mapped = nullptr;
+	size_t frame_capacity = 0;
+	size_t alignment = 16;
+
+	size_t frame = 0;
+	/// The offset into the region of the current frame
+	size_t offset = 0;
+	std::array<GLsync, frame_count> fences = {};
+	/// Buffers that have been replaced by a bigger one during the current frame
+	std::vector<GLuint> retired;
+
+	void create(const size_t capacity) {
+		frame_capacity = (capacity + alignment - 1) / alignment * alignment;
+		offset = 0;
+
+		constexpr GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glCreateBuffers(1, &buffer);
+		glNamedBufferStorage(buffer, frame_capacity * frame_count, nullptr, flags);
+		mapped = static_cast<uint8_t*>(glMapNamedBufferRange(buffer, 0, frame_capacity * frame_count, flags));
+	}
+};
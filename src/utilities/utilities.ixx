@@ -12,6 +12,11 @@ export module Utilities;
 namespace fs = std::filesystem;
 
 // String functions
+/// The heap memory the string owns, 0 while it fits in the small string buffer
+export size_t string_memory(const std::string& string) {
+	return string.capacity() > std::string().capacity() ? string.capacity() + 1 : 0;
+}
+
 export std::string string_replaced(const std::string& source, const std::string& from, const std::string& to) {
 	std::string new_string;
 	new_string.reserve(source.length()); // avoids a few memory allocations
@@ -83,4 +88,13 @@ export std::string read_text_file(const fs::path& path) {
 
 export struct ItemSet {
 	std::vector<std::pair<std::string, int>> items;
+
+	/// The heap memory the item set owns
+	size_t memory_usage() const {
+		size_t total = items.capacity() * sizeof(std::pair<std::string, int>);
+		for (const auto& [id, chance] : items) {
+			total += string_memory(id);
+		}
+		return total;
+	}
 };
\ No newline at end of file